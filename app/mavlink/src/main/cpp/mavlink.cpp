@@ -27,6 +27,7 @@
 
 #include "mavlink/common/mavlink.h"
 #include "mavlink.h"
+#include "TelemetryBlock.h"
 
 #define TAG "pixelpilot"
 
@@ -56,6 +57,43 @@ long distance_meters_between(double lat1, double lon1, double lat2, double lon2)
 
 int mavlink_thread_signal = 0;
 std::atomic<bool> latestMavlinkDataChange = false;
+TelemetryBlock<mavlink_telemetry> telemetry(mavlink_telemetry::version);
+
+static_assert(sizeof(mavlink_telemetry) == 208, "MavlinkTelemetry.java expects 208 bytes");
+static_assert(offsetof(mavlink_telemetry, telemetry_altitude) == 48 &&
+              offsetof(mavlink_telemetry, hdop) == 100 &&
+              offsetof(mavlink_telemetry, status_text) == 106, "MavlinkTelemetry.java offsets");
+
+// Copies the fields of latestMavlinkData the UI shows into the shared block
+void publish_telemetry() {
+    telemetry.publish([](mavlink_telemetry &t) {
+        const mavlink_data &d = latestMavlinkData;
+        t.telemetry_lat = d.telemetry_lat;
+        t.telemetry_lon = d.telemetry_lon;
+        t.telemetry_lat_base = d.telemetry_lat_base;
+        t.telemetry_lon_base = d.telemetry_lon_base;
+        t.telemetry_hdg = d.telemetry_hdg;
+        t.telemetry_distance = d.telemetry_distance;
+        t.telemetry_altitude = d.telemetry_altitude;
+        t.telemetry_pitch = d.telemetry_pitch;
+        t.telemetry_roll = d.telemetry_roll;
+        t.telemetry_yaw = d.telemetry_yaw;
+        t.telemetry_battery = d.telemetry_battery;
+        t.telemetry_current = d.telemetry_current;
+        t.telemetry_current_consumed = d.telemetry_current_consumed;
+        t.telemetry_sats = d.telemetry_sats;
+        t.telemetry_gspeed = d.telemetry_gspeed;
+        t.telemetry_vspeed = d.telemetry_vspeed;
+        t.telemetry_throttle = d.telemetry_throttle;
+        t.telemetry_rssi = d.telemetry_rssi;
+        t.telemetry_arm = d.telemetry_arm;
+        t.hdop = d.hdop;
+        t.heading = d.heading;
+        t.flight_mode = d.flight_mode;
+        t.gps_fix_type = d.gps_fix_type;
+        memcpy(t.status_text, d.status_text, sizeof(t.status_text));
+    });
+}
 
 void *listen(int mavlink_port) {
     __android_log_print(ANDROID_LOG_DEBUG, TAG, "Starting mavlink thread...");
@@ -312,6 +350,10 @@ void *listen(int mavlink_port) {
                 }
             }
         }
+        // Once per datagram, Java polls the block
+        if (latestMavlinkDataChange.exchange(false)) {
+            publish_telemetry();
+        }
         usleep(1);
     }
 
@@ -320,57 +362,9 @@ void *listen(int mavlink_port) {
 }
 
 extern "C"
-JNIEXPORT void JNICALL
-Java_com_openipc_mavlink_MavlinkNative_nativeCallBack(JNIEnv *env, jclass clazz,
-                                                      jobject mavlinkChangeI) {
-//    g_context = mavlinkChangeI;
-    //Update all java stuff
-    if (latestMavlinkDataChange) {
-        jclass jClassExtendsMavlinkChangeI = env->GetObjectClass(mavlinkChangeI);
-        jclass jcMavlinkData = env->FindClass("com/openipc/mavlink/MavlinkData");
-        assert(jcMavlinkData != nullptr);
-        jmethodID jcMavlinkDataConstructor = env->GetMethodID(jcMavlinkData, "<init>",
-                                                              "(FFFFFFFDDDDDDFFFFBBBBBBLjava/lang/String;)V");
-        assert(jcMavlinkDataConstructor != nullptr);
-        jstring pJstring = env->NewStringUTF(latestMavlinkData.status_text);
-        auto mavlinkData = env->NewObject(jcMavlinkData, jcMavlinkDataConstructor,
-                                          (jfloat) latestMavlinkData.telemetry_altitude,
-                                          (jfloat) latestMavlinkData.telemetry_pitch,
-                                          (jfloat) latestMavlinkData.telemetry_roll,
-                                          (jfloat) latestMavlinkData.telemetry_yaw,
-                                          (jfloat) latestMavlinkData.telemetry_battery,
-                                          (jfloat) latestMavlinkData.telemetry_current,
-                                          (jfloat) latestMavlinkData.telemetry_current_consumed,
-                                          (jdouble) latestMavlinkData.telemetry_lat,
-                                          (jdouble) latestMavlinkData.telemetry_lon,
-                                          (jdouble) latestMavlinkData.telemetry_lat_base,
-                                          (jdouble) latestMavlinkData.telemetry_lon_base,
-                                          (jdouble) latestMavlinkData.telemetry_hdg,
-                                          (jdouble) latestMavlinkData.telemetry_distance,
-                                          (jfloat) latestMavlinkData.telemetry_sats,
-                                          (jfloat) latestMavlinkData.telemetry_gspeed,
-                                          (jfloat) latestMavlinkData.telemetry_vspeed,
-                                          (jfloat) latestMavlinkData.telemetry_throttle,
-                                          (jbyte) latestMavlinkData.telemetry_arm,
-                                          (jbyte) latestMavlinkData.flight_mode,
-                                          (jbyte) latestMavlinkData.gps_fix_type,
-                                          (jbyte) latestMavlinkData.hdop,
-                                          (jbyte) latestMavlinkData.telemetry_rssi,
-                                          (jbyte) latestMavlinkData.heading,
-                                          pJstring);
-        assert(mavlinkData != nullptr);
-        jmethodID onNewMavlinkDataJAVA = env->GetMethodID(jClassExtendsMavlinkChangeI,
-                                                          "onNewMavlinkData",
-                                                          "(Lcom/openipc/mavlink/MavlinkData;)V");
-        assert(onNewMavlinkDataJAVA != nullptr);
-        env->CallVoidMethod(mavlinkChangeI, onNewMavlinkDataJAVA, mavlinkData);
-        latestMavlinkDataChange = false;
-
-        // Clean up local references
-        env->DeleteLocalRef(jcMavlinkData);
-        env->DeleteLocalRef(mavlinkData);
-        env->DeleteLocalRef(pJstring);
-    }
+JNIEXPORT jobject JNICALL
+Java_com_openipc_mavlink_MavlinkNative_nativeGetTelemetry(JNIEnv *env, jclass clazz) {
+    return env->NewDirectByteBuffer(telemetry.data(), telemetry.size());
 }
 extern "C"
 JNIEXPORT void JNICALL
@@ -44,6 +44,36 @@ struct mavlink_data {
     int8_t wfb_flags;
 } latestMavlinkData;
 
+// Flight data shared with Java, MavlinkTelemetry.java mirrors the offsets
+struct mavlink_telemetry {
+    static constexpr uint16_t version = 1;
+
+    double telemetry_lat;
+    double telemetry_lon;
+    double telemetry_lat_base;
+    double telemetry_lon_base;
+    double telemetry_hdg;
+    double telemetry_distance;
+    float telemetry_altitude;
+    float telemetry_pitch;
+    float telemetry_roll;
+    float telemetry_yaw;
+    float telemetry_battery;
+    float telemetry_current;
+    float telemetry_current_consumed;
+    float telemetry_sats;
+    float telemetry_gspeed;
+    float telemetry_vspeed;
+    float telemetry_throttle;
+    float telemetry_rssi;
+    float telemetry_arm;
+    uint16_t hdop;
+    uint16_t heading;
+    uint8_t flight_mode;
+    uint8_t gps_fix_type;
+    char status_text[101]; // not terminated at full length
+};
+
 typedef enum PLANE_MODE {
     PLANE_MODE_MANUAL = 0, /*  | */
     PLANE_MODE_CIRCLE = 1, /*  | */
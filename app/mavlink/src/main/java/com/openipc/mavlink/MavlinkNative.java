@@ -2,6 +2,8 @@ package com.openipc.mavlink;
 
 import android.content.Context;
 
+import java.nio.ByteBuffer;
+
 public class MavlinkNative {
 
     // Used to load the 'mavlink' library on application startup.
@@ -13,7 +15,22 @@ public class MavlinkNative {
 
     public static native void nativeStop(Context context);
 
-    // TODO: Use message queue from cpp for performance#
-    // This initiates a 'call back' for the IVideoParams
-    public static native <T extends MavlinkUpdate> void nativeCallBack(T t);
+    // The block the mavlink thread publishes the flight data to, see MavlinkTelemetry
+    public static native ByteBuffer nativeGetTelemetry();
+
+    private static MavlinkTelemetry telemetry;
+
+    /**
+     * Calls onNewMavlinkData if new flight data arrived since the last poll. Reads shared memory, only new data
+     * allocates.
+     */
+    public static synchronized <T extends MavlinkUpdate> void poll(T t) {
+        if (telemetry == null) {
+            telemetry = new MavlinkTelemetry(nativeGetTelemetry());
+        }
+        MavlinkData data = telemetry.read();
+        if (data != null) {
+            t.onNewMavlinkData(data);
+        }
+    }
 }
\ No newline at end of file
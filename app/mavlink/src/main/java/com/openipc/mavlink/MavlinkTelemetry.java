@@ -0,0 +1,120 @@
+package com.openipc.mavlink;
+
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.nio.charset.StandardCharsets;
+
+/**
+ * Reads the flight data the mavlink thread publishes into shared memory (mavlink_telemetry in mavlink.h). The block
+ * is a seqlock, a snapshot is only used if the sequence was even and unchanged while it was copied.
+ * Not thread safe.
+ */
+class MavlinkTelemetry {
+    private static final int VERSION = 1;
+    private static final int SIZE = 208;
+
+    private static final int SEQUENCE = 0;
+    private static final int HEADER_VERSION = 4;
+    private static final int HEADER_SIZE = 6;
+    private static final int LAYOUT = 16;
+    private static final int LAT = LAYOUT;
+    private static final int LON = LAYOUT + 8;
+    private static final int LAT_BASE = LAYOUT + 16;
+    private static final int LON_BASE = LAYOUT + 24;
+    private static final int HDG = LAYOUT + 32;
+    private static final int DISTANCE = LAYOUT + 40;
+    private static final int ALTITUDE = LAYOUT + 48;
+    private static final int PITCH = LAYOUT + 52;
+    private static final int ROLL = LAYOUT + 56;
+    private static final int YAW = LAYOUT + 60;
+    private static final int BATTERY = LAYOUT + 64;
+    private static final int CURRENT = LAYOUT + 68;
+    private static final int CURRENT_CONSUMED = LAYOUT + 72;
+    private static final int SATS = LAYOUT + 76;
+    private static final int GSPEED = LAYOUT + 80;
+    private static final int VSPEED = LAYOUT + 84;
+    private static final int THROTTLE = LAYOUT + 88;
+    private static final int RSSI = LAYOUT + 92;
+    private static final int ARM = LAYOUT + 96;
+    private static final int HDOP = LAYOUT + 100;
+    private static final int HEADING = LAYOUT + 102;
+    private static final int FLIGHT_MODE = LAYOUT + 104;
+    private static final int GPS_FIX_TYPE = LAYOUT + 105;
+    private static final int STATUS_TEXT = LAYOUT + 106;
+    private static final int STATUS_TEXT_LENGTH = 101;
+
+    // Volatile store + load: keeps the plain buffer reads from crossing it, minSdk 26 has no VarHandle fences
+    private static volatile int fence;
+
+    private final ByteBuffer buffer;
+    private final byte[] statusText = new byte[STATUS_TEXT_LENGTH];
+    private int sequence = -1;
+
+    MavlinkTelemetry(ByteBuffer block) {
+        buffer = block.order(ByteOrder.nativeOrder());
+        if (buffer.getShort(HEADER_VERSION) != VERSION || buffer.getShort(HEADER_SIZE) != SIZE) {
+            throw new IllegalStateException("Unexpected mavlink telemetry layout");
+        }
+    }
+
+    private static void fullFence() {
+        fence = 0;
+        int ignored = fence;
+    }
+
+    /**
+     * @return The latest flight data, null if nothing was published since the last call.
+     */
+    MavlinkData read() {
+        while (true) {
+            int seq = buffer.getInt(SEQUENCE);
+            if ((seq & 1) != 0) {
+                continue;
+            }
+            if (seq == sequence) {
+                return null;
+            }
+            fullFence();
+            double lat = buffer.getDouble(LAT);
+            double lon = buffer.getDouble(LON);
+            double latBase = buffer.getDouble(LAT_BASE);
+            double lonBase = buffer.getDouble(LON_BASE);
+            double hdg = buffer.getDouble(HDG);
+            double distance = buffer.getDouble(DISTANCE);
+            float altitude = buffer.getFloat(ALTITUDE);
+            float pitch = buffer.getFloat(PITCH);
+            float roll = buffer.getFloat(ROLL);
+            float yaw = buffer.getFloat(YAW);
+            float battery = buffer.getFloat(BATTERY);
+            float current = buffer.getFloat(CURRENT);
+            float currentConsumed = buffer.getFloat(CURRENT_CONSUMED);
+            float sats = buffer.getFloat(SATS);
+            float gspeed = buffer.getFloat(GSPEED);
+            float vspeed = buffer.getFloat(VSPEED);
+            float throttle = buffer.getFloat(THROTTLE);
+            float rssi = buffer.getFloat(RSSI);
+            float arm = buffer.getFloat(ARM);
+            short hdop = buffer.getShort(HDOP);
+            short heading = buffer.getShort(HEADING);
+            byte flightMode = buffer.get(FLIGHT_MODE);
+            byte gpsFixType = buffer.get(GPS_FIX_TYPE);
+            int statusLength = 0;
+            while (statusLength < STATUS_TEXT_LENGTH) {
+                byte c = buffer.get(STATUS_TEXT + statusLength);
+                if (c == 0) {
+                    break;
+                }
+                statusText[statusLength++] = c;
+            }
+            fullFence();
+            if (buffer.getInt(SEQUENCE) != seq) {
+                continue;
+            }
+            sequence = seq;
+            return new MavlinkData(altitude, pitch, roll, yaw, battery, current, currentConsumed, lat, lon, latBase,
+                    lonBase, hdg, distance, sats, gspeed, vspeed, throttle, (byte) arm, flightMode, gpsFixType,
+                    (byte) hdop, (byte) rssi, (byte) heading,
+                    new String(statusText, 0, statusLength, StandardCharsets.UTF_8));
+        }
+    }
+}
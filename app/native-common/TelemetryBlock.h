@@ -0,0 +1,88 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <type_traits>
+
+/**
+ * @class TelemetryBlock
+ * @brief Statistics published by native threads and read by Java straight from memory, without JNI calls.
+ *
+ * The block is a seqlock: a 16 byte header (sequence, layout version, layout size) followed by @p Layout.
+ * A writer makes the sequence odd, updates the layout and makes it even again. A reader copies the layout
+ * between two loads of the same even sequence and retries otherwise, so it never blocks a writer and never
+ * keeps a torn snapshot. Java maps the block once as a direct ByteBuffer in native byte order; the field
+ * offsets are fixed for a layout version.
+ */
+template <typename Layout> class TelemetryBlock {
+    static_assert(std::is_trivially_copyable<Layout>::value, "Layout is copied byte-wise by readers");
+
+  public:
+    static constexpr size_t kHeaderSize = 16;
+    static constexpr size_t kSequenceOffset = 0;
+    static constexpr size_t kVersionOffset = 4;
+    static constexpr size_t kSizeOffset = 6;
+
+    explicit TelemetryBlock(uint16_t version) {
+        memory_.version = version;
+        memory_.size = sizeof(Layout);
+    }
+
+    TelemetryBlock(const TelemetryBlock &) = delete;
+    TelemetryBlock &operator=(const TelemetryBlock &) = delete;
+
+    /**
+     * @brief Calls @p update with the layout to change in place, readers retry until it returns.
+     * Writers of several threads are serialized.
+     */
+    template <typename Fn> void publish(Fn &&update) {
+        std::lock_guard<std::mutex> lock(writer_mutex_);
+        const uint32_t sequence = memory_.sequence.load(std::memory_order_relaxed);
+        memory_.sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        update(memory_.layout);
+        memory_.sequence.store(sequence + 2, std::memory_order_release);
+    }
+
+    /**
+     * @brief A consistent copy of the layout, for native readers.
+     */
+    Layout read() const {
+        Layout copy;
+        for (;;) {
+            const uint32_t sequence = memory_.sequence.load(std::memory_order_acquire);
+            if (sequence & 1) {
+                continue;
+            }
+            memcpy(&copy, &memory_.layout, sizeof(Layout));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (memory_.sequence.load(std::memory_order_relaxed) == sequence) {
+                return copy;
+            }
+        }
+    }
+
+    uint32_t sequence() const { return memory_.sequence.load(std::memory_order_acquire); }
+
+    /// Start of the block for NewDirectByteBuffer(), valid as long as this object.
+    void *data() { return &memory_; }
+    static constexpr size_t size() { return sizeof(Memory); }
+
+  private:
+    struct Memory {
+        std::atomic<uint32_t> sequence{0};
+        uint16_t version;
+        uint16_t size;
+        uint32_t reserved[2]{};
+        Layout layout{};
+    };
+    static_assert(sizeof(std::atomic<uint32_t>) == 4 && std::atomic<uint32_t>::is_always_lock_free,
+                  "Java reads the sequence as a plain int");
+    static_assert(offsetof(Memory, layout) == kHeaderSize, "Java expects the layout right after the header");
+
+    alignas(8) Memory memory_;
+    std::mutex writer_mutex_;
+};
@@ -0,0 +1,371 @@
+#include "TraceRecorder.h"
+
+#include <android/log.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <pthread.h>
+#include <string>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#undef TAG
+#define TAG "pixelpilot"
+
+namespace trace {
+namespace {
+
+// About a second of USB RX or a few seconds of RTP at full video rate, 128 KiB per thread
+constexpr size_t kEventsPerThread = 4096;
+constexpr int64_t kAnomalyIntervalNs = 10'000'000'000;
+
+// Fields are atomics because writeEvents() may copy a slot while its thread overwrites it
+struct Event {
+    std::atomic<int64_t> ts_ns{0};
+    std::atomic<int64_t> dur_ns{0}; // < 0 for an instant event
+    std::atomic<const char *> name{nullptr};
+    std::atomic<int64_t> arg{0};
+};
+
+struct ThreadBuffer {
+    std::atomic<uint64_t> head{0};
+    std::atomic<bool> in_use{true};
+    // Guarded by Registry::mutex
+    uint64_t first{0};
+    int tid{0};
+    char name[16]{};
+    Event events[kEventsPerThread];
+};
+
+struct Registry {
+    std::mutex mutex;
+    // Buffers are never freed, the buffer of an exited thread is handed to the next new thread
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+    std::function<void(const char *)> anomaly_handler;
+    std::atomic<bool> anomaly_enabled{false};
+    std::atomic<int64_t> last_anomaly_ns{0};
+};
+
+// Leaked on purpose, threads may still record while static destructors run
+Registry &registry() {
+    static Registry *r = new Registry;
+    return *r;
+}
+
+struct ThreadHandle {
+    ThreadBuffer *buffer = nullptr;
+    ~ThreadHandle() {
+        if (buffer) {
+            buffer->in_use.store(false, std::memory_order_release);
+        }
+    }
+};
+
+thread_local ThreadHandle handle;
+
+ThreadBuffer *acquireBuffer() {
+    Registry &r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    ThreadBuffer *buffer = nullptr;
+    for (const auto &candidate : r.buffers) {
+        if (!candidate->in_use.load(std::memory_order_acquire)) {
+            buffer = candidate.get();
+            break;
+        }
+    }
+    if (buffer == nullptr) {
+        r.buffers.push_back(std::make_unique<ThreadBuffer>());
+        buffer = r.buffers.back().get();
+    }
+    buffer->in_use.store(true, std::memory_order_relaxed);
+    // Events of the previous owner would show up under the new thread id
+    buffer->first = buffer->head.load(std::memory_order_relaxed);
+    buffer->tid = gettid();
+    pthread_getname_np(pthread_self(), buffer->name, sizeof(buffer->name));
+    return buffer;
+}
+
+void record(const char *name, int64_t ts_ns, int64_t dur_ns, int64_t arg) {
+    ThreadBuffer *buffer = handle.buffer;
+    if (buffer == nullptr) {
+        buffer = handle.buffer = acquireBuffer();
+    }
+    const uint64_t head = buffer->head.load(std::memory_order_relaxed);
+    // A reader that sees any of the stores below also sees the previous head, so it can tell the slot is reused
+    std::atomic_thread_fence(std::memory_order_release);
+    Event &e = buffer->events[head % kEventsPerThread];
+    e.ts_ns.store(ts_ns, std::memory_order_relaxed);
+    e.dur_ns.store(dur_ns, std::memory_order_relaxed);
+    e.name.store(name, std::memory_order_relaxed);
+    e.arg.store(arg, std::memory_order_relaxed);
+    buffer->head.store(head + 1, std::memory_order_release);
+}
+
+struct EventCopy {
+    int64_t ts_ns;
+    int64_t dur_ns;
+    const char *name;
+    int64_t arg;
+};
+
+// Everything still in the ring and not overwritten while it was copied. Registry::mutex must be held.
+std::vector<EventCopy> copyEvents(const ThreadBuffer &buffer) {
+    const uint64_t head = buffer.head.load(std::memory_order_acquire);
+    uint64_t begin = head > kEventsPerThread ? head - kEventsPerThread : 0;
+    begin = std::max(begin, buffer.first);
+    std::vector<EventCopy> events;
+    events.reserve(head - begin);
+    for (uint64_t i = begin; i < head; ++i) {
+        const Event &e = buffer.events[i % kEventsPerThread];
+        events.push_back({e.ts_ns.load(std::memory_order_relaxed),
+                          e.dur_ns.load(std::memory_order_relaxed),
+                          e.name.load(std::memory_order_relaxed),
+                          e.arg.load(std::memory_order_relaxed)});
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    // The thread may be writing event `now` at this moment, which reuses the slot of `now - kEventsPerThread`
+    const uint64_t now = buffer.head.load(std::memory_order_relaxed);
+    const uint64_t valid = now >= kEventsPerThread ? now - kEventsPerThread + 1 : 0;
+    if (valid > begin) {
+        events.erase(events.begin(), events.begin() + std::min<uint64_t>(valid - begin, events.size()));
+    }
+    return events;
+}
+
+// What writeEvents() needs of a ThreadBuffer, copied under Registry::mutex so the formatting can run without it
+struct ThreadCopy {
+    int tid;
+    bool live;
+    char name[16];
+    std::vector<EventCopy> events;
+};
+
+void threadName(const ThreadCopy &thread, char *name, size_t size) {
+    // Live threads are often renamed after their first event, ask the kernel for the current name
+    snprintf(name, size, "%s", thread.name);
+    if (!thread.live) {
+        return;
+    }
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/self/task/%d/comm", thread.tid);
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    const ssize_t n = read(fd, name, size - 1);
+    close(fd);
+    if (n > 0) {
+        name[n] = '\0';
+        name[strcspn(name, "\n")] = '\0';
+    }
+}
+
+bool writeAll(int fd, const std::string &data) {
+    size_t written = 0;
+    while (written < data.size()) {
+        const ssize_t n = write(fd, data.data() + written, data.size() - written);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        written += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+} // namespace
+
+int64_t nowNs() {
+    timespec ts{};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1'000'000'000 + ts.tv_nsec;
+}
+
+void instant(const char *name, int64_t arg) { record(name, nowNs(), -1, arg); }
+
+void complete(const char *name, int64_t start_ns, int64_t end_ns, int64_t arg) {
+    record(name, start_ns, end_ns - start_ns, arg);
+}
+
+void writeEvents(int fd) {
+    Registry &r = registry();
+    std::vector<ThreadCopy> threads;
+    {
+        // A new thread waits for this in acquireBuffer(), so only the copy happens under the lock
+        std::lock_guard<std::mutex> lock(r.mutex);
+        threads.reserve(r.buffers.size());
+        for (const auto &buffer : r.buffers) {
+            auto events = copyEvents(*buffer);
+            if (events.empty()) {
+                continue;
+            }
+            ThreadCopy &thread = threads.emplace_back();
+            thread.tid = thread.tid;
+            thread.live = buffer->in_use.load(std::memory_order_acquire);
+            memcpy(thread.name, buffer->name, sizeof(thread.name));
+            thread.events = std::move(events);
+        }
+    }
+    const int pid = getpid();
+    std::string out;
+    for (const auto &thread : threads) {
+        char name[32];
+        threadName(thread, name, sizeof(name));
+        out.clear();
+        char line[256];
+        snprintf(line,
+                 sizeof(line),
+                 "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}},\n",
+                 pid,
+                 thread.tid,
+                 name);
+        out += line;
+        for (const auto &e : thread.events) {
+            // Chrome trace timestamps are microseconds
+            if (e.dur_ns < 0) {
+                snprintf(line,
+                         sizeof(line),
+                         "{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%" PRId64 ".%03d,\"pid\":%d,\"tid\":%d,"
+                         "\"args\":{\"v\":%" PRId64 "}},\n",
+                         e.name,
+                         e.ts_ns / 1000,
+                         static_cast<int>(e.ts_ns % 1000),
+                         pid,
+                         thread.tid,
+                         e.arg);
+            } else {
+                snprintf(line,
+                         sizeof(line),
+                         "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%" PRId64 ".%03d,\"dur\":%" PRId64
+                         ".%03d,\"pid\":%d,\"tid\":%d,\"args\":{\"v\":%" PRId64 "}},\n",
+                         e.name,
+                         e.ts_ns / 1000,
+                         static_cast<int>(e.ts_ns % 1000),
+                         e.dur_ns / 1000,
+                         static_cast<int>(e.dur_ns % 1000),
+                         pid,
+                         thread.tid,
+                         e.arg);
+            }
+            out += line;
+        }
+        if (!writeAll(fd, out)) {
+            __android_log_print(ANDROID_LOG_ERROR, TAG, "trace: write failed: %s", strerror(errno));
+            return;
+        }
+    }
+}
+
+void anomaly(const char *reason) {
+    Registry &r = registry();
+    if (!r.anomaly_enabled.load(std::memory_order_relaxed)) {
+        return;
+    }
+    const int64_t now = nowNs();
+    int64_t last = r.last_anomaly_ns.load(std::memory_order_relaxed);
+    if ((last != 0 && now - last < kAnomalyIntervalNs) ||
+        !r.last_anomaly_ns.compare_exchange_strong(last, now, std::memory_order_relaxed)) {
+        return;
+    }
+    std::function<void(const char *)> handler;
+    {
+        std::lock_guard<std::mutex> lock(r.mutex);
+        handler = r.anomaly_handler;
+    }
+    if (!handler) {
+        return;
+    }
+    __android_log_print(ANDROID_LOG_WARN, TAG, "trace: anomaly '%s'", reason);
+    // Dumping takes a few ms, the thread that noticed the anomaly is usually one of those being traced
+    std::thread([handler, reason = std::string(reason)] { handler(reason.c_str()); }).detach();
+}
+
+void setAnomalyHandler(std::function<void(const char *reason)> handler) {
+    Registry &r = registry();
+    {
+        std::lock_guard<std::mutex> lock(r.mutex);
+        r.anomaly_enabled.store(handler != nullptr, std::memory_order_relaxed);
+        std::swap(r.anomaly_handler, handler);
+    }
+    // The previous handler goes away outside the lock, releasing a Java listener calls into the VM
+}
+
+#ifdef __ANDROID__
+namespace {
+
+/// Runs @p fn with the JNIEnv of the calling thread, attached for the call if it isn't yet.
+template <typename Fn> void withJniEnv(JavaVM *vm, Fn &&fn) {
+    JNIEnv *env = nullptr;
+    if (vm->GetEnv(reinterpret_cast<void **>(&env), JNI_VERSION_1_6) == JNI_OK) {
+        fn(env);
+        return;
+    }
+    if (vm->AttachCurrentThread(&env, nullptr) != JNI_OK) {
+        return;
+    }
+    fn(env);
+    vm->DetachCurrentThread();
+}
+
+/**
+ * @brief Global reference to a Java TraceAnomalyListener, released once the last anomaly thread calling it is done.
+ */
+class JavaListener {
+  public:
+    JavaListener(JNIEnv *env, jobject listener) : listener_(env->NewGlobalRef(listener)) {
+        env->GetJavaVM(&vm_);
+        jclass clazz = env->GetObjectClass(listener);
+        method_ = env->GetMethodID(clazz, "onTraceAnomaly", "(Ljava/lang/String;)V");
+        env->DeleteLocalRef(clazz);
+    }
+
+    ~JavaListener() {
+        withJniEnv(vm_, [this](JNIEnv *env) { env->DeleteGlobalRef(listener_); });
+    }
+
+    JavaListener(const JavaListener &) = delete;
+    JavaListener &operator=(const JavaListener &) = delete;
+
+    void operator()(const char *reason) const {
+        withJniEnv(vm_, [&](JNIEnv *env) {
+            jstring jreason = env->NewStringUTF(reason);
+            env->CallVoidMethod(listener_, method_, jreason);
+            if (env->ExceptionCheck()) {
+                env->ExceptionDescribe();
+                env->ExceptionClear();
+            }
+            env->DeleteLocalRef(jreason);
+        });
+    }
+
+  private:
+    JavaVM *vm_ = nullptr;
+    jobject listener_;
+    jmethodID method_ = nullptr;
+};
+
+} // namespace
+
+void setAnomalyListener(JNIEnv *env, jobject listener) {
+    if (listener == nullptr) {
+        setAnomalyHandler(nullptr);
+        return;
+    }
+    auto java = std::make_shared<JavaListener>(env, listener);
+    setAnomalyHandler([java](const char *reason) { (*java)(reason); });
+}
+#endif
+
+} // namespace trace
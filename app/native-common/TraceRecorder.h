@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+
+#ifdef __ANDROID__
+#include <jni.h>
+#endif
+
+/**
+ * @brief Timeline of the native threads in Chrome trace JSON, viewable in ui.perfetto.dev or chrome://tracing.
+ *
+ * Every thread records into its own fixed-size ring, the oldest events are overwritten and recording takes a lock only
+ * for the first event of a thread, while its ring is assigned. Timestamps are CLOCK_MONOTONIC, so the events of several libraries can be written into one file.
+ *
+ * Every library that compiles TraceRecorder.cpp has rings of its own, the symbols are hidden so they don't resolve
+ * to those of another library loaded into the process.
+ *
+ * The TRACE_* macros compile to nothing unless PIXELPILOT_TRACE is defined (CMake option of the same name, set by the
+ * debug builds).
+ * Event names must be string literals, only the pointer is stored.
+ */
+#pragma GCC visibility push(hidden)
+namespace trace {
+
+int64_t nowNs();
+
+void instant(const char *name, int64_t arg = 0);
+
+void complete(const char *name, int64_t start_ns, int64_t end_ns, int64_t arg = 0);
+
+/**
+ * @brief Records a complete event from construction to destruction.
+ */
+class Scope {
+  public:
+    explicit Scope(const char *name, int64_t arg = 0) : name_(name), arg_(arg), start_ns_(nowNs()) {}
+    ~Scope() { complete(name_, start_ns_, nowNs(), arg_); }
+
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+
+  private:
+    const char *name_;
+    int64_t arg_;
+    int64_t start_ns_;
+};
+
+/**
+ * @brief Writes the buffered events of every thread to @p fd as elements of a JSON array, each followed by ",\n".
+ *
+ * The caller writes the enclosing brackets, so the events of several libraries can go into the same file.
+ */
+void writeEvents(int fd);
+
+/**
+ * @brief Hands @p reason to the anomaly handler on a background thread.
+ *
+ * Does nothing while there is no handler, and at most once every 10 seconds.
+ */
+void anomaly(const char *reason);
+
+/**
+ * @brief Called with the reason of every anomaly(), on a thread of its own. Null disables them.
+ */
+void setAnomalyHandler(std::function<void(const char *reason)> handler);
+
+#ifdef __ANDROID__
+/**
+ * @brief Makes @p listener.onTraceAnomaly(String reason) the anomaly handler, null removes it.
+ *
+ * The app dumps the rings of every library into one file from there (writeEvents() of each), so an anomaly noticed
+ * by one library shows what the threads of the others did at the same time.
+ */
+void setAnomalyListener(JNIEnv *env, jobject listener);
+#endif
+
+} // namespace trace
+#pragma GCC visibility pop
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+#ifdef PIXELPILOT_TRACE
+#define TRACE_SCOPE(name) trace::Scope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#define TRACE_SCOPE_ARG(name, arg) trace::Scope TRACE_CONCAT(trace_scope_, __LINE__)(name, arg)
+#define TRACE_INSTANT(name, arg) trace::instant(name, arg)
+#define TRACE_ANOMALY(reason) trace::anomaly(reason)
+#else
+#define TRACE_SCOPE(name) ((void)0)
+#define TRACE_SCOPE_ARG(name, arg) ((void)0)
+#define TRACE_INSTANT(name, arg) ((void)0)
+#define TRACE_ANOMALY(reason) ((void)0)
+#endif
@@ -0,0 +1,37 @@
+// Host stand-in for the NDK logging header, for the unit tests and the replay tools on desktop Linux. Only on the
+// include path of host builds, the NDK one is used on Android.
+#pragma once
+
+#include <stdarg.h>
+#include <stdio.h>
+
+typedef enum android_LogPriority {
+    ANDROID_LOG_UNKNOWN = 0,
+    ANDROID_LOG_DEFAULT,
+    ANDROID_LOG_VERBOSE,
+    ANDROID_LOG_DEBUG,
+    ANDROID_LOG_INFO,
+    ANDROID_LOG_WARN,
+    ANDROID_LOG_ERROR,
+    ANDROID_LOG_FATAL,
+    ANDROID_LOG_SILENT,
+} android_LogPriority;
+
+// Debug and info output would drown the test and replay reports
+static inline int __android_log_vprint(int prio, const char *tag, const char *fmt, va_list ap) {
+    if (prio < ANDROID_LOG_WARN) {
+        return 0;
+    }
+    fprintf(stderr, "%s: ", tag);
+    const int n = vfprintf(stderr, fmt, ap);
+    fputc('\n', stderr);
+    return n;
+}
+
+static inline int __android_log_print(int prio, const char *tag, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    const int n = __android_log_vprint(prio, tag, fmt, ap);
+    va_end(ap);
+    return n;
+}
@@ -0,0 +1,79 @@
+package com.openipc.pixelpilot;
+
+import android.os.ParcelFileDescriptor;
+import android.os.SystemClock;
+import android.util.Log;
+
+import com.openipc.videonative.VideoPlayer;
+import com.openipc.wfbngrtl8812.WfbNgLink;
+
+import java.io.File;
+import java.io.FileOutputStream;
+import java.io.IOException;
+import java.text.SimpleDateFormat;
+import java.util.Date;
+import java.util.Locale;
+
+/**
+ * Recent events of the link and the video threads in one Chrome trace JSON file, open it in ui.perfetto.dev.
+ * Both libraries timestamp with the monotonic clock, so their events line up.
+ * <p>
+ * As listener of both libraries it writes such a file whenever one of them reports an anomaly, so a stalled decoder
+ * shows what the link did at the same time and the other way round.
+ */
+public class TraceWriter implements VideoPlayer.TraceAnomalyListener, WfbNgLink.TraceAnomalyListener {
+    private static final String TAG = "pixelpilot";
+    // One hiccup is often noticed by both libraries, a lost link stalls the decoder too
+    private static final long ANOMALY_INTERVAL_MS = 10_000;
+    // Enough to catch a recurring problem, not enough to fill the storage during a long session
+    private static final int MAX_ANOMALY_DUMPS = 20;
+
+    private final File anomalyDir;
+    private long lastAnomalyMs = -ANOMALY_INTERVAL_MS;
+    private int anomalyDumps = 0;
+
+    public TraceWriter(File anomalyDir) {
+        this.anomalyDir = anomalyDir;
+    }
+
+    /**
+     * Writes the events of both libraries to traceFile.
+     */
+    public static boolean write(File traceFile) {
+        try (FileOutputStream out = new FileOutputStream(traceFile)) {
+            out.write("[\n".getBytes());
+            out.flush();
+            int fd = ParcelFileDescriptor.dup(out.getFD()).detachFd();
+            try {
+                WfbNgLink.writeTraceEvents(fd);
+                VideoPlayer.writeTraceEvents(fd);
+            } finally {
+                ParcelFileDescriptor.adoptFd(fd).close();
+            }
+            // The native side ends every event with a comma, the metadata event closes the array
+            out.write(("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" + android.os.Process.myPid()
+                    + ",\"args\":{\"name\":\"pixelpilot\"}}\n]\n").getBytes());
+            return true;
+        } catch (IOException e) {
+            Log.e(TAG, "writeTrace: ", e);
+            return false;
+        }
+    }
+
+    @Override
+    public void onTraceAnomaly(String reason) {
+        synchronized (this) {
+            long now = SystemClock.elapsedRealtime();
+            if (now - lastAnomalyMs < ANOMALY_INTERVAL_MS || anomalyDumps >= MAX_ANOMALY_DUMPS) {
+                return;
+            }
+            lastAnomalyMs = now;
+            anomalyDumps++;
+        }
+        String timeStamp = new SimpleDateFormat("yyyyMMdd_HHmmss", Locale.getDefault()).format(new Date());
+        File traceFile = new File(anomalyDir, "trace-" + reason + "-" + timeStamp + ".json");
+        if (write(traceFile)) {
+            Log.w(TAG, "Trace of anomaly '" + reason + "' written to " + traceFile);
+        }
+    }
+}
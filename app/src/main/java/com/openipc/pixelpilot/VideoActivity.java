@@ -96,7 +96,7 @@ public class VideoActivity extends AppCompatActivity implements IVideoParamsChan
     final Handler handler = new Handler(Looper.getMainLooper());
     final Runnable runnable = new Runnable() {
         public void run() {
-            MavlinkNative.nativeCallBack(VideoActivity.this);
+            MavlinkNative.poll(VideoActivity.this);
             handler.postDelayed(this, 100);
         }
     };
@@ -259,6 +259,9 @@ public class VideoActivity extends AppCompatActivity implements IVideoParamsChan
         // Video Player(s) Setup
         initializeVideoPlayers();
 
+        // Traces dumped when the link or the decoder misbehaves
+        setupTraceAnomalyDumps();
+
         // VR-specific SeekBars (only if VR mode)
         setupVRSeekBarsIfNeeded();
 
@@ -1014,6 +1017,16 @@ public class VideoActivity extends AppCompatActivity implements IVideoParamsChan
         if (videoPlayer != null) {
             videoPlayer.setUdpForwarding(ip, port, enabled);
         }
+        // Forwarding is done by the UDP receiver, so keep video on loopback UDP while it is enabled.
+        if (wfbLink != null && videoPlayer != null) {
+            if (enabled) {
+                videoPlayer.setKeyframeRequester(0, 0);
+                wfbLink.clearInProcessVideoSink();
+            } else {
+                wfbLink.setInProcessVideoSink(videoPlayer.getInProcessSinkFn(), videoPlayer.getInProcessSinkCtx());
+                videoPlayer.setKeyframeRequester(wfbLink.getKeyframeRequestFn(), wfbLink.getKeyframeRequestCtx());
+            }
+        }
     }
 
     /**
@@ -1107,6 +1120,27 @@ public class VideoActivity extends AppCompatActivity implements IVideoParamsChan
     // LOG SHARING
     // ----------------------------------------------------------------------------
 
+    /**
+     * An anomaly noticed by either native library dumps the events of both into one file in the traces directory.
+     */
+    private void setupTraceAnomalyDumps() {
+        File traceDir = getExternalFilesDir("traces");
+        if (traceDir == null) {
+            return;
+        }
+        TraceWriter traceWriter = new TraceWriter(traceDir);
+        WfbNgLink.setTraceAnomalyListener(traceWriter);
+        VideoPlayer.setTraceAnomalyListener(traceWriter);
+    }
+
+    /**
+     * The trace of the last seconds next to the shared log, see TraceWriter.
+     */
+    private File writeTrace(String timeStamp) {
+        File traceFile = new File(getExternalFilesDir(null), "pixelpilot_trace_" + timeStamp + ".json");
+        return TraceWriter.write(traceFile) ? traceFile : null;
+    }
+
     /**
      * Shares the device logs by writing them to a file and prompting the user to choose a share target.
      */
@@ -1149,12 +1183,17 @@ public class VideoActivity extends AppCompatActivity implements IVideoParamsChan
             fileWriter.flush();
             fileWriter.close();
 
-            // Share the log file
+            // Share the log file, together with the trace of the last seconds
+            ArrayList<Uri> fileUris = new ArrayList<>();
+            fileUris.add(FileProvider.getUriForFile(this, getPackageName() + ".provider", logFile));
+            File traceFile = writeTrace(timeStamp);
+            if (traceFile != null) {
+                fileUris.add(FileProvider.getUriForFile(this, getPackageName() + ".provider", traceFile));
+            }
             Intent sendIntent = new Intent();
-            sendIntent.setAction(Intent.ACTION_SEND);
-            Uri fileUri = FileProvider.getUriForFile(this, getPackageName() + ".provider", logFile);
-            sendIntent.putExtra(Intent.EXTRA_STREAM, fileUri);
-            sendIntent.setType("text/plain");
+            sendIntent.setAction(Intent.ACTION_SEND_MULTIPLE);
+            sendIntent.putParcelableArrayListExtra(Intent.EXTRA_STREAM, fileUris);
+            sendIntent.setType("*/*");
             sendIntent.addFlags(Intent.FLAG_GRANT_READ_URI_PERMISSION);
             Intent shareIntent = Intent.createChooser(sendIntent, null);
             startActivity(shareIntent);
@@ -1439,6 +1478,16 @@ public class VideoActivity extends AppCompatActivity implements IVideoParamsChan
         super.onStop();
     }
 
+    @Override
+    protected void onDestroy() {
+        // The link and the player hold raw native pointers to each other, neither may outlive the other's finalizer.
+        if (wfbLink != null && videoPlayer != null) {
+            videoPlayer.setKeyframeRequester(0, 0);
+            wfbLink.clearInProcessVideoSink();
+        }
+        super.onDestroy();
+    }
+
     @Override
     protected void onResume() {
         registerReceivers();
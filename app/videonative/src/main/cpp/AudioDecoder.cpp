@@ -4,6 +4,7 @@
 
 #include "AudioDecoder.h"
 #include <android/log.h>
+#include "TraceRecorder.h"
 
 #define TAG "pixelpilot"
 
@@ -88,6 +89,7 @@ void AudioDecoder::stopAudio()
 
 void AudioDecoder::onNewAudioData(const uint8_t* data, const std::size_t data_length)
 {
+    TRACE_SCOPE_ARG("audio_decode", data_length);
     const int      rtp_header_size   = 12;
     const uint8_t* opus_payload      = data + rtp_header_size;
     int            opus_payload_size = data_length - rtp_header_size;
@@ -1,3 +1,5 @@
+#pragma once
+
 #if defined(__ANDROID__) || defined(__ANDROID_API__)
 #include <android/log.h>
 #else
@@ -5,20 +7,36 @@
 #include <cstdio>
 #endif
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <cstdarg>
 #include <cstddef>
 #include <cstdint>
 #include <limits>
-
-#include <unordered_map>
+#include <type_traits>
 #include <vector>
 
-// Define logging tag and maximum buffer size
+#include "LatencyStats.h"
+
+// Define logging tag
 #define BUFFERED_QUEUE_LOG_TAG "BufferedPacketQueue"
-// Considering the packet rate about 100 packets per second, 10 packets should be enough
-constexpr size_t MAX_BUFFER_SIZE = 15;
-// Number of monotonically increasing packets
-constexpr size_t MONOTONIC_THRESHOLD = 5;
+// Slots of the ring, indexed by sequence number modulo the size. Must be a power of two so the index stays
+// continuous when the 16 bit sequence number wraps.
+constexpr size_t REORDER_RING_SIZE = 64;
+static_assert((REORDER_RING_SIZE & (REORDER_RING_SIZE - 1)) == 0);
+// Every slot is allocated for a full RTP packet up front, a larger packet grows its slot once
+constexpr size_t REORDER_SLOT_SIZE = 1500;
+// How far ahead of a missing packet we keep buffering. Starts where the old count threshold was and follows the
+// reordering actually seen, twice the largest displacement of the last DEPTH_WINDOW_PACKETS packets.
+constexpr size_t INITIAL_REORDER_DEPTH = 15;
+constexpr size_t MIN_REORDER_DEPTH     = 4;
+constexpr size_t MAX_REORDER_DEPTH     = REORDER_RING_SIZE - 1;
+constexpr size_t DEPTH_WINDOW_PACKETS  = 1000;
+// A missing packet is given up after this long, whatever the depth. About a frame at 60 fps.
+constexpr int DEFAULT_MAX_HOLD_MS = 20;
+// That many late packets in a row mean the sender restarted with lower sequence numbers
+constexpr size_t LATE_RESYNC_THRESHOLD = 5;
 
 // Type definition for sequence numbers
 using SeqType   = uint16_t;
@@ -27,14 +45,42 @@ using SignedSeq = std::make_signed_t<SeqType>;
 /**
  * @brief BufferedPacketQueue class handles packet processing with sequence numbers,
  *        ensuring in-order delivery and buffering out-of-order packets.
+ *
+ * Out-of-order packets wait in a preallocated ring until the missing ones arrive, until they are more than the
+ * reorder depth ahead, or until the oldest of them was held for the maximum hold time. Hold times are only checked
+ * when a packet arrives, which at video packet rates is often enough.
+ * Not thread safe, except for stats() and holdTime().
  */
 class BufferedPacketQueue
 {
   public:
+    struct Stats
+    {
+        // Arrived after a higher sequence number but still delivered in order
+        uint64_t nReordered = 0;
+        // Arrived after their position was given up, dropped
+        uint64_t nLate = 0;
+        // Not delivered: late packets and duplicates
+        uint64_t nDropped = 0;
+        // Sequence numbers given up on because they did not arrive in time
+        uint64_t nSkipped = 0;
+        size_t   depth    = 0;
+    };
+
     /**
      * @brief Constructs a BufferedPacketQueue instance.
+     * @param maxHoldMs Longest time a packet waits for the ones before it.
      */
-    BufferedPacketQueue() : mFirstPacket(true), mLastPacketIdx(0), mMonotonicOutOfOrderIncreaseCount(0) {}
+    explicit BufferedPacketQueue(int maxHoldMs = DEFAULT_MAX_HOLD_MS)
+    {
+        setMaxHoldMs(maxHoldMs);
+        for (auto& slot : mSlots)
+        {
+            slot.data.reserve(REORDER_SLOT_SIZE);
+        }
+    }
+
+    void setMaxHoldMs(int maxHoldMs) { mMaxHoldNs = (int64_t) maxHoldMs * 1000000; }
 
     /**
      * @brief Processes an incoming packet based on its sequence index.
@@ -43,265 +89,290 @@ class BufferedPacketQueue
      * @param data Pointer to the packet data.
      * @param data_length Size of the packet data.
      * @param callback Callable to handle processed packets.
+     * @param nowNs Arrival time on the steady clock.
      */
     template <typename Callback>
-    void processPacket(SeqType currPacketIdx, const uint8_t* data, std::size_t data_length, Callback& callback)
+    void processPacket(
+        SeqType        currPacketIdx,
+        const uint8_t* data,
+        std::size_t    data_length,
+        Callback&      callback,
+        int64_t        nowNs = steadyNowNs())
     {
         logDebug(
-            "Processing packet with Sequence=%u, lastPacketIdx=%u, firstPacket=%s",
+            "Processing packet with Sequence=%u, expected=%u, firstPacket=%s",
             currPacketIdx,
-            mLastPacketIdx,
+            mExpected,
             mFirstPacket ? "true" : "false");
 
-        if (isFirstPacket(currPacketIdx))
+        if (mFirstPacket)
+        {
+            mFirstPacket = false;
+            mExpected    = currPacketIdx;
+            mHighest     = currPacketIdx;
+        }
+        releaseExpired(callback, nowNs);
+
+        SignedSeq dist = calculateDistance(mExpected, currPacketIdx);
+        if (dist < 0)
         {
-            handleFirstPacket(currPacketIdx);
-            // Continue processing the first packet
-            processInOrderPacket(currPacketIdx, data, data_length, callback);
-            processBufferedPackets(callback);
+            handleLatePacket(currPacketIdx, data, data_length, callback, nowNs);
             return;
         }
+        mConsecutiveLate = 0;
+        trackReordering(currPacketIdx);
 
-        if (isNextExpectedPacket(currPacketIdx))
+        if ((size_t) dist >= REORDER_RING_SIZE)
+        {
+            // Far ahead, nothing held can be completed anymore
+            logWarning("Sequence jumped from %u to %u. Restarting buffering.", mExpected, currPacketIdx);
+            restartBuffering(callback, currPacketIdx, nowNs);
+            dist = 0;
+        }
+        else if ((size_t) dist >= mDepth)
+        {
+            // Give up on the oldest missing packets until this one fits into the reorder depth
+            skipTo(static_cast<SeqType>(currPacketIdx - mDepth + 1), callback, nowNs);
+            dist = calculateDistance(mExpected, currPacketIdx);
+        }
+
+        if (dist == 0)
         {
             // In-order packet
-            processInOrderPacket(currPacketIdx, data, data_length, callback);
-            processBufferedPackets(callback);
-            // Reset monotonic increase counter after in-order packet
-            mMonotonicOutOfOrderIncreaseCount = 0;
+            callback(data, data_length);
+            mExpected++;
+            processBufferedPackets(callback, nowNs);
         }
         else
         {
-            // Out-of-order packet
-            handleOutOfOrderPacket(currPacketIdx, data, data_length, callback);
+            bufferPacket(currPacketIdx, data, data_length, nowNs);
         }
     }
 
-  private:
-    bool    mFirstPacket;
-    SeqType mLastPacketIdx;
+    // May be called from any thread
+    Stats stats() const
+    {
+        Stats s;
+        s.nReordered = mNReordered.load(std::memory_order_relaxed);
+        s.nLate      = mNLate.load(std::memory_order_relaxed);
+        s.nDropped   = mNDropped.load(std::memory_order_relaxed);
+        s.nSkipped   = mNSkipped.load(std::memory_order_relaxed);
+        s.depth      = mDepthPublished.load(std::memory_order_relaxed);
+        return s;
+    }
 
-    std::unordered_map<SeqType, std::vector<uint8_t>> mPackets;
+    // How long out-of-order packets waited before they were delivered. May be read from any thread.
+    const LatencyHistogram& holdTime() const { return mHoldTime; }
 
-    // This variable is used to track a situation where the sequence number is increasing monotonically while packets
-    // are out of order. if this counter reaches MONOTONIC_THRESHOLD, we will restart buffering and update lastPacketIdx
-    // to the highest sequence index received.
-    size_t mMonotonicOutOfOrderIncreaseCount;
+    static int64_t steadyNowNs()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
 
-    /**
-     * @brief Determines if the incoming packet is the first packet.
-     * @param currPacketIdx Sequence index of the incoming packet.
-     * @return True if it's the first packet; otherwise, false.
-     */
-    bool isFirstPacket(SeqType currPacketIdx) const { return mFirstPacket; }
+  private:
+    struct Slot
+    {
+        std::vector<uint8_t> data;
+        int64_t              arrivalNs = 0;
+        SeqType              seq       = 0;
+        bool                 filled    = false;
+    };
+
+    std::array<Slot, REORDER_RING_SIZE> mSlots;
+    bool                                mFirstPacket = true;
+    // Next sequence number to deliver
+    SeqType mExpected = 0;
+    // Highest sequence number seen
+    SeqType mHighest = 0;
+    // Filled slots
+    size_t  mHeld            = 0;
+    size_t  mDepth           = INITIAL_REORDER_DEPTH;
+    int64_t mMaxHoldNs       = 0;
+    size_t  mConsecutiveLate = 0;
+    // Largest displacement seen in the current window, in packets
+    size_t mWindowMaxDisplacement = 0;
+    size_t mWindowPackets         = 0;
+
+    std::atomic<uint64_t> mNReordered{0};
+    std::atomic<uint64_t> mNLate{0};
+    std::atomic<uint64_t> mNDropped{0};
+    std::atomic<uint64_t> mNSkipped{0};
+    std::atomic<size_t>   mDepthPublished{INITIAL_REORDER_DEPTH};
+    LatencyHistogram      mHoldTime;
+
+    Slot& slotOf(SeqType seq) { return mSlots[seq % REORDER_RING_SIZE]; }
 
     /**
-     * @brief Handles the first packet by initializing the lastPacketIdx.
-     * @param currPacketIdx Sequence index of the first packet.
+     * @brief Buffers an out-of-order packet in its slot, the slot keeps its allocation.
+     * @param currPacketIdx Sequence index of the incoming packet.
+     * @param data Pointer to the packet data.
+     * @param data_length Size of the packet data.
+     * @param nowNs Arrival time.
      */
-    void handleFirstPacket(SeqType currPacketIdx)
+    void bufferPacket(SeqType currPacketIdx, const uint8_t* data, std::size_t data_length, int64_t nowNs)
     {
-        mLastPacketIdx = currPacketIdx - 1;
-        mFirstPacket   = false;
-        logDebug("First packet received. Initialized lastPacketIdx to %u", mLastPacketIdx);
+        Slot& slot = slotOf(currPacketIdx);
+        if (slot.filled)
+        {
+            logWarning("Duplicate packet received with Sequence=%u. ", currPacketIdx);
+            mNDropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        slot.data.assign(data, data + data_length);
+        slot.arrivalNs = nowNs;
+        slot.seq       = currPacketIdx;
+        slot.filled    = true;
+        mHeld++;
+        logDebug("Buffered out-of-order packet. Buffer size: %zu", mHeld);
     }
 
     /**
-     * @brief Checks if the incoming packet is the next expected in order.
-     * @param currPacketIdx Sequence index of the incoming packet.
-     * @return True if it's the next expected packet; otherwise, false.
+     * @brief Delivers the buffered packet in the expected slot, if there is one.
+     * @return True if a packet was delivered.
      */
-    bool isNextExpectedPacket(SeqType currPacketIdx) const
+    template <typename Callback>
+    bool deliverExpected(Callback& callback, int64_t nowNs)
     {
-        return currPacketIdx == static_cast<SeqType>(mLastPacketIdx + 1);
+        Slot& slot = slotOf(mExpected);
+        if (!slot.filled || slot.seq != mExpected)
+        {
+            return false;
+        }
+        logDebug("Found buffered packet with Sequence=%u. Processing.", mExpected);
+        mHoldTime.record((nowNs - slot.arrivalNs) / 1000);
+        callback(slot.data.data(), slot.data.size());
+        slot.filled = false;
+        mHeld--;
+        return true;
     }
 
     /**
-     * @brief Processes an in-order packet by invoking the callback and updating state.
+     * @brief Processes buffered packets that can now be delivered in order.
      * @tparam Callback A callable type that processes the packet data.
-     * @param currPacketIdx Sequence index of the packet.
-     * @param data Pointer to the packet data.
-     * @param data_length Size of the packet data.
      * @param callback Callable to handle processed packets.
      */
     template <typename Callback>
-    void processInOrderPacket(SeqType currPacketIdx, const uint8_t* data, std::size_t data_length, Callback& callback)
+    void processBufferedPackets(Callback& callback, int64_t nowNs)
     {
-        logDebug("In-order packet detected. Processing immediately.");
-
-        // in-order packet receiver which means we restart tracking out of order monotonic increases
-        mMonotonicOutOfOrderIncreaseCount = 0;
-
-        callback(data, data_length);
-        mLastPacketIdx = currPacketIdx;
-        logDebug("Updated lastPacketIdx to %u", mLastPacketIdx);
+        while (mHeld > 0 && deliverExpected(callback, nowNs))
+        {
+            mExpected++;
+        }
     }
 
     /**
-     * @brief Processes buffered packets that can now be delivered in order.
-     * @tparam Callback A callable type that processes the packet data.
-     * @param callback Callable to handle processed packets.
+     * @brief Gives up on every missing packet before @param target, delivering the buffered ones on the way.
      */
     template <typename Callback>
-    void processBufferedPackets(Callback& callback)
+    void skipTo(SeqType target, Callback& callback, int64_t nowNs)
     {
-        while (true)
+        while (calculateDistance(mExpected, target) > 0)
         {
-            SeqType nextIdx = mLastPacketIdx + 1;
-            auto    it      = mPackets.find(nextIdx);
-            if (it != mPackets.end())
+            if (!deliverExpected(callback, nowNs))
             {
-                logDebug("Found buffered packet with Sequence=%u. Processing.", it->first);
-                callback(it->second.data(), it->second.size());
-                mLastPacketIdx = it->first;
-                logDebug("Updated lastPacketIdx to %u after processing buffered packet.", mLastPacketIdx);
-                mPackets.erase(it);
-            }
-            else
-            {
-                logDebug("No buffered packet found for Sequence=%u.", nextIdx);
-                break;
+                mNSkipped.fetch_add(1, std::memory_order_relaxed);
             }
+            mExpected++;
         }
+        processBufferedPackets(callback, nowNs);
     }
 
     /**
-     * @brief Handles out-of-order packets by buffering or ignoring based on distance and monotonic increases.
-     * @tparam Callback A callable type that processes the packet data.
-     * @param currPacketIdx Sequence index of the incoming packet.
-     * @param data Pointer to the packet data.
-     * @param data_length Size of the packet data.
-     * @param callback Callable to handle processed packets.
+     * @brief Skips the gap in front of the first buffered packet once that waited for the maximum hold time.
      */
     template <typename Callback>
-    void handleOutOfOrderPacket(SeqType currPacketIdx, const uint8_t* data, std::size_t data_length, Callback& callback)
+    void releaseExpired(Callback& callback, int64_t nowNs)
     {
-        logDebug("Out-of-order packet detected. Sequence=%u", currPacketIdx);
-
-        if (isDuplicatePacket(currPacketIdx))
-        {
-            logWarning("Duplicate packet received with Sequence=%u. ", currPacketIdx);
-            // return;
-        }
-
-        bufferPacket(currPacketIdx, data, data_length);
-
-        auto dist = calculateDistance(currPacketIdx, mLastPacketIdx);
-        if (std::abs(dist) < MONOTONIC_THRESHOLD)
+        while (mHeld > 0)
         {
-            // Check for monotonic increases
-            if (dist > 0)
+            SeqType first = mExpected;
+            while (!slotOf(first).filled)
             {
-                mMonotonicOutOfOrderIncreaseCount++;
-                logDebug("Monotonic increase count: %zu", mMonotonicOutOfOrderIncreaseCount);
-                if (mMonotonicOutOfOrderIncreaseCount >= MONOTONIC_THRESHOLD)
-                {
-                    restartBuffering(callback, currPacketIdx);
-                    // Update lastPacketIdx to the highest sequence index received
-                    SeqType newLastIdx = currPacketIdx;
-                    logWarning("Monotonic threshold reached. Updating lastPacketIdx to %u", newLastIdx);
-                }
+                first++;
             }
-            else
+            if (nowNs - slotOf(first).arrivalNs < mMaxHoldNs)
             {
-                // Reset the counter if a non-increasing packet is received
-                mMonotonicOutOfOrderIncreaseCount = 0;
-                logDebug("Non-increasing packet received. Resetting monotonic increase count.");
+                return;
             }
-        }
-        // If buffer size exceeds MAX_BUFFER_SIZE, handle buffer overflow
-        if (mPackets.size() >= MAX_BUFFER_SIZE)
-        {
-            logWarning(
-                "Buffer size exceeded MAX_BUFFER_SIZE (%zu). Processing in-order buffered packets.", MAX_BUFFER_SIZE);
-            restartBuffering(callback, currPacketIdx);
+            logDebug("Held packet with Sequence=%u expired. Skipping to it.", first);
+            skipTo(first, callback, nowNs);
         }
     }
 
     /**
-     * @brief Checks if the incoming packet is a duplicate.
-     * @param currPacketIdx Sequence index of the incoming packet.
-     * @return True if the packet is a duplicate; otherwise, false.
+     * @brief Drops a packet that arrived after its position was given up, or restarts on a sender restart.
      */
-    bool isDuplicatePacket(SeqType currPacketIdx) const { return mPackets.find(currPacketIdx) != mPackets.end(); }
+    template <typename Callback>
+    void handleLatePacket(
+        SeqType currPacketIdx, const uint8_t* data, std::size_t data_length, Callback& callback, int64_t nowNs)
+    {
+        trackReordering(currPacketIdx);
+        if (++mConsecutiveLate >= LATE_RESYNC_THRESHOLD)
+        {
+            logWarning("Sequence went back from %u to %u. Restarting buffering.", mExpected, currPacketIdx);
+            restartBuffering(callback, currPacketIdx, nowNs);
+            mConsecutiveLate = 0;
+            callback(data, data_length);
+            mExpected++;
+            return;
+        }
+        logDebug("Late packet with Sequence=%u dropped.", currPacketIdx);
+        mNLate.fetch_add(1, std::memory_order_relaxed);
+        mNDropped.fetch_add(1, std::memory_order_relaxed);
+    }
 
     /**
-     * @brief Buffers an out-of-order packet.
-     * @param currPacketIdx Sequence index of the incoming packet.
-     * @param data Pointer to the packet data.
-     * @param data_length Size of the packet data.
+     * @brief Delivers everything buffered in sequence order and continues from @param currPacketIdx.
      */
-    void bufferPacket(SeqType currPacketIdx, const uint8_t* data, std::size_t data_length)
+    template <typename Callback>
+    void restartBuffering(Callback& callback, SeqType currPacketIdx, int64_t nowNs)
     {
-        mPackets[currPacketIdx] = std::vector<uint8_t>(data, data + data_length);
-        logDebug("Buffered out-of-order packet. Buffer size: %zu", mPackets.size());
+        for (size_t i = 0; i < REORDER_RING_SIZE && mHeld > 0; ++i, ++mExpected)
+        {
+            deliverExpected(callback, nowNs);
+        }
+        mExpected = currPacketIdx;
+        mHighest  = currPacketIdx;
     }
 
     /**
-     * @brief Handles buffer overflow by processing in-order packets and discarding others.
-     * @tparam Callback A callable type that processes the packet data.
-     * @param callback Callable to handle processed packets.
+     * @brief Measures how far behind the highest sequence number a packet arrived and adapts the reorder depth.
+     * @param currPacketIdx Sequence index of the incoming packet.
      */
-    template <typename Callback>
-    void restartBuffering(Callback& callback, SeqType currPacketIdx)
+    void trackReordering(SeqType currPacketIdx)
     {
-        // Process as many in-order buffered packets as possible
-        processBufferedPackets(callback);
-
-        if (!mPackets.empty())
+        const SignedSeq behind = calculateDistance(currPacketIdx, mHighest);
+        if (behind < 0)
         {
-            logWarning("Processing %zu buffered packets that might be out of order.", mPackets.size());
-
-            // Create a vector of iterators to the map elements
-            std::vector<std::unordered_map<uint16_t, std::vector<uint8_t>>::const_iterator> sortedPackets;
-            sortedPackets.reserve(mPackets.size());
-
-            // Populate the vector with iterators to the map elements
-            for (auto it = mPackets.cbegin(); it != mPackets.cend(); ++it)
+            mHighest = currPacketIdx;
+        }
+        else if (behind > 0 && (size_t) behind < REORDER_RING_SIZE)
+        {
+            if (calculateDistance(mExpected, currPacketIdx) >= 0)
             {
-                sortedPackets.push_back(it);
+                mNReordered.fetch_add(1, std::memory_order_relaxed);
             }
-
-            // Sort the vector based on the keys
-            std::sort(
-                sortedPackets.begin(),
-                sortedPackets.end(),
-                [](const auto& a, const auto& b) { return a->first < b->first; });
-
-            // Iterate over the sorted packets and invoke the callback
-            for (const auto& it : sortedPackets)
+            mWindowMaxDisplacement = std::max(mWindowMaxDisplacement, (size_t) behind);
+            // Grow right away, this packet was (or almost was) too late
+            if ((size_t) behind >= mDepth)
             {
-                const auto& packet = it->second;
-                logDebug("Processing possibly out-of-order buffered packet with Sequence=%u.", it->first);
-                callback(packet.data(), packet.size());
+                setDepth(2 * (size_t) behind);
             }
-
-            mPackets.clear();
-            // Reset the monotonic increase counter
-            mMonotonicOutOfOrderIncreaseCount = 0;
         }
-        mLastPacketIdx = currPacketIdx;
-    }
-
-    /**
-     * @brief Compares two sequence numbers considering wrap-around.
-     * @param a First sequence number.
-     * @param b Second sequence number.
-     * @return True if sequence a is less than b, accounting for wrap-around.
-     */
-    bool seqLessThan(SeqType a, SeqType b) const
-    {
-        bool result = calculateDistance(a, b) > 0;
-        logDebug("seqLessThan: a=%u, b=%u, result=%s", a, b, result ? "true" : "false");
-        return result;
+        if (++mWindowPackets >= DEPTH_WINDOW_PACKETS)
+        {
+            setDepth(2 * mWindowMaxDisplacement);
+            mWindowPackets         = 0;
+            mWindowMaxDisplacement = 0;
+        }
     }
 
-    template <typename T>
-    typename std::make_signed<T>::type to_signed(T value)
+    void setDepth(size_t depth)
     {
-        static_assert(std::is_unsigned<T>::value, "Type must be unsigned");
-        using SignedType = typename std::make_signed<T>::type;
-        return static_cast<SignedType>(value);
+        mDepth = std::clamp(depth, MIN_REORDER_DEPTH, MAX_REORDER_DEPTH);
+        mDepthPublished.store(mDepth, std::memory_order_relaxed);
     }
 
     /**
@@ -328,8 +399,8 @@ class BufferedPacketQueue
         va_start(args, format);
         __android_log_vprint(ANDROID_LOG_DEBUG, BUFFERED_QUEUE_LOG_TAG, format, args);
         va_end(args);
-#else
-        // Fallback to standard output for non-Android platforms
+#elif defined(BUFFERED_QUEUE_DEBUG)
+        // Fallback to standard output for non-Android platforms, a line per packet would swamp the benchmark
         va_list args;
         va_start(args, format);
         vfprintf(stderr, format, args);
@@ -0,0 +1,84 @@
+//
+// DecoderBackend.h
+// The decoder VideoDecoder feeds: MediaCodec on Android, a software decoder or a null sink on desktop Linux.
+// The calls follow AMediaCodec, so the MediaCodec backend stays a thin wrapper and VideoDecoder keeps its flow.
+//
+
+#pragma once
+
+#include <sys/types.h>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include "NALU/KeyFrameFinder.hpp"
+
+struct VideoRatio
+{
+    int width  = 0;
+    int height = 0;
+
+    bool operator==(const VideoRatio& b) const { return width == b.width && height == b.height; }
+
+    bool operator!=(const VideoRatio& b) const { return !(*this == b); }
+};
+
+struct DecoderOutputInfo
+{
+    int64_t  presentationTimeUs = 0;
+    uint32_t flags              = 0;
+};
+
+/**
+ * One decoder instance. Input and output run on different threads (the parser feeds, VideoDecoder's output thread
+ * drains), everything else is called with the input side idle. After stop() the dequeue calls return an error, so the
+ * output thread ends.
+ */
+class DecoderBackend
+{
+  public:
+    // dequeueInputBuffer / dequeueOutputBuffer results other than a buffer index, the values of AMEDIACODEC_INFO_*
+    static constexpr ssize_t TRY_AGAIN_LATER        = -1;
+    static constexpr ssize_t OUTPUT_FORMAT_CHANGED  = -2;
+    static constexpr ssize_t OUTPUT_BUFFERS_CHANGED = -3;
+    // Returned once stopped, like AMEDIA_ERROR_UNKNOWN
+    static constexpr ssize_t ERROR = -10000;
+    // Buffer flags, the values of AMEDIACODEC_BUFFER_FLAG_*
+    static constexpr uint32_t FLAG_CODEC_CONFIG  = 2;
+    static constexpr uint32_t FLAG_END_OF_STREAM = 4;
+
+    struct OutputFormat
+    {
+        VideoRatio  size;
+        std::string description;
+    };
+
+    virtual ~DecoderBackend() = default;
+
+    /**
+     * Configure with the SPS / PPS (and VPS) in @param keyFrames and start decoding. @param maxInputSize is the
+     * smallest input buffer size wanted, 0 for the backend default. False if there is no usable decoder.
+     */
+    virtual bool start(const KeyFrameFinder& keyFrames, bool isH265, size_t maxInputSize) = 0;
+
+    virtual void stop() = 0;
+
+    virtual ssize_t dequeueInputBuffer(int64_t timeoutUs) = 0;
+
+    virtual uint8_t* getInputBuffer(size_t index, size_t* capacity) = 0;
+
+    // @param size 0 hands the buffer back unused
+    virtual void queueInputBuffer(size_t index, size_t size, uint64_t presentationTimeUs, uint32_t flags) = 0;
+
+    virtual ssize_t dequeueOutputBuffer(DecoderOutputInfo& info, int64_t timeoutUs) = 0;
+
+    // @param render shows the frame, MediaCodec renders it to its surface
+    virtual void releaseOutputBuffer(size_t index, bool render) = 0;
+
+    // After OUTPUT_FORMAT_CHANGED
+    virtual OutputFormat outputFormat() = 0;
+};
+
+// Creates a new backend every time VideoDecoder (re)starts a decoder
+using DecoderBackendFactory = std::function<std::unique_ptr<DecoderBackend>()>;
@@ -0,0 +1,154 @@
+//
+// DvrWriter.cpp
+//
+
+#include "DvrWriter.h"
+#include <android/log.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include "TraceRecorder.h"
+#include "minimp4.h"
+
+#define TAG "pixelpilot"
+
+static int write_callback(int64_t offset, const void* buffer, size_t size, void* token)
+{
+    FILE* f = (FILE*) token;
+    fseek(f, offset, SEEK_SET);
+    return fwrite(buffer, 1, size, f) != size;
+}
+
+void DvrWriter::start(int fd, bool fragmented)
+{
+    mFd         = dup(fd);
+    mFragmented = fragmented;
+    __android_log_print(ANDROID_LOG_DEBUG, TAG, "dvr_fd=%d", mFd.load());
+    if (mFd == -1)
+    {
+        __android_log_print(ANDROID_LOG_DEBUG, TAG, "Failed to duplicate dvr file descriptor");
+        return;
+    }
+    mStopFlag = false;
+    mThread   = std::thread(&DvrWriter::processQueue, this);
+}
+
+void DvrWriter::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStopFlag = true;
+    }
+    mCv.notify_all();
+    if (mThread.joinable())
+    {
+        mThread.join();
+    }
+    // Not written, the buffers go back to the pool
+    std::lock_guard<std::mutex> lock(mMutex);
+    mQueue.clear();
+    mStats.queuedBytes = 0;
+}
+
+void DvrWriter::enqueue(PooledNalu nalu)
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStats.queuedBytes += nalu->getSize();
+        mQueue.push_back(std::move(nalu));
+        while (mStats.queuedBytes > mQueueBudget && !mQueue.empty())
+        {
+            // The recording breaks up to the next key frame either way, but keeps the key frames it has
+            auto dropped = std::find_if(mQueue.begin(),
+                                        mQueue.end(),
+                                        [](const PooledNalu& queued)
+                                        { return !queued->is_config() && !queued->is_keyframe(); });
+            if (dropped == mQueue.end())
+            {
+                dropped = mQueue.begin();
+            }
+            TRACE_INSTANT("dvr_drop", (*dropped)->getSize());
+            mStats.queuedBytes -= (*dropped)->getSize();
+            mStats.nDropped++;
+            mQueue.erase(dropped);
+        }
+        mStats.maxQueuedBytes = std::max(mStats.maxQueuedBytes, mStats.queuedBytes);
+    }
+    mCv.notify_one();
+}
+
+DvrWriter::Stats DvrWriter::stats() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mStats;
+}
+
+void DvrWriter::processQueue()
+{
+    ::FILE*           fout = fdopen(mFd, "wb");
+    MP4E_mux_t*       mux  = MP4E_open(0 /*sequential_mode*/, mFragmented, fout, write_callback);
+    mp4_h26x_writer_t mp4wr;
+    float             framerate = 0;
+    if (mux == nullptr)
+    {
+        __android_log_print(ANDROID_LOG_ERROR, TAG, "dvr open failed");
+        return;
+    }
+
+    while (true)
+    {
+        mLastWriteMs = nowMs();
+        std::unique_lock<std::mutex> lock(mMutex);
+        mCv.wait(lock, [this] { return !mQueue.empty() || mStopFlag; });
+        if (mStopFlag)
+        {
+            break;
+        }
+        if (!mQueue.empty())
+        {
+            const PooledNalu nalu = mQueue.front();
+            if (framerate == 0)
+            {
+                const VideoFormat video = mFormatProvider();
+                if (video.fps <= 0)
+                {
+                    continue;
+                }
+                if (MP4E_STATUS_OK !=
+                    mp4_h26x_write_init(&mp4wr, mux, video.width, video.height, nalu->IS_H265_PACKET))
+                {
+                    __android_log_print(ANDROID_LOG_DEBUG, TAG, "error: mp4_h26x_write_init failed");
+                }
+                framerate = video.fps;
+                __android_log_print(
+                    ANDROID_LOG_DEBUG,
+                    TAG,
+                    "mp4 init with fps=%.2f, res=%dx%d, hevc=%d",
+                    framerate,
+                    video.width,
+                    video.height,
+                    nalu->IS_H265_PACKET);
+            }
+            mQueue.pop_front();
+            mStats.queuedBytes -= nalu->getSize();
+            lock.unlock();
+            // Process the NALU
+            TRACE_SCOPE_ARG("dvr_write", nalu->getSize());
+            auto res = mp4_h26x_write_nal(&mp4wr, nalu->getData(), nalu->getSize(), 90000 / framerate);
+            if (MP4E_STATUS_OK != res)
+            {
+                __android_log_print(ANDROID_LOG_DEBUG, TAG, "mp4_h26x_write_nal failed with %d", res);
+            }
+        }
+    }
+
+    MP4E_close(mux);
+    mp4_h26x_write_close(&mp4wr);
+    if (fout)
+    {
+        fclose(fout);
+        fout = NULL;
+    }
+    mFd = -1;
+    __android_log_print(ANDROID_LOG_DEBUG, TAG, "dvr thread done");
+}
@@ -0,0 +1,88 @@
+//
+// DvrWriter.h
+// Ground recording: muxes the received NALUs into an mp4 on a thread of its own, so the parser never waits for the
+// storage. Free of Android APIs, the desktop replay tool records with it too.
+//
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include "NaluBufferPool.h"
+
+class DvrWriter
+{
+  public:
+    struct VideoFormat
+    {
+        int   width  = 0;
+        int   height = 0;
+        float fps    = 0;
+    };
+    // Asked before every NALU until it knows a frame rate, the mp4 track is set up with that
+    using FormatProvider = std::function<VideoFormat()>;
+
+    struct Stats
+    {
+        size_t queuedBytes    = 0;
+        size_t maxQueuedBytes = 0;
+        // Dropped because the storage did not keep up
+        uint64_t nDropped = 0;
+    };
+
+    // Some seconds of a high bitrate stream, for storage that stalls now and then
+    static constexpr size_t DEFAULT_QUEUE_BUDGET = 16 * 1024 * 1024;
+
+    // Once more than @param queueBudget bytes wait for the storage, the oldest NALUs that are not key frames go
+    explicit DvrWriter(FormatProvider formatProvider, size_t queueBudget = DEFAULT_QUEUE_BUDGET)
+        : mFormatProvider(std::move(formatProvider)),
+          mQueueBudget(queueBudget)
+    {
+    }
+
+    ~DvrWriter() { stop(); }
+
+    // Record into a duplicate of @param fd, as fragmented mp4 if @param fragmented
+    void start(int fd, bool fragmented);
+
+    void stop();
+
+    // A file is open, NALUs are taken
+    bool isOpen() const { return mFd > 0; }
+
+    // Wrote within the last 500 ms
+    bool isRecording() const { return nowMs() - mLastWriteMs <= 500; }
+
+    // Queues @param nalu for the writer thread, the bytes are shared and not copied
+    void enqueue(PooledNalu nalu);
+
+    Stats stats() const;
+
+  private:
+    void processQueue();
+
+    static int64_t nowMs()
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+    const FormatProvider    mFormatProvider;
+    const size_t            mQueueBudget;
+    std::atomic<int>        mFd{-1};
+    bool                    mFragmented = false;
+    std::atomic<int64_t>    mLastWriteMs{0};
+    std::deque<PooledNalu>  mQueue;
+    Stats                   mStats;
+    mutable std::mutex      mMutex;
+    std::condition_variable mCv;
+    bool                    mStopFlag = false;
+    std::thread             mThread;
+};
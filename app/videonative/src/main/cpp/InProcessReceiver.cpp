@@ -0,0 +1,92 @@
+#include "InProcessReceiver.h"
+
+#include <chrono>
+#include "helper/AndroidLogger.hpp"
+#include "helper/NDKThreadHelper.hpp"
+
+namespace
+{
+int64_t nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+}  // namespace
+
+InProcessReceiver::InProcessReceiver(JavaVM* jvm, std::string name, int prio, DATA_CALLBACK cb, LatencyStats* latency)
+    : mName(std::move(name)), mCPUPriority(prio), onData(std::move(cb)), javaVm(jvm), mLatency(latency)
+{
+}
+
+void InProcessReceiver::startReceiving()
+{
+    if (receiving) return;
+    // Anything left over from the previous session is stale by now
+    while (mRing.front() != nullptr) mRing.pop();
+    receiving = true;
+    mThread   = std::make_unique<std::thread>([this] { receiveLoop(); });
+#ifdef __ANDROID__
+    NDKThreadHelper::setName(mThread->native_handle(), mName.c_str());
+#endif
+}
+
+void InProcessReceiver::stopReceiving()
+{
+    receiving = false;
+    mRing.wakeUp();
+    if (mThread && mThread->joinable()) mThread->join();
+    mThread.reset();
+}
+
+void InProcessReceiver::push(const uint8_t* data, size_t len, const PacketTiming* timing)
+{
+    if (!receiving)
+    {
+        nDroppedStopped++;
+        return;
+    }
+    mRing.push(data, len, nowNs(), timing ? *timing : PacketTiming{});
+}
+
+void InProcessReceiver::pushTrampoline(void* ctx, const uint8_t* data, size_t len, const PacketTiming* timing)
+{
+    static_cast<InProcessReceiver*>(ctx)->push(data, len, timing);
+}
+
+void InProcessReceiver::receiveLoop()
+{
+#ifdef __ANDROID__
+    if (javaVm) NDKThreadHelper::setProcessThreadPriorityAttachDetach(javaVm, mCPUPriority, mName.c_str());
+#endif
+    MLOGD << "In-process receiver '" << mName << "' started";
+
+    while (receiving)
+    {
+        if (const auto* slot = mRing.front())
+        {
+            const int64_t       now    = nowNs();
+            const PacketTiming& timing = slot->meta;
+            const int64_t       pushNs = (int64_t) slot->timestampNs;
+            if (mLatency)
+            {
+                if (timing.arrivalNs != 0)
+                {
+                    mLatency->recordNs(LatencyStage::RADIO_QUEUE, timing.arrivalNs, timing.dequeueNs);
+                    mLatency->recordNs(
+                        (timing.flags & PacketTiming::FEC_RECOVERED) ? LatencyStage::FEC_RECOVERY
+                                                                     : LatencyStage::AGGREGATOR,
+                        timing.dequeueNs,
+                        pushNs);
+                }
+                mLatency->recordNs(LatencyStage::HANDOFF, pushNs, now);
+            }
+            onData(slot->data.data(), slot->length, timing.arrivalNs != 0 ? timing.arrivalNs : pushNs);
+            nReceivedBytes += slot->length;
+            mRing.pop();
+            continue;
+        }
+        // The timeout only guards against a missed stop, wake ups normally come from push()
+        mRing.waitForData(std::chrono::milliseconds(100));
+    }
+    MLOGD << "In-process receiver '" << mName << "' stopped, dropped " << getNDroppedPackets();
+}
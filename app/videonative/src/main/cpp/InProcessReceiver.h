@@ -0,0 +1,96 @@
+//
+// InProcessReceiver.h
+// Receives RTP packets from another native library loaded into the same process (the wfb-ng link) without going
+// through a socket. Drop-in companion to UDPReceiver / UDSReceiver.
+//
+
+#pragma once
+
+#include <jni.h>  // JavaVM
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "LatencyStats.h"
+#include "SpscPacketRing.h"
+
+/**
+ * Timing the wfb-ng link attaches to every packet, same layout as PacketTiming in the wfbngrtl8812 library.
+ * CLOCK_MONOTONIC nanoseconds, FEC_RECOVERED in flags marks packets the aggregator only released after a FEC
+ * recovery.
+ */
+struct PacketTiming
+{
+    static constexpr uint32_t FEC_RECOVERED = 1;
+
+    int64_t  arrivalNs;
+    int64_t  dequeueNs;
+    uint32_t flags;
+};
+
+class InProcessReceiver
+{
+  public:
+    // originNs: when the packet came out of the USB adapter (CLOCK_MONOTONIC), the push time if the link sent no
+    // timing
+    using DATA_CALLBACK = std::function<void(const uint8_t* data, size_t len, int64_t originNs)>;
+    /**
+     * Producer entry point as seen from the other library. The pair (&pushTrampoline, this) is handed over through
+     * Java as two jlongs, so this signature and PacketTiming are the whole contract between the two libraries.
+     */
+    using PUSH_FN = void (*)(void* ctx, const uint8_t* data, size_t len, const PacketTiming* timing);
+
+    // Large enough for any wfb-ng payload, 1024 slots hold ~0.5s of video at 40 MBit/s
+    static constexpr size_t SLOT_SIZE     = 4096;
+    static constexpr size_t RING_CAPACITY = 1024;
+
+    /**
+     * @param latency Receives the link and handoff stages of every packet, may be nullptr.
+     */
+    InProcessReceiver(
+        JavaVM* javaVm, std::string name, int CPUPriority, DATA_CALLBACK onData, LatencyStats* latency = nullptr);
+
+    InProcessReceiver(const InProcessReceiver&)            = delete;
+    InProcessReceiver& operator=(const InProcessReceiver&) = delete;
+
+    ~InProcessReceiver() { stopReceiving(); }
+
+    /**
+     * Start / stop the consumer thread that drains the ring into the data callback.
+     * Packets pushed while the consumer is stopped are dropped.
+     */
+    void startReceiving();
+    void stopReceiving();
+
+    /**
+     * Copy a packet into the ring. Must only be called by one producer at a time (the aggregator calls it with its
+     * own lock held).
+     */
+    void push(const uint8_t* data, size_t len, const PacketTiming* timing);
+
+    static void pushTrampoline(void* ctx, const uint8_t* data, size_t len, const PacketTiming* timing);
+
+    [[nodiscard]] long     getNReceivedBytes() const { return nReceivedBytes; }
+    [[nodiscard]] uint64_t getNDroppedPackets() const { return mRing.getNDropped() + nDroppedStopped; }
+    [[nodiscard]] bool     isReceiving() const { return receiving; }
+
+  private:
+    void receiveLoop();
+
+    const std::string   mName;
+    const int           mCPUPriority;
+    const DATA_CALLBACK onData;
+    JavaVM* const       javaVm;
+    LatencyStats* const mLatency;
+
+    SpscPacketRing<SLOT_SIZE, RING_CAPACITY, PacketTiming> mRing;
+
+    std::unique_ptr<std::thread> mThread;
+    std::atomic<bool>            receiving{false};
+    std::atomic<long>            nReceivedBytes{0};
+    std::atomic<uint64_t>        nDroppedStopped{0};
+};
@@ -0,0 +1,188 @@
+//
+// LatencyStats.h
+// Where a video packet spends its time between the USB adapter and the display, one histogram per pipeline
+// stage. Any pipeline thread records into it with a couple of relaxed atomic adds, no lock involved.
+//
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+enum class LatencyStage : int
+{
+    RADIO_QUEUE = 0,  // USB arrival -> the wfb-ng stream worker took the frame (in-process only)
+    AGGREGATOR,       // worker -> packet left the aggregator without FEC (in-process only)
+    FEC_RECOVERY,     // worker -> packet left the aggregator after a FEC recovery (in-process only)
+    HANDOFF,          // aggregator output -> receiver thread (in-process only)
+    REORDER,          // held by the BufferedPacketQueue
+    REASSEMBLY,       // first RTP fragment of a NALU -> NALU complete
+    INPUT_WAIT,       // waiting for a free decoder input buffer
+    DECODE,           // queueInputBuffer -> output buffer released to the surface
+    TOTAL,            // USB arrival (or socket receive) of the first packet of a frame -> displayed
+    COUNT
+};
+
+/**
+ * Log-linear histogram of microseconds: values 0..3 get a bucket each, every power of two above that is split
+ * into 4 buckets, so any value is off by at most 25%. Values of 2^26 us (about a minute) and above share the last
+ * bucket.
+ */
+class LatencyHistogram
+{
+  public:
+    static constexpr int kSubBuckets = 4;
+    static constexpr int kMaxLog2    = 25;
+    static constexpr int kBuckets    = kSubBuckets + (kMaxLog2 - 1) * kSubBuckets;
+
+    struct Snapshot
+    {
+        std::array<uint64_t, kBuckets> counts{};
+        uint64_t                       sumUs = 0;
+    };
+
+    struct Summary
+    {
+        uint64_t count = 0;
+        int64_t  avgUs = 0;
+        int64_t  p50Us = 0;
+        int64_t  p90Us = 0;
+        int64_t  p99Us = 0;
+        // Upper bound of the highest non-empty bucket
+        int64_t maxUs = 0;
+    };
+
+    static int bucketOf(int64_t us)
+    {
+        if (us < kSubBuckets)
+        {
+            return us < 0 ? 0 : (int) us;
+        }
+        const int log2 = 63 - __builtin_clzll((uint64_t) us);
+        if (log2 > kMaxLog2)
+        {
+            return kBuckets - 1;
+        }
+        const int sub = (int) (us >> (log2 - 2)) & (kSubBuckets - 1);
+        return kSubBuckets + (log2 - 2) * kSubBuckets + sub;
+    }
+
+    // Largest value that still falls into @param bucket
+    static int64_t upperBoundUs(int bucket)
+    {
+        if (bucket < kSubBuckets)
+        {
+            return bucket;
+        }
+        const int log2 = (bucket - kSubBuckets) / kSubBuckets + 2;
+        const int sub  = (bucket - kSubBuckets) % kSubBuckets;
+        return ((int64_t) (kSubBuckets + sub + 1) << (log2 - 2)) - 1;
+    }
+
+    void record(int64_t us)
+    {
+        mCounts[bucketOf(us)].fetch_add(1, std::memory_order_relaxed);
+        mSumUs.fetch_add(us < 0 ? 0 : (uint64_t) us, std::memory_order_relaxed);
+    }
+
+    // Not atomic as a whole, a value recorded concurrently may be missing from the sum or the counts
+    Snapshot snapshot() const
+    {
+        Snapshot s;
+        for (int i = 0; i < kBuckets; ++i)
+        {
+            s.counts[i] = mCounts[i].load(std::memory_order_relaxed);
+        }
+        s.sumUs = mSumUs.load(std::memory_order_relaxed);
+        return s;
+    }
+
+    // Statistics of what was recorded between @param from and @param to
+    static Summary summarize(const Snapshot& from, const Snapshot& to)
+    {
+        Summary                        summary;
+        std::array<uint64_t, kBuckets> counts{};
+        for (int i = 0; i < kBuckets; ++i)
+        {
+            counts[i] = to.counts[i] - from.counts[i];
+            summary.count += counts[i];
+        }
+        if (summary.count == 0)
+        {
+            return summary;
+        }
+        summary.avgUs = (int64_t) ((to.sumUs - from.sumUs) / summary.count);
+
+        const uint64_t p50 = (summary.count * 50 + 99) / 100;
+        const uint64_t p90 = (summary.count * 90 + 99) / 100;
+        const uint64_t p99 = (summary.count * 99 + 99) / 100;
+        uint64_t       seen = 0;
+        for (int i = 0; i < kBuckets; ++i)
+        {
+            if (counts[i] == 0)
+            {
+                continue;
+            }
+            const uint64_t before = seen;
+            seen += counts[i];
+            if (before < p50 && seen >= p50) summary.p50Us = upperBoundUs(i);
+            if (before < p90 && seen >= p90) summary.p90Us = upperBoundUs(i);
+            if (before < p99 && seen >= p99) summary.p99Us = upperBoundUs(i);
+            summary.maxUs = upperBoundUs(i);
+        }
+        return summary;
+    }
+
+  private:
+    std::array<std::atomic<uint64_t>, kBuckets> mCounts{};
+    std::atomic<uint64_t>                       mSumUs{0};
+};
+
+class LatencyStats
+{
+  public:
+    static constexpr int kStages = (int) LatencyStage::COUNT;
+
+    using Summaries = std::array<LatencyHistogram::Summary, kStages>;
+
+    void record(LatencyStage stage, int64_t us) { mStages[(int) stage].record(us); }
+
+    void recordNs(LatencyStage stage, int64_t fromNs, int64_t toNs) { record(stage, (toNs - fromNs) / 1000); }
+
+    const LatencyHistogram& histogram(LatencyStage stage) const { return mStages[(int) stage]; }
+
+    static const char* name(LatencyStage stage)
+    {
+        static constexpr const char* kNames[kStages] = {
+            "RadioQueue", "Aggregator", "FecRecovery", "Handoff", "Reorder", "Reassembly", "InputWait", "Decode",
+            "Total"};
+        return kNames[(int) stage];
+    }
+
+    /**
+     * Summaries of everything recorded since the previous call on the same window. Every reader (log, Java) keeps
+     * its own window, so they don't reset each other.
+     */
+    class Window
+    {
+      public:
+        Summaries next(const LatencyStats& stats)
+        {
+            Summaries summaries;
+            for (int i = 0; i < kStages; ++i)
+            {
+                const auto now = stats.mStages[i].snapshot();
+                summaries[i]   = LatencyHistogram::summarize(mLast[i], now);
+                mLast[i]       = now;
+            }
+            return summaries;
+        }
+
+      private:
+        std::array<LatencyHistogram::Snapshot, kStages> mLast{};
+    };
+
+  private:
+    std::array<LatencyHistogram, kStages> mStages;
+};
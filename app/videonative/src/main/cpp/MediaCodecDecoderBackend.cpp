@@ -0,0 +1,125 @@
+//
+// MediaCodecDecoderBackend.cpp
+//
+
+#include "MediaCodecDecoderBackend.h"
+#include "helper/AndroidLogger.hpp"
+#include "helper/AndroidMediaFormatHelper.h"
+
+MediaCodecDecoderBackend::~MediaCodecDecoderBackend()
+{
+    if (mCodec != nullptr)
+    {
+        AMediaCodec_delete(mCodec);
+    }
+}
+
+bool MediaCodecDecoderBackend::start(const KeyFrameFinder& keyFrames, bool isH265, size_t maxInputSize)
+{
+    const std::string MIME = isH265 ? "video/hevc" : "video/avc";
+    mCodec                 = AMediaCodec_createDecoderByType(MIME.c_str());
+    if (mCodec == nullptr)
+    {
+        MLOGD << "Cannot create decoder for " << MIME;
+        return false;
+    }
+
+    AMediaFormat* format = AMediaFormat_new();
+    AMediaFormat_setString(format, AMEDIAFORMAT_KEY_MIME, MIME.c_str());
+
+    // AMediaFormat_setInt32(format, "low-latency", 1);
+    // AMediaFormat_setInt32(format, "vendor.low-latency.enable", 1);
+    // AMediaFormat_setInt32(format, "vendor.qti-ext-dec-low-latency.enable", 1);
+    // AMediaFormat_setInt32(format, "vendor.hisi-ext-low-latency-video-dec.video-scene-for-low-latency-req", 1);
+    // AMediaFormat_setInt32(format, "vendor.rtc-ext-dec-low-latency.enable", 1);
+
+    // MediaCodec supports two priorities: 0 - realtime, 1 - best effort
+    // AMediaFormat_setInt32(format, "priority", 0);
+
+    if (isH265)
+    {
+        h265_configureAMediaFormat(keyFrames, format);
+    }
+    else
+    {
+        h264_configureAMediaFormat(keyFrames, format);
+    }
+    // Only once a NALU did not fit, a 720p stream keeps the input buffers the codec chose
+    if (maxInputSize > 0)
+    {
+        AMediaFormat_setInt32(format, AMEDIAFORMAT_KEY_MAX_INPUT_SIZE, (int32_t) maxInputSize);
+    }
+
+    MLOGD << "Configuring decoder:" << AMediaFormat_toString(format);
+
+    auto status = AMediaCodec_configure(mCodec, format, mWindow, nullptr, 0);
+    AMediaFormat_delete(format);
+
+    switch (status)
+    {
+        case AMEDIA_OK:
+        {
+            MLOGD << "AMediaCodec_configure: OK";
+            break;
+        }
+        case AMEDIA_ERROR_UNKNOWN:
+        {
+            MLOGD << "AMediaCodec_configure: AMEDIA_ERROR_UNKNOWN";
+            break;
+        }
+        case AMEDIA_ERROR_MALFORMED:
+        {
+            MLOGD << "AMediaCodec_configure: AMEDIA_ERROR_MALFORMED";
+            break;
+        }
+        case AMEDIA_ERROR_UNSUPPORTED:
+        {
+            MLOGD << "AMediaCodec_configure: AMEDIA_ERROR_UNSUPPORTED";
+            break;
+        }
+        case AMEDIA_ERROR_INVALID_OBJECT:
+        {
+            MLOGD << "AMediaCodec_configure: AMEDIA_ERROR_INVALID_OBJECT";
+            break;
+        }
+        case AMEDIA_ERROR_INVALID_PARAMETER:
+        {
+            MLOGD << "AMediaCodec_configure: AMEDIA_ERROR_INVALID_PARAMETER";
+            break;
+        }
+        default:
+        {
+            break;
+        }
+    }
+    AMediaCodec_start(mCodec);
+    return true;
+}
+
+void MediaCodecDecoderBackend::stop()
+{
+    AMediaCodec_stop(mCodec);
+}
+
+ssize_t MediaCodecDecoderBackend::dequeueOutputBuffer(DecoderOutputInfo& info, int64_t timeoutUs)
+{
+    AMediaCodecBufferInfo codecInfo;
+    const ssize_t         index = AMediaCodec_dequeueOutputBuffer(mCodec, &codecInfo, timeoutUs);
+    if (index >= 0)
+    {
+        info.presentationTimeUs = codecInfo.presentationTimeUs;
+        info.flags              = codecInfo.flags;
+    }
+    return index;
+}
+
+DecoderBackend::OutputFormat MediaCodecDecoderBackend::outputFormat()
+{
+    OutputFormat  result;
+    AMediaFormat* format = AMediaCodec_getOutputFormat(mCodec);
+    AMediaFormat_getInt32(format, AMEDIAFORMAT_KEY_WIDTH, &result.size.width);
+    AMediaFormat_getInt32(format, AMEDIAFORMAT_KEY_HEIGHT, &result.size.height);
+    result.description = AMediaFormat_toString(format);
+    AMediaFormat_delete(format);
+    return result;
+}
@@ -0,0 +1,51 @@
+//
+// MediaCodecDecoderBackend.h
+// DecoderBackend on Android: a hardware (or platform software) AMediaCodec rendering to a surface.
+//
+
+#pragma once
+
+#include <android/native_window.h>
+#include <media/NdkMediaCodec.h>
+#include "DecoderBackend.h"
+
+class MediaCodecDecoderBackend : public DecoderBackend
+{
+  public:
+    // @param window is borrowed, it must outlive the backend
+    explicit MediaCodecDecoderBackend(ANativeWindow* window) : mWindow(window) {}
+
+    ~MediaCodecDecoderBackend() override;
+
+    bool start(const KeyFrameFinder& keyFrames, bool isH265, size_t maxInputSize) override;
+
+    void stop() override;
+
+    ssize_t dequeueInputBuffer(int64_t timeoutUs) override
+    {
+        return AMediaCodec_dequeueInputBuffer(mCodec, timeoutUs);
+    }
+
+    uint8_t* getInputBuffer(size_t index, size_t* capacity) override
+    {
+        return AMediaCodec_getInputBuffer(mCodec, index, capacity);
+    }
+
+    void queueInputBuffer(size_t index, size_t size, uint64_t presentationTimeUs, uint32_t flags) override
+    {
+        AMediaCodec_queueInputBuffer(mCodec, index, 0, size, presentationTimeUs, flags);
+    }
+
+    ssize_t dequeueOutputBuffer(DecoderOutputInfo& info, int64_t timeoutUs) override;
+
+    void releaseOutputBuffer(size_t index, bool render) override
+    {
+        AMediaCodec_releaseOutputBuffer(mCodec, index, render);
+    }
+
+    OutputFormat outputFormat() override;
+
+  private:
+    ANativeWindow* mWindow = nullptr;
+    AMediaCodec*   mCodec  = nullptr;
+};
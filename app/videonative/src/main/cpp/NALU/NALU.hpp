@@ -12,6 +12,7 @@
 #include <chrono>
 #include <cstdint>  // for uint8_t
 #include <cstring>
+#include <functional>
 #include <iomanip>
 #include <iostream>
 #include <memory>
@@ -39,12 +40,27 @@
 class NALU
 {
   public:
+    // Classification of an access unit, collected by the parser from every NALU appended to it. Its first NALU is
+    // often an AUD or SEI, so the header of the first one doesn't tell.
+    struct AccessUnitInfo
+    {
+        bool keyframe   = false;
+        bool disposable = true;
+    };
+
     NALU(
         const uint8_t*                              data1,
         size_t                                      data_len1,
         const bool                                  IS_H265_PACKET1 = false,
-        const std::chrono::steady_clock::time_point creationTime    = std::chrono::steady_clock::now())
-        : m_data(data1), m_data_len(data_len1), IS_H265_PACKET(IS_H265_PACKET1), creationTime{creationTime}
+        const std::chrono::steady_clock::time_point creationTime    = std::chrono::steady_clock::now(),
+        const bool                                  isAccessUnit    = false,
+        const AccessUnitInfo                        accessUnitInfo  = {false, true})
+        : m_data(data1),
+          m_data_len(data_len1),
+          IS_H265_PACKET(IS_H265_PACKET1),
+          creationTime{creationTime},
+          IS_ACCESS_UNIT(isAccessUnit),
+          ACCESS_UNIT_INFO(accessUnitInfo)
     {
         assert(hasValidPrefix());
         assert(getSize() >= getMinimumNaluSize(IS_H265_PACKET1));
@@ -53,12 +69,6 @@ class NALU
 
     ~NALU() = default;
 
-    // test video white iceland: Max 1024*117. Video might not be decodable if its NALU buffers size exceed the limit
-    // But a buffer size of 1MB accounts for 60fps video of up to 60MB/s or 480 Mbit/s. That should be plenty !
-    static constexpr const auto NALU_MAXLEN = 1024 * 1024;
-    // Application should re-use NALU_BUFFER to avoid memory allocations
-    using NALU_BUFFER = std::array<uint8_t, NALU_MAXLEN>;
-
   private:
     const uint8_t* m_data;
     const size_t   m_data_len;
@@ -68,6 +78,10 @@ class NALU
     const bool IS_H265_PACKET;
     // creation time is used to measure latency
     const std::chrono::steady_clock::time_point creationTime;
+    // All NALUs of one frame back to back, each with its start code. The type getters refer to the first one,
+    // is_keyframe() and is_disposable() to ACCESS_UNIT_INFO.
+    const bool           IS_ACCESS_UNIT;
+    const AccessUnitInfo ACCESS_UNIT_INFO;
 
   public:
     // returns true if starts with 0001, false otherwise
@@ -177,21 +191,22 @@ class NALU
         return (get_nal_unit_type() == NALUnitType::H264::NAL_UNIT_TYPE_DPS);
     }
 
-    bool is_config() { return isSPS() || isPPS() || (IS_H265_PACKET && isVPS()); }
+    bool is_config() const { return isSPS() || isPPS() || (IS_H265_PACKET && isVPS()); }
 
-    // keyframe / IDR frame
+    // keyframe / IDR frame. An access unit is one if any of its slices is an IDR slice.
     bool is_keyframe() const
     {
-        const auto nut = get_nal_unit_type();
-        if (IS_H265_PACKET)
-        {
-            return false;
-        }
-        if (nut == NALUnitType::H264::NAL_UNIT_TYPE_CODED_SLICE_IDR)
-        {
-            return true;
-        }
-        return false;
+        if (IS_ACCESS_UNIT) return ACCESS_UNIT_INFO.keyframe;
+        return is_keyframe_header(getDataWithoutPrefix()[0]);
+    }
+
+    // Nothing else needs it: a slice no other frame references (H264 nal_ref_idc 0, H265 sub-layer non-reference),
+    // SEI or AUD. Dropping it costs that frame at most. An access unit only if that holds for all of its NALUs, it
+    // usually starts with an AUD or SEI.
+    bool is_disposable() const
+    {
+        if (IS_ACCESS_UNIT) return ACCESS_UNIT_INFO.disposable;
+        return is_disposable_header(getDataWithoutPrefix()[0]);
     }
 
     bool is_frame_but_not_keyframe() const
@@ -303,6 +318,37 @@ class NALU
     }
     //
     // XXX -----------
+
+  private:
+    int nal_unit_type_of(uint8_t header) const { return IS_H265_PACKET ? (header & 0x7E) >> 1 : header & 0x1f; }
+
+    bool is_keyframe_header(uint8_t header) const
+    {
+        const int nut = nal_unit_type_of(header);
+        if (IS_H265_PACKET)
+        {
+            return nut == NALUnitType::H265::NAL_UNIT_CODED_SLICE_IDR_W_RADL ||
+                   nut == NALUnitType::H265::NAL_UNIT_CODED_SLICE_IDR_N_LP;
+        }
+        return nut == NALUnitType::H264::NAL_UNIT_TYPE_CODED_SLICE_IDR;
+    }
+
+    bool is_disposable_header(uint8_t header) const
+    {
+        const int nut = nal_unit_type_of(header);
+        if (IS_H265_PACKET)
+        {
+            if (nut < 32) return nut <= 14 && nut % 2 == 0;
+            return nut == NALUnitType::H265::NAL_UNIT_ACCESS_UNIT_DELIMITER ||
+                   nut == NALUnitType::H265::NAL_UNIT_PREFIX_SEI || nut == NALUnitType::H265::NAL_UNIT_SUFFIX_SEI;
+        }
+        if (nut >= NALUnitType::H264::NAL_UNIT_TYPE_CODED_SLICE_NON_IDR &&
+            nut <= NALUnitType::H264::NAL_UNIT_TYPE_CODED_SLICE_IDR)
+        {
+            return (header & 0x60) == 0;
+        }
+        return nut == NALUnitType::H264::NAL_UNIT_TYPE_SEI || nut == NALUnitType::H264::NAL_UNIT_TYPE_AUD;
+    }
 };
 
 typedef std::function<void(const NALU& nalu)> NALU_DATA_CALLBACK;
@@ -320,7 +366,13 @@ class NALUBuffer
     NALUBuffer(const NALU& nalu)
     {
         m_data = std::make_shared<std::vector<uint8_t>>(nalu.getData(), nalu.getData() + nalu.getSize());
-        m_nalu = std::make_unique<NALU>(m_data->data(), m_data->size(), nalu.IS_H265_PACKET, nalu.creationTime);
+        m_nalu = std::make_unique<NALU>(
+            m_data->data(),
+            m_data->size(),
+            nalu.IS_H265_PACKET,
+            nalu.creationTime,
+            nalu.IS_ACCESS_UNIT,
+            nalu.ACCESS_UNIT_INFO);
     }
 
     NALUBuffer(const NALUBuffer&) = delete;
@@ -0,0 +1,209 @@
+//
+// NaluBufferPool.h
+// Refcounted copies of NALUs, shared by the decoder feeders and the dvr and recycled once the last one is done.
+//
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <vector>
+#include "NALU/NALU.hpp"
+
+class PooledNalu;
+
+/**
+ * @brief Recycles the buffers NALUs are copied into when they have to outlive the parser callback.
+ *
+ * Every buffer keeps its storage and grows it to the largest NALU it carried, so once the stream runs a copy costs
+ * the memcpy and no allocation. Up to maxFreeBuffers idle buffers are kept, more are freed as they come back.
+ * Buffers are handed out on the parsing thread and come back on any thread, the last PooledNalu referring to one
+ * returns it. Handles may outlive the pool, their buffers are then freed instead.
+ */
+class NaluBufferPool
+{
+  public:
+    struct Stats
+    {
+        // Allocated and not freed, in use or idle
+        size_t nBuffers = 0;
+        size_t nInUse   = 0;
+        // Storage of all buffers, and the part of it taken by the NALUs in use
+        size_t bytesAllocated = 0;
+        size_t bytesInUse     = 0;
+        // Buffers created or grown, stays flat once the stream runs
+        uint64_t nAllocations = 0;
+    };
+
+    static constexpr size_t DEFAULT_MAX_FREE_BUFFERS = 64;
+
+    explicit NaluBufferPool(size_t maxFreeBuffers = DEFAULT_MAX_FREE_BUFFERS) : mShared(std::make_shared<Shared>())
+    {
+        mShared->maxFreeBuffers = maxFreeBuffers;
+    }
+
+    ~NaluBufferPool()
+    {
+        std::vector<Buffer*> idle;
+        {
+            std::lock_guard<std::mutex> lock(mShared->mutex);
+            mShared->closed = true;
+            idle.swap(mShared->free);
+        }
+        for (Buffer* buffer : idle)
+        {
+            delete buffer;
+        }
+    }
+
+    NaluBufferPool(const NaluBufferPool&)            = delete;
+    NaluBufferPool& operator=(const NaluBufferPool&) = delete;
+
+    // Copies @param nalu into a buffer of the pool
+    PooledNalu copy(const NALU& nalu);
+
+    Stats stats() const
+    {
+        std::lock_guard<std::mutex> lock(mShared->mutex);
+        return mShared->stats;
+    }
+
+  private:
+    friend class PooledNalu;
+
+    struct Shared;
+
+    struct Buffer
+    {
+        std::vector<uint8_t>    data;
+        std::optional<NALU>     nalu;
+        std::atomic<uint32_t>   refs{0};
+        std::shared_ptr<Shared> pool;
+    };
+
+    struct Shared
+    {
+        std::mutex           mutex;
+        std::vector<Buffer*> free;
+        size_t               maxFreeBuffers = DEFAULT_MAX_FREE_BUFFERS;
+        bool                 closed         = false;
+        Stats                stats;
+    };
+
+    // The last reference to @param buffer went away
+    static void recycle(Buffer* buffer)
+    {
+        Shared& shared = *buffer->pool;
+        {
+            std::lock_guard<std::mutex> lock(shared.mutex);
+            shared.stats.nInUse--;
+            shared.stats.bytesInUse -= buffer->nalu->getSize();
+            buffer->nalu.reset();
+            if (!shared.closed && shared.free.size() < shared.maxFreeBuffers)
+            {
+                shared.free.push_back(buffer);
+                return;
+            }
+            shared.stats.nBuffers--;
+            shared.stats.bytesAllocated -= buffer->data.size();
+        }
+        // Outside the lock, this may release the last reference to the shared state
+        delete buffer;
+    }
+
+    std::shared_ptr<Shared> mShared;
+};
+
+/**
+ * @brief A NALU in a buffer of a NaluBufferPool.
+ *
+ * Copying the handle only counts a reference, the bytes are shared. A default constructed handle holds nothing.
+ */
+class PooledNalu
+{
+  public:
+    PooledNalu() = default;
+
+    PooledNalu(const PooledNalu& other) : mBuffer(other.mBuffer)
+    {
+        if (mBuffer != nullptr)
+        {
+            mBuffer->refs.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    PooledNalu(PooledNalu&& other) noexcept : mBuffer(std::exchange(other.mBuffer, nullptr)) {}
+
+    PooledNalu& operator=(PooledNalu other) noexcept
+    {
+        std::swap(mBuffer, other.mBuffer);
+        return *this;
+    }
+
+    ~PooledNalu()
+    {
+        if (mBuffer != nullptr && mBuffer->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            NaluBufferPool::recycle(mBuffer);
+        }
+    }
+
+    explicit operator bool() const { return mBuffer != nullptr; }
+
+    const NALU& operator*() const { return *mBuffer->nalu; }
+
+    const NALU* operator->() const { return &*mBuffer->nalu; }
+
+  private:
+    friend class NaluBufferPool;
+
+    explicit PooledNalu(NaluBufferPool::Buffer* buffer) : mBuffer(buffer) { mBuffer->refs = 1; }
+
+    NaluBufferPool::Buffer* mBuffer = nullptr;
+};
+
+inline PooledNalu NaluBufferPool::copy(const NALU& nalu)
+{
+    const size_t size   = nalu.getSize();
+    Buffer*      buffer = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mShared->mutex);
+        Stats& stats = mShared->stats;
+        if (!mShared->free.empty())
+        {
+            buffer = mShared->free.back();
+            mShared->free.pop_back();
+        }
+        else
+        {
+            buffer       = new Buffer();
+            buffer->pool = mShared;
+            stats.nBuffers++;
+        }
+        if (buffer->data.size() < size)
+        {
+            stats.bytesAllocated += size - buffer->data.size();
+            stats.nAllocations++;
+        }
+        stats.nInUse++;
+        stats.bytesInUse += size;
+    }
+    if (buffer->data.size() < size)
+    {
+        buffer->data.resize(size);
+    }
+    std::memcpy(buffer->data.data(), nalu.getData(), size);
+    buffer->nalu.emplace(buffer->data.data(),
+                         size,
+                         nalu.IS_H265_PACKET,
+                         nalu.creationTime,
+                         nalu.IS_ACCESS_UNIT,
+                         nalu.ACCESS_UNIT_INFO);
+    return PooledNalu(buffer);
+}
@@ -0,0 +1,169 @@
+//
+// NaluFeedQueue.h
+// Hands NALUs from the parsing thread to the feeder thread of one decoder.
+//
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <sys/types.h>
+#include <vector>
+#include "NaluBufferPool.h"
+
+/**
+ * @brief Bounded single-producer / single-consumer queue of NALUs.
+ *
+ * Built like SpscPacketRing, but for payloads from a few bytes to a whole key frame: an entry holds a pooled copy of
+ * the NALU, which the other decoder and the dvr share. A NALU that already sits in an input buffer of the decoder is
+ * not copied at all, its entry only names the buffer.
+ * Both sides can block: the consumer until there is data, the producer until there is room. Each side only touches
+ * the mutex when the other one is actually sleeping.
+ */
+class NaluFeedQueue
+{
+  public:
+    struct Entry
+    {
+        // The copied NALU, empty if inputIndex names a decoder input buffer. The consumer lets go of it before pop()
+        PooledNalu nalu;
+        size_t     size       = 0;
+        ssize_t    inputIndex = -1;
+        // DecoderBackend flags to queue the NALU with
+        uint32_t                              flags    = 0;
+        // Parameter set or IDR slice, decoding can start over from here
+        bool                                  keyFrame = false;
+        int64_t                               originNs = 0;
+        std::chrono::steady_clock::time_point creationTime;
+        std::chrono::steady_clock::time_point queuedTime;
+    };
+
+    explicit NaluFeedQueue(size_t capacity) : mEntries(capacity) {}
+
+    NaluFeedQueue(const NaluFeedQueue&)            = delete;
+    NaluFeedQueue& operator=(const NaluFeedQueue&) = delete;
+
+    /**
+     * @brief The entry to fill next, or nullptr if the queue is full. Producer thread only.
+     * Nothing is visible to the consumer until push().
+     */
+    Entry* back()
+    {
+        const size_t head = mHead.load(std::memory_order_relaxed);
+        if (head - mCachedTail == mEntries.size())
+        {
+            mCachedTail = mTail.load(std::memory_order_acquire);
+            if (head - mCachedTail == mEntries.size())
+            {
+                return nullptr;
+            }
+        }
+        return &mEntries[head % mEntries.size()];
+    }
+
+    // Publishes the entry returned by back(). Producer thread only.
+    void push()
+    {
+        mHead.store(mHead.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        // Pairs with the fence in waitFor(): either the consumer sees the new head, or we see it waiting
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (mConsumerWaiting.load(std::memory_order_relaxed))
+        {
+            std::lock_guard<std::mutex> lock(mWaitMutex);
+            mConsumerCv.notify_one();
+        }
+    }
+
+    // Oldest published entry, or nullptr if the queue is empty. Consumer thread only.
+    Entry* front()
+    {
+        const size_t tail = mTail.load(std::memory_order_relaxed);
+        if (tail == mCachedHead)
+        {
+            mCachedHead = mHead.load(std::memory_order_acquire);
+            if (tail == mCachedHead)
+            {
+                return nullptr;
+            }
+        }
+        return &mEntries[tail % mEntries.size()];
+    }
+
+    // Hands the entry returned by front() back to the producer. Consumer thread only.
+    void pop()
+    {
+        mTail.store(mTail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (mProducerWaiting.load(std::memory_order_relaxed))
+        {
+            std::lock_guard<std::mutex> lock(mWaitMutex);
+            mProducerCv.notify_one();
+        }
+    }
+
+    /**
+     * @brief Blocks until there is an entry to read, wakeUp() was called or the timeout expired. Consumer only.
+     * @return True if there is data to read.
+     */
+    bool waitForData(std::chrono::milliseconds timeout)
+    {
+        return waitFor(mConsumerWaiting, mConsumerCv, timeout, [this] { return front() != nullptr; });
+    }
+
+    /**
+     * @brief Blocks until there is room for an entry, wakeUp() was called or the timeout expired. Producer only.
+     * @return True if back() has an entry to fill.
+     */
+    bool waitForSpace(std::chrono::milliseconds timeout)
+    {
+        return waitFor(mProducerWaiting, mProducerCv, timeout, [this] { return back() != nullptr; });
+    }
+
+    // Releases both sides from waiting, e.g. to let them observe a stop request
+    void wakeUp()
+    {
+        std::lock_guard<std::mutex> lock(mWaitMutex);
+        mWakeUp = true;
+        mConsumerCv.notify_all();
+        mProducerCv.notify_all();
+    }
+
+    size_t size() const { return mHead.load(std::memory_order_acquire) - mTail.load(std::memory_order_acquire); }
+
+    size_t capacity() const { return mEntries.size(); }
+
+  private:
+    template <typename Ready>
+    bool waitFor(
+        std::atomic<bool>& waiting, std::condition_variable& cv, std::chrono::milliseconds timeout, Ready ready)
+    {
+        if (ready()) return true;
+        std::unique_lock<std::mutex> lock(mWaitMutex);
+        waiting.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!ready() && !mWakeUp)
+        {
+            cv.wait_for(lock, timeout);
+        }
+        mWakeUp = false;
+        waiting.store(false, std::memory_order_relaxed);
+        return ready();
+    }
+
+    // Same layout as SpscPacketRing: each side keeps a private copy of the other's index
+    alignas(64) std::atomic<size_t> mHead{0};
+    size_t mCachedTail = 0;
+    alignas(64) std::atomic<size_t> mTail{0};
+    size_t                  mCachedHead = 0;
+    std::atomic<bool>       mConsumerWaiting{false};
+    std::atomic<bool>       mProducerWaiting{false};
+    std::mutex              mWaitMutex;
+    std::condition_variable mConsumerCv;
+    std::condition_variable mProducerCv;
+    bool                    mWakeUp = false;
+    std::vector<Entry>      mEntries;
+};
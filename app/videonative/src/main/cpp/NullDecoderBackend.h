@@ -0,0 +1,144 @@
+//
+// NullDecoderBackend.h
+// DecoderBackend that decodes nothing: every queued NALU comes out as a frame right away. Measures everything around
+// the decoder on desktop Linux, and stands in for MediaCodec in the unit tests.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <vector>
+#include "DecoderBackend.h"
+
+class NullDecoderBackend : public DecoderBackend
+{
+  public:
+    static constexpr size_t DEFAULT_INPUT_BUFFERS = 8;
+    static constexpr size_t DEFAULT_INPUT_SIZE    = 1024 * 1024;
+
+    explicit NullDecoderBackend(size_t nInputBuffers = DEFAULT_INPUT_BUFFERS, size_t inputSize = DEFAULT_INPUT_SIZE)
+        : mInputs(nInputBuffers), mInputSize(inputSize)
+    {
+    }
+
+    bool start(const KeyFrameFinder& keyFrames, bool isH265, size_t maxInputSize) override
+    {
+        const auto wh = keyFrames.getCSD0().getVideoWidthHeightSPS();
+        mFormat       = {{wh[0], wh[1]}, isH265 ? "null video/hevc" : "null video/avc"};
+        for (auto& input : mInputs)
+        {
+            input.data.resize(std::max(mInputSize, maxInputSize));
+            input.free = true;
+        }
+        nInputSize = mInputs.empty() ? 0 : mInputs[0].data.size();
+        return true;
+    }
+
+    void stop() override
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mStopped = true;
+        }
+        mInputFreed.notify_all();
+        mOutputQueued.notify_all();
+    }
+
+    ssize_t dequeueInputBuffer(int64_t timeoutUs) override
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        ssize_t                      index = TRY_AGAIN_LATER;
+        mInputFreed.wait_for(lock,
+                             std::chrono::microseconds(timeoutUs),
+                             [&]
+                             {
+                                 index = freeInput();
+                                 return mStopped || index >= 0;
+                             });
+        if (mStopped) return ERROR;
+        if (index >= 0) mInputs[index].free = false;
+        return index;
+    }
+
+    uint8_t* getInputBuffer(size_t index, size_t* capacity) override
+    {
+        *capacity = mInputs[index].data.size();
+        return mInputs[index].data.data();
+    }
+
+    void queueInputBuffer(size_t index, size_t size, uint64_t presentationTimeUs, uint32_t flags) override
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mInputs[index].free = true;
+            nQueuedInputs++;
+            if (size > 0 && (flags & FLAG_CODEC_CONFIG) == 0)
+            {
+                mOutputs.push_back({(int64_t) presentationTimeUs, flags});
+            }
+        }
+        mInputFreed.notify_one();
+        mOutputQueued.notify_one();
+    }
+
+    ssize_t dequeueOutputBuffer(DecoderOutputInfo& info, int64_t timeoutUs) override
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mOutputQueued.wait_for(
+            lock, std::chrono::microseconds(timeoutUs), [&] { return mStopped || !mOutputs.empty(); });
+        if (mStopped) return ERROR;
+        if (mOutputs.empty()) return TRY_AGAIN_LATER;
+        // Like MediaCodec, the format is known with the first frame
+        if (!mFormatReported)
+        {
+            mFormatReported = true;
+            return OUTPUT_FORMAT_CHANGED;
+        }
+        info = mOutputs.front();
+        mOutputs.pop_front();
+        return 0;
+    }
+
+    void releaseOutputBuffer(size_t /*index*/, bool render) override
+    {
+        if (render) nRenderedFrames++;
+    }
+
+    OutputFormat outputFormat() override { return mFormat; }
+
+    // Size of the input buffers since start(), and the counters for tests and benchmarks
+    size_t            nInputSize = 0;
+    std::atomic<long> nQueuedInputs{0};
+    std::atomic<long> nRenderedFrames{0};
+
+  private:
+    struct Input
+    {
+        std::vector<uint8_t> data;
+        bool                 free = true;
+    };
+
+    ssize_t freeInput() const
+    {
+        for (size_t i = 0; i < mInputs.size(); ++i)
+        {
+            if (mInputs[i].free) return (ssize_t) i;
+        }
+        return -1;
+    }
+
+    std::mutex                    mMutex;
+    std::condition_variable       mInputFreed;
+    std::condition_variable       mOutputQueued;
+    std::vector<Input>            mInputs;
+    const size_t                  mInputSize;
+    std::deque<DecoderOutputInfo> mOutputs;
+    OutputFormat                  mFormat;
+    bool                          mFormatReported = false;
+    bool                          mStopped        = false;
+};
@@ -0,0 +1,224 @@
+//
+// SoftwareDecoderBackend.cpp
+//
+
+#include "SoftwareDecoderBackend.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include "helper/AndroidLogger.hpp"
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+}
+
+SoftwareDecoderBackend::SoftwareDecoderBackend(int nThreads) : mThreads(nThreads), mInputs(DEFAULT_INPUT_BUFFERS) {}
+
+SoftwareDecoderBackend::~SoftwareDecoderBackend()
+{
+    for (AVFrame* frame : mFrames)
+    {
+        av_frame_free(&frame);
+    }
+    av_packet_free(&mPacket);
+    av_parser_close(mParser);
+    avcodec_free_context(&mContext);
+}
+
+bool SoftwareDecoderBackend::start(const KeyFrameFinder& keyFrames, bool isH265, size_t maxInputSize)
+{
+    const AVCodecID id    = isH265 ? AV_CODEC_ID_HEVC : AV_CODEC_ID_H264;
+    const AVCodec*  codec = avcodec_find_decoder(id);
+    if (codec == nullptr)
+    {
+        MLOGE << "No software decoder for " << (isH265 ? "H265" : "H264");
+        return false;
+    }
+    mContext = avcodec_alloc_context3(codec);
+    mParser  = av_parser_init(id);
+    mPacket  = av_packet_alloc();
+    if (mContext == nullptr || mParser == nullptr || mPacket == nullptr)
+    {
+        return false;
+    }
+    mContext->flags |= AV_CODEC_FLAG_LOW_DELAY;
+    mContext->thread_count = mThreads;
+    mContext->thread_type  = FF_THREAD_SLICE;
+
+    // The parameter sets as Annex B extradata, like csd-0 / csd-1 of MediaCodec
+    std::vector<uint8_t> csd;
+    const auto           append = [&](const NALU& nalu)
+    { csd.insert(csd.end(), nalu.getData(), nalu.getData() + nalu.getSize()); };
+    if (isH265)
+    {
+        append(keyFrames.getVPS());
+    }
+    append(keyFrames.getCSD0());
+    append(keyFrames.getCSD1());
+    mContext->extradata = (uint8_t*) av_mallocz(csd.size() + AV_INPUT_BUFFER_PADDING_SIZE);
+    if (mContext->extradata == nullptr)
+    {
+        return false;
+    }
+    std::memcpy(mContext->extradata, csd.data(), csd.size());
+    mContext->extradata_size = (int) csd.size();
+
+    if (avcodec_open2(mContext, codec, nullptr) < 0)
+    {
+        MLOGE << "Cannot open software decoder " << codec->name;
+        return false;
+    }
+    // The parser reads a little beyond the data
+    const size_t inputSize = std::max(DEFAULT_INPUT_SIZE, maxInputSize);
+    for (auto& input : mInputs)
+    {
+        input.data.assign(inputSize + AV_INPUT_BUFFER_PADDING_SIZE, 0);
+        input.free = true;
+    }
+    MLOGD << "Software decoder " << codec->name << " with " << mThreads << " threads";
+    return true;
+}
+
+void SoftwareDecoderBackend::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStopped = true;
+    }
+    mInputQueued.notify_all();
+    mInputFreed.notify_all();
+}
+
+ssize_t SoftwareDecoderBackend::dequeueInputBuffer(int64_t timeoutUs)
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    const auto                   isFree = [](const Input& input) { return input.free; };
+    mInputFreed.wait_for(lock,
+                         std::chrono::microseconds(timeoutUs),
+                         [&] { return mStopped || std::any_of(mInputs.begin(), mInputs.end(), isFree); });
+    if (mStopped) return ERROR;
+    const auto input = std::find_if(mInputs.begin(), mInputs.end(), isFree);
+    if (input == mInputs.end()) return TRY_AGAIN_LATER;
+    input->free = false;
+    return input - mInputs.begin();
+}
+
+uint8_t* SoftwareDecoderBackend::getInputBuffer(size_t index, size_t* capacity)
+{
+    *capacity = mInputs[index].data.size() - AV_INPUT_BUFFER_PADDING_SIZE;
+    return mInputs[index].data.data();
+}
+
+void SoftwareDecoderBackend::queueInputBuffer(size_t index, size_t size, uint64_t presentationTimeUs, uint32_t flags)
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        Input&                      input = mInputs[index];
+        if (size == 0)
+        {
+            input.free = true;
+        }
+        else
+        {
+            input.size               = size;
+            input.presentationTimeUs = presentationTimeUs;
+            mQueued.push_back(index);
+        }
+    }
+    mInputFreed.notify_one();
+    mInputQueued.notify_one();
+}
+
+ssize_t SoftwareDecoderBackend::dequeueOutputBuffer(DecoderOutputInfo& info, int64_t timeoutUs)
+{
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(timeoutUs);
+    while (mFrames.empty())
+    {
+        size_t index;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mInputQueued.wait_until(lock, deadline, [&] { return mStopped || !mQueued.empty(); });
+            if (mStopped) return ERROR;
+            if (mQueued.empty()) return TRY_AGAIN_LATER;
+            index = mQueued.front();
+            mQueued.pop_front();
+        }
+        // Nobody else touches a queued input buffer
+        decode(mInputs[index]);
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mInputs[index].free = true;
+        }
+        mInputFreed.notify_one();
+    }
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mStopped) return ERROR;
+    }
+    const AVFrame*   frame = mFrames.front();
+    const VideoRatio size{frame->width, frame->height};
+    if (!mSizeReported || size != mSize)
+    {
+        mSize         = size;
+        mSizeReported = true;
+        return OUTPUT_FORMAT_CHANGED;
+    }
+    info.presentationTimeUs = frame->pts;
+    info.flags              = 0;
+    return 0;
+}
+
+void SoftwareDecoderBackend::releaseOutputBuffer(size_t index, bool render)
+{
+    if (mFrames.empty()) return;
+    av_frame_free(&mFrames.front());
+    mFrames.pop_front();
+}
+
+DecoderBackend::OutputFormat SoftwareDecoderBackend::outputFormat()
+{
+    const char* name = mContext != nullptr && mContext->codec != nullptr ? mContext->codec->name : "";
+    return {mSize, std::string("software ") + name};
+}
+
+void SoftwareDecoderBackend::decode(const Input& input)
+{
+    const uint8_t* data = input.data.data();
+    int            size = (int) input.size;
+    const auto     pts  = (int64_t) input.presentationTimeUs;
+    while (size > 0)
+    {
+        uint8_t*  frameData = nullptr;
+        int       frameSize = 0;
+        const int used = av_parser_parse2(mParser, mContext, &frameData, &frameSize, data, size, pts, pts, 0);
+        if (used < 0)
+        {
+            return;
+        }
+        data += used;
+        size -= used;
+        if (frameSize == 0)
+        {
+            continue;
+        }
+        mPacket->data = frameData;
+        mPacket->size = frameSize;
+        mPacket->pts  = mParser->pts;
+        if (avcodec_send_packet(mContext, mPacket) < 0)
+        {
+            // Broken by a loss, the next key frame repairs it like on MediaCodec
+            continue;
+        }
+        while (true)
+        {
+            AVFrame* frame = av_frame_alloc();
+            if (frame == nullptr || avcodec_receive_frame(mContext, frame) < 0)
+            {
+                av_frame_free(&frame);
+                break;
+            }
+            mFrames.push_back(frame);
+        }
+    }
+}
@@ -0,0 +1,80 @@
+//
+// SoftwareDecoderBackend.h
+// DecoderBackend on desktop Linux: H.264 / H.265 decoded by FFmpeg's libavcodec, the frames are dropped instead of
+// rendered. Gives the replay tool a decoder with real decoding time and frame reordering behaviour.
+//
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <vector>
+#include "DecoderBackend.h"
+
+struct AVCodecContext;
+struct AVCodecParserContext;
+struct AVFrame;
+struct AVPacket;
+
+/**
+ * The input buffers are plain memory, queueInputBuffer only queues them. The decoding happens in
+ * dequeueOutputBuffer, on VideoDecoder's output thread like MediaCodec's own decoding thread. FFmpeg's parser joins
+ * the NALUs into frames, it holds a frame until the next one starts.
+ */
+class SoftwareDecoderBackend : public DecoderBackend
+{
+  public:
+    static constexpr size_t DEFAULT_INPUT_BUFFERS = 8;
+    static constexpr size_t DEFAULT_INPUT_SIZE    = 1024 * 1024;
+
+    // @param nThreads slice threads, 0 for as many as there are cores. Frame threading would add a frame of latency.
+    explicit SoftwareDecoderBackend(int nThreads = 1);
+
+    ~SoftwareDecoderBackend() override;
+
+    bool start(const KeyFrameFinder& keyFrames, bool isH265, size_t maxInputSize) override;
+
+    void stop() override;
+
+    ssize_t dequeueInputBuffer(int64_t timeoutUs) override;
+
+    uint8_t* getInputBuffer(size_t index, size_t* capacity) override;
+
+    void queueInputBuffer(size_t index, size_t size, uint64_t presentationTimeUs, uint32_t flags) override;
+
+    ssize_t dequeueOutputBuffer(DecoderOutputInfo& info, int64_t timeoutUs) override;
+
+    void releaseOutputBuffer(size_t index, bool render) override;
+
+    OutputFormat outputFormat() override;
+
+  private:
+    struct Input
+    {
+        std::vector<uint8_t> data;
+        size_t               size               = 0;
+        uint64_t             presentationTimeUs = 0;
+        bool                 free               = true;
+    };
+
+    // Parses and decodes @param input, the frames wait in mFrames. Called unlocked.
+    void decode(const Input& input);
+
+    const int             mThreads;
+    AVCodecContext*       mContext = nullptr;
+    AVCodecParserContext* mParser  = nullptr;
+    AVPacket*             mPacket  = nullptr;
+    // Decoded, the front one is the output buffer until released
+    std::deque<AVFrame*> mFrames;
+    VideoRatio           mSize;
+    bool                 mSizeReported = false;
+
+    std::mutex              mMutex;
+    std::condition_variable mInputQueued;
+    std::condition_variable mInputFreed;
+    std::vector<Input>      mInputs;
+    // Indices of the queued inputs, oldest first
+    std::deque<size_t> mQueued;
+    bool               mStopped = false;
+};
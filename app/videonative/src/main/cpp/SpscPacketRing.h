@@ -0,0 +1,176 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// Default for rings that carry nothing but the payload and the timestamp
+struct NoPacketMeta
+{
+};
+
+/**
+ * @brief Bounded single-producer / single-consumer ring of fixed-size packet slots.
+ *
+ * All slots are allocated once on construction, so neither side touches the heap while packets flow.
+ * The producer copies a packet into the next free slot and publishes it with a release store of the head index,
+ * the consumer reads the slot in place and returns it by advancing the tail index.
+ * A consumer that ran dry can block in waitForData(), the producer only touches the mutex when a consumer is
+ * actually sleeping.
+ *
+ * @tparam SLOT_SIZE Maximum payload size of a single packet in bytes.
+ * @tparam CAPACITY Number of slots, must be a power of two.
+ * @tparam Meta Trivially copyable per-packet data the producer passes along with the payload.
+ */
+template <std::size_t SLOT_SIZE, std::size_t CAPACITY, typename Meta = NoPacketMeta>
+class SpscPacketRing
+{
+    static_assert(CAPACITY > 0 && (CAPACITY & (CAPACITY - 1)) == 0, "CAPACITY must be a power of two");
+
+  public:
+    struct Slot
+    {
+        // Producer-side timestamp in nanoseconds (steady clock), 0 if the producer did not provide one
+        uint64_t                       timestampNs;
+        uint32_t                       length;
+        Meta                           meta;
+        std::array<uint8_t, SLOT_SIZE> data;
+    };
+
+    SpscPacketRing() : mSlots(std::make_unique<Slot[]>(CAPACITY)) {}
+
+    SpscPacketRing(const SpscPacketRing&)            = delete;
+    SpscPacketRing& operator=(const SpscPacketRing&) = delete;
+
+    /**
+     * @brief Copies a packet into the ring. Producer thread only.
+     * @return False if the packet is larger than SLOT_SIZE or the ring is full, the packet is dropped in that case.
+     */
+    bool push(const uint8_t* data, std::size_t length, uint64_t timestampNs = 0, const Meta& meta = {})
+    {
+        const std::size_t head = mHead.load(std::memory_order_relaxed);
+        if (length > SLOT_SIZE)
+        {
+            mNDropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        if (head - mCachedTail == CAPACITY)
+        {
+            mCachedTail = mTail.load(std::memory_order_acquire);
+            if (head - mCachedTail == CAPACITY)
+            {
+                mNDropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+        }
+        Slot& slot       = mSlots[head & (CAPACITY - 1)];
+        slot.timestampNs = timestampNs;
+        slot.length      = static_cast<uint32_t>(length);
+        slot.meta        = meta;
+        std::memcpy(slot.data.data(), data, length);
+        mHead.store(head + 1, std::memory_order_release);
+        // Pairs with the fence in waitForData(): either the consumer sees the new head, or we see it waiting.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (mConsumerWaiting.load(std::memory_order_relaxed))
+        {
+            std::lock_guard<std::mutex> lock(mWaitMutex);
+            mWaitCv.notify_one();
+        }
+        return true;
+    }
+
+    /**
+     * @brief Oldest published slot, or nullptr if the ring is empty. Consumer thread only.
+     * The slot stays valid until pop() is called.
+     */
+    const Slot* front()
+    {
+        const std::size_t tail = mTail.load(std::memory_order_relaxed);
+        if (tail == mCachedHead)
+        {
+            mCachedHead = mHead.load(std::memory_order_acquire);
+            if (tail == mCachedHead)
+            {
+                return nullptr;
+            }
+        }
+        return &mSlots[tail & (CAPACITY - 1)];
+    }
+
+    /**
+     * @brief Hands the slot returned by front() back to the producer. Consumer thread only.
+     */
+    void pop() { mTail.store(mTail.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+    /**
+     * @brief Blocks until the ring holds a packet, wakeUp() was called or the timeout expired. Consumer thread only.
+     * Polls for @param spin first: packets of one video frame arrive in bursts, and catching the next one without
+     * a futex round trip on either side is what makes this cheaper than a socket. Spinning is skipped on single
+     * core machines where it would only steal time from the producer.
+     * @return True if there is data to read.
+     */
+    bool waitForData(std::chrono::milliseconds timeout, std::chrono::microseconds spin = std::chrono::microseconds(50))
+    {
+        static const bool multiCore = std::thread::hardware_concurrency() > 1;
+        if (!multiCore) spin = std::chrono::microseconds(0);
+        const auto spinUntil = std::chrono::steady_clock::now() + spin;
+        do
+        {
+            if (front() != nullptr) return true;
+        } while (std::chrono::steady_clock::now() < spinUntil);
+        std::unique_lock<std::mutex> lock(mWaitMutex);
+        mConsumerWaiting.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (empty() && !mWakeUp)
+        {
+            mWaitCv.wait_for(lock, timeout);
+        }
+        mWakeUp = false;
+        mConsumerWaiting.store(false, std::memory_order_relaxed);
+        return front() != nullptr;
+    }
+
+    /**
+     * @brief Releases a consumer blocked in waitForData(), e.g. to let it observe a stop request.
+     */
+    void wakeUp()
+    {
+        std::lock_guard<std::mutex> lock(mWaitMutex);
+        mWakeUp = true;
+        mWaitCv.notify_one();
+    }
+
+    bool empty() const { return mHead.load(std::memory_order_acquire) == mTail.load(std::memory_order_acquire); }
+
+    std::size_t size() const
+    {
+        return mHead.load(std::memory_order_acquire) - mTail.load(std::memory_order_acquire);
+    }
+
+    uint64_t getNDropped() const { return mNDropped.load(std::memory_order_relaxed); }
+
+    static constexpr std::size_t capacity() { return CAPACITY; }
+
+    static constexpr std::size_t slotSize() { return SLOT_SIZE; }
+
+  private:
+    // Head and tail live on separate cache lines, each side keeps a private copy of the other's index so it only
+    // touches the shared line when the cached value says the ring is full / empty.
+    alignas(64) std::atomic<std::size_t> mHead{0};
+    std::size_t mCachedTail = 0;
+    alignas(64) std::atomic<std::size_t> mTail{0};
+    std::size_t mCachedHead = 0;
+    alignas(64) std::atomic<uint64_t> mNDropped{0};
+    std::atomic<bool>       mConsumerWaiting{false};
+    std::mutex              mWaitMutex;
+    std::condition_variable mWaitCv;
+    bool                    mWakeUp = false;
+    std::unique_ptr<Slot[]> mSlots;
+};
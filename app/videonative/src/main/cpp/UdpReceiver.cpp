@@ -4,7 +4,10 @@
 
 #include "UdpReceiver.h"
 #include <arpa/inet.h>
+#include <algorithm>
 #include <array>
+#include <chrono>
+#include <ctime>
 #include <sstream>
 #include <utility>
 #include <vector>
@@ -35,11 +38,22 @@ void UDPReceiver::registerOnSourceIPFound(SOURCE_IP_CALLBACK onSourceIP1)
     this->onSourceIP = std::move(onSourceIP1);
 }
 
+void UDPReceiver::setBatchMode(BATCH_CALLBACK onBatch, size_t batchSize)
+{
+    onBatchReceivedCallback = std::move(onBatch);
+    mBatchSize              = std::max<size_t>(batchSize, 1);
+}
+
 long UDPReceiver::getNReceivedBytes() const
 {
     return nReceivedBytes;
 }
 
+long UDPReceiver::getNDroppedPackets() const
+{
+    return nDroppedPackets;
+}
+
 std::string UDPReceiver::getSourceIPAddress() const
 {
     return senderIP;
@@ -111,6 +125,12 @@ void UDPReceiver::receiveFromUDPLoop()
         MLOGE << "Error binding Port; " << mPort;
         return;
     }
+    if (onBatchReceivedCallback)
+    {
+        receiveBatchesLoop();
+        close(mSocket);
+        return;
+    }
     // wrap into unique pointer to avoid running out of stack
     const auto buff = std::make_unique<std::array<uint8_t, UDP_PACKET_MAX_SIZE>>();
 
@@ -144,18 +164,7 @@ void UDPReceiver::receiveFromUDPLoop()
             onDataReceivedCallback(buff->data(), (size_t) message_length);
 
             nReceivedBytes += message_length;
-            // The source ip stuff
-            const char* p  = inet_ntoa(source.sin_addr);
-            std::string s1 = std::string(p);
-            // MLOGE << "received " << message_length <<  " bytes from " << s1;
-            if (senderIP != s1)
-            {
-                senderIP = s1;
-            }
-            if (onSourceIP != nullptr)
-            {
-                onSourceIP(p);
-            }
+            updateSourceIP(source);
         }
         else
         {
@@ -168,6 +177,147 @@ void UDPReceiver::receiveFromUDPLoop()
     close(mSocket);
 }
 
+void UDPReceiver::receiveBatchesLoop()
+{
+    int enable = 1;
+    if (setsockopt(mSocket, SOL_SOCKET, SO_TIMESTAMPNS, &enable, sizeof(enable)) < 0)
+    {
+        MLOGD << "Cannot enable SO_TIMESTAMPNS";
+    }
+    if (setsockopt(mSocket, SOL_SOCKET, SO_RXQ_OVFL, &enable, sizeof(enable)) < 0)
+    {
+        MLOGD << "Cannot enable SO_RXQ_OVFL";
+    }
+
+    // Everything recvmmsg() needs is allocated once, one MTU sized slot per datagram of a batch
+    using Control = std::array<uint8_t, CMSG_SPACE(sizeof(timespec)) + CMSG_SPACE(sizeof(uint32_t))>;
+    const size_t                n = mBatchSize;
+    std::vector<uint8_t>        slab(n * BATCH_SLOT_SIZE);
+    std::vector<iovec>          iovecs(n);
+    std::vector<mmsghdr>        msgs(n);
+    std::vector<sockaddr_in>    sources(n);
+    std::vector<Control>        controls(n);
+    std::vector<ReceivedPacket> packets(n);
+    std::vector<iovec>          forwardIovecs(n);
+    std::vector<mmsghdr>        forwardMsgs(n);
+    uint32_t                    rxqOverflowCount = 0;
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        iovecs[i].iov_base = slab.data() + i * BATCH_SLOT_SIZE;
+        iovecs[i].iov_len  = BATCH_SLOT_SIZE;
+    }
+
+    MLOGD << "Listening on " << INADDR_ANY << ":" << mPort << " in batches of " << n;
+
+    while (receiving)
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            msgs[i].msg_hdr.msg_name       = &sources[i];
+            msgs[i].msg_hdr.msg_namelen    = sizeof(sockaddr_in);
+            msgs[i].msg_hdr.msg_iov        = &iovecs[i];
+            msgs[i].msg_hdr.msg_iovlen     = 1;
+            msgs[i].msg_hdr.msg_control    = controls[i].data();
+            msgs[i].msg_hdr.msg_controllen = controls[i].size();
+            msgs[i].msg_hdr.msg_flags      = 0;
+        }
+        // Block for the first datagram, then take whatever else is already queued
+        const int count = recvmmsg(mSocket, msgs.data(), n, MSG_WAITFORONE, nullptr);
+        if (count <= 0)
+        {
+            if (count < 0 && errno != EWOULDBLOCK && errno != EAGAIN && errno != EINTR)
+            {
+                MLOGE << "Error on recvmmsg. errno=" << errno << " " << strerror(errno);
+            }
+            continue;
+        }
+
+        // SO_TIMESTAMPNS is CLOCK_REALTIME, translate it once per batch to the steady clock used everywhere else
+        timespec realNow{}, monoNow{};
+        clock_gettime(CLOCK_REALTIME, &realNow);
+        clock_gettime(CLOCK_MONOTONIC, &monoNow);
+        const int64_t realToMono = (int64_t(monoNow.tv_sec) - realNow.tv_sec) * 1000000000LL +
+                                   (int64_t(monoNow.tv_nsec) - realNow.tv_nsec);
+
+        size_t nPackets = 0;
+        for (int i = 0; i < count; ++i)
+        {
+            msghdr& hdr         = msgs[i].msg_hdr;
+            int64_t timestampNs = int64_t(monoNow.tv_sec) * 1000000000LL + monoNow.tv_nsec;
+            for (cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr); cmsg != nullptr; cmsg = CMSG_NXTHDR(&hdr, cmsg))
+            {
+                if (cmsg->cmsg_level != SOL_SOCKET) continue;
+                if (cmsg->cmsg_type == SO_TIMESTAMPNS)
+                {
+                    timespec ts{};
+                    memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+                    timestampNs = int64_t(ts.tv_sec) * 1000000000LL + ts.tv_nsec + realToMono;
+                }
+                else if (cmsg->cmsg_type == SO_RXQ_OVFL)
+                {
+                    uint32_t overflow = 0;
+                    memcpy(&overflow, CMSG_DATA(cmsg), sizeof(overflow));
+                    if (overflow != rxqOverflowCount)
+                    {
+                        nDroppedPackets += overflow - rxqOverflowCount;
+                        rxqOverflowCount = overflow;
+                    }
+                }
+            }
+            if ((hdr.msg_flags & MSG_TRUNC) || msgs[i].msg_len == 0)
+            {
+                nDroppedPackets++;
+                continue;
+            }
+            packets[nPackets++] = {static_cast<const uint8_t*>(iovecs[i].iov_base), msgs[i].msg_len, timestampNs};
+            nReceivedBytes += msgs[i].msg_len;
+        }
+
+        // 1. Forward the whole batch first (minimize latency)
+        {
+            std::lock_guard<std::mutex> lock(mForwardMutex);
+            if (mForwardEnabled && nPackets > 0)
+            {
+                for (size_t i = 0; i < nPackets; ++i)
+                {
+                    forwardIovecs[i]                   = {const_cast<uint8_t*>(packets[i].data), packets[i].length};
+                    forwardMsgs[i]                     = {};
+                    forwardMsgs[i].msg_hdr.msg_name    = &mDestAddr;
+                    forwardMsgs[i].msg_hdr.msg_namelen = sizeof(mDestAddr);
+                    forwardMsgs[i].msg_hdr.msg_iov     = &forwardIovecs[i];
+                    forwardMsgs[i].msg_hdr.msg_iovlen  = 1;
+                }
+                sendmmsg(mSocket, forwardMsgs.data(), nPackets, 0);
+            }
+        }
+
+        // 2. Local processing
+        if (nPackets > 0)
+        {
+            onBatchReceivedCallback(packets.data(), nPackets);
+        }
+        updateSourceIP(sources[count - 1]);
+    }
+}
+
+void UDPReceiver::updateSourceIP(const sockaddr_in& source)
+{
+    // Only format the address when the sender actually changed
+    if (source.sin_addr.s_addr == mLastSourceAddr)
+    {
+        return;
+    }
+    mLastSourceAddr = source.sin_addr.s_addr;
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &source.sin_addr, ip, sizeof(ip));
+    senderIP = ip;
+    if (onSourceIP != nullptr)
+    {
+        onSourceIP(senderIP);
+    }
+}
+
 int UDPReceiver::getPort() const
 {
     return mPort;
@@ -11,9 +11,11 @@
 #include <unistd.h>
 #include <atomic>
 #include <cstdio>
+#include <functional>
 #include <iostream>
 #include <thread>
 #include <mutex>
+#include <vector>
 // Starts a new thread that continuously checks for new data on UDP port
 
 class UDPReceiver
@@ -22,6 +24,16 @@ class UDPReceiver
     typedef std::function<void(const uint8_t[], size_t)> DATA_CALLBACK;
     typedef std::function<void(const std::string)>       SOURCE_IP_CALLBACK;
 
+    struct ReceivedPacket
+    {
+        const uint8_t* data;
+        size_t         length;
+        // Kernel receive time (SO_TIMESTAMPNS) converted to the steady clock, in nanoseconds
+        int64_t timestampNs;
+    };
+    // Called once per recvmmsg() with every packet of the batch, the data is only valid during the call
+    typedef std::function<void(const ReceivedPacket* packets, size_t count)> BATCH_CALLBACK;
+
   public:
     /**
      * @param javaVm used to set thread priority (attach and then detach) for android,
@@ -48,6 +60,13 @@ class UDPReceiver
      */
     void registerOnSourceIPFound(SOURCE_IP_CALLBACK onSourceIP1);
 
+    /**
+     * Switch to batched receiving: up to @param batchSize datagrams are fetched per recvmmsg() into a slab of
+     * preallocated slots and handed to @param onBatch in one call. The per packet callback is not used in that mode.
+     * Must be called before startReceiving().
+     */
+    void setBatchMode(BATCH_CALLBACK onBatch, size_t batchSize = 32);
+
     /**
      * Start receiver thread,which opens UDP port
      */
@@ -61,6 +80,9 @@ class UDPReceiver
     // Get function(s) for private member variables
     long getNReceivedBytes() const;
 
+    // Datagrams the kernel dropped because the socket buffer was full (SO_RXQ_OVFL), batch mode only
+    long getNDroppedPackets() const;
+
     std::string getSourceIPAddress() const;
 
     int getPort() const;
@@ -69,6 +91,8 @@ class UDPReceiver
 
   private:
     void receiveFromUDPLoop();
+    void receiveBatchesLoop();
+    void updateSourceIP(const sockaddr_in& source);
 
     const DATA_CALLBACK onDataReceivedCallback = nullptr;
     SOURCE_IP_CALLBACK  onSourceIP             = nullptr;
@@ -82,10 +106,16 @@ class UDPReceiver
     std::string                  senderIP       = "0.0.0.0";
     std::atomic<bool>            receiving      = false;
     std::atomic<long>            nReceivedBytes = 0;
+    std::atomic<long>            nDroppedPackets = 0;
+    in_addr_t                    mLastSourceAddr = INADDR_NONE;
+    BATCH_CALLBACK               onBatchReceivedCallback = nullptr;
+    size_t                       mBatchSize              = 0;
     std::unique_ptr<std::thread> mUDPReceiverThread;
     // https://en.wikipedia.org/wiki/User_Datagram_Protocol
     // 65,507 bytes (65,535 − 8 byte UDP header − 20 byte IP header).
     static constexpr const size_t UDP_PACKET_MAX_SIZE = 65507;
+    // Slot size in batch mode, covers the largest payload wfb-ng can carry. Bigger datagrams are dropped.
+    static constexpr const size_t BATCH_SLOT_SIZE = 4096;
     JavaVM*                       javaVm;
 
     std::mutex                    mForwardMutex;
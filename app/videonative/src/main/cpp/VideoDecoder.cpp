@@ -3,20 +3,26 @@
 //
 
 #include "VideoDecoder.h"
+#include <pthread.h>
 #include <unistd.h>
+#include <algorithm>
+#include <cstring>
 #include <sstream>
 #include "AndroidThreadPrioValues.hpp"
-#include "helper/AndroidMediaFormatHelper.h"
-#include "helper/NDKThreadHelper.hpp"
+#include "TraceRecorder.h"
 
 #include <vector>
 
+#ifdef __ANDROID__
 #include <android/native_window_jni.h>
-#include <media/NdkMediaCodec.h>
+#include "MediaCodecDecoderBackend.h"
+#include "helper/NDKThreadHelper.hpp"
+#endif
 
 using namespace std::chrono;
 
-VideoDecoder::VideoDecoder(JNIEnv* env)
+#ifdef __ANDROID__
+VideoDecoder::VideoDecoder(JNIEnv* env) : VideoDecoder()
 {
     env->GetJavaVM(&javaVm);
     resetStatistics();
@@ -27,42 +33,56 @@ void VideoDecoder::setOutputSurface(JNIEnv* env, jobject surface, jint idx)
     if (surface == nullptr)
     {
         MLOGD << "Set output null surface idx: " << idx;
-        // assert(decoder.window!=nullptr);
-        if (decoder.window[idx] == nullptr && decoder.codec[idx] == nullptr)
-        {
-            // MLOGD<<"Decoder window is already null";
-            return;
-        }
-        std::lock_guard<std::mutex> lock(mMutexInputPipe);
-        inputPipeClosed = true;
-        if (decoder.configured[idx])
-        {
-            AMediaCodec_stop(decoder.codec[idx]);
-            AMediaCodec_delete(decoder.codec[idx]);
-            decoder.codec[idx] = nullptr;
-            MLOGD << "Set decoder.codec null idx: " << idx;
-            mKeyFrameFinder.reset();
-            decoder.configured[idx] = false;
-            if (mCheckOutputThread[idx]->joinable())
-            {
-                mCheckOutputThread[idx]->join();
-                mCheckOutputThread[idx].reset();
-            }
-        }
+        setOutput(idx, nullptr);
         if (decoder.window[idx])
         {
             ANativeWindow_release(decoder.window[idx]);
             decoder.window[idx] = nullptr;
             MLOGD << "Set decoder.window null idx: " << idx;
         }
-        resetStatistics();
     }
     else
     {
         MLOGD << "Set output non-null surface idx :" << idx;
         // Throw warning if the surface is set without clearing it first
         assert(decoder.window[idx] == nullptr);
-        decoder.window[idx] = ANativeWindow_fromSurface(env, surface);
+        ANativeWindow* window = ANativeWindow_fromSurface(env, surface);
+        decoder.window[idx]   = window;
+        setOutput(idx, [window]() { return std::make_unique<MediaCodecDecoderBackend>(window); });
+    }
+}
+#endif
+
+void VideoDecoder::setOutput(int idx, DecoderBackendFactory factory)
+{
+    std::lock_guard<std::recursive_mutex> lock(mMutexInputPipe);
+    if (factory == nullptr)
+    {
+        if (decoder.factory[idx] == nullptr && decoder.codec[idx] == nullptr)
+        {
+            // MLOGD<<"Decoder output is already closed";
+            return;
+        }
+        inputPipeClosed = true;
+        if (decoder.configured[idx])
+        {
+            stopDecoder(idx);
+            mKeyFrameFinder.reset();
+        }
+        decoder.factory[idx] = nullptr;
+        resetStatistics();
+        Feeder& feeder            = mFeeders[idx];
+        feeder.nQueued            = 0;
+        feeder.nFed               = 0;
+        feeder.nDropped           = 0;
+        feeder.nDroppedDisposable = 0;
+        feeder.nFastForwards      = 0;
+        feeder.nStalls            = 0;
+        feeder.maxDepth           = 0;
+    }
+    else
+    {
+        decoder.factory[idx] = std::move(factory);
         // open the input pipe - now the decoder will start as soon as enough data is available
         inputPipeClosed = false;
     }
@@ -78,13 +98,18 @@ void VideoDecoder::registerOnDecodingInfoChangedCallback(DECODING_INFO_CHANGED_C
     onDecodingInfoChangedCallback = std::move(decodingInfoChangedCallback);
 }
 
-void VideoDecoder::interpretNALU(const NALU& nalu)
+void VideoDecoder::registerOnKeyFrameNeededCallback(std::function<void()> keyFrameNeededCallback)
+{
+    onKeyFrameNeededCallback = std::move(keyFrameNeededCallback);
+}
+
+void VideoDecoder::interpretNALU(const NALU& nalu, int64_t originNs, PooledNalu copy)
 {
     // TODO: RN switching between h264 / h265 requires re-setting the surface
     IS_H265             = nalu.IS_H265_PACKET;
     decodingInfo.nCodec = IS_H265;
     // we need this lock, since the receiving/parsing/feeding does not run on the same thread who sets the input surface
-    std::lock_guard<std::mutex> lock(mMutexInputPipe);
+    std::lock_guard<std::recursive_mutex> lock(mMutexInputPipe);
     decodingInfo.nNALU++;
     if (nalu.getSize() <= 4)
     {
@@ -102,8 +127,15 @@ void VideoDecoder::interpretNALU(const NALU& nalu)
     }
     if (decoder.configured[0] || decoder.configured[1])
     {
-        feedDecoder(nalu, 0);
-        feedDecoder(nalu, 1);
+        // Decoder 1 copies from a lent input buffer of decoder 0, so that one is queued last
+        for (const int idx : {1, 0})
+        {
+            if (decoder.configured[idx])
+            {
+                growInputBuffers(idx, nalu);
+                enqueueNALU(nalu, idx, originNs, copy);
+            }
+        }
         decodingInfo.nNALUSFeeded++;
         // manually feeding AUDs doesn't seem to change anything for high latency streams
         // Only for the x264 sw encoded example stream it might improve latency slightly
@@ -128,119 +160,310 @@ void VideoDecoder::interpretNALU(const NALU& nalu)
 
 void VideoDecoder::configureStartDecoder(int idx)
 {
-    if (decoder.window[idx] == nullptr) return;
-    const std::string MIME = IS_H265 ? "video/hevc" : "video/avc";
-    decoder.codec[idx]     = AMediaCodec_createDecoderByType(MIME.c_str());
-
-    AMediaFormat* format = AMediaFormat_new();
-    AMediaFormat_setString(format, AMEDIAFORMAT_KEY_MIME, MIME.c_str());
-
-    // AMediaFormat_setInt32(format, "low-latency", 1);
-    // AMediaFormat_setInt32(format, "vendor.low-latency.enable", 1);
-    // AMediaFormat_setInt32(format, "vendor.qti-ext-dec-low-latency.enable", 1);
-    // AMediaFormat_setInt32(format, "vendor.hisi-ext-low-latency-video-dec.video-scene-for-low-latency-req", 1);
-    // AMediaFormat_setInt32(format, "vendor.rtc-ext-dec-low-latency.enable", 1);
-
-    // MediaCodec supports two priorities: 0 - realtime, 1 - best effort
-    // AMediaFormat_setInt32(format, "priority", 0);
-
-    if (IS_H265)
+    if (decoder.factory[idx] == nullptr) return;
+    auto codec = decoder.factory[idx]();
+    if (codec == nullptr || !codec->start(mKeyFrameFinder, IS_H265, mMaxInputSize))
     {
-        h265_configureAMediaFormat(mKeyFrameFinder, format);
+        MLOGD << "Cannot configure decoder";
+        // set csd-0 and csd-1 back to 0, maybe they were just faulty but we have better luck with the next ones
+        // mKeyFrameFinder.reset();
+        return;
     }
-    else
+    decoder.codec[idx]      = std::move(codec);
+    mCheckOutputThread[idx] = std::make_unique<std::thread>(&VideoDecoder::checkOutputLoop, this, idx);
+    Feeder& feeder          = mFeeders[idx];
+    feeder.queue            = std::make_unique<NaluFeedQueue>(feeder.capacity);
+    feeder.stop             = false;
+    feeder.skipping         = false;
+    feeder.inputCapacity    = 0;
+    feeder.neededInputSize  = 0;
+    feeder.thread           = std::make_unique<std::thread>(&VideoDecoder::feedLoop, this, idx);
+#ifdef __ANDROID__
+    NDKThreadHelper::setName(mCheckOutputThread[idx]->native_handle(), "LLDCheckOutput");
+    NDKThreadHelper::setName(feeder.thread->native_handle(), "LLDFeed");
+#else
+    pthread_setname_np(mCheckOutputThread[idx]->native_handle(), "LLDCheckOutput");
+    pthread_setname_np(feeder.thread->native_handle(), "LLDFeed");
+#endif
+    decoder.configured[idx] = true;
+    if (idx == 0)
     {
-        h264_configureAMediaFormat(mKeyFrameFinder, format);
+        // Lend the first input buffer right away, that also tells how large the input buffers are
+        acquire();
     }
+}
 
-    MLOGD << "Configuring decoder:" << AMediaFormat_toString(format);
-
-    auto status = AMediaCodec_configure(decoder.codec[idx], format, decoder.window[idx], nullptr, 0);
-    AMediaFormat_delete(format);
+void VideoDecoder::stopDecoder(int idx)
+{
+    if (idx == 0)
+    {
+        // Freed with the codec, the parser finds out through isValid()
+        mLentInput = {};
+    }
+    // The feeder first, it may wait for an input buffer
+    Feeder& feeder = mFeeders[idx];
+    feeder.stop    = true;
+    feeder.queue->wakeUp();
+    if (feeder.thread->joinable())
+    {
+        feeder.thread->join();
+        feeder.thread.reset();
+    }
+    feeder.queue.reset();
+    feeder.depth = 0;
+    // Ends the output thread before the codec goes away under it
+    decoder.codec[idx]->stop();
+    decoder.configured[idx] = false;
+    if (mCheckOutputThread[idx]->joinable())
+    {
+        mCheckOutputThread[idx]->join();
+        mCheckOutputThread[idx].reset();
+    }
+    decoder.codec[idx].reset();
+    MLOGD << "Set decoder.codec null idx: " << idx;
+}
 
-    switch (status)
+NaluBufferProvider::Buffer VideoDecoder::acquire()
+{
+    if (!mDirectInput || inputPipeClosed || !decoder.configured[0])
     {
-        case AMEDIA_OK:
-        {
-            MLOGD << "AMediaCodec_configure: OK";
-            break;
-        }
-        case AMEDIA_ERROR_UNKNOWN:
+        return {};
+    }
+    if (mLentInput.index < 0)
+    {
+        // Never waits, the parser falls back to its staging buffer
+        const ssize_t index = decoder.codec[0]->dequeueInputBuffer(0);
+        if (index < 0)
         {
-            MLOGD << "AMediaCodec_configure: AMEDIA_ERROR_UNKNOWN";
-            break;
+            return {};
         }
-        case AMEDIA_ERROR_MALFORMED:
+        size_t   capacity = 0;
+        uint8_t* data     = decoder.codec[0]->getInputBuffer((size_t) index, &capacity);
+        if (data == nullptr)
         {
-            MLOGD << "AMediaCodec_configure: AMEDIA_ERROR_MALFORMED";
-            break;
+            decoder.codec[0]->queueInputBuffer((size_t) index, 0, 0, 0);
+            return {};
         }
-        case AMEDIA_ERROR_UNSUPPORTED:
+        mLentInput                = {index, data, capacity};
+        mFeeders[0].inputCapacity = capacity;
+    }
+    return {mLentInput.data, mLentInput.capacity, (int64_t) mLentInput.index};
+}
+
+bool VideoDecoder::isValid(const Buffer& buffer)
+{
+    return buffer.data != nullptr && buffer.data == mLentInput.data && buffer.id == mLentInput.index;
+}
+
+void VideoDecoder::release(const Buffer& /*buffer*/)
+{
+    // Unless feedDecoder() queued it, the buffer stays with us for the next NALU
+}
+
+void VideoDecoder::setFeedPolicy(int idx, FeedPolicy policy, size_t capacity, milliseconds latencyBudget)
+{
+    std::lock_guard<std::recursive_mutex> lock(mMutexInputPipe);
+    mFeeders[idx].policy        = policy;
+    mFeeders[idx].capacity      = std::max<size_t>(capacity, 1);
+    mFeeders[idx].latencyBudget = latencyBudget;
+}
+
+FeederStats VideoDecoder::feederStats(int idx) const
+{
+    const Feeder& feeder = mFeeders[idx];
+    FeederStats   stats;
+    stats.nQueued            = feeder.nQueued;
+    stats.nFed               = feeder.nFed;
+    stats.nDropped           = feeder.nDropped;
+    stats.nDroppedDisposable = feeder.nDroppedDisposable;
+    stats.nFastForwards      = feeder.nFastForwards;
+    stats.nStalls            = feeder.nStalls;
+    stats.depth              = feeder.depth;
+    stats.maxDepth           = feeder.maxDepth;
+    return stats;
+}
+
+void VideoDecoder::growInputBuffers(int idx, const NALU& nalu)
+{
+    // The lent input buffer the NALU sits in would go away with the decoder
+    if (idx == 0 && isLentInput(nalu)) return;
+    Feeder&      feeder   = mFeeders[idx];
+    const size_t capacity = feeder.inputCapacity;
+    size_t       needed   = feeder.neededInputSize.exchange(0);
+    if (capacity != 0 && nalu.getSize() > capacity)
+    {
+        needed = std::max(needed, nalu.getSize());
+    }
+    if (needed == 0) return;
+    // Most likely an IDR slice, without it the following frames are garbage anyways
+    mMaxInputSize = std::max(mMaxInputSize, needed + needed * INPUT_SIZE_HEADROOM_PERCENT / 100);
+    MLOGD << "Restarting decoder " << idx << " with input buffers of " << mMaxInputSize << " bytes";
+    stopDecoder(idx);
+    configureStartDecoder(idx);
+}
+
+void VideoDecoder::enqueueNALU(const NALU& nalu, int idx, int64_t originNs, PooledNalu& copy)
+{
+    Feeder& feeder = mFeeders[idx];
+    if (!feeder.queue) return;
+    if (feeder.skipping)
+    {
+        if (!nalu.is_config() && !nalu.is_keyframe())
         {
-            MLOGD << "AMediaCodec_configure: AMEDIA_ERROR_UNSUPPORTED";
-            break;
+            feeder.nDropped++;
+            return;
         }
-        case AMEDIA_ERROR_INVALID_OBJECT:
+        feeder.skipping = false;
+    }
+    const bool   keyFrame = nalu.is_config() || nalu.is_keyframe();
+    const bool   priority = feeder.policy == FeedPolicy::PRIORITY && !keyFrame;
+    const size_t capacity = feeder.queue->capacity();
+    if (priority && nalu.is_disposable() && feeder.queue->size() >= std::max<size_t>(capacity / 2, 1))
+    {
+        TRACE_INSTANT("decoder_drop_disposable", idx);
+        feeder.nDropped++;
+        feeder.nDroppedDisposable++;
+        return;
+    }
+    NaluFeedQueue::Entry* entry = feeder.queue->back();
+    if (priority && feeder.queue->size() >= capacity - capacity / KEY_FRAME_RESERVE_DIVISOR)
+    {
+        // The rest is kept for key frames
+        entry = nullptr;
+    }
+    else if (entry == nullptr && (feeder.policy == FeedPolicy::WAIT || feeder.policy == FeedPolicy::PRIORITY))
+    {
+        TRACE_SCOPE_ARG("decoder_queue_full", idx);
+        const auto deadline = steady_clock::now() + FEED_WAIT_TIMEOUT;
+        while (entry == nullptr && steady_clock::now() < deadline)
         {
-            MLOGD << "AMediaCodec_configure: AMEDIA_ERROR_INVALID_OBJECT";
-            break;
+            feeder.queue->waitForSpace(milliseconds(BUFFER_TIMEOUT_US / 1000));
+            entry = feeder.queue->back();
         }
-        case AMEDIA_ERROR_INVALID_PARAMETER:
+    }
+    if (entry == nullptr)
+    {
+        // A lent input buffer stays lent for the next NALU
+        MLOGD << "Feed queue of decoder " << idx << " full, skipping to the next key frame";
+        TRACE_ANOMALY("decoder_feed_drop");
+        feeder.nDropped++;
+        feeder.skipping = true;
+        requestKeyFrame();
+        return;
+    }
+    const size_t size   = nalu.getSize();
+    entry->size         = size;
+    entry->flags        = (IS_H265 && nalu.is_config()) ? DecoderBackend::FLAG_CODEC_CONFIG : 0;
+    entry->originNs     = originNs;
+    entry->creationTime = nalu.creationTime;
+    entry->queuedTime   = steady_clock::now();
+    entry->keyFrame     = keyFrame;
+    entry->inputIndex   = -1;
+    const bool lent     = idx == 0 && isLentInput(nalu);
+    // A buffer lent out but not used (staging fallback, access unit mode) is filled before dequeuing another one
+    if (lent || (idx == 0 && mLentInput.index >= 0 && size <= mLentInput.capacity))
+    {
+        // The parser reassembled the NALU right into this input buffer, queue it without a copy
+        if (!lent)
         {
-            MLOGD << "AMediaCodec_configure: AMEDIA_ERROR_INVALID_PARAMETER";
-            break;
+            std::memcpy(mLentInput.data, nalu.getData(), size);
         }
-        default:
+        entry->inputIndex = mLentInput.index;
+        mLentInput        = {};
+    }
+    else
+    {
+        // One copy for both feeders
+        if (!copy)
         {
-            break;
+            copy = mBufferPool.copy(nalu);
         }
+        entry->nalu = copy;
+    }
+    feeder.queue->push();
+    feeder.nQueued++;
+    const size_t depth = feeder.queue->size();
+    feeder.depth       = depth;
+    if (depth > feeder.maxDepth)
+    {
+        feeder.maxDepth = depth;
     }
+}
 
-    if (decoder.codec[idx] == nullptr)
+void VideoDecoder::requestKeyFrame()
+{
+    if (onKeyFrameNeededCallback != nullptr)
     {
-        MLOGD << "Cannot configure decoder";
-        // set csd-0 and csd-1 back to 0, maybe they were just faulty but we have better luck with the next ones
-        // mKeyFrameFinder.reset();
-        return;
+        onKeyFrameNeededCallback();
     }
-    AMediaCodec_start(decoder.codec[idx]);
-    mCheckOutputThread[idx] = std::make_unique<std::thread>(&VideoDecoder::checkOutputLoop, this, idx);
-    NDKThreadHelper::setName(mCheckOutputThread[idx]->native_handle(), "LLDCheckOutput");
-    decoder.configured[idx] = true;
 }
 
-void VideoDecoder::feedDecoder(const NALU& nalu, int idx)
+void VideoDecoder::feedLoop(int idx)
 {
-    if (!decoder.codec[idx]) return;
-    const auto now          = std::chrono::steady_clock::now();
-    const auto deltaParsing = now - nalu.creationTime;
-    while (true)
+#ifdef __ANDROID__
+    NDKThreadHelper::setProcessThreadPriorityAttachDetach(javaVm, -16, "DecoderFeed");
+#endif
+    Feeder& feeder      = mFeeders[idx];
+    bool    fastForward = false;
+    while (!feeder.stop)
     {
-        const auto index = AMediaCodec_dequeueInputBuffer(decoder.codec[idx], BUFFER_TIMEOUT_US);
-        if (index >= 0)
+        if (!feeder.queue->waitForData(milliseconds(100)))
+        {
+            continue;
+        }
+        NaluFeedQueue::Entry& entry  = *feeder.queue->front();
+        const auto            waited = steady_clock::now() - entry.queuedTime;
+        if (!fastForward && !entry.keyFrame && feeder.latencyBudget.count() > 0 && waited > feeder.latencyBudget)
         {
-            size_t   inputBufferSize;
-            uint8_t* buf = AMediaCodec_getInputBuffer(decoder.codec[idx], (size_t) index, &inputBufferSize);
-            // I have not seen any case where the input buffer returned by MediaCodec is too small to hold the NALU
-            // But better be safe than crashing with a memory exception
-            if (nalu.getSize() > inputBufferSize)
+            // The decoder fell behind, catch up at the next key frame instead of showing old frames
+            MLOGD << "Decoder " << idx << " backlog of " << MyTimeHelper::R(waited)
+                  << ", skipping to the next key frame";
+            TRACE_ANOMALY("decoder_fast_forward");
+            feeder.nFastForwards++;
+            fastForward = true;
+            requestKeyFrame();
+        }
+        else if (fastForward && entry.keyFrame)
+        {
+            fastForward = false;
+        }
+        if (fastForward)
+        {
+            if (entry.inputIndex >= 0)
             {
-                MLOGD << "Nalu too big" << nalu.getSize();
-                return;
+                // Lent to the parser and filled, hand it back empty
+                decoder.codec[idx]->queueInputBuffer((size_t) entry.inputIndex, 0, 0, 0);
             }
+            feeder.nDropped++;
+        }
+        else
+        {
+            feedDecoder(entry, idx);
+        }
+        // Back to the pool unless the other feeder or the dvr still has it
+        entry.nalu = {};
+        feeder.queue->pop();
+        feeder.depth = feeder.queue->size();
+    }
+}
 
-            int flag =
-                (IS_H265 && (nalu.isSPS() || nalu.isPPS() || nalu.isVPS())) ? AMEDIACODEC_BUFFER_FLAG_CODEC_CONFIG : 0;
-            std::memcpy(buf, nalu.getData(), (size_t) nalu.getSize());
-            const uint64_t presentationTimeUS =
-                (uint64_t) duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
-            AMediaCodec_queueInputBuffer(
-                decoder.codec[idx], (size_t) index, 0, (size_t) nalu.getSize(), presentationTimeUS, flag);
-            waitForInputB.add(steady_clock::now() - now);
-            parsingTime.add(deltaParsing);
-            return;
+void VideoDecoder::feedDecoder(const NaluFeedQueue::Entry& entry, int idx)
+{
+    // Deleted only after this thread ended
+    DecoderBackend* codec  = decoder.codec[idx].get();
+    Feeder&         feeder = mFeeders[idx];
+    TRACE_SCOPE_ARG("decoder_feed", idx);
+    const auto now          = std::chrono::steady_clock::now();
+    const auto deltaParsing = now - entry.creationTime;
+    ssize_t    index        = entry.inputIndex;
+    while (index < 0)
+    {
+        index = codec->dequeueInputBuffer(BUFFER_TIMEOUT_US);
+        if (index >= 0 || feeder.stop)
+        {
+            break;
         }
-        else if (index == AMEDIACODEC_INFO_TRY_AGAIN_LATER)
+        else if (index == DecoderBackend::TRY_AGAIN_LATER)
         {
             // just try again. But if we had no success in the last 1 second,log a warning and return.
             const auto elapsedTimeTryingForBuffer = std::chrono::steady_clock::now() - now;
@@ -251,6 +474,8 @@ void VideoDecoder::feedDecoder(const NALU& nalu, int idx)
                 // though;
                 MLOGE << "AMEDIACODEC_INFO_TRY_AGAIN_LATER for more than 1 second "
                       << MyTimeHelper::R(elapsedTimeTryingForBuffer) << "return.";
+                TRACE_ANOMALY("decoder_stall");
+                feeder.nStalls++;
                 return;
             }
         }
@@ -261,18 +486,64 @@ void VideoDecoder::feedDecoder(const NALU& nalu, int idx)
             return;
         }
     }
+    if (index < 0)
+    {
+        return;
+    }
+    if (entry.inputIndex < 0)
+    {
+        size_t   inputBufferSize = 0;
+        uint8_t* buf             = codec->getInputBuffer((size_t) index, &inputBufferSize);
+        feeder.inputCapacity     = inputBufferSize;
+        // I have not seen any case where the input buffer returned by MediaCodec is too small to hold the NALU
+        // But better be safe than crashing with a memory exception
+        if (buf == nullptr || entry.size > inputBufferSize)
+        {
+            MLOGD << "Nalu too big" << entry.size;
+            // Hand the buffer back empty, the parsing thread restarts the decoder with larger ones
+            codec->queueInputBuffer((size_t) index, 0, 0, 0);
+            if (buf != nullptr)
+            {
+                feeder.neededInputSize = entry.size;
+            }
+            feeder.nDropped++;
+            return;
+        }
+        std::memcpy(buf, entry.nalu->getData(), entry.size);
+    }
+    const uint64_t presentationTimeUS =
+        (uint64_t) duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+    codec->queueInputBuffer((size_t) index, entry.size, presentationTimeUS, entry.flags);
+    feeder.nFed++;
+    if (idx == 0)
+    {
+        waitForInputB.add(steady_clock::now() - now);
+        parsingTime.add(deltaParsing);
+        if (mLatency)
+        {
+            mLatency->record(LatencyStage::INPUT_WAIT, duration_cast<microseconds>(steady_clock::now() - now).count());
+            auto& queued = mQueuedInputs[mNextQueuedInput++ % mQueuedInputs.size()];
+            // Invalidate first, the output thread must never pair the new origin with the old timestamp
+            queued.presentationTimeUs.store(-1, std::memory_order_relaxed);
+            queued.originNs.store(entry.originNs, std::memory_order_relaxed);
+            queued.presentationTimeUs.store((int64_t) presentationTimeUS, std::memory_order_release);
+        }
+    }
 }
 
 void VideoDecoder::checkOutputLoop(int idx)
 {
+#ifdef __ANDROID__
     NDKThreadHelper::setProcessThreadPriorityAttachDetach(javaVm, -16, "DecoderCheckOutput");
-    AMediaCodecBufferInfo info;
-    bool                  decoderSawEOS          = false;
-    bool                  decoderProducedUnknown = false;
+#endif
+    // Deleted only after this thread ended
+    DecoderBackend*   codec = decoder.codec[idx].get();
+    DecoderOutputInfo info;
+    bool              decoderSawEOS          = false;
+    bool              decoderProducedUnknown = false;
     while (!decoderSawEOS && !decoderProducedUnknown)
     {
-        if (!decoder.codec[idx]) break;
-        const ssize_t index = AMediaCodec_dequeueOutputBuffer(decoder.codec[idx], &info, BUFFER_TIMEOUT_US);
+        const ssize_t index = codec->dequeueOutputBuffer(info, BUFFER_TIMEOUT_US);
         if (index >= 0)
         {
             const auto    now   = steady_clock::now();
@@ -283,40 +554,53 @@ void VideoDecoder::checkOutputLoop(int idx)
             // https://android.googlesource.com/platform/frameworks/av/+/3fdb405/media/libstagefright/MediaCodec.cpp
             //-> Message kWhatReleaseOutputBuffer -> onReleaseOutputBuffer
             //  also https://android.googlesource.com/platform/frameworks/native/+/5c1139f/libs/gui/SurfaceTexture.cpp
-            if (!decoder.codec[idx]) break;
-            AMediaCodec_releaseOutputBuffer(decoder.codec[idx], (size_t) index, true);
+            {
+                TRACE_SCOPE_ARG("decoder_release", idx);
+                codec->releaseOutputBuffer((size_t) index, true);
+            }
             // but the presentationTime is in US
             if (idx == 0)
             {
                 decodingTime.add(std::chrono::microseconds(nowUS - info.presentationTimeUs));
                 nDecodedFrames.add(1);
+                if (mLatency)
+                {
+                    mLatency->record(LatencyStage::DECODE, nowUS - info.presentationTimeUs);
+                    if (const int64_t originNs = findOrigin(info.presentationTimeUs))
+                    {
+                        const int64_t nowNs = duration_cast<nanoseconds>(now.time_since_epoch()).count();
+                        mLatency->recordNs(LatencyStage::TOTAL, originNs, nowNs);
+                        if (nowNs - originNs > SLOW_FRAME_NS)
+                        {
+                            TRACE_ANOMALY("slow_frame");
+                        }
+                    }
+                }
             }
-            if (info.flags & AMEDIACODEC_BUFFER_FLAG_END_OF_STREAM)
+            if (info.flags & DecoderBackend::FLAG_END_OF_STREAM)
             {
                 MLOGD << "Decoder saw EOS";
                 decoderSawEOS = true;
                 continue;
             }
         }
-        else if (index == AMEDIACODEC_INFO_OUTPUT_FORMAT_CHANGED)
+        else if (index == DecoderBackend::OUTPUT_FORMAT_CHANGED)
         {
-            auto format = AMediaCodec_getOutputFormat(decoder.codec[idx]);
-            int  width = 0, height = 0;
-            AMediaFormat_getInt32(format, AMEDIAFORMAT_KEY_WIDTH, &width);
-            AMediaFormat_getInt32(format, AMEDIAFORMAT_KEY_HEIGHT, &height);
+            const auto format = codec->outputFormat();
+            const int  width  = format.size.width;
+            const int  height = format.size.height;
             MLOGD << "Actual Width and Height in output " << width << "," << height;
             if (idx == 0 && onDecoderRatioChangedCallback != nullptr && width != 0 && height != 0)
             {
                 onDecoderRatioChangedCallback({width, height});
             }
-            MLOGD << "AMEDIACODEC_INFO_OUTPUT_FORMAT_CHANGED " << width << " " << height << " "
-                  << AMediaFormat_toString(format);
+            MLOGD << "AMEDIACODEC_INFO_OUTPUT_FORMAT_CHANGED " << width << " " << height << " " << format.description;
         }
-        else if (index == AMEDIACODEC_INFO_OUTPUT_BUFFERS_CHANGED)
+        else if (index == DecoderBackend::OUTPUT_BUFFERS_CHANGED)
         {
             MLOGD << "AMEDIACODEC_INFO_OUTPUT_BUFFERS_CHANGED";
         }
-        else if (index == AMEDIACODEC_INFO_TRY_AGAIN_LATER)
+        else if (index == DecoderBackend::TRY_AGAIN_LATER)
         {
             // MLOGD<<"AMEDIACODEC_INFO_TRY_AGAIN_LATER";
         }
@@ -353,6 +637,25 @@ void VideoDecoder::checkOutputLoop(int idx)
     MLOGD << "Exit CheckOutputLoop";
 }
 
+int64_t VideoDecoder::findOrigin(int64_t presentationTimeUs) const
+{
+    for (const auto& queued : mQueuedInputs)
+    {
+        if (queued.presentationTimeUs.load(std::memory_order_acquire) != presentationTimeUs)
+        {
+            continue;
+        }
+        const int64_t originNs = queued.originNs.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        // Still the same entry, the feeding thread did not reuse it while we read the origin
+        if (queued.presentationTimeUs.load(std::memory_order_relaxed) == presentationTimeUs)
+        {
+            return originNs;
+        }
+    }
+    return 0;
+}
+
 void VideoDecoder::printAvgLog()
 {
     if (PRINT_DEBUG_INFO)
@@ -373,6 +676,19 @@ void VideoDecoder::printAvgLog()
                      << " | N NALUES feeded:" << decodingInfo.nNALUSFeeded
                      << " | N Decoded Frames:" << nDecodedFrames.getAbsolute() << "\nFPS:" << decodingInfo.currentFPS
                      << " | Codec:" << (decodingInfo.nCodec ? "H265" : "H264");
+            if (mLatency)
+            {
+                const auto summaries = mLogLatencyWindow.next(*mLatency);
+                frameLog << "\nLatency p50/p99 us:";
+                for (int i = 0; i < LatencyStats::kStages; ++i)
+                {
+                    if (summaries[i].count > 0)
+                    {
+                        frameLog << " " << LatencyStats::name((LatencyStage) i) << ":" << summaries[i].p50Us << "/"
+                                 << summaries[i].p99Us;
+                    }
+                }
+            }
             MLOGD << frameLog.str();
         }
     }
@@ -6,15 +6,23 @@
 #define FPVUE_VIDEODECODER_H
 
 #include <android/log.h>
+#ifdef __ANDROID__
 #include <android/native_window.h>
 #include <jni.h>
-#include <media/NdkMediaCodec.h>
+#endif
+#include <array>
 #include <atomic>
 #include <iostream>
+#include <mutex>
 #include <thread>
+#include "DecoderBackend.h"
+#include "LatencyStats.h"
 #include "NALU/KeyFrameFinder.hpp"
 #include "NALU/NALU.hpp"
+#include "NaluBufferPool.h"
+#include "NaluFeedQueue.h"
 #include "helper/TimeHelper.hpp"
+#include "parser/NaluBufferProvider.h"
 
 struct DecodingInfo
 {
@@ -39,26 +47,55 @@ struct DecodingInfo
     bool operator!=(const DecodingInfo& d2) const { return !(*this == d2); }
 };
 
-struct VideoRatio
+// What the parsing thread does with a NALU when the feed queue of a decoder is full
+enum class FeedPolicy
 {
-    int width  = 0;
-    int height = 0;
-
-    bool operator==(const VideoRatio& b) const { return width == b.width && height == b.height; }
+    // Wait for room up to FEED_WAIT_TIMEOUT, then drop like SKIP_TO_KEY_FRAME. Parsing keeps pace with the decoder.
+    WAIT,
+    // Drop it and every NALU up to the next key frame, the frames in between could not be decoded anyways
+    SKIP_TO_KEY_FRAME,
+    // By what the decoder can do without: NALUs nothing references are dropped once the queue is half full, other
+    // slices when only the room kept for key frames is left (and everything up to the next key frame with them).
+    // Parameter sets and IDR slices wait for room like WAIT.
+    PRIORITY,
+};
 
-    bool operator!=(const VideoRatio& b) const { return !(*this == b); }
+// Counters of the feeder of one decoder
+struct FeederStats
+{
+    // Handed to the feeder thread
+    uint64_t nQueued = 0;
+    // Queued into the decoder
+    uint64_t nFed = 0;
+    // Dropped because the queue was full, on the way to the next key frame, or too big for the input buffers
+    uint64_t nDropped = 0;
+    // Of those, dropped by PRIORITY although there was room, only they were not needed
+    uint64_t nDroppedDisposable = 0;
+    // The oldest queued NALU waited longer than the latency budget, the feeder skipped to the next key frame
+    uint64_t nFastForwards = 0;
+    // Given up on after the decoder had no input buffer for a second
+    uint64_t nStalls  = 0;
+    size_t   depth    = 0;
+    size_t   maxDepth = 0;
 };
 
 // Handles decoding of .h264 and .h265 video
-// with low latency. Uses the AMediaCodec api
-class VideoDecoder
+// with low latency. Uses the AMediaCodec api on Android, any DecoderBackend elsewhere
+// As NaluBufferProvider it lends input buffers of decoder 0 to the RTP parser, which reassembles NALUs right into them
+// Every decoder is fed by a thread of its own through a bounded queue, a stalled secondary view never holds up the
+// parsing thread and with it the primary one
+class VideoDecoder : public NaluBufferProvider
 {
   private:
     struct Decoder
     {
-        bool           configured[2] = {false, false};
-        AMediaCodec*   codec[2]      = {nullptr, nullptr};
-        ANativeWindow* window[2]     = {nullptr, nullptr};
+        bool                            configured[2] = {false, false};
+        std::unique_ptr<DecoderBackend> codec[2];
+        // Set while the output is open, creates the codec once the key frames are there
+        DecoderBackendFactory factory[2];
+#ifdef __ANDROID__
+        ANativeWindow* window[2] = {nullptr, nullptr};
+#endif
     };
 
   public:
@@ -73,6 +110,10 @@ class VideoDecoder
     // We cannot initialize the Decoder until we have SPS and PPS data -
     // when streaming this data will be available at some point in future
     // Therefore we don't allocate the MediaCodec resources here
+    // The primary view drops by priority, the secondary one skips to the next key frame (see setFeedPolicy)
+    VideoDecoder() { mFeeders[0].policy = FeedPolicy::PRIORITY; }
+
+#ifdef __ANDROID__
     VideoDecoder(JNIEnv* env);
 
     // This call acquires or releases the output surface
@@ -80,24 +121,90 @@ class VideoDecoder
     // When releasing the surface, the decoder will be stopped if running and any resources will be freed
     // After releasing the surface it is safe for the android os to delete it
     void setOutputSurface(JNIEnv* env, jobject surface, jint idx);
+#endif
+
+    // Like setOutputSurface for any backend: decoder @param idx is created by @param factory as soon as enough
+    // configuration data was passed, nullptr stops and deletes it and closes the input pipe
+    void setOutput(int idx, DecoderBackendFactory factory);
 
     // register the specified callbacks. Only one can be registered at a time
     void registerOnDecoderRatioChangedCallback(DECODER_RATIO_CHANGED decoderRatioChangedC);
 
     void registerOnDecodingInfoChangedCallback(DECODING_INFO_CHANGED_CALLBACK decodingInfoChangedCallback);
 
+    // Called when a feeder dropped a frame others reference, decoding is broken until the next key frame. From the
+    // parsing or a feeder thread, register before the first NALU
+    void registerOnKeyFrameNeededCallback(std::function<void()> keyFrameNeededCallback);
+
+    // Where the input wait, decode and total latency go. Must be set before the first NALU, may be nullptr
+    void setLatencyStats(LatencyStats* latency) { mLatency = latency; }
+
     // If the decoder has been configured, feed NALU. Else search for configuration data and
     // configure as soon as possible
     //  If the input pipe was closed (surface has been removed or is not set yet), only buffer key frames
-    void interpretNALU(const NALU& nalu);
+    // originNs: steady clock time the first packet of this NALU was received, 0 if unknown
+    // copy: of the NALU if the caller made one already (e.g. for the dvr), the feeders share it instead of copying
+    void interpretNALU(const NALU& nalu, int64_t originNs = 0, PooledNalu copy = {});
+
+    // NALUs between the parsing thread and a feeder, a few frames with their slices
+    static constexpr size_t FEED_QUEUE_CAPACITY = 32;
+    // Queue wait after which a feeder skips to the next key frame, about 6 frames at 60 fps
+    static constexpr auto FEED_LATENCY_BUDGET = std::chrono::milliseconds(100);
+
+    // Applies from the next start of decoder @param idx. Default: the primary one drops by priority, the secondary
+    // one skips to the next key frame. NALUs queued for longer than @param latencyBudget (0: no limit) are skipped
+    // up to the next key frame, a dropped frame is better than lag.
+    void setFeedPolicy(int                       idx,
+                       FeedPolicy                policy,
+                       size_t                    capacity      = FEED_QUEUE_CAPACITY,
+                       std::chrono::milliseconds latencyBudget = FEED_LATENCY_BUDGET);
+
+    FeederStats feederStats(int idx) const;
+
+    // Holds the NALUs queued for the feeders, callers can make copies the feeders share
+    NaluBufferPool& bufferPool() { return mBufferPool; }
+
+    const NaluBufferPool& bufferPool() const { return mBufferPool; }
+
+    // Lend input buffers to the parser (default), or copy every NALU into a buffer of our own
+    void setDirectInput(bool enable) { mDirectInput = enable; }
+
+    // NaluBufferProvider, on the parsing thread
+    void   lock() override { mMutexInputPipe.lock(); }
+    void   unlock() override { mMutexInputPipe.unlock(); }
+    Buffer acquire() override;
+    bool   isValid(const Buffer& buffer) override;
+    void   release(const Buffer& buffer) override;
 
   private:
     // Initialize decoder with SPS / PPS data from KeyFrameFinder
     // Set Decoder.configured to true on success
     void configureStartDecoder(int idx);
 
+    // Stop and delete the codec, wait for its output thread. Keeps the window and the key frames
+    void stopDecoder(int idx);
+
+    // The NALU was reassembled in the input buffer lent to the parser
+    bool isLentInput(const NALU& nalu) const { return mLentInput.index >= 0 && nalu.getData() == mLentInput.data; }
+
+    // A NALU did not fit into the input buffers of decoder @param idx, or will not: restart it with larger ones
+    void growInputBuffers(int idx, const NALU& nalu);
+
+    // Hands the NALU to the feeder of decoder @param idx, as its policy allows. On the parsing thread
+    // Makes @param copy of the NALU if the feeder needs one and there is none yet
+    void enqueueNALU(const NALU& nalu, int idx, int64_t originNs, PooledNalu& copy);
+
+    // A feeder dropped a NALU the decoder needed, decoding is broken until the next key frame
+    void requestKeyFrame();
+
+    // Runs until stopDecoder(), feeds the queued NALUs
+    void feedLoop(int idx);
+
     // Wait for input buffer to become available before feeding NALU
-    void feedDecoder(const NALU& nalu, int idx);
+    void feedDecoder(const NaluFeedQueue::Entry& entry, int idx);
+
+    // Origin of the input buffer queued with @param presentationTimeUs, 0 if it was overwritten in the meantime
+    int64_t findOrigin(int64_t presentationTimeUs) const;
 
     // Runs until EOS arrives at output buffer or decoder is stopped
     void checkOutputLoop(int idx);
@@ -108,28 +215,89 @@ class VideoDecoder
     void resetStatistics();
 
     std::unique_ptr<std::thread> mCheckOutputThread[2]  = {nullptr, nullptr};
+    struct Feeder
+    {
+        FeedPolicy                     policy        = FeedPolicy::SKIP_TO_KEY_FRAME;
+        size_t                         capacity      = FEED_QUEUE_CAPACITY;
+        std::chrono::milliseconds      latencyBudget = FEED_LATENCY_BUDGET;
+        std::unique_ptr<NaluFeedQueue> queue;
+        std::unique_ptr<std::thread>   thread;
+        std::atomic<bool>              stop{false};
+        // Dropping up to the next key frame. Parsing thread only
+        bool skipping = false;
+        // Of the decoder input buffers, 0 until the first one was seen
+        std::atomic<size_t> inputCapacity{0};
+        // Size of a NALU that did not fit, the parsing thread restarts the decoder with larger input buffers
+        std::atomic<size_t>   neededInputSize{0};
+        std::atomic<uint64_t> nQueued{0};
+        std::atomic<uint64_t> nFed{0};
+        std::atomic<uint64_t> nDropped{0};
+        std::atomic<uint64_t> nDroppedDisposable{0};
+        std::atomic<uint64_t> nFastForwards{0};
+        std::atomic<uint64_t> nStalls{0};
+        std::atomic<size_t>   depth{0};
+        std::atomic<size_t>   maxDepth{0};
+    };
+    NaluBufferPool mBufferPool;
+    // Created and ended with the decoder, except for the policy and the counters
+    Feeder mFeeders[2];
     bool                         USE_SW_DECODER_INSTEAD = false;
     // Holds the AMediaCodec instance, as well as the state (configured or not configured)
     Decoder      decoder{};
     DecodingInfo decodingInfo;
     // The input pipe is closed until we set a valid surface
     bool                           inputPipeClosed = true;
-    std::mutex                     mMutexInputPipe;
+    // Recursive, the parser holds it while it forwards a NALU from a lent input buffer (see NaluBufferProvider)
+    std::recursive_mutex           mMutexInputPipe;
     DECODER_RATIO_CHANGED          onDecoderRatioChangedCallback = nullptr;
     DECODING_INFO_CHANGED_CALLBACK onDecodingInfoChangedCallback = nullptr;
+    std::function<void()>          onKeyFrameNeededCallback      = nullptr;
+#ifdef __ANDROID__
     // So we can temporarily attach the output thread to the vm and make ndk calls
-    JavaVM*                               javaVm  = nullptr;
+    JavaVM* javaVm = nullptr;
+#endif
     std::chrono::steady_clock::time_point lastLog = std::chrono::steady_clock::now();
     RelativeCalculator                    nDecodedFrames;
     RelativeCalculator                    nNALUBytesFed;
     AvgCalculator                         parsingTime;
     AvgCalculator                         waitForInputB;
     AvgCalculator                         decodingTime;
+    LatencyStats*                         mLatency = nullptr;
+    LatencyStats::Window                  mLogLatencyWindow;
+    // Input buffers of decoder 0 in flight, written by the feeding thread and searched by the output thread.
+    // MediaCodec hands the presentation time back with the output buffer, that is the key.
+    struct QueuedInput
+    {
+        std::atomic<int64_t> presentationTimeUs{-1};
+        std::atomic<int64_t> originNs{0};
+    };
+    std::array<QueuedInput, 64> mQueuedInputs;
+    size_t                      mNextQueuedInput = 0;
+    // MediaCodec sizes its input buffers for the resolution it was configured with, and the SPS parser reports a
+    // fixed one. A NALU that did not fit restarts the decoder with input buffers sized after it (0: codec default).
+    size_t mMaxInputSize = 0;
+    // The input buffer of decoder 0 the parser writes into, or kept for its next NALU. Guarded by mMutexInputPipe
+    struct LentInput
+    {
+        ssize_t  index    = -1;
+        uint8_t* data     = nullptr;
+        size_t   capacity = 0;
+    };
+    LentInput         mLentInput;
+    std::atomic<bool> mDirectInput{true};
     // Every n ms re-calculate the Decoding info
     static const constexpr auto DECODING_INFO_RECALCULATION_INTERVAL = std::chrono::milliseconds(1000);
     static constexpr const bool PRINT_DEBUG_INFO                     = true;
     static constexpr auto       TIME_BETWEEN_LOGS                    = std::chrono::seconds(5);
     static constexpr int64_t    BUFFER_TIMEOUT_US = 17 * 1000;  // 17ms (a little bit more than 17 ms (==60 fps))
+    // Glass-to-glass time above which the recent trace events are dumped (TraceRecorder anomaly)
+    static constexpr int64_t    SLOW_FRAME_NS     = 250 * 1000 * 1000;
+    // Headroom on top of the largest NALU seen when the input buffers have to grow, the next IDR is often larger
+    static constexpr size_t     INPUT_SIZE_HEADROOM_PERCENT = 50;
+    // Longest a WAIT feeder holds up the parsing thread, like the wait for an input buffer before
+    static constexpr auto       FEED_WAIT_TIMEOUT   = std::chrono::seconds(1);
+    // Share of a PRIORITY queue kept for parameter sets and IDR slices (1 / n)
+    static constexpr size_t     KEY_FRAME_RESERVE_DIVISOR = 8;
   private:
     KeyFrameFinder mKeyFrameFinder;
     bool           IS_H265 = false;
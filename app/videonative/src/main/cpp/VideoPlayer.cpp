@@ -6,112 +6,98 @@
 #include <jni.h>
 #include <fstream>
 #include "AndroidThreadPrioValues.hpp"
+#include "TraceRecorder.h"
 #include "helper/NDKHelper.hpp"
 #include "helper/NDKThreadHelper.hpp"
 
 #define TAG "pixelpilot"
 
+static int64_t steadyNowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
 VideoPlayer::VideoPlayer(JNIEnv* env, jobject context)
     : mParser{std::bind(&VideoPlayer::onNewNALU, this, std::placeholders::_1)}, videoDecoder(env)
 {
     env->GetJavaVM(&javaVm);
+    mInProcessReceiver = std::make_unique<InProcessReceiver>(
+        javaVm,
+        "InProcessRx",
+        -16,
+        [this](const uint8_t* data, size_t data_length, int64_t originNs)
+        { onNewRTPData(data, data_length, originNs); },
+        &mLatency);
+    videoDecoder.setLatencyStats(&mLatency);
+    // Fragments go straight into the decoder input buffers
+    mParser.setBufferProvider(&videoDecoder);
+    mParser.setReferenceLossCallback([this]() { onReferenceLoss(); });
+    // Frames dropped on the way to the decoder break the references just like lost packets
+    videoDecoder.registerOnKeyFrameNeededCallback([this]() { onReferenceLoss(); });
     videoDecoder.registerOnDecoderRatioChangedCallback(
         [this](const VideoRatio ratio)
         {
-            const bool changed      = ratio != this->latestVideoRatio;
-            this->latestVideoRatio  = ratio;
-            latestVideoRatioChanged = changed;
+            if (ratio == mLastVideoRatio)
+            {
+                return;
+            }
+            mLastVideoRatio = ratio;
+            mTelemetry.publish(
+                [&](VideoTelemetry& t)
+                {
+                    t.publishMs = get_time_ms();
+                    t.width     = ratio.width;
+                    t.height    = ratio.height;
+                    t.ratioChanges++;
+                });
         });
     videoDecoder.registerOnDecodingInfoChangedCallback(
         [this](const DecodingInfo info)
         {
-            const bool changed        = info != this->latestDecodingInfo;
-            this->latestDecodingInfo  = info;
-            latestDecodingInfoChanged = changed;
-        });
-}
-
-static int write_callback(int64_t offset, const void* buffer, size_t size, void* token)
-{
-    FILE* f = (FILE*) token;
-    fseek(f, offset, SEEK_SET);
-    return fwrite(buffer, 1, size, f) != size;
-}
-
-void VideoPlayer::processQueue()
-{
-    ::FILE*           fout = fdopen(dvr_fd, "wb");
-    MP4E_mux_t*       mux  = MP4E_open(0 /*sequential_mode*/, dvr_mp4_fragmentation, fout, write_callback);
-    mp4_h26x_writer_t mp4wr;
-    float             framerate = 0;
-    if (mux == nullptr)
-    {
-        __android_log_print(ANDROID_LOG_ERROR, TAG, "dvr open failed");
-        return;
-    }
-
-    while (true)
-    {
-        last_dvr_write = get_time_ms();
-        std::unique_lock<std::mutex> lock(mtx);
-        cv.wait(lock, [this] { return !naluQueue.empty() || stopFlag; });
-        if (stopFlag)
-        {
-            break;
-        }
-        if (!naluQueue.empty())
-        {
-            NALU nalu = naluQueue.front();
-            if (framerate == 0)
-            {
-                if (latestDecodingInfo.currentFPS <= 0)
-                {
-                    continue;
-                }
-                if (MP4E_STATUS_OK !=
-                    mp4_h26x_write_init(
-                        &mp4wr, mux, latestVideoRatio.width, latestVideoRatio.height, nalu.IS_H265_PACKET))
-                {
-                    __android_log_print(ANDROID_LOG_DEBUG, TAG, "error: mp4_h26x_write_init failed");
-                }
-                framerate = latestDecodingInfo.currentFPS;
-                __android_log_print(
-                    ANDROID_LOG_DEBUG,
-                    TAG,
-                    "mp4 init with fps=%.2f, res=%dx%d, hevc=%d",
-                    framerate,
-                    latestVideoRatio.width,
-                    latestVideoRatio.height,
-                    nalu.IS_H265_PACKET);
-            }
-            naluQueue.pop();
-            lock.unlock();
-            // Process the NALU
-            auto res = mp4_h26x_write_nal(&mp4wr, nalu.getData(), nalu.getSize(), 90000 / framerate);
-            if (MP4E_STATUS_OK != res)
+            if (info == mLastDecodingInfo)
             {
-                __android_log_print(ANDROID_LOG_DEBUG, TAG, "mp4_h26x_write_nal failed with %d", res);
+                return;
             }
-        }
-    }
-
-    MP4E_close(mux);
-    mp4_h26x_write_close(&mp4wr);
-    if (fout)
-    {
-        fclose(fout);
-        fout = NULL;
-    }
-    dvr_fd = -1;
-    __android_log_print(ANDROID_LOG_DEBUG, TAG, "dvr thread done");
+            mLastDecodingInfo = info;
+            mTelemetry.publish(
+                [&](VideoTelemetry& t)
+                {
+                    t.publishMs                = get_time_ms();
+                    t.currentFPS               = info.currentFPS;
+                    t.currentKiloBitsPerSecond = info.currentKiloBitsPerSecond;
+                    t.avgParsingTime_ms        = info.avgParsingTime_ms;
+                    t.avgWaitForInputBTime_ms  = info.avgWaitForInputBTime_ms;
+                    t.avgDecodingTime_ms       = info.avgDecodingTime_ms;
+                    t.nNALU                    = (int32_t) info.nNALU;
+                    t.nNALUSFeeded             = (int32_t) info.nNALUSFeeded;
+                    t.nDecodedFrames           = (int32_t) info.nDecodedFrames;
+                    t.nCodec                   = (int32_t) info.nCodec;
+                    t.infoChanges++;
+                });
+        });
 }
 
+static_assert(sizeof(VideoTelemetry) == 64, "VideoTelemetry.java expects 64 bytes");
+static_assert(
+    offsetof(VideoTelemetry, width) == 16 && offsetof(VideoTelemetry, currentFPS) == 24 &&
+        offsetof(VideoTelemetry, nNALU) == 44,
+    "VideoTelemetry.java offsets");
+
 // Not yet parsed bit stream (e.g. raw h264 or rtp data)
-void VideoPlayer::onNewRTPData(const uint8_t* data, const std::size_t data_length)
+void VideoPlayer::onNewRTPData(const uint8_t* data, const std::size_t data_length, int64_t originNs)
 {
     // Parse the RTP packet
     const RTP::RTPPacket rtpPacket(data, data_length);
     uint16_t             idx = rtpPacket.header.getSequence();
+    TRACE_SCOPE_ARG("rtp", idx);
+
+    if (rtpPacket.header.payload != RTP_PAYLOAD_TYPE_AUDIO)
+    {
+        const int64_t now                     = steadyNowNs();
+        mVideoReceivedNs[idx % REORDER_SLOTS] = now;
+        mVideoOriginNs[idx % REORDER_SLOTS]   = originNs != 0 ? originNs : now;
+    }
 
     // Define the callback based on payload type
     auto callback = [&](const uint8_t* packet_data, std::size_t packet_length)
@@ -122,6 +108,13 @@ void VideoPlayer::onNewRTPData(const uint8_t* data, const std::size_t data_lengt
         }
         else
         {
+            // Buffered packets come out with their own sequence number, not the one that released them
+            const uint16_t seq = RTP::RTPPacket(packet_data, packet_length).header.getSequence();
+            mLatency.recordNs(LatencyStage::REORDER, mVideoReceivedNs[seq % REORDER_SLOTS], steadyNowNs());
+            if (mNaluOriginNs == 0)
+            {
+                mNaluOriginNs = mVideoOriginNs[seq % REORDER_SLOTS];
+            }
             mParser.parse_rtp_stream(packet_data, packet_length);
         }
     };
@@ -139,16 +132,22 @@ void VideoPlayer::onNewRTPData(const uint8_t* data, const std::size_t data_lengt
 
 void VideoPlayer::onNewNALU(const NALU& nalu)
 {
-    videoDecoder.interpretNALU(nalu);
-    if (dvr_fd <= 0 || latestDecodingInfo.currentFPS <= 0)
+    TRACE_INSTANT("nalu", nalu.getSize());
+    const auto now = std::chrono::steady_clock::now();
+    mLatency.record(
+        LatencyStage::REASSEMBLY,
+        std::chrono::duration_cast<std::chrono::microseconds>(now - nalu.creationTime).count());
+    // Counted from the first packet the parser got since the previous NALU
+    const int64_t originNs = mNaluOriginNs;
+    mNaluOriginNs          = 0;
+    // Before the decoder gets it, the data may be in one of its input buffers. The feeders share the dvr's copy.
+    PooledNalu copy;
+    if (mDvr.isOpen() && mTelemetry.read().currentFPS > 0)
     {
-        return;
+        copy = videoDecoder.bufferPool().copy(nalu);
+        mDvr.enqueue(copy);
     }
-    // Copy data to write if from a different thread.
-    uint8_t* m_data_copy = new uint8_t[nalu.getSize()];
-    memcpy(m_data_copy, nalu.getData(), nalu.getSize());
-    NALU nalu_(m_data_copy, nalu.getSize(), nalu.IS_H265_PACKET);
-    enqueueNALU(nalu_);
+    videoDecoder.interpretNALU(nalu, originNs, std::move(copy));
 }
 
 void VideoPlayer::setVideoSurface(JNIEnv* env, jobject surface, jint i)
@@ -172,6 +171,14 @@ void VideoPlayer::start(JNIEnv* env, jobject androidContext)
         -16,
         [this](const uint8_t* data, size_t data_length) { onNewRTPData(data, data_length); },
         WANTED_UDP_RCVBUF_SIZE);
+    mUDPReceiver->setBatchMode(
+        [this](const UDPReceiver::ReceivedPacket* packets, size_t count)
+        {
+            for (size_t i = 0; i < count; ++i)
+            {
+                onNewRTPData(packets[i].data, packets[i].length);
+            }
+        });
     mUDPReceiver->setForwarding(mForwardIP, mForwardPort, mForwardEnabled);
     mUDPReceiver->startReceiving();
 
@@ -190,6 +197,8 @@ void VideoPlayer::start(JNIEnv* env, jobject androidContext)
     );
 
     mUDSReceiver->startReceiving();
+
+    mInProcessReceiver->startReceiving();
 }
 
 void VideoPlayer::stop(JNIEnv* env, jobject androidContext)
@@ -204,14 +213,44 @@ void VideoPlayer::stop(JNIEnv* env, jobject androidContext)
         mUDSReceiver->stopReceiving();
         mUDSReceiver.reset();
     }
+    mInProcessReceiver->stopReceiving();
+    // The link behind it may go away while stopped, start() is followed by a new setKeyframeRequester()
+    setKeyframeRequester(nullptr, nullptr);
 
     audioDecoder.stopAudio();
 }
 
+void VideoPlayer::setKeyframeRequester(KeyframeRequestFn fn, void* ctx)
+{
+    std::lock_guard<std::mutex> lock(mKeyframeRequesterMutex);
+    mKeyframeRequestFn  = fn;
+    mKeyframeRequestCtx = ctx;
+}
+
+void VideoPlayer::onReferenceLoss()
+{
+    std::lock_guard<std::mutex> lock(mKeyframeRequesterMutex);
+    const auto                  now = std::chrono::steady_clock::now();
+    if (mKeyframeRequestFn == nullptr || now - mLastKeyframeRequest < KEYFRAME_REQUEST_INTERVAL)
+    {
+        return;
+    }
+    mLastKeyframeRequest = now;
+    mNKeyframeRequests++;
+    TRACE_INSTANT("keyframe_request", mNKeyframeRequests);
+    mKeyframeRequestFn(mKeyframeRequestCtx);
+}
+
 std::string VideoPlayer::getInfoString() const
 {
     std::stringstream ss;
-    if (mUDPReceiver)
+    if (mInProcessReceiver->getNReceivedBytes() > 0)
+    {
+        ss << "Receiving video in-process from the wfb-ng link";
+        ss << "\nReceived: " << mInProcessReceiver->getNReceivedBytes() << "B"
+           << " | dropped packets: " << mInProcessReceiver->getNDroppedPackets();
+    }
+    else if (mUDPReceiver)
     {
         ss << "Listening for video on port " << mUDPReceiver->getPort();
         ss << "\nReceived: " << mUDPReceiver->getNReceivedBytes() << "B"
@@ -229,26 +268,45 @@ std::string VideoPlayer::getInfoString() const
     {
         ss << "Not receiving udp raw / rtp / rtsp";
     }
+    const auto reorder = mBufferedPacketQueueVideo.stats();
+    const auto held    = LatencyHistogram::summarize({}, mBufferedPacketQueueVideo.holdTime().snapshot());
+    ss << "\nReordered: " << reorder.nReordered << " | late: " << reorder.nLate << " | dropped: " << reorder.nDropped
+       << " | skipped: " << reorder.nSkipped << " | depth: " << reorder.depth << " | held p99: " << held.p99Us / 1000
+       << "ms";
+    ss << "\nReference losses: " << mParser.nReferenceLosses() << " | ignored losses: " << mParser.nIgnoredLosses()
+       << " | keyframe requests: " << mNKeyframeRequests;
+    for (int idx = 0; idx < 2; ++idx)
+    {
+        const auto feeder = videoDecoder.feederStats(idx);
+        if (feeder.nQueued + feeder.nDropped == 0)
+        {
+            continue;
+        }
+        ss << "\nDecoder " << idx << " fed: " << feeder.nFed << " | dropped: " << feeder.nDropped << " ("
+           << feeder.nDroppedDisposable << " disposable) | fast forwards: " << feeder.nFastForwards
+           << " | stalls: " << feeder.nStalls << " | depth: " << feeder.depth << " (max " << feeder.maxDepth << ")";
+    }
+    const auto pool = videoDecoder.bufferPool().stats();
+    ss << "\nNALU buffers: " << pool.nInUse << "/" << pool.nBuffers << " in use | " << pool.bytesInUse / 1024 << "/"
+       << pool.bytesAllocated / 1024 << "KB | allocations: " << pool.nAllocations;
+    if (mDvr.isOpen())
+    {
+        const auto dvr = mDvr.stats();
+        ss << "\nDvr queued: " << dvr.queuedBytes / 1024 << "KB (max " << dvr.maxQueuedBytes / 1024
+           << "KB) | dropped: " << dvr.nDropped;
+    }
     return ss.str();
 }
 
 void VideoPlayer::startDvr(JNIEnv* env, jint fd, jint dvr_fmp4_enabled)
 {
-    dvr_fd                = dup(fd);
-    dvr_mp4_fragmentation = dvr_fmp4_enabled;
-    __android_log_print(ANDROID_LOG_DEBUG, TAG, "dvr_fd=%d", dvr_fd);
-    if (dvr_fd == -1)
-    {
-        __android_log_print(ANDROID_LOG_DEBUG, TAG, "Failed to duplicate dvr file descriptor");
-        return;
-    }
-    startProcessing();
+    mDvr.start(fd, dvr_fmp4_enabled != 0);
 }
 
 void VideoPlayer::stopDvr()
 {
     __android_log_print(ANDROID_LOG_DEBUG, TAG, "Stop dvr");
-    stopProcessing();
+    mDvr.stop();
 }
 
 void VideoPlayer::setForwarding(const std::string& ip, int port, bool enabled)
@@ -318,6 +376,19 @@ extern "C"
         }
     }
 
+    JNI_METHOD(jlong, nativeGetInProcessSinkFn)
+    (JNIEnv* env, jclass jclass1)
+    {
+        InProcessReceiver::PUSH_FN fn = &InProcessReceiver::pushTrampoline;
+        return reinterpret_cast<intptr_t>(fn);
+    }
+
+    JNI_METHOD(jlong, nativeGetInProcessSinkCtx)
+    (JNIEnv* env, jclass jclass1, jlong nativeInstance)
+    {
+        return reinterpret_cast<intptr_t>(native(nativeInstance)->mInProcessReceiver.get());
+    }
+
     JNI_METHOD(void, nativeSetVideoSurface)
     (JNIEnv* env, jclass jclass1, jlong videoPlayerN, jobject surface, jint index)
     {
@@ -347,6 +418,7 @@ extern "C"
         {
             ret |= (p->mUDSReceiver->getNReceivedBytes() > 0);
         }
+        ret |= (p->mInProcessReceiver->getNReceivedBytes() > 0);
 
         return (jboolean) ret;
     }
@@ -371,54 +443,95 @@ extern "C"
         return (jboolean) (nalusSinceLast > 0);
     }
 
-    JNI_METHOD(void, nativeCallBack)
-    (JNIEnv* env, jclass jclass1, jobject videoParamsChangedI, jlong testReceiverN)
+    JNI_METHOD(jobject, nativeGetTelemetry)
+    (JNIEnv* env, jclass jclass1, jlong testReceiverN)
     {
-        VideoPlayer* p = native(testReceiverN);
-        // Update all java stuff
-        if (p->latestDecodingInfoChanged || p->latestVideoRatioChanged)
+        auto& telemetry = native(testReceiverN)->mTelemetry;
+        return env->NewDirectByteBuffer(telemetry.data(), telemetry.size());
+    }
+
+    // {count, avg, p50, p90, p99, max} in us for every LatencyStage, recorded since the previous call
+    JNI_METHOD(jlongArray, nativeGetLatencyStats)
+    (JNIEnv* env, jclass jclass1, jlong testReceiverN)
+    {
+        constexpr int kFields   = 6;
+        const auto    summaries = native(testReceiverN)->latencySinceLastCall();
+        jlong         values[LatencyStats::kStages * kFields];
+        for (int i = 0; i < LatencyStats::kStages; ++i)
         {
-            jclass jClassExtendsIVideoParamsChanged = env->GetObjectClass(videoParamsChangedI);
-            if (p->latestVideoRatioChanged)
-            {
-                jmethodID onVideoRatioChangedJAVA =
-                    env->GetMethodID(jClassExtendsIVideoParamsChanged, "onVideoRatioChanged", "(II)V");
-                env->CallVoidMethod(
-                    videoParamsChangedI,
-                    onVideoRatioChangedJAVA,
-                    (jint) p->latestVideoRatio.width,
-                    (jint) p->latestVideoRatio.height);
-                p->latestVideoRatioChanged = false;
-            }
-            if (p->latestDecodingInfoChanged)
+            const auto& s            = summaries[i];
+            values[i * kFields + 0] = (jlong) s.count;
+            values[i * kFields + 1] = s.avgUs;
+            values[i * kFields + 2] = s.p50Us;
+            values[i * kFields + 3] = s.p90Us;
+            values[i * kFields + 4] = s.p99Us;
+            values[i * kFields + 5] = s.maxUs;
+        }
+        jlongArray ret = env->NewLongArray(LatencyStats::kStages * kFields);
+        env->SetLongArrayRegion(ret, 0, LatencyStats::kStages * kFields, values);
+        return ret;
+    }
+
+    // {upper bound in us, count} of every non-empty bucket of one stage, counted since the player was created
+    JNI_METHOD(jlongArray, nativeGetLatencyHistogram)
+    (JNIEnv* env, jclass jclass1, jlong testReceiverN, jint stage)
+    {
+        if (stage < 0 || stage >= LatencyStats::kStages)
+        {
+            return env->NewLongArray(0);
+        }
+        const auto snapshot = native(testReceiverN)->latency().histogram((LatencyStage) stage).snapshot();
+        std::vector<jlong> values;
+        for (int i = 0; i < LatencyHistogram::kBuckets; ++i)
+        {
+            if (snapshot.counts[i] > 0)
             {
-                jclass jcDecodingInfo = env->FindClass("com/openipc/videonative/DecodingInfo");
-                assert(jcDecodingInfo != nullptr);
-                jmethodID jcDecodingInfoConstructor = env->GetMethodID(jcDecodingInfo, "<init>", "(FFFFFIIII)V");
-                assert(jcDecodingInfoConstructor != nullptr);
-                const auto info         = p->latestDecodingInfo;
-                auto       decodingInfo = env->NewObject(
-                    jcDecodingInfo,
-                    jcDecodingInfoConstructor,
-                    (jfloat) info.currentFPS,
-                    (jfloat) info.currentKiloBitsPerSecond,
-                    (jfloat) info.avgParsingTime_ms,
-                    (jfloat) info.avgWaitForInputBTime_ms,
-                    (jfloat) info.avgDecodingTime_ms,
-                    (jint) info.nNALU,
-                    (jint) info.nNALUSFeeded,
-                    (jint) info.nDecodedFrames,
-                    (jint) info.nCodec);
-                assert(decodingInfo != nullptr);
-                jmethodID onDecodingInfoChangedJAVA = env->GetMethodID(
-                    jClassExtendsIVideoParamsChanged,
-                    "onDecodingInfoChanged",
-                    "(Lcom/openipc/videonative/DecodingInfo;)V");
-                assert(onDecodingInfoChangedJAVA != nullptr);
-                env->CallVoidMethod(videoParamsChangedI, onDecodingInfoChangedJAVA, decodingInfo);
-                p->latestDecodingInfoChanged = false;
+                values.push_back(LatencyHistogram::upperBoundUs(i));
+                values.push_back((jlong) snapshot.counts[i]);
             }
         }
+        jlongArray ret = env->NewLongArray((jsize) values.size());
+        env->SetLongArrayRegion(ret, 0, (jsize) values.size(), values.data());
+        return ret;
+    }
+
+    JNI_METHOD(void, nativeSetDirectDecoderInput)
+    (JNIEnv* env, jclass jclass1, jlong testReceiverN, jboolean enable)
+    {
+        native(testReceiverN)->videoDecoder.setDirectInput(enable);
+    }
+
+    JNI_METHOD(void, nativeSetReorderMaxHoldMs)
+    (JNIEnv* env, jclass jclass1, jlong testReceiverN, jint maxHoldMs)
+    {
+        native(testReceiverN)->setReorderMaxHoldMs(maxHoldMs);
+    }
+
+    JNI_METHOD(void, nativeSetAccessUnitMode)
+    (JNIEnv* env, jclass jclass1, jlong testReceiverN, jboolean enable)
+    {
+        native(testReceiverN)->setAccessUnitMode(enable);
+    }
+
+    JNI_METHOD(void, nativeSetKeyframeRequester)
+    (JNIEnv* env, jclass jclass1, jlong testReceiverN, jlong fn, jlong ctx)
+    {
+        native(testReceiverN)->setKeyframeRequester(reinterpret_cast<VideoPlayer::KeyframeRequestFn>(fn),
+                                                    reinterpret_cast<void*>(ctx));
+    }
+
+    // Recent events of all video threads as Chrome trace JSON array elements, the caller writes the brackets
+    JNI_METHOD(void, nativeWriteTraceEvents)
+    (JNIEnv* env, jclass jclass1, jint fd)
+    {
+        trace::writeEvents(fd);
+    }
+
+    // Slow frames and stalled decoders go to the listener, which dumps the link events along with ours
+    JNI_METHOD(void, nativeSetTraceAnomalyListener)
+    (JNIEnv* env, jclass jclass1, jobject listener)
+    {
+        trace::setAnomalyListener(env, listener);
     }
 }
 
@@ -11,19 +11,45 @@
 #include <queue>
 #include "AudioDecoder.h"
 #include "BufferedPacketQueue.h"
+#include "DvrWriter.h"
+#include "InProcessReceiver.h"
+#include "LatencyStats.h"
+#include "TelemetryBlock.h"
 #include "UdpReceiver.h"
 #include "UdsReceiver.h"
 #include "VideoDecoder.h"
-#include "minimp4.h"
 #include "parser/H26XParser.h"
 #include "time_util.h"
 
+// Decoder statistics shared with Java, VideoTelemetry.java mirrors the offsets
+struct VideoTelemetry
+{
+    static constexpr uint16_t kVersion = 1;
+
+    int64_t  publishMs;     // CLOCK_MONOTONIC
+    uint32_t ratioChanges;  // incremented with every new width/height
+    uint32_t infoChanges;   // incremented with every new DecodingInfo
+    int32_t  width;
+    int32_t  height;
+    float    currentFPS;
+    float    currentKiloBitsPerSecond;
+    float    avgParsingTime_ms;
+    float    avgWaitForInputBTime_ms;
+    float    avgDecodingTime_ms;
+    int32_t  nNALU;
+    int32_t  nNALUSFeeded;
+    int32_t  nDecodedFrames;
+    int32_t  nCodec;
+    int32_t  reserved;
+};
+
 class VideoPlayer
 {
   public:
     VideoPlayer(JNIEnv* env, jobject context);
 
-    void onNewRTPData(const uint8_t* data, const std::size_t data_length);
+    // originNs: steady clock time the packet left the radio, 0 for now (socket receivers know nothing earlier)
+    void onNewRTPData(const uint8_t* data, const std::size_t data_length, int64_t originNs = 0);
 
     /*
      * Set the surface the decoder can be configured with. When @param surface==nullptr
@@ -50,13 +76,33 @@ class VideoPlayer
 
     void stopDvr();
 
-    bool isRecording() { return (get_time_ms() - last_dvr_write) <= 500; }
+    bool isRecording() { return mDvr.isRecording(); }
 
     void setForwarding(const std::string& ip, int port, bool enabled);
 
+    // Longest time the video packet queue waits for a missing packet
+    void setReorderMaxHoldMs(int maxHoldMs) { mBufferedPacketQueueVideo.setMaxHoldMs(maxHoldMs); }
+
+    // One decoder submission per frame instead of per NALU, see H26XParser
+    void setAccessUnitMode(bool enable) { mParser.setAccessUnitMode(enable); }
+
+    // Native function of another library that asks the camera for a keyframe, called with its context
+    using KeyframeRequestFn = void (*)(void* ctx);
+
+    // Requested after a loss broke a reference frame (see RTPDecoder::setReferenceLossCallback), at most once per
+    // KEYFRAME_REQUEST_INTERVAL. fn == nullptr stops the requests, so does stop(). Any thread.
+    void setKeyframeRequester(KeyframeRequestFn fn, void* ctx);
+
+    // Per stage latency of everything recorded since the previous call, for Java
+    LatencyStats::Summaries latencySinceLastCall() { return mJavaLatencyWindow.next(mLatency); }
+
+    const LatencyStats& latency() const { return mLatency; }
+
   private:
     void onNewNALU(const NALU& nalu);
 
+    void onReferenceLoss();
+
     // Assumptions: Max bitrate: 40 MBit/s, Max time to buffer: 500ms
     // 25 MB should be plenty !
     static constexpr const size_t WANTED_UDP_RCVBUF_SIZE = 1024 * 1024 * 25;
@@ -74,45 +120,23 @@ class VideoPlayer
     H26XParser          mParser;
     BufferedPacketQueue mBufferedPacketQueueVideo, mBufferedPacketQueueAudio;
 
-    // DVR attributes
-    int                     dvr_fd;
-    std::queue<NALU>        naluQueue;
-    std::mutex              mtx;
-    std::condition_variable cv;
-    bool                    stopFlag = false;
-    std::thread             processingThread;
-    int                     dvr_mp4_fragmentation = 0;
-    uint64_t                last_dvr_write        = 0;
-
-    void enqueueNALU(const NALU& nalu)
-    {
-        {
-            std::lock_guard<std::mutex> lock(mtx);
-            naluQueue.push(nalu);
-        }
-        cv.notify_one();
-    }
-
-    void startProcessing()
-    {
-        stopFlag         = false;
-        processingThread = std::thread(&VideoPlayer::processQueue, this);
-    }
-
-    void stopProcessing()
-    {
-        {
-            std::lock_guard<std::mutex> lock(mtx);
-            stopFlag = true;
-        }
-        cv.notify_all();
-        if (processingThread.joinable())
-        {
-            processingThread.join();
-        }
-    }
-
-    void processQueue();
+    LatencyStats         mLatency;
+    LatencyStats::Window mJavaLatencyWindow;
+    // Receive and origin time of the video packets the BufferedPacketQueue may still hold, by sequence number.
+    // The queue holds less than REORDER_RING_SIZE packets, so the slots are not reused before they are delivered.
+    static constexpr size_t            REORDER_SLOTS = 1024;
+    std::array<int64_t, REORDER_SLOTS> mVideoReceivedNs{};
+    std::array<int64_t, REORDER_SLOTS> mVideoOriginNs{};
+    // Origin of the first packet delivered to the parser since the last NALU, 0 if none
+    int64_t mNaluOriginNs = 0;
+
+    // A keyframe takes a few frames to arrive, the losses until then don't need another one
+    static constexpr auto                 KEYFRAME_REQUEST_INTERVAL = std::chrono::milliseconds(100);
+    std::mutex                            mKeyframeRequesterMutex;
+    KeyframeRequestFn                     mKeyframeRequestFn  = nullptr;
+    void*                                 mKeyframeRequestCtx = nullptr;
+    std::chrono::steady_clock::time_point mLastKeyframeRequest;
+    int                                   mNKeyframeRequests = 0;
 
     std::string mForwardIP = "";
     int         mForwardPort = 0;
@@ -123,15 +147,26 @@ class VideoPlayer
     VideoDecoder                 videoDecoder;
     std::unique_ptr<UDPReceiver> mUDPReceiver;
     std::unique_ptr<UDSReceiver> mUDSReceiver;
+    // Lives as long as the player, the wfb-ng link keeps a raw pointer to it as its video sink
+    std::unique_ptr<InProcessReceiver> mInProcessReceiver;
     long                         nNALUsAtLastCall = 0;
 
   public:
-    DecodingInfo      latestDecodingInfo{};
-    std::atomic<bool> latestDecodingInfoChanged = false;
-    VideoRatio        latestVideoRatio{};
-    std::atomic<bool> latestVideoRatioChanged = false;
+    // Written by the decoder callbacks, read by Java and the dvr
+    TelemetryBlock<VideoTelemetry> mTelemetry{VideoTelemetry::kVersion};
+    // Last values of each callback, only touched by the callback itself
+    DecodingInfo mLastDecodingInfo{};
+    VideoRatio   mLastVideoRatio{};
 
     bool lastFrameWasAUD = false;
+
+  private:
+    // Last, its writer thread reads mTelemetry until it is stopped
+    DvrWriter mDvr{[this]()
+                   {
+                       const VideoTelemetry video = mTelemetry.read();
+                       return DvrWriter::VideoFormat{video.width, video.height, video.currentFPS};
+                   }};
 };
 
 #endif  // FPV_VR_VIDEOPLAYERN_H
@@ -27,7 +27,7 @@ void writeAndroidPerformanceParams(AMediaFormat* format)
     // AMediaFormat_setInt32(format,AMEDIAFORMAT_KEY_OPERATING_RATE,0);
 }
 
-static void h264_configureAMediaFormat(KeyFrameFinder& kff, AMediaFormat* format)
+static void h264_configureAMediaFormat(const KeyFrameFinder& kff, AMediaFormat* format)
 {
     const auto sps     = kff.getCSD0();
     const auto pps     = kff.getCSD1();
@@ -45,7 +45,7 @@ static void h264_configureAMediaFormat(KeyFrameFinder& kff, AMediaFormat* format
     // writeAndroidPerformanceParams(format);
 }
 
-static void h265_configureAMediaFormat(KeyFrameFinder& kff, AMediaFormat* format)
+static void h265_configureAMediaFormat(const KeyFrameFinder& kff, AMediaFormat* format)
 {
     std::vector<uint8_t> buff = {};
     const auto           sps  = kff.getCSD0();
@@ -0,0 +1,502 @@
+// Replays an RTP video capture (tcpdump / Wireshark pcap of the UDP stream on port 5600) through the receive path
+// VideoPlayer runs on the phone: the reorder queue, the H26XParser with its fragments lent from the decoder input
+// buffers, VideoDecoder with its key frame handling and statistics, and optionally the DVR. Only the decoder differs.
+//
+//   video_replay [-p udp_port] [-d null|sw] [-t threads] [-s speed | -m] [-a] [-w] [-r out.mp4] [-f fps] capture.pcap
+//
+//   -d null    no decoding, measures everything around the decoder (default)
+//   -d sw      FFmpeg software decoder, if the tool was built with it
+//   -s speed   replay at speed x the recorded pace (default 1)
+//   -m         as fast as possible
+//   -a         access unit mode of the parser
+//   -w         feed every NALU, waiting for the decoder instead of dropping by priority (for decoder benchmarks)
+//   -r         record like the DVR, at -f fps (default 60)
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "BufferedPacketQueue.h"
+#include "DvrWriter.h"
+#include "LatencyStats.h"
+#include "NullDecoderBackend.h"
+#include "VideoDecoder.h"
+#include "parser/H26XParser.h"
+#include "parser/RTP.hpp"
+#ifdef HAVE_SOFTWARE_DECODER
+#include "SoftwareDecoderBackend.h"
+#endif
+
+namespace
+{
+int64_t nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+/**
+ * Reader of classic pcap files, in either byte order and with micro- or nanosecond timestamps. Finds the UDP
+ * payloads sent to one port in IPv4 over Ethernet, Linux cooked (v1 and v2), BSD loopback and raw IP captures.
+ */
+class PcapReader
+{
+  public:
+    ~PcapReader()
+    {
+        if (mFile != nullptr)
+        {
+            fclose(mFile);
+        }
+    }
+
+    bool open(const char* path)
+    {
+        mFile = fopen(path, "rb");
+        if (mFile == nullptr)
+        {
+            perror(path);
+            return false;
+        }
+        uint8_t header[24];
+        if (fread(header, 1, sizeof(header), mFile) != sizeof(header))
+        {
+            fprintf(stderr, "%s: not a pcap file\n", path);
+            return false;
+        }
+        const uint32_t magic = read32(header);
+        switch (magic)
+        {
+            case 0xa1b2c3d4:
+            case 0xa1b23c4d:
+                break;
+            case 0xd4c3b2a1:
+            case 0x4d3cb2a1:
+                mSwapped = true;
+                break;
+            default:
+                fprintf(stderr, "%s: not a pcap file (pcapng is not supported)\n", path);
+                return false;
+        }
+        mNanoseconds = magic == 0xa1b23c4d || magic == 0x4d3cb2a1;
+        mLinkType    = read32(header + 20) & 0xFFFF;
+        switch (mLinkType)
+        {
+            case LINKTYPE_NULL:
+            case LINKTYPE_ETHERNET:
+            case LINKTYPE_RAW:
+            case LINKTYPE_RAW_OPENBSD:
+            case LINKTYPE_LINUX_SLL:
+            case LINKTYPE_LINUX_SLL2:
+                return true;
+            default:
+                fprintf(stderr, "%s: link type %u is not supported\n", path, mLinkType);
+                return false;
+        }
+    }
+
+    /**
+     * Reads up to the next UDP datagram for @param port.
+     * @return false at the end of the file
+     */
+    bool next(uint16_t port, const uint8_t*& payload, size_t& length, int64_t& timestampNs)
+    {
+        uint8_t header[16];
+        while (fread(header, 1, sizeof(header), mFile) == sizeof(header))
+        {
+            const uint32_t captured = read32(header + 8);
+            mFrame.resize(captured);
+            if (fread(mFrame.data(), 1, captured, mFile) != captured)
+            {
+                return false;
+            }
+            timestampNs =
+                (int64_t) read32(header) * 1000000000 + (int64_t) read32(header + 4) * (mNanoseconds ? 1 : 1000);
+            if (findUdp(port, payload, length))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+  private:
+    static constexpr uint32_t LINKTYPE_NULL        = 0;
+    static constexpr uint32_t LINKTYPE_ETHERNET    = 1;
+    static constexpr uint32_t LINKTYPE_RAW_OPENBSD = 12;
+    static constexpr uint32_t LINKTYPE_RAW         = 101;
+    static constexpr uint32_t LINKTYPE_LINUX_SLL   = 113;
+    static constexpr uint32_t LINKTYPE_LINUX_SLL2  = 276;
+    static constexpr uint16_t ETHERTYPE_IPV4       = 0x0800;
+    static constexpr uint16_t ETHERTYPE_VLAN       = 0x8100;
+
+    uint32_t read32(const uint8_t* p) const
+    {
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+        return mSwapped ? __builtin_bswap32(v) : v;
+    }
+
+    static uint16_t be16(const uint8_t* p) { return (uint16_t) ((p[0] << 8) | p[1]); }
+
+    bool findUdp(uint16_t port, const uint8_t*& payload, size_t& length) const
+    {
+        const uint8_t* p    = mFrame.data();
+        size_t         size = mFrame.size();
+        // Skip the link layer header, knowing the network protocol from it where possible
+        uint16_t etherType = ETHERTYPE_IPV4;
+        size_t   linkSize  = 0;
+        switch (mLinkType)
+        {
+            case LINKTYPE_NULL:
+                linkSize = 4;
+                break;
+            case LINKTYPE_ETHERNET:
+                linkSize = 14;
+                if (size < linkSize) return false;
+                etherType = be16(p + 12);
+                while (etherType == ETHERTYPE_VLAN && size >= linkSize + 4)
+                {
+                    etherType = be16(p + linkSize + 2);
+                    linkSize += 4;
+                }
+                break;
+            case LINKTYPE_LINUX_SLL:
+                linkSize = 16;
+                if (size < linkSize) return false;
+                etherType = be16(p + 14);
+                break;
+            case LINKTYPE_LINUX_SLL2:
+                linkSize = 20;
+                if (size < linkSize) return false;
+                etherType = be16(p);
+                break;
+            default:
+                break;
+        }
+        if (etherType != ETHERTYPE_IPV4 || size < linkSize + 20)
+        {
+            return false;
+        }
+        p += linkSize;
+        size -= linkSize;
+
+        const size_t ipHeaderSize = (p[0] & 0x0F) * 4;
+        const size_t ipTotal      = be16(p + 2);
+        // IPv4, UDP, not a fragment
+        if ((p[0] >> 4) != 4 || p[9] != 17 || (be16(p + 6) & 0x3FFF) != 0 || ipHeaderSize < 20 ||
+            ipTotal < ipHeaderSize + 8 || ipTotal > size)
+        {
+            return false;
+        }
+        const uint8_t* udp = p + ipHeaderSize;
+        if (be16(udp + 2) != port)
+        {
+            return false;
+        }
+        const size_t udpLength = be16(udp + 4);
+        if (udpLength < 8 || udpLength > ipTotal - ipHeaderSize)
+        {
+            return false;
+        }
+        payload = udp + 8;
+        length  = udpLength - 8;
+        return true;
+    }
+
+    FILE*                mFile        = nullptr;
+    bool                 mSwapped     = false;
+    bool                 mNanoseconds = false;
+    uint32_t             mLinkType    = 0;
+    std::vector<uint8_t> mFrame;
+};
+
+/**
+ * The video half of VideoPlayer: the same queue, parser and decoder wiring, the same latency stages.
+ */
+class ReplayPlayer
+{
+  public:
+    ReplayPlayer(DecoderBackendFactory backend, float dvrFps)
+        : mParser{[this](const NALU& nalu) { onNewNALU(nalu); }},
+          mDvr{[this, dvrFps]() { return DvrWriter::VideoFormat{mRatio.width, mRatio.height, dvrFps}; }}
+    {
+        mDecoder.setLatencyStats(&mLatency);
+        mParser.setBufferProvider(&mDecoder);
+        mDecoder.registerOnDecoderRatioChangedCallback([this](const VideoRatio ratio) { mRatio = ratio; });
+        mDecoder.registerOnDecodingInfoChangedCallback([this](const DecodingInfo info) { mInfo = info; });
+        mDecoder.setOutput(0, std::move(backend));
+    }
+
+    ~ReplayPlayer()
+    {
+        mDvr.stop();
+        mDecoder.setOutput(0, nullptr);
+    }
+
+    void onNewRTPData(const uint8_t* data, size_t length)
+    {
+        if (length < sizeof(rtp_header_t))
+        {
+            return;
+        }
+        const RTP::RTPPacket rtpPacket(data, length);
+        if (rtpPacket.header.payload == RTP_PAYLOAD_TYPE_AUDIO)
+        {
+            return;
+        }
+        const uint16_t idx = rtpPacket.header.getSequence();
+        mReceivedNs[idx % REORDER_SLOTS] = nowNs();
+        auto callback = [this](const uint8_t* packet_data, std::size_t packet_length)
+        {
+            const uint16_t seq = RTP::RTPPacket(packet_data, packet_length).header.getSequence();
+            mLatency.recordNs(LatencyStage::REORDER, mReceivedNs[seq % REORDER_SLOTS], nowNs());
+            mParser.parse_rtp_stream(packet_data, packet_length);
+        };
+        mQueue.processPacket(idx, data, length, callback);
+    }
+
+    void onNewNALU(const NALU& nalu)
+    {
+        mLatency.record(
+            LatencyStage::REASSEMBLY,
+            std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - nalu.creationTime)
+                .count());
+        PooledNalu copy;
+        if (mDvr.isOpen() && mRatio.width > 0)
+        {
+            copy = mDecoder.bufferPool().copy(nalu);
+            mDvr.enqueue(copy);
+        }
+        mDecoder.interpretNALU(nalu, 0, std::move(copy));
+    }
+
+    H26XParser          mParser;
+    VideoDecoder        mDecoder;
+    BufferedPacketQueue mQueue;
+    LatencyStats        mLatency;
+    VideoRatio          mRatio;
+    DecodingInfo        mInfo;
+    DvrWriter           mDvr;
+
+  private:
+    static constexpr size_t            REORDER_SLOTS = 1024;
+    std::array<int64_t, REORDER_SLOTS> mReceivedNs{};
+};
+
+void usage()
+{
+    fprintf(stderr,
+            "usage: video_replay [-p udp_port] [-d null|sw] [-t threads] [-s speed | -m] [-a] [-w] [-r out.mp4] "
+            "[-f fps] capture.pcap\n");
+}
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    int         port       = 5600;
+    std::string backend    = "null";
+    int         threads    = 1;
+    double      speed      = 1.0;
+    bool        accessUnit = false;
+    bool        lossless   = false;
+    const char* dvrPath    = nullptr;
+    float       dvrFps     = 60;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "p:d:t:s:mawr:f:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'p':
+                port = atoi(optarg);
+                break;
+            case 'd':
+                backend = optarg;
+                break;
+            case 't':
+                threads = atoi(optarg);
+                break;
+            case 's':
+                speed = atof(optarg);
+                break;
+            case 'm':
+                speed = 0;
+                break;
+            case 'a':
+                accessUnit = true;
+                break;
+            case 'w':
+                lossless = true;
+                break;
+            case 'r':
+                dvrPath = optarg;
+                break;
+            case 'f':
+                dvrFps = (float) atof(optarg);
+                break;
+            default:
+                usage();
+                return 1;
+        }
+    }
+    if (optind != argc - 1 || port <= 0 || port > 65535 || dvrFps <= 0)
+    {
+        usage();
+        return 1;
+    }
+
+    DecoderBackendFactory factory;
+    NullDecoderBackend*   nullBackend = nullptr;
+    if (backend == "null")
+    {
+        factory = [&nullBackend]()
+        {
+            auto b      = std::make_unique<NullDecoderBackend>();
+            nullBackend = b.get();
+            return b;
+        };
+    }
+#ifdef HAVE_SOFTWARE_DECODER
+    else if (backend == "sw")
+    {
+        factory = [threads]() { return std::make_unique<SoftwareDecoderBackend>(threads); };
+    }
+#endif
+    else
+    {
+        fprintf(stderr, "decoder backend '%s' is not available\n", backend.c_str());
+        return 1;
+    }
+    (void) threads;
+
+    PcapReader reader;
+    if (!reader.open(argv[optind]))
+    {
+        return 1;
+    }
+    auto player = std::make_unique<ReplayPlayer>(std::move(factory), dvrFps);
+    player->mParser.setAccessUnitMode(accessUnit);
+    if (lossless)
+    {
+        player->mDecoder.setFeedPolicy(0, FeedPolicy::WAIT, VideoDecoder::FEED_QUEUE_CAPACITY, std::chrono::milliseconds(0));
+    }
+    if (dvrPath != nullptr)
+    {
+        const int fd = ::open(dvrPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+        {
+            perror(dvrPath);
+            return 1;
+        }
+        player->mDvr.start(fd, false);
+        close(fd);
+    }
+
+    const uint8_t* payload;
+    size_t         length;
+    int64_t        timestampNs;
+    int64_t        firstTimestampNs = -1;
+    size_t         packets          = 0;
+    uint64_t       bytes            = 0;
+    const int64_t  startNs          = nowNs();
+    while (reader.next((uint16_t) port, payload, length, timestampNs))
+    {
+        if (firstTimestampNs < 0)
+        {
+            firstTimestampNs = timestampNs;
+        }
+        if (speed > 0)
+        {
+            const int64_t wait = startNs + (int64_t) ((timestampNs - firstTimestampNs) / speed) - nowNs();
+            if (wait > 0)
+            {
+                std::this_thread::sleep_for(std::chrono::nanoseconds(wait));
+            }
+        }
+        player->onNewRTPData(payload, length);
+        packets++;
+        bytes += length;
+    }
+    const double seconds = (nowNs() - startNs) / 1e9;
+    // Let the output thread take the last frames
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    printf("%.2f s, %zu packets (%.2f MBit/s), %ld NALUs, %ld key frames, %ld access units\n",
+           seconds,
+           packets,
+           bytes * 8 / seconds / 1e6,
+           player->mParser.nParsedNALUs,
+           player->mParser.nParsedKonfigurationFrames,
+           player->mParser.nAccessUnits);
+    printf("video %dx%d, %s\n", player->mRatio.width, player->mRatio.height, backend.c_str());
+    if (nullBackend != nullptr)
+    {
+        printf("null decoder: %ld frames\n", nullBackend->nRenderedFrames.load());
+    }
+    const auto feeder = player->mDecoder.feederStats(0);
+    printf("feeder: %llu queued, %llu fed, %llu dropped (%llu disposable), %llu fast forwards, %llu stalls, "
+           "max depth %zu\n",
+           (unsigned long long) feeder.nQueued,
+           (unsigned long long) feeder.nFed,
+           (unsigned long long) feeder.nDropped,
+           (unsigned long long) feeder.nDroppedDisposable,
+           (unsigned long long) feeder.nFastForwards,
+           (unsigned long long) feeder.nStalls,
+           feeder.maxDepth);
+    const auto pool = player->mDecoder.bufferPool().stats();
+    printf("nalu buffers: %zu, %zu KB, %llu allocations\n",
+           pool.nBuffers,
+           pool.bytesAllocated / 1024,
+           (unsigned long long) pool.nAllocations);
+    if (dvrPath != nullptr)
+    {
+        const auto dvr = player->mDvr.stats();
+        printf("dvr: max %zu KB queued, %llu dropped\n", dvr.maxQueuedBytes / 1024, (unsigned long long) dvr.nDropped);
+    }
+    const DecodingInfo& info = player->mInfo;
+    printf("decoder (last 2 s): %.1f fps, %.0f kbit/s, parsing %.2f ms, input wait %.2f ms, decoding %.2f ms\n",
+           info.currentFPS,
+           info.currentKiloBitsPerSecond,
+           info.avgParsingTime_ms,
+           info.avgWaitForInputBTime_ms,
+           info.avgDecodingTime_ms);
+    const auto reorder = player->mQueue.stats();
+    printf("reorder: %llu reordered, %llu late, %llu dropped, %llu skipped\n",
+           (unsigned long long) reorder.nReordered,
+           (unsigned long long) reorder.nLate,
+           (unsigned long long) reorder.nDropped,
+           (unsigned long long) reorder.nSkipped);
+    printf("reference losses: %d, ignored losses: %d\n",
+           player->mParser.nReferenceLosses(),
+           player->mParser.nIgnoredLosses());
+
+    LatencyStats::Window window;
+    const auto           summaries = window.next(player->mLatency);
+    printf("%-14s %8s %8s %8s %8s %8s %8s\n", "stage us", "count", "avg", "p50", "p90", "p99", "max");
+    for (int i = 0; i < LatencyStats::kStages; ++i)
+    {
+        const auto& s = summaries[i];
+        if (s.count == 0)
+        {
+            continue;
+        }
+        printf("%-14s %8llu %8lld %8lld %8lld %8lld %8lld\n",
+               LatencyStats::name((LatencyStage) i),
+               (unsigned long long) s.count,
+               (long long) s.avgUs,
+               (long long) s.p50Us,
+               (long long) s.p90Us,
+               (long long) s.p99Us,
+               (long long) s.maxUs);
+    }
+    player.reset();
+    return 0;
+}
@@ -22,6 +22,7 @@ H26XParser::H26XParser(NALU_DATA_CALLBACK onNewNALU)
 void H26XParser::reset()
 {
     mDecodeRTP.reset();
+    mAccessUnit.clear();
     nParsedNALUs               = 0;
     nParsedKonfigurationFrames = 0;
 }
@@ -29,6 +30,11 @@ void H26XParser::reset()
 void H26XParser::parse_rtp_stream(const uint8_t* rtp_data, const size_t data_length)
 {
     const RTP::RTPPacket rtpPacket(rtp_data, data_length);
+    if (mAccessUnitModeRequested != mAccessUnitMode)
+    {
+        applyAccessUnitMode();
+    }
+    mRtpTimestamp = rtpPacket.header.getTimestamp();
     if (rtpPacket.header.payload == RTP_PAYLOAD_TYPE_H264)
     {
         IS_H265 = false;
@@ -39,6 +45,31 @@ void H26XParser::parse_rtp_stream(const uint8_t* rtp_data, const size_t data_len
         IS_H265 = true;
         mDecodeRTP.parseRTPH265toNALU(rtp_data, data_length);
     }
+    else
+    {
+        return;
+    }
+    // The marker is set on the last packet of a frame, no need to wait for the first packet of the next one
+    if (mAccessUnitMode && rtpPacket.header.marker)
+    {
+        flushAccessUnit();
+    }
+}
+
+void H26XParser::setBufferProvider(NaluBufferProvider* provider)
+{
+    mProvider = provider;
+    if (!mAccessUnitMode)
+    {
+        mDecodeRTP.setBufferProvider(provider);
+    }
+}
+
+void H26XParser::applyAccessUnitMode()
+{
+    flushAccessUnit();
+    mAccessUnitMode = mAccessUnitModeRequested;
+    mDecodeRTP.setBufferProvider(mAccessUnitMode ? nullptr : mProvider);
 }
 
 void H26XParser::onNewNaluDataExtracted(
@@ -50,14 +81,66 @@ void H26XParser::onNewNaluDataExtracted(
 
 void H26XParser::newNaluExtracted(const NALU& nalu)
 {
-    if (onNewNALU != nullptr)
-    {
-        onNewNALU(nalu);
-    }
+    // Before the callback, the data may be in a decoder input buffer that is queued by it
     nParsedNALUs++;
     const bool sps_or_pps = nalu.isSPS() || nalu.isPPS();
     if (sps_or_pps)
     {
         nParsedKonfigurationFrames++;
     }
+    if (!mAccessUnitMode)
+    {
+        forwardNALU(nalu);
+    }
+    else if (nalu.is_config())
+    {
+        // Goes ahead of the frame it belongs to, a previous frame that lost its marker goes first
+        flushAccessUnit();
+        forwardNALU(nalu);
+    }
+    else
+    {
+        appendToAccessUnit(nalu);
+    }
+}
+
+void H26XParser::forwardNALU(const NALU& nalu)
+{
+    if (onNewNALU != nullptr)
+    {
+        onNewNALU(nalu);
+    }
+}
+
+void H26XParser::appendToAccessUnit(const NALU& nalu)
+{
+    if (!mAccessUnit.empty() && mRtpTimestamp != mAccessUnitTimestamp)
+    {
+        // The packet with the marker of the previous frame was lost
+        nAccessUnitsWithoutMark++;
+        flushAccessUnit();
+    }
+    if (mAccessUnit.empty())
+    {
+        mAccessUnitTimestamp    = mRtpTimestamp;
+        mAccessUnitCreationTime = nalu.creationTime;
+        mAccessUnitInfo         = {};
+    }
+    mAccessUnit.insert(mAccessUnit.end(), nalu.getData(), nalu.getData() + nalu.getSize());
+    // One IDR slice makes it a keyframe, one reference slice makes it needed by later frames
+    mAccessUnitInfo.keyframe   = mAccessUnitInfo.keyframe || nalu.is_keyframe();
+    mAccessUnitInfo.disposable = mAccessUnitInfo.disposable && nalu.is_disposable();
+}
+
+void H26XParser::flushAccessUnit()
+{
+    if (mAccessUnit.empty())
+    {
+        return;
+    }
+    nAccessUnits++;
+    const NALU accessUnit(
+        mAccessUnit.data(), mAccessUnit.size(), IS_H265, mAccessUnitCreationTime, true, mAccessUnitInfo);
+    forwardNALU(accessUnit);
+    mAccessUnit.clear();
 }
@@ -5,15 +5,19 @@
 #ifndef FPV_VR_PARSE2H264RAW_H
 #define FPV_VR_PARSE2H264RAW_H
 
+#include <atomic>
 #include <functional>
 #include <sstream>
+#include <vector>
 
 /**
  * Input:
  * 1) rtp packets (h264/h265)
  * 2) raw packets (h264/h265)
  * Output:
- * NAL units in the onNewNalu callback, one after another
+ * NAL units in the onNewNalu callback, one after another.
+ * In access unit mode all NALUs of a frame (same RTP timestamp) are forwarded as one, as soon as the packet with the
+ * marker bit was parsed. SPS / PPS / VPS are still forwarded on their own, the decoder needs them to configure.
  */
 //
 
@@ -34,9 +38,25 @@ class H26XParser
 
     void reset();
 
+    // See RTPDecoder::setBufferProvider. Not used in access unit mode, a frame is assembled from several NALUs.
+    void setBufferProvider(NaluBufferProvider* provider);
+
+    // Takes effect with the next packet, may be called from any thread
+    void setAccessUnitMode(bool enable) { mAccessUnitModeRequested = enable; }
+
+    // See RTPDecoder::setReferenceLossCallback, call before parsing starts
+    void setReferenceLossCallback(std::function<void()> cb) { mDecodeRTP.setReferenceLossCallback(std::move(cb)); }
+
+    int nReferenceLosses() const { return mDecodeRTP.m_n_reference_losses; }
+
+    int nIgnoredLosses() const { return mDecodeRTP.m_n_ignored_losses; }
+
   public:
     long nParsedNALUs               = 0;
     long nParsedKonfigurationFrames = 0;
+    // Frames forwarded in access unit mode, and those flushed by a new RTP timestamp because the marker got lost
+    long nAccessUnits            = 0;
+    long nAccessUnitsWithoutMark = 0;
 
     // For live video set to -1 (no fps limitation), else additional latency will be generated
     void setLimitFPS(int maxFPS);
@@ -44,6 +64,16 @@ class H26XParser
   private:
     void newNaluExtracted(const NALU& nalu);
 
+    void forwardNALU(const NALU& nalu);
+
+    void appendToAccessUnit(const NALU& nalu);
+
+    // Forwards the NALUs collected for the current frame, if any
+    void flushAccessUnit();
+
+    // Switches between NALU and access unit mode on the parsing thread
+    void applyAccessUnitMode();
+
     void onNewNaluDataExtracted(
         const std::chrono::steady_clock::time_point creation_time, const uint8_t* nalu_data, const int nalu_data_size);
 
@@ -53,6 +83,17 @@ class H26XParser
 
     RTPDecoder mDecodeRTP;
 
+    NaluBufferProvider* mProvider = nullptr;
+    std::atomic<bool>   mAccessUnitModeRequested{false};
+    bool                mAccessUnitMode = false;
+    // Grows to the largest frame seen
+    std::vector<uint8_t>                  mAccessUnit;
+    std::chrono::steady_clock::time_point mAccessUnitCreationTime;
+    NALU::AccessUnitInfo                  mAccessUnitInfo;
+    uint32_t                              mAccessUnitTimestamp = 0;
+    // Of the packet being parsed
+    uint32_t mRtpTimestamp = 0;
+
     int  maxFPS  = 0;
     bool IS_H265 = false;
     // First time a NALU was succesfully decoded
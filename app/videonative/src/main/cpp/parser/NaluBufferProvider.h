@@ -0,0 +1,49 @@
+//
+// NaluBufferProvider.h
+// Lets RTPDecoder reassemble a NALU straight into memory of its consumer, a decoder input buffer, instead of its
+// staging buffer. That saves copying every NALU from the one into the other.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * RTPDecoder asks for a buffer when a NALU starts, copies the fragments into it and forwards the NALU through its
+ * regular callback with the data pointing into the buffer. The consumer recognizes the pointer and queues the
+ * buffer as is. If no buffer is free, or the NALU outgrows it, RTPDecoder uses its staging buffer as before.
+ *
+ * The provider is BasicLockable: RTPDecoder holds the lock while it writes into a provided buffer or forwards a NALU
+ * from it, so the provider can't take the buffer back (e.g. stop the decoder) in the middle. The lock must be
+ * recursive, the consumer takes it again while the NALU is forwarded.
+ */
+class NaluBufferProvider
+{
+  public:
+    struct Buffer
+    {
+        uint8_t* data     = nullptr;
+        size_t   capacity = 0;
+        // Opaque to RTPDecoder, e.g. the MediaCodec buffer index
+        int64_t id = -1;
+    };
+
+    virtual ~NaluBufferProvider() = default;
+
+    virtual void lock() = 0;
+
+    virtual void unlock() = 0;
+
+    // A buffer for the NALU that starts now, data == nullptr if there is none. Must not block. Called locked.
+    virtual Buffer acquire() = 0;
+
+    // False once the provider took @param buffer back, its content is lost then. Called locked.
+    virtual bool isValid(const Buffer& buffer) = 0;
+
+    /**
+     * RTPDecoder is done with @param buffer, after the NALU in it was forwarded or dropped. Unless the consumer
+     * queued it while the NALU was forwarded, the buffer goes back to the provider. Called locked.
+     */
+    virtual void release(const Buffer& buffer) = 0;
+};
@@ -3,8 +3,10 @@
 //
 
 #include "ParseRTP.h"
+#include <algorithm>
 #include <cstring>
 #include <iostream>
+#include <mutex>
 #include "../helper/AndroidLogger.hpp"
 
 static int diff_between_packets(int last_packet, int curr_packet)
@@ -36,11 +38,89 @@ RTPDecoder::RTPDecoder(RTP_FRAME_DATA_CALLBACK cb, bool feed_incomplete_frames)
 
 void RTPDecoder::reset()
 {
-    m_nalu_data_length       = 0;
+    discard_nalu();
     lastSequenceNumber       = -1;
     flagPacketHasGoneMissing = false;
     m_n_gaps                 = 0;
-    // nalu_data.reserve(NALU::NALU_MAXLEN);
+    m_gap_before_packet      = false;
+    m_frame_reference        = -1;
+    m_loss_pending           = false;
+}
+
+void RTPDecoder::setReferenceLossCallback(std::function<void()> cb)
+{
+    m_reference_loss_cb = std::move(cb);
+}
+
+// 1 if the packet is part of a NALU other frames reference, 0 if of a slice nothing references, -1 if it doesn't tell
+static int h264_packet_reference(const RTP::RTPPacketH264& packet)
+{
+    const auto& nalu_header = packet.getNALUHeaderH264();
+    int         type        = nalu_header.type;
+    if (type == 28)
+    {
+        if (packet.rtpPayloadSize < sizeof(nalu_header_t) + sizeof(fu_header_t)) return -1;
+        type = packet.getFuHeader().type;
+    }
+    // Slices (1..5) with nal_ref_idc 0 are not referenced, SEI and AUD always have 0
+    if (type >= 1 && type <= 5) return nalu_header.nri != 0 ? 1 : 0;
+    return nalu_header.nri != 0 ? 1 : -1;
+}
+
+static int h265_packet_reference(const RTP::RTPPacketH265& packet)
+{
+    int type = packet.getNALUHeaderH265().type;
+    if (type == 49)
+    {
+        if (packet.rtpPayloadSize < sizeof(nal_unit_header_h265_t) + sizeof(fu_header_h265_t)) return -1;
+        type = packet.getFuHeader().fuType;
+    }
+    // TRAIL_N, TSA_N, STSA_N, RADL_N, RASL_N and the reserved ones are even types up to 14
+    if (type < 32) return (type <= 14 && type % 2 == 0) ? 0 : 1;
+    // VPS, SPS, PPS and aggregation packets (usually of these)
+    if (type <= 34 || type == 48) return 1;
+    return -1;
+}
+
+void RTPDecoder::track_reference_loss(const uint32_t timestamp, const int reference)
+{
+    bool gap            = m_gap_before_packet;
+    m_gap_before_packet = false;
+    if (timestamp != m_frame_timestamp)
+    {
+        // Packets lost across a frame boundary may have been a whole frame, assume it was referenced
+        if (m_loss_pending || gap)
+        {
+            resolve_loss(true);
+        }
+        gap               = false;
+        m_frame_timestamp = timestamp;
+        m_frame_reference = -1;
+    }
+    m_frame_reference = std::max(m_frame_reference, reference);
+    if (gap)
+    {
+        m_loss_pending = true;
+    }
+    if (m_loss_pending && m_frame_reference != -1)
+    {
+        resolve_loss(m_frame_reference == 1);
+    }
+}
+
+void RTPDecoder::resolve_loss(const bool reference)
+{
+    m_loss_pending = false;
+    if (!reference)
+    {
+        m_n_ignored_losses++;
+        return;
+    }
+    m_n_reference_losses++;
+    if (m_reference_loss_cb)
+    {
+        m_reference_loss_cb();
+    }
 }
 
 bool RTPDecoder::validateRTPPacket(const rtp_header_t& rtp_header)
@@ -76,6 +156,7 @@ bool RTPDecoder::validateRTPPacket(const rtp_header_t& rtp_header)
             // Diff:"<<(seqNr-(int)lastSequenceNumber)<<" total:"<<m_n_gaps;
             flagPacketHasGoneMissing = true;
             m_n_gaps++;
+            m_gap_before_packet = true;
             const auto gap_size = seqNr - (int) lastSequenceNumber;
             m_n_lost_packets += gap_size;
             // Feed it anyways (buggy / hacky)
@@ -107,10 +188,8 @@ void RTPDecoder::h264_reconstruct_and_forward_one_nalu(const uint8_t* data, cons
     append_nalu_data_byte(h264_nal_header);
     // write the rest of the data
     append_nalu_data(&data[1], (size_t) data_size - 1);
-    // forward via callback
+    // forward via callback, which also clears the buffer
     forwardNALU();
-    // reset length after forwarding
-    m_nalu_data_length = 0;
 }
 
 void RTPDecoder::parseRTPH264toNALU(const uint8_t* rtp_data, const size_t data_length)
@@ -121,6 +200,7 @@ void RTPDecoder::parseRTPH264toNALU(const uint8_t* rtp_data, const size_t data_l
         MLOGD << "Not enough rtp data";
         return;
     }
+    const auto providerLock = lock_provider();
     // MLOGD<<"Got h264 rtp data";
     const RTP::RTPPacketH264 rtpPacket(rtp_data, data_length);
 
@@ -135,6 +215,7 @@ void RTPDecoder::parseRTPH264toNALU(const uint8_t* rtp_data, const size_t data_l
     {
         return;
     }
+    track_reference_loss(rtpPacket.header.getTimestamp(), h264_packet_reference(rtpPacket));
     const auto& nalu_header = rtpPacket.getNALUHeaderH264();
     if (nalu_header.type == 28)
     { /* FU-A */
@@ -156,7 +237,7 @@ void RTPDecoder::parseRTPH264toNALU(const uint8_t* rtp_data, const size_t data_l
             m_total_n_fragments_for_current_fu++;
             // MLOGD<<"N fragments for this fu:"<<m_total_n_fragments_for_current_fu;
             m_total_n_fragments_for_current_fu = 0;
-            m_nalu_data_length                 = 0;
+            discard_nalu();
         }
         else if (fu_header.s == 1)
         {
@@ -245,7 +326,6 @@ void RTPDecoder::h265_forward_one_nalu(const uint8_t* data, int data_size, bool
     // copy the NALU header and NALU data, other than h264 here nothing has to be 'reconstructed'
     append_nalu_data(data, data_size);
     forwardNALU(true);
-    m_nalu_data_length = 0;
 }
 
 void RTPDecoder::parseRTPH265toNALU(const uint8_t* rtp_data, const size_t data_length)
@@ -256,6 +336,7 @@ void RTPDecoder::parseRTPH265toNALU(const uint8_t* rtp_data, const size_t data_l
         MLOGD << "Not enough rtp data";
         return;
     }
+    const auto providerLock = lock_provider();
     // MLOGD<<"Got h265 rtp data";
     const RTP::RTPPacketH265 rtpPacket(rtp_data, data_length);
     // MLOGD<<"RTP Header: "<<rtp_header->asString();
@@ -264,6 +345,7 @@ void RTPDecoder::parseRTPH265toNALU(const uint8_t* rtp_data, const size_t data_l
         MLOGD << "Invalid rtp packet";
         return;
     }
+    track_reference_loss(rtpPacket.header.getTimestamp(), h265_packet_reference(rtpPacket));
     const auto& nal_unit_header_h265 = rtpPacket.getNALUHeaderH265();
     if (nal_unit_header_h265.type > 50)
     {
@@ -310,7 +392,6 @@ void RTPDecoder::parseRTPH265toNALU(const uint8_t* rtp_data, const size_t data_l
             // MLOGD<<"end of fu packetization";
             append_nalu_data(fu_payload, fu_payload_size);
             forwardNALU(true);
-            m_nalu_data_length = 0;
         }
         else if (fu_header.s)
         {
@@ -363,32 +444,113 @@ void RTPDecoder::parse_rtp_mjpeg(const uint8_t* rtp_data, const size_t data_leng
     // MLOGD<<"X:"<<jpeg_main_header.type;
 }
 
+void RTPDecoder::setBufferProvider(NaluBufferProvider* provider)
+{
+    discard_nalu();
+    m_provider = provider;
+}
+
+std::unique_lock<NaluBufferProvider> RTPDecoder::lock_provider()
+{
+    if (m_provider == nullptr)
+    {
+        return {};
+    }
+    return std::unique_lock<NaluBufferProvider>(*m_provider);
+}
+
+void RTPDecoder::begin_provided_nalu()
+{
+    if (m_provider == nullptr)
+    {
+        return;
+    }
+    std::lock_guard<NaluBufferProvider> lock(*m_provider);
+    // A buffer kept from a NALU that never ended is reused as long as the provider did not take it back
+    if (m_provided_buffer.data == nullptr || !m_provider->isValid(m_provided_buffer))
+    {
+        m_provided_buffer = m_provider->acquire();
+    }
+    m_provided_size = 0;
+}
+
+void RTPDecoder::discard_nalu()
+{
+    if (m_provided_buffer.data != nullptr)
+    {
+        std::lock_guard<NaluBufferProvider> lock(*m_provider);
+        m_provider->release(m_provided_buffer);
+        m_provided_buffer = {};
+    }
+    m_provided_size = 0;
+    m_curr_nalu.clear();
+    m_curr_nalu_incomplete = false;
+}
+
 void RTPDecoder::forwardNALU(const bool isH265)
 {
-    if (m_cb != nullptr)
+    if (m_provided_buffer.data != nullptr)
+    {
+        // Locked until the consumer is done, the buffer must not go away while it parses or queues the NALU
+        std::lock_guard<NaluBufferProvider> lock(*m_provider);
+        if (!m_curr_nalu_incomplete && m_cb != nullptr && m_provider->isValid(m_provided_buffer) &&
+            check_has_valid_prefix(m_provided_buffer.data, (int) m_provided_size, true))
+        {
+            m_n_provided_nalus++;
+            m_cb(timePointStartOfReceivingNALU, m_provided_buffer.data, (int) m_provided_size);
+        }
+        m_provider->release(m_provided_buffer);
+        m_provided_buffer = {};
+        m_provided_size   = 0;
+    }
+    else if (!m_curr_nalu_incomplete && m_cb != nullptr)
     {
         // if either the rtp encoder is buggy or the premise of increasing sequence numbers is not given, this
         // callback might be called with grabage data. Try and catch that as early as possible.
-        if (!check_curr_nalu_has_valid_prefix(true))
+        if (check_curr_nalu_has_valid_prefix(true))
         {
-            return;
+            m_cb(timePointStartOfReceivingNALU, m_curr_nalu.contiguous(), (int) m_curr_nalu.size());
         }
-        uint8_t* p = &m_curr_nalu.at(0);
-        m_cb(timePointStartOfReceivingNALU, p, m_nalu_data_length);
     }
-    m_nalu_data_length = 0;
+    m_curr_nalu.clear();
+    m_curr_nalu_incomplete = false;
 }
 
 void RTPDecoder::append_nalu_data(const uint8_t* data, size_t data_len)
 {
-    if (m_nalu_data_length + data_len > m_curr_nalu.size())
+    if (m_curr_nalu_incomplete)
     {
-        MLOGD << "Weird - not enough space to write NALU. curr_size:" << m_nalu_data_length << " append:" << data_len;
         return;
     }
-    uint8_t* p = &m_curr_nalu.at(m_nalu_data_length);
-    memcpy(p, data, data_len);
-    m_nalu_data_length += data_len;
+    if (m_provided_buffer.data != nullptr)
+    {
+        if (!m_provider->isValid(m_provided_buffer))
+        {
+            // The decoder was stopped in between, what we had written is gone
+            m_provided_buffer      = {};
+            m_provided_size        = 0;
+            m_curr_nalu_incomplete = true;
+            return;
+        }
+        if (data_len <= m_provided_buffer.capacity - m_provided_size)
+        {
+            memcpy(m_provided_buffer.data + m_provided_size, data, data_len);
+            m_provided_size += data_len;
+            return;
+        }
+        // Outgrew the decoder buffer, continue in the staging buffer
+        m_n_staging_fallbacks++;
+        m_curr_nalu.append(m_provided_buffer.data, m_provided_size);
+        m_provider->release(m_provided_buffer);
+        m_provided_buffer = {};
+        m_provided_size   = 0;
+    }
+    if (!m_curr_nalu.append(data, data_len))
+    {
+        MLOGD << "Dropping NALU larger than " << SegmentedNaluBuffer::DEFAULT_MAX_SIZE << " bytes";
+        m_n_oversized_nalus++;
+        m_curr_nalu_incomplete = true;
+    }
 }
 
 void RTPDecoder::append_nalu_data_byte(uint8_t byte)
@@ -398,34 +560,32 @@ void RTPDecoder::append_nalu_data_byte(uint8_t byte)
 
 void RTPDecoder::append_empty(size_t data_len)
 {
-    if (m_nalu_data_length + data_len > m_curr_nalu.size())
+    static constexpr uint8_t ZEROS[256] = {};
+    while (data_len > 0)
     {
-        MLOGD << "Weird - not enugh space to write NALU. curr_size:" << m_nalu_data_length << " append:" << data_len;
-        return;
+        const size_t n = std::min(data_len, sizeof(ZEROS));
+        append_nalu_data(ZEROS, n);
+        data_len -= n;
     }
-    uint8_t* p = &m_curr_nalu.at(m_nalu_data_length);
-    std::memset(p, 0, data_len);
-    m_nalu_data_length += data_len;
 }
 
 void RTPDecoder::write_h264_h265_nalu_start(const bool use_4_bytes)
 {
-    // m_curr_nalu=std::make_shared<std::array<uint8_t,NALU_MAXLEN>>();
-    m_nalu_data_length = 0;
+    m_curr_nalu.clear();
+    m_curr_nalu_incomplete = false;
+    begin_provided_nalu();
     if (use_4_bytes)
     {
         append_nalu_data_byte(0);
         append_nalu_data_byte(0);
         append_nalu_data_byte(0);
         append_nalu_data_byte(1);
-        assert(m_nalu_data_length == 4);
     }
     else
     {
         append_nalu_data_byte(0);
         append_nalu_data_byte(0);
         append_nalu_data_byte(1);
-        assert(m_nalu_data_length == 3);
     }
 }
 
@@ -458,6 +618,6 @@ bool RTPDecoder::check_has_valid_prefix(const uint8_t* nalu_data, int nalu_data_
 
 bool RTPDecoder::check_curr_nalu_has_valid_prefix(bool use_4_bytes_start_code)
 {
-    uint8_t* p = &m_curr_nalu.at(0);
-    return check_has_valid_prefix(p, m_nalu_data_length, use_4_bytes_start_code);
+    // The start code and the NALU header are always in the first segment
+    return check_has_valid_prefix(m_curr_nalu.front(), (int) m_curr_nalu.size(), use_4_bytes_start_code);
 }
@@ -9,7 +9,10 @@
 #include <chrono>
 #include <cstdio>
 #include <functional>
+#include <mutex>
+#include "NaluBufferProvider.h"
 #include "RTP.hpp"
+#include "SegmentedNaluBuffer.h"
 
 /*********************************************
  ** Parses a stream of rtp h264 / h265 data into NALUs.
@@ -21,9 +24,6 @@
  ** Data is forwarded directly via a callback for no thread scheduling overhead
  **********************************************/
 
-// Enough for pretty much any resolution/framerate we handle in OpenHD
-static constexpr const auto NALU_MAXLEN = 1024 * 1024;
-
 typedef std::function<void(
     const std::chrono::steady_clock::time_point creation_time, const uint8_t* nalu_data, const int nalu_data_size)>
     RTP_FRAME_DATA_CALLBACK;
@@ -53,39 +53,86 @@ class RTPDecoder
     // reset to defaults
     void reset();
 
+    // Reassemble into buffers of @param provider when it has one free, nullptr to always use the staging buffer.
+    // Call on the parsing thread, the provider must outlive this decoder or be unset first.
+    void setBufferProvider(NaluBufferProvider* provider);
+
+    // Called on the parsing thread when lost packets carried a frame other frames reference (or may have, a loss
+    // across frames counts as such), a keyframe is needed to stop the artifacts. Losses within a frame nothing
+    // references (H264 nal_ref_idc 0, H265 sub-layer non-reference) only cost that frame and don't call it.
+    void setReferenceLossCallback(std::function<void()> cb);
+
   private:
     // Write 0,0,0,1 (or 0,0,1) into the start of the NALU buffer and set the length to 4 / 3
     void write_h264_h265_nalu_start(bool use_4_bytes = true);
 
     // copy data_len bytes into the data buffer at the current position
-    // and increase its size by data_len
+    // and increase its size by data_len. If the NALU grows too big, it is dropped when forwarded.
+    // Only while parsing a packet, it relies on the provider lock taken there.
     void append_nalu_data(const uint8_t* data, size_t data_len);
 
     // like append_nalu_data, but for one byte
     void append_nalu_data_byte(uint8_t byte);
 
+    // Held by the parse functions for a whole packet, rather than by every append (a byte at a time for headers).
+    // Not locked without a provider.
+    std::unique_lock<NaluBufferProvider> lock_provider();
+
+    // Get a provided buffer for the NALU that starts now, if there is a provider and it has one
+    void begin_provided_nalu();
+
+    // Drop the current NALU without forwarding it
+    void discard_nalu();
+
     void append_empty(size_t data_len);
 
     // Properly calls the cb function (if not null)
-    // Resets the m_nalu_data_length to 0
+    // Clears the NALU buffer
     void forwardNALU(const bool isH265 = false);
 
+    // After validateRTPPacket: note whether the frame with @param timestamp is referenced (1, 0 or -1 if the packet
+    // doesn't tell) and decide about a loss before this packet once that is known
+    void track_reference_loss(uint32_t timestamp, int reference);
+
+    void resolve_loss(bool reference);
+
     const RTP_FRAME_DATA_CALLBACK m_cb;
-    // std::shared_ptr<std::array<uint8_t,NALU_MAXLEN>> m_curr_nalu{};
-    std::array<uint8_t, NALU_MAXLEN> m_curr_nalu;
-    size_t                           m_nalu_data_length = 0;
-    bool                             m_feed_incomplete_frames;
-    int                              m_total_n_fragments_for_current_fu = 0;
+    // Grows segment by segment, so a 4K IDR slice fits while a 720p stream stays at a few segments
+    SegmentedNaluBuffer m_curr_nalu;
+    // While m_provided_buffer.data is set, the current NALU goes there instead of m_curr_nalu
+    NaluBufferProvider*        m_provider = nullptr;
+    NaluBufferProvider::Buffer m_provided_buffer;
+    size_t                     m_provided_size = 0;
+    // Bytes of the current NALU were lost (it grew too big, or the provider took its buffer back), don't forward it
+    bool m_curr_nalu_incomplete = false;
+    bool m_feed_incomplete_frames;
+    int  m_total_n_fragments_for_current_fu = 0;
 
   private:
     // TDOD: What shall we do if a start, middle or end of fu-a is missing ?
     int  lastSequenceNumber       = -1;
     bool flagPacketHasGoneMissing = false;
+    // Like flagPacketHasGoneMissing, but only for the current packet and not cleared by m_feed_incomplete_frames
+    bool m_gap_before_packet = false;
+    // The frame the last packet belonged to, and whether it is referenced (-1 unknown yet)
+    uint32_t m_frame_timestamp = 0;
+    int      m_frame_reference = -1;
+    // A loss within the current frame waits until the frame turns out to be referenced or not
+    bool                  m_loss_pending = false;
+    std::function<void()> m_reference_loss_cb;
 
   public:
     // each time there is a "gap" between packets, this counter is increased
     int m_n_gaps         = 0;
     int m_n_lost_packets = 0;
+    // NALUs dropped because they exceeded SegmentedNaluBuffer::DEFAULT_MAX_SIZE
+    int m_n_oversized_nalus = 0;
+    // NALUs forwarded from a provided buffer, and those that outgrew it and moved to the staging buffer
+    int m_n_provided_nalus    = 0;
+    int m_n_staging_fallbacks = 0;
+    // Losses that needed a keyframe, and those that only hit non-reference frames
+    int m_n_reference_losses = 0;
+    int m_n_ignored_losses   = 0;
     // This time point is as 'early as possible' to debug the parsing time as accurately as possible.
     // E.g for a fu-a NALU the time point when the start fu-a was received, not when its end is received
     std::chrono::steady_clock::time_point timePointStartOfReceivingNALU;
@@ -0,0 +1,166 @@
+//
+// SegmentedNaluBuffer.h
+// Reassembly buffer for one NALU at a time, built from fixed-size segments that are taken from a pool on demand.
+// A 720p stream only ever touches a couple of segments, a multi-MiB 4K IDR slice takes as many as it needs and
+// they are reused for the next one. A contiguous copy is only made when a consumer asks for it and the NALU
+// does not fit into the first segment.
+// Not thread safe, the RTP decoder fills and forwards on the receiving thread.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+class NaluSegmentPool
+{
+  public:
+    // Most P-frame slices fit into the first segment, those are forwarded without a copy
+    static constexpr size_t SEGMENT_SIZE = 64 * 1024;
+
+    using Segment = std::unique_ptr<uint8_t[]>;
+
+    Segment acquire()
+    {
+        if (mFree.empty())
+        {
+            mNAllocated++;
+            return Segment(new uint8_t[SEGMENT_SIZE]);
+        }
+        Segment segment = std::move(mFree.back());
+        mFree.pop_back();
+        return segment;
+    }
+
+    void release(Segment segment) { mFree.push_back(std::move(segment)); }
+
+    // Segments ever allocated, the pool never frees them
+    size_t nAllocated() const { return mNAllocated; }
+
+    size_t nFree() const { return mFree.size(); }
+
+  private:
+    std::vector<Segment> mFree;
+    size_t               mNAllocated = 0;
+};
+
+class SegmentedNaluBuffer
+{
+  public:
+    static constexpr size_t SEGMENT_SIZE = NaluSegmentPool::SEGMENT_SIZE;
+    // Far above any slice we stream, only there so a fragmented NALU that never ends can't take all memory
+    static constexpr size_t DEFAULT_MAX_SIZE = 16 * 1024 * 1024;
+
+    explicit SegmentedNaluBuffer(
+        std::shared_ptr<NaluSegmentPool> pool = std::make_shared<NaluSegmentPool>(), size_t maxSize = DEFAULT_MAX_SIZE)
+        : mPool(std::move(pool)), mMaxSize(maxSize)
+    {
+    }
+
+    ~SegmentedNaluBuffer()
+    {
+        for (auto& segment : mSegments)
+        {
+            mPool->release(std::move(segment));
+        }
+    }
+
+    SegmentedNaluBuffer(const SegmentedNaluBuffer&)            = delete;
+    SegmentedNaluBuffer& operator=(const SegmentedNaluBuffer&) = delete;
+
+    // Returns false and appends nothing if the NALU would grow beyond the maximum size
+    bool append(const uint8_t* data, size_t length)
+    {
+        if (length > mMaxSize - mSize)
+        {
+            return false;
+        }
+        while (length > 0)
+        {
+            const size_t index  = mSize / SEGMENT_SIZE;
+            const size_t offset = mSize % SEGMENT_SIZE;
+            if (index == mSegments.size())
+            {
+                mSegments.push_back(mPool->acquire());
+            }
+            const size_t n = std::min(length, SEGMENT_SIZE - offset);
+            std::memcpy(mSegments[index].get() + offset, data, n);
+            data += n;
+            length -= n;
+            mSize += n;
+        }
+        return true;
+    }
+
+    // Starts the next NALU. The first segment stays, the others go back to the pool.
+    void clear()
+    {
+        while (mSegments.size() > 1)
+        {
+            mPool->release(std::move(mSegments.back()));
+            mSegments.pop_back();
+        }
+        mSize = 0;
+    }
+
+    size_t size() const { return mSize; }
+
+    // The first min(size(), SEGMENT_SIZE) bytes, nullptr while nothing was appended yet
+    const uint8_t* front() const { return mSegments.empty() ? nullptr : mSegments[0].get(); }
+
+    /**
+     * The whole NALU in one block. Points into the first segment if it fits there, else to a copy that grows to the
+     * largest NALU seen. Valid until the next append() or clear().
+     */
+    const uint8_t* contiguous()
+    {
+        if (mSize <= SEGMENT_SIZE)
+        {
+            return front();
+        }
+        if (mLinear.size() < mSize)
+        {
+            mLinear.resize(mSize);
+        }
+        copyTo(mLinear.data());
+        return mLinear.data();
+    }
+
+    // Calls @param fn (const uint8_t* data, size_t length) for every filled segment in order
+    template <typename Fn>
+    void forEachSegment(Fn&& fn) const
+    {
+        size_t remaining = mSize;
+        for (size_t i = 0; remaining > 0; ++i)
+        {
+            const size_t n = std::min(remaining, SEGMENT_SIZE);
+            fn((const uint8_t*) mSegments[i].get(), n);
+            remaining -= n;
+        }
+    }
+
+    // Copies the whole NALU to @param dst, which must hold size() bytes
+    void copyTo(uint8_t* dst) const
+    {
+        forEachSegment(
+            [&dst](const uint8_t* data, size_t length)
+            {
+                std::memcpy(dst, data, length);
+                dst += length;
+            });
+    }
+
+    // Heap held by this buffer: its segments and the contiguous copy, not the free segments of the pool
+    size_t memoryUsage() const { return mSegments.size() * SEGMENT_SIZE + mLinear.capacity(); }
+
+  private:
+    std::shared_ptr<NaluSegmentPool>      mPool;
+    const size_t                          mMaxSize;
+    std::vector<NaluSegmentPool::Segment> mSegments;
+    size_t                                mSize = 0;
+    std::vector<uint8_t>                  mLinear;
+};
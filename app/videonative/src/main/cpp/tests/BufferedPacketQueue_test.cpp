@@ -1,6 +1,8 @@
 #include "BufferedPacketQueue.h"  // the class under test
 #include <gtest/gtest.h>
+#include <chrono>
 #include <cstdint>
+#include <iostream>
 #include <vector>
 
 // ---------- Test fixture ----------------------------------------------------
@@ -25,6 +27,14 @@ class BufferedPacketQueueTest : public ::testing::Test
 
         q.processPacket(seq, (uint8_t*) &dummy, 2, cb);
     }
+
+    /* Helper: like feed(), with the arrival time under control of the test. */
+    void feedAt(uint16_t seq, int64_t nowMs)
+    {
+        uint16_t dummy = seq;
+        auto     cb    = [this](const uint8_t* seq, std::size_t) { delivered.push_back(*(uint16_t*) seq); };
+        q.processPacket(seq, (uint8_t*) &dummy, 2, cb, nowMs * 1000000);
+    }
 };
 
 // ---------- The reproduction test ------------------------------------------
@@ -57,6 +67,101 @@ TEST_F(BufferedPacketQueueTest, ReorderedDeliversInOrder)
     ASSERT_EQ(delivered, expected) << "Overflow flush should deliver the entire block in one shot";
 }
 
+// ---------- Time based release ---------------------------------------------
+TEST_F(BufferedPacketQueueTest, MissingPacketGivenUpAfterMaxHold)
+{
+    feedAt(100, 0);
+    feedAt(102, 1);
+    feedAt(103, 2);
+    ASSERT_EQ(delivered, (std::vector<uint16_t>{100}));
+
+    // 101 is lost, the next arrival after the hold time releases the others
+    feedAt(104, DEFAULT_MAX_HOLD_MS + 1);
+    ASSERT_EQ(delivered, (std::vector<uint16_t>{100, 102, 103, 104}));
+    EXPECT_EQ(q.stats().nSkipped, 1u);
+    const auto held = LatencyHistogram::summarize({}, q.holdTime().snapshot());
+    EXPECT_EQ(held.count, 2u);
+    EXPECT_GE(held.maxUs, (DEFAULT_MAX_HOLD_MS - 1) * 1000);
+
+    // Too late now
+    feedAt(101, DEFAULT_MAX_HOLD_MS + 2);
+    EXPECT_EQ(delivered.size(), 4u);
+    EXPECT_EQ(q.stats().nLate, 1u);
+    EXPECT_EQ(q.stats().nDropped, 1u);
+}
+
+TEST_F(BufferedPacketQueueTest, ReorderedWithinHoldTimeIsCounted)
+{
+    feedAt(10, 0);
+    feedAt(12, 1);
+    feedAt(13, 1);
+    feedAt(11, 2);
+    ASSERT_EQ(delivered, (std::vector<uint16_t>{10, 11, 12, 13}));
+    EXPECT_EQ(q.stats().nReordered, 1u);
+    EXPECT_EQ(q.stats().nSkipped, 0u);
+}
+
+// ---------- Adaptive depth -------------------------------------------------
+TEST_F(BufferedPacketQueueTest, DepthFollowsReordering)
+{
+    int64_t  t   = 0;
+    uint16_t seq = 0;
+    // Blocks of 24 where the first packet comes last, 23 behind the highest
+    for (int block = 0; block < 10; ++block, seq += 24)
+    {
+        for (uint16_t i = 1; i < 24; ++i) feedAt(seq + i, t);
+        feedAt(seq, t++);
+    }
+    EXPECT_GE(q.stats().depth, 24u);
+    EXPECT_EQ(q.stats().nLate, 1u) << "Only the first reordered packet should miss the initial depth";
+
+    // No reordering for a while, the depth goes back to the minimum
+    for (size_t i = 0; i < 2 * DEPTH_WINDOW_PACKETS; ++i) feedAt(seq++, t++);
+    EXPECT_EQ(q.stats().depth, MIN_REORDER_DEPTH);
+}
+
+TEST_F(BufferedPacketQueueTest, SenderRestartResyncs)
+{
+    for (uint16_t s = 5000; s < 5010; ++s) feedAt(s, 0);
+    for (uint16_t s = 100; s < 110; ++s) feedAt(s, 1);
+    ASSERT_EQ(delivered.size(), 10u + 10u - LATE_RESYNC_THRESHOLD + 1);
+    EXPECT_EQ(delivered.back(), 109);
+}
+
+// ---------- Throughput -----------------------------------------------------
+TEST(BufferedPacketQueueBench, Throughput)
+{
+    constexpr size_t     N_PACKETS = 2000000;
+    BufferedPacketQueue  q;
+    std::vector<uint8_t> packet(1400, 0xab);
+    size_t               nDelivered = 0;
+    size_t               nBytes     = 0;
+    auto                 cb         = [&](const uint8_t*, std::size_t length)
+    {
+        nDelivered++;
+        nBytes += length;
+    };
+
+    const auto start = std::chrono::steady_clock::now();
+    int64_t    nowNs = 0;
+    for (size_t i = 0; i < N_PACKETS; i += 2)
+    {
+        // Every 50th pair swapped, 1% of the packets arrive out of order
+        const auto seq     = (uint16_t) i;
+        const bool swapped = i % 100 == 50;
+        q.processPacket(swapped ? seq + 1 : seq, packet.data(), packet.size(), cb, nowNs += 20000);
+        q.processPacket(swapped ? seq : seq + 1, packet.data(), packet.size(), cb, nowNs += 20000);
+    }
+    const double seconds =
+        std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - start).count();
+
+    ASSERT_EQ(nDelivered, N_PACKETS);
+    ASSERT_EQ(nBytes, N_PACKETS * packet.size());
+    EXPECT_EQ(q.stats().nReordered, N_PACKETS / 100);
+    std::cout << "BufferedPacketQueue: " << (uint64_t) (N_PACKETS / seconds) << " packets/s, "
+              << (uint64_t) (seconds * 1e9 / N_PACKETS) << " ns/packet" << std::endl;
+}
+
 // ---------- gtest boilerplate main -----------------------------------------
 int main(int argc, char** argv)
 {
@@ -0,0 +1,63 @@
+#include "DvrWriter.h"  // the class under test
+#include <gtest/gtest.h>
+#include <cstdint>
+#include <vector>
+
+namespace
+{
+const std::vector<uint8_t> SPS = {0, 0, 0, 1, 0x67, 1, 2, 3};
+
+std::vector<uint8_t> nalu(uint8_t header, size_t size)
+{
+    std::vector<uint8_t> data = {0, 0, 0, 1, header};
+    data.resize(size, 0x5A);
+    return data;
+}
+
+// Not started, so nothing is written and the queue only shrinks by dropping
+class DvrWriterTest : public ::testing::Test
+{
+  protected:
+    NaluBufferPool pool;
+    DvrWriter      dvr{[]() { return DvrWriter::VideoFormat{640, 480, 60}; }, 10000};
+
+    void enqueue(const std::vector<uint8_t>& data) { dvr.enqueue(pool.copy(NALU(data.data(), data.size()))); }
+};
+}  // namespace
+
+// ---------- Byte budget -----------------------------------------------------
+TEST_F(DvrWriterTest, DropsOldestSlicesOverBudget)
+{
+    enqueue(SPS);
+    enqueue(nalu(0x65, 4000));
+    for (int i = 0; i < 4; ++i)
+    {
+        enqueue(nalu(0x41, 1000));
+    }
+    EXPECT_EQ(dvr.stats().nDropped, 0u);
+
+    // Over the budget by 1000 bytes, the first P slice goes, the key frames stay
+    enqueue(nalu(0x41, 3000 - SPS.size()));
+    const auto stats = dvr.stats();
+    EXPECT_EQ(stats.nDropped, 1u);
+    EXPECT_EQ(stats.queuedBytes, 10000u);
+    EXPECT_EQ(stats.maxQueuedBytes, 10000u);
+    EXPECT_EQ(pool.stats().nInUse, 6u);
+}
+
+TEST_F(DvrWriterTest, DropsKeyFramesOnlyWhenNothingElseIsLeft)
+{
+    enqueue(nalu(0x65, 6000));
+    enqueue(nalu(0x65, 6000));
+    EXPECT_EQ(dvr.stats().nDropped, 1u);
+    EXPECT_EQ(dvr.stats().queuedBytes, 6000u);
+}
+
+TEST_F(DvrWriterTest, StopReturnsTheBuffers)
+{
+    enqueue(SPS);
+    enqueue(nalu(0x41, 1000));
+    dvr.stop();
+    EXPECT_EQ(dvr.stats().queuedBytes, 0u);
+    EXPECT_EQ(pool.stats().nInUse, 0u);
+}
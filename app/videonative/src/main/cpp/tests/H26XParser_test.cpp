@@ -0,0 +1,146 @@
+#include "parser/H26XParser.h"  // the class under test
+#include <gtest/gtest.h>
+#include <cstdint>
+#include <vector>
+
+namespace
+{
+struct Forwarded
+{
+    std::vector<uint8_t> data;
+    bool                 accessUnit;
+    bool                 keyframe;
+    bool                 disposable;
+};
+
+class H26XParserTest : public ::testing::Test
+{
+  protected:
+    std::vector<Forwarded> forwarded;
+    H26XParser             parser{[this](const NALU& nalu)
+                      {
+                          forwarded.push_back(
+                              {std::vector<uint8_t>(nalu.getData(), nalu.getData() + nalu.getSize()),
+                               nalu.IS_ACCESS_UNIT,
+                               nalu.is_keyframe(),
+                               nalu.is_disposable()});
+                      }};
+    uint16_t               seq = 1;
+
+    // Sends a single NALU H264 packet
+    void feed(uint32_t timestamp, bool marker, std::vector<uint8_t> nalu)
+    {
+        std::vector<uint8_t> packet = {
+            0x80,
+            (uint8_t) (96 | (marker ? 0x80 : 0)),
+            (uint8_t) (seq >> 8),
+            (uint8_t) seq,
+            (uint8_t) (timestamp >> 24),
+            (uint8_t) (timestamp >> 16),
+            (uint8_t) (timestamp >> 8),
+            (uint8_t) timestamp,
+            0,
+            0,
+            0,
+            0};
+        packet.insert(packet.end(), nalu.begin(), nalu.end());
+        seq++;
+        parser.parse_rtp_stream(packet.data(), packet.size());
+    }
+
+    static std::vector<uint8_t> annexB(std::initializer_list<std::vector<uint8_t>> nalus)
+    {
+        std::vector<uint8_t> out;
+        for (const auto& nalu : nalus)
+        {
+            out.insert(out.end(), {0, 0, 0, 1});
+            out.insert(out.end(), nalu.begin(), nalu.end());
+        }
+        return out;
+    }
+};
+
+const std::vector<uint8_t> SPS   = {0x67, 1, 2, 3};
+const std::vector<uint8_t> PPS   = {0x68, 4, 5};
+const std::vector<uint8_t> IDR_1 = {0x65, 10, 11, 12};
+const std::vector<uint8_t> IDR_2 = {0x65, 13, 14, 15};
+const std::vector<uint8_t> SLICE = {0x41, 20, 21, 22};
+// nal_ref_idc 0, no other frame references it
+const std::vector<uint8_t> NONREF_SLICE = {0x01, 23, 24, 25};
+const std::vector<uint8_t> SEI          = {0x06, 30, 31, 32};
+}  // namespace
+
+TEST_F(H26XParserTest, ForwardsEveryNaluByDefault)
+{
+    feed(1000, false, IDR_1);
+    feed(1000, true, IDR_2);
+
+    ASSERT_EQ(forwarded.size(), 2u);
+    EXPECT_FALSE(forwarded[0].accessUnit);
+    EXPECT_EQ(forwarded[1].data, annexB({IDR_2}));
+}
+
+// ---------- Access unit mode -----------------------------------------------
+TEST_F(H26XParserTest, GroupsFrameUntilMarker)
+{
+    parser.setAccessUnitMode(true);
+    feed(1000, false, SPS);
+    feed(1000, false, PPS);
+    feed(1000, false, IDR_1);
+    feed(1000, false, IDR_2);
+    // The configuration goes on its own, the slices wait for the marker
+    ASSERT_EQ(forwarded.size(), 2u);
+    EXPECT_EQ(forwarded[0].data, annexB({SPS}));
+    EXPECT_EQ(forwarded[1].data, annexB({PPS}));
+
+    feed(1000, true, IDR_2);
+    ASSERT_EQ(forwarded.size(), 3u);
+    EXPECT_TRUE(forwarded[2].accessUnit);
+    EXPECT_EQ(forwarded[2].data, annexB({IDR_1, IDR_2, IDR_2}));
+    EXPECT_EQ(parser.nAccessUnits, 1);
+    EXPECT_EQ(parser.nParsedNALUs, 5);
+}
+
+TEST_F(H26XParserTest, ClassifiesFrameByAllOfItsNalus)
+{
+    parser.setAccessUnitMode(true);
+    // Many encoders put an SEI (or AUD) first
+    feed(1000, false, SEI);
+    feed(1000, true, IDR_1);
+    feed(4000, false, SEI);
+    feed(4000, true, SLICE);
+    feed(7000, false, SEI);
+    feed(7000, true, NONREF_SLICE);
+
+    ASSERT_EQ(forwarded.size(), 3u);
+    EXPECT_TRUE(forwarded[0].keyframe);
+    EXPECT_FALSE(forwarded[0].disposable);
+    EXPECT_FALSE(forwarded[1].keyframe);
+    EXPECT_FALSE(forwarded[1].disposable);
+    EXPECT_FALSE(forwarded[2].keyframe);
+    EXPECT_TRUE(forwarded[2].disposable);
+}
+
+TEST_F(H26XParserTest, FlushesOnNewTimestampWhenMarkerIsLost)
+{
+    parser.setAccessUnitMode(true);
+    feed(1000, false, SLICE);
+    feed(4000, true, SLICE);
+
+    ASSERT_EQ(forwarded.size(), 2u);
+    EXPECT_EQ(forwarded[0].data, annexB({SLICE}));
+    EXPECT_EQ(forwarded[1].data, annexB({SLICE}));
+    EXPECT_EQ(parser.nAccessUnitsWithoutMark, 1);
+}
+
+TEST_F(H26XParserTest, SwitchingBackFlushesPendingFrame)
+{
+    parser.setAccessUnitMode(true);
+    feed(1000, false, SLICE);
+    parser.setAccessUnitMode(false);
+    feed(4000, false, SLICE);
+
+    ASSERT_EQ(forwarded.size(), 2u);
+    EXPECT_TRUE(forwarded[0].accessUnit);
+    EXPECT_FALSE(forwarded[1].accessUnit);
+}
@@ -0,0 +1,59 @@
+#include "LatencyStats.h"  // the class under test
+#include <gtest/gtest.h>
+#include <cstdint>
+
+// ---------- Bucket layout ---------------------------------------------------
+TEST(LatencyHistogramTest, BucketsCoverEveryValueOnce)
+{
+    EXPECT_EQ(LatencyHistogram::bucketOf(-5), 0);
+    int64_t lower = 0;
+    for (int bucket = 0; bucket < LatencyHistogram::kBuckets - 1; ++bucket)
+    {
+        const int64_t upper = LatencyHistogram::upperBoundUs(bucket);
+        ASSERT_GE(upper, lower);
+        EXPECT_EQ(LatencyHistogram::bucketOf(lower), bucket);
+        EXPECT_EQ(LatencyHistogram::bucketOf(upper), bucket);
+        // Log-linear: a bucket is never wider than a quarter of its lower bound
+        EXPECT_LE(upper - lower, lower / LatencyHistogram::kSubBuckets);
+        lower = upper + 1;
+    }
+    EXPECT_EQ(LatencyHistogram::bucketOf(lower), LatencyHistogram::kBuckets - 1);
+    EXPECT_EQ(LatencyHistogram::bucketOf(INT64_MAX), LatencyHistogram::kBuckets - 1);
+}
+
+// ---------- Summaries -------------------------------------------------------
+TEST(LatencyHistogramTest, SummaryOfWindow)
+{
+    LatencyHistogram histogram;
+    histogram.record(1000000);
+    const auto before = histogram.snapshot();
+
+    // 1..100 ms, the value recorded before the window must not show up
+    for (int ms = 1; ms <= 100; ++ms)
+    {
+        histogram.record(ms * 1000);
+    }
+    const auto summary = LatencyHistogram::summarize(before, histogram.snapshot());
+    EXPECT_EQ(summary.count, 100u);
+    EXPECT_EQ(summary.avgUs, 50500);
+    EXPECT_EQ(summary.p50Us, LatencyHistogram::upperBoundUs(LatencyHistogram::bucketOf(50000)));
+    EXPECT_EQ(summary.p90Us, LatencyHistogram::upperBoundUs(LatencyHistogram::bucketOf(90000)));
+    EXPECT_EQ(summary.p99Us, LatencyHistogram::upperBoundUs(LatencyHistogram::bucketOf(99000)));
+    EXPECT_EQ(summary.maxUs, LatencyHistogram::upperBoundUs(LatencyHistogram::bucketOf(100000)));
+    EXPECT_GE(summary.p50Us, 50000);
+    EXPECT_LE(summary.p50Us, 50000 * 5 / 4);
+}
+
+TEST(LatencyStatsTest, WindowsAreIndependent)
+{
+    LatencyStats         stats;
+    LatencyStats::Window log, java;
+    stats.recordNs(LatencyStage::DECODE, 1000000, 9000000);
+
+    EXPECT_EQ(log.next(stats)[(int) LatencyStage::DECODE].count, 1u);
+    EXPECT_EQ(log.next(stats)[(int) LatencyStage::DECODE].count, 0u);
+    const auto summaries = java.next(stats);
+    EXPECT_EQ(summaries[(int) LatencyStage::DECODE].count, 1u);
+    EXPECT_EQ(summaries[(int) LatencyStage::DECODE].avgUs, 8000);
+    EXPECT_EQ(summaries[(int) LatencyStage::TOTAL].count, 0u);
+}
@@ -0,0 +1,98 @@
+#include "NaluBufferPool.h"  // the class under test
+#include <gtest/gtest.h>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+namespace
+{
+std::vector<uint8_t> slice(size_t size, uint8_t seed)
+{
+    std::vector<uint8_t> data = {0, 0, 0, 1, 0x41};
+    for (size_t i = data.size(); i < size; ++i) data.push_back((uint8_t) (seed + i * 7));
+    return data;
+}
+
+NALU asNalu(const std::vector<uint8_t>& data) { return NALU(data.data(), data.size()); }
+}  // namespace
+
+// ---------- Sharing ---------------------------------------------------------
+TEST(NaluBufferPoolTest, CopiesShareOneBuffer)
+{
+    NaluBufferPool pool;
+    const auto     data = slice(1000, 1);
+    PooledNalu     first;
+    {
+        const PooledNalu copy = pool.copy(asNalu(data));
+        first                 = copy;
+        EXPECT_EQ(&*first, &*copy);
+        EXPECT_EQ(std::vector<uint8_t>(first->getData(), first->getData() + first->getSize()), data);
+    }
+    // Still referenced by first
+    EXPECT_EQ(pool.stats().nInUse, 1u);
+    EXPECT_EQ(pool.stats().bytesInUse, data.size());
+    first = {};
+    EXPECT_EQ(pool.stats().nInUse, 0u);
+    EXPECT_EQ(pool.stats().bytesInUse, 0u);
+}
+
+// ---------- Recycling -------------------------------------------------------
+TEST(NaluBufferPoolTest, ReusesBuffersOnceTheStreamRuns)
+{
+    NaluBufferPool pool;
+    const auto     idr = slice(50000, 2);
+    const auto     p   = slice(2000, 3);
+    pool.copy(asNalu(idr));
+    for (int i = 0; i < 100; ++i)
+    {
+        const PooledNalu a = pool.copy(asNalu(p));
+        EXPECT_EQ(a->getSize(), p.size());
+    }
+    const auto stats = pool.stats();
+    EXPECT_EQ(stats.nBuffers, 1u);
+    EXPECT_EQ(stats.nAllocations, 1u);
+    EXPECT_EQ(stats.bytesAllocated, idr.size());
+}
+
+TEST(NaluBufferPoolTest, FreesIdleBuffersBeyondTheLimit)
+{
+    NaluBufferPool          pool(2);
+    const auto              data = slice(100, 4);
+    std::vector<PooledNalu> held;
+    for (int i = 0; i < 5; ++i)
+    {
+        held.push_back(pool.copy(asNalu(data)));
+    }
+    EXPECT_EQ(pool.stats().nBuffers, 5u);
+    held.clear();
+    EXPECT_EQ(pool.stats().nBuffers, 2u);
+    EXPECT_EQ(pool.stats().bytesAllocated, 2 * data.size());
+}
+
+TEST(NaluBufferPoolTest, HandlesOutliveThePool)
+{
+    const auto data = slice(100, 5);
+    PooledNalu copy;
+    {
+        NaluBufferPool pool;
+        copy = pool.copy(asNalu(data));
+        pool.copy(asNalu(data));
+    }
+    EXPECT_EQ(copy->getSize(), data.size());
+}
+
+// ---------- Released on other threads ---------------------------------------
+TEST(NaluBufferPoolTest, ReleasedOnAnyThread)
+{
+    NaluBufferPool pool;
+    const auto     data = slice(500, 6);
+    for (int i = 0; i < 1000; ++i)
+    {
+        PooledNalu  copy = pool.copy(asNalu(data));
+        std::thread consumer([shared = copy]() { EXPECT_EQ(shared->getData()[4], 0x41); });
+        copy = {};
+        consumer.join();
+    }
+    EXPECT_EQ(pool.stats().nInUse, 0u);
+    EXPECT_LE(pool.stats().nBuffers, 2u);
+}
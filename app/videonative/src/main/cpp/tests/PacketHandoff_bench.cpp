@@ -0,0 +1,207 @@
+// Host benchmark: loopback UDP vs. the in-process SpscPacketRing used to hand video from the wfb-ng link to the
+// video player. Both paths move a packet stream from one thread to another with a blocking consumer:
+//  - paced in bursts, the consumer measures the one-way latency
+//  - unpaced, the process CPU time per delivered packet is measured (producer + consumer)
+
+#include "SpscPacketRing.h"  // the class under test
+#include <arpa/inet.h>
+#include <gtest/gtest.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+namespace
+{
+constexpr size_t   PACKET_SIZE = 1400;
+constexpr size_t   N_PACKETS   = 20000;
+constexpr uint64_t INTERVAL_NS = 20000;  // 50k packets/s on average, well above a 40 MBit/s video stream
+// Video arrives in bursts (one frame's worth of packets back to back), send BURST packets per tick
+constexpr size_t BURST = 16;
+
+uint64_t nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+uint64_t processCpuNs()
+{
+    timespec ts{};
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+void waitUntil(uint64_t deadlineNs)
+{
+    while (nowNs() < deadlineNs)
+    {
+    }
+}
+
+struct Result
+{
+    std::vector<uint64_t> latencies;
+    size_t                nReceivedUnpaced = 0;
+    uint64_t              cpuNsUnpaced     = 0;
+};
+
+void report(const char* name, Result& r)
+{
+    ASSERT_FALSE(r.latencies.empty());
+    std::sort(r.latencies.begin(), r.latencies.end());
+    const auto pct = [&](double p) { return r.latencies[size_t(p * (r.latencies.size() - 1))] / 1000.0; };
+    std::cout << name << ": received " << r.latencies.size() << "/" << N_PACKETS << " | latency us p50=" << pct(0.5)
+              << " p99=" << pct(0.99) << " max=" << pct(1.0)
+              << " | unpaced: received " << r.nReceivedUnpaced << "/" << N_PACKETS
+              << " cpu per packet us=" << (r.cpuNsUnpaced / 1000.0) / std::max<size_t>(r.nReceivedUnpaced, 1)
+              << std::endl;
+}
+}  // namespace
+
+TEST(SpscPacketRing, DeliversInOrderAndDropsWhenFull)
+{
+    SpscPacketRing<8, 4> ring;
+    for (uint8_t i = 0; i < 4; ++i) ASSERT_TRUE(ring.push(&i, 1));
+    uint8_t extra = 42;
+    ASSERT_FALSE(ring.push(&extra, 1));
+    ASSERT_EQ(ring.getNDropped(), 1u);
+    for (uint8_t i = 0; i < 4; ++i)
+    {
+        const auto* slot = ring.front();
+        ASSERT_NE(slot, nullptr);
+        ASSERT_EQ(slot->length, 1u);
+        ASSERT_EQ(slot->data[0], i);
+        ring.pop();
+    }
+    ASSERT_EQ(ring.front(), nullptr);
+    uint8_t big[9] = {};
+    ASSERT_FALSE(ring.push(big, sizeof(big)));
+}
+
+namespace
+{
+/**
+ * Runs the paced and the unpaced pass through one transport.
+ * @param send(packet, size) producer side
+ * @param receive(out sentTimestampNs) consumer side, blocks and returns false once the producer is done and idle
+ * @param setDone(bool) called with false before a pass starts and with true after the producer's last packet
+ */
+template <typename Send, typename Receive, typename SetDone>
+void run(Result& result, Send send, Receive receive, SetDone setDone)
+{
+    uint8_t packet[PACKET_SIZE] = {};
+    for (const bool paced : {true, false})
+    {
+        std::atomic<size_t> nReceived{0};
+        setDone(false);
+        std::thread         consumer(
+            [&]
+            {
+                uint64_t sent;
+                while (nReceived < N_PACKETS && receive(sent))
+                {
+                    if (paced) result.latencies.push_back(nowNs() - sent);
+                    nReceived++;
+                }
+            });
+        const uint64_t cpuStart = processCpuNs();
+        uint64_t       next     = nowNs();
+        for (size_t i = 0; i < N_PACKETS; ++i)
+        {
+            if (paced && i % BURST == 0)
+            {
+                waitUntil(next);
+                next += INTERVAL_NS * BURST;
+            }
+            const uint64_t ts = nowNs();
+            memcpy(packet, &ts, sizeof(ts));
+            send(packet, sizeof(packet));
+        }
+        setDone(true);
+        consumer.join();
+        if (!paced)
+        {
+            result.cpuNsUnpaced     = processCpuNs() - cpuStart;
+            result.nReceivedUnpaced = nReceived;
+        }
+    }
+}
+}  // namespace
+
+TEST(PacketHandoffBench, LoopbackUdp)
+{
+    const int rx = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    const int tx = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    ASSERT_GE(rx, 0);
+    ASSERT_GE(tx, 0);
+    int rcvbuf = 8 * 1024 * 1024;
+    setsockopt(rx, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    timeval tv{0, 200000};
+    setsockopt(rx, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    sockaddr_in addr{};
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port        = 0;
+    ASSERT_EQ(bind(rx, (sockaddr*) &addr, sizeof(addr)), 0);
+    socklen_t addrLen = sizeof(addr);
+    getsockname(rx, (sockaddr*) &addr, &addrLen);
+
+    Result  result;
+    uint8_t buf[65507];
+    run(
+        result,
+        [&](const uint8_t* packet, size_t size) { sendto(tx, packet, size, 0, (sockaddr*) &addr, sizeof(addr)); },
+        [&](uint64_t& sent)
+        {
+            // Times out once the producer stopped sending (or everything it sent was dropped)
+            if (recv(rx, buf, sizeof(buf), 0) <= 0) return false;
+            memcpy(&sent, buf, sizeof(sent));
+            return true;
+        },
+        [](bool) {});
+    close(rx);
+    close(tx);
+    report("loopback udp", result);
+}
+
+TEST(PacketHandoffBench, SpscRing)
+{
+    auto              ring = std::make_unique<SpscPacketRing<4096, 1024>>();
+    std::atomic<bool> producerDone{false};
+
+    Result result;
+    run(
+        result,
+        [&](const uint8_t* packet, size_t size)
+        {
+            // Back off instead of dropping so both transports deliver every packet in the unpaced pass
+            while (!ring->push(packet, size, nowNs())) std::this_thread::yield();
+        },
+        [&](uint64_t& sent)
+        {
+            while (ring->front() == nullptr)
+            {
+                if (producerDone && ring->empty()) return false;
+                ring->waitForData(std::chrono::milliseconds(100));
+            }
+            const auto* slot = ring->front();
+            memcpy(&sent, slot->data.data(), sizeof(sent));
+            ring->pop();
+            return true;
+        },
+        [&](bool done)
+        {
+            producerDone = done;
+            if (done) ring->wakeUp();
+        });
+    report("spsc ring", result);
+}
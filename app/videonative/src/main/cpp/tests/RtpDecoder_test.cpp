@@ -0,0 +1,235 @@
+#include "parser/ParseRTP.h"  // the class under test
+#include <gtest/gtest.h>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace
+{
+// Hands out fixed buffers like MediaCodec input buffers, and can take them back like a stopped decoder
+class FakeProvider : public NaluBufferProvider
+{
+  public:
+    FakeProvider(size_t nBuffers, size_t capacity) : mBuffers(nBuffers, std::vector<uint8_t>(capacity)) {}
+
+    void lock() override { mMutex.lock(); }
+
+    void unlock() override { mMutex.unlock(); }
+
+    Buffer acquire() override
+    {
+        for (size_t i = 0; i < mBuffers.size(); ++i)
+        {
+            if (!mLent[i])
+            {
+                mLent[i] = true;
+                nAcquired++;
+                return {mBuffers[i].data(), mBuffers[i].size(), (int64_t) i};
+            }
+        }
+        return {};
+    }
+
+    bool isValid(const Buffer& buffer) override { return buffer.id >= 0 && mLent[buffer.id] && !mRevoked; }
+
+    void release(const Buffer& buffer) override
+    {
+        mLent[buffer.id] = false;
+        nReleased++;
+    }
+
+    bool owns(const uint8_t* data) const
+    {
+        for (const auto& buffer : mBuffers)
+        {
+            if (data == buffer.data()) return true;
+        }
+        return false;
+    }
+
+    void revoke() { mRevoked = true; }
+
+    int nAcquired = 0;
+    int nReleased = 0;
+
+  private:
+    std::recursive_mutex              mMutex;
+    std::vector<std::vector<uint8_t>> mBuffers;
+    std::vector<bool>                 mLent    = std::vector<bool>(mBuffers.size());
+    bool                              mRevoked = false;
+};
+
+struct Forwarded
+{
+    std::vector<uint8_t> data;
+    const uint8_t*       pointer;
+};
+
+class RtpDecoderTest : public ::testing::Test
+{
+  protected:
+    std::vector<Forwarded> forwarded;
+    RTPDecoder             decoder{[this](auto, const uint8_t* data, int size)
+                       { forwarded.push_back({std::vector<uint8_t>(data, data + size), data}); }};
+    uint16_t               seq              = 1000;
+    uint32_t               timestamp        = 0;
+    int                    nReferenceLosses = 0;
+
+    void feed(const std::vector<uint8_t>& payload)
+    {
+        std::vector<uint8_t> packet = {0x80,
+                                       96,
+                                       (uint8_t) (seq >> 8),
+                                       (uint8_t) seq,
+                                       (uint8_t) (timestamp >> 24),
+                                       (uint8_t) (timestamp >> 16),
+                                       (uint8_t) (timestamp >> 8),
+                                       (uint8_t) timestamp,
+                                       0,
+                                       0,
+                                       0,
+                                       0};
+        packet.insert(packet.end(), payload.begin(), payload.end());
+        seq++;
+        decoder.parseRTPH264toNALU(packet.data(), packet.size());
+    }
+
+    // Sends an IDR slice of @param size bytes (without start code and NAL header) as FU-A fragments
+    std::vector<uint8_t> sendFragmented(size_t size, size_t fragment = 1400, void (*between)(FakeProvider*) = nullptr,
+                                        FakeProvider* provider = nullptr)
+    {
+        std::vector<uint8_t> body(size);
+        for (size_t i = 0; i < size; ++i) body[i] = (uint8_t) (i * 13 + 1);
+        for (size_t offset = 0; offset < size; offset += fragment)
+        {
+            const size_t n      = std::min(fragment, size - offset);
+            uint8_t      header = 0x05;
+            if (offset == 0) header |= 0x80;
+            if (offset + n == size) header |= 0x40;
+            std::vector<uint8_t> payload = {0x7C, header};
+            payload.insert(payload.end(), body.begin() + offset, body.begin() + offset + n);
+            feed(payload);
+            if (offset == 0 && between != nullptr) between(provider);
+        }
+        std::vector<uint8_t> nalu = {0, 0, 0, 1, 0x65};
+        nalu.insert(nalu.end(), body.begin(), body.end());
+        return nalu;
+    }
+};
+}  // namespace
+
+// ---------- Fragments land in the provided buffer --------------------------
+TEST_F(RtpDecoderTest, ReassemblesIntoProvidedBuffer)
+{
+    FakeProvider provider(2, 64 * 1024);
+    decoder.setBufferProvider(&provider);
+    const auto nalu = sendFragmented(20000);
+
+    ASSERT_EQ(forwarded.size(), 1u);
+    EXPECT_EQ(forwarded[0].data, nalu);
+    EXPECT_TRUE(provider.owns(forwarded[0].pointer));
+    EXPECT_EQ(decoder.m_n_provided_nalus, 1);
+    EXPECT_EQ(provider.nAcquired, provider.nReleased);
+}
+
+TEST_F(RtpDecoderTest, SingleNaluUsesProvidedBuffer)
+{
+    FakeProvider provider(1, 4096);
+    decoder.setBufferProvider(&provider);
+    feed({0x41, 1, 2, 3, 4, 5});
+
+    ASSERT_EQ(forwarded.size(), 1u);
+    EXPECT_EQ(forwarded[0].data, (std::vector<uint8_t>{0, 0, 0, 1, 0x41, 1, 2, 3, 4, 5}));
+    EXPECT_TRUE(provider.owns(forwarded[0].pointer));
+}
+
+// ---------- Staging fallback -----------------------------------------------
+TEST_F(RtpDecoderTest, FallsBackWithoutFreeBuffer)
+{
+    FakeProvider provider(0, 0);
+    decoder.setBufferProvider(&provider);
+    const auto nalu = sendFragmented(5000);
+
+    ASSERT_EQ(forwarded.size(), 1u);
+    EXPECT_EQ(forwarded[0].data, nalu);
+    EXPECT_FALSE(provider.owns(forwarded[0].pointer));
+    EXPECT_EQ(decoder.m_n_provided_nalus, 0);
+}
+
+TEST_F(RtpDecoderTest, MovesToStagingWhenOutgrowingBuffer)
+{
+    FakeProvider provider(1, 8000);
+    decoder.setBufferProvider(&provider);
+    const auto nalu = sendFragmented(30000);
+
+    ASSERT_EQ(forwarded.size(), 1u);
+    EXPECT_EQ(forwarded[0].data, nalu);
+    EXPECT_FALSE(provider.owns(forwarded[0].pointer));
+    EXPECT_EQ(decoder.m_n_staging_fallbacks, 1);
+    EXPECT_EQ(provider.nAcquired, provider.nReleased);
+
+    // The next small NALU gets the buffer again
+    feed({0x41, 1, 2, 3, 4, 5});
+    ASSERT_EQ(forwarded.size(), 2u);
+    EXPECT_TRUE(provider.owns(forwarded[1].pointer));
+}
+
+// ---------- The provider takes its buffer back -----------------------------
+TEST_F(RtpDecoderTest, DropsNaluWhenBufferIsRevoked)
+{
+    FakeProvider provider(1, 64 * 1024);
+    decoder.setBufferProvider(&provider);
+    sendFragmented(10000, 1400, [](FakeProvider* p) { p->revoke(); }, &provider);
+
+    EXPECT_TRUE(forwarded.empty());
+    EXPECT_EQ(decoder.m_n_provided_nalus, 0);
+}
+
+// ---------- Loss classification --------------------------------------------
+TEST_F(RtpDecoderTest, IgnoresLossWithinNonReferenceFrame)
+{
+    decoder.setReferenceLossCallback([this]() { nReferenceLosses++; });
+    timestamp = 1000;
+    feed({0x01, 1, 2, 3});
+    seq++;  // lost, same frame
+    feed({0x01, 4, 5, 6});
+
+    EXPECT_EQ(nReferenceLosses, 0);
+    EXPECT_EQ(decoder.m_n_ignored_losses, 1);
+}
+
+TEST_F(RtpDecoderTest, ReportsLossWithinReferenceFrame)
+{
+    decoder.setReferenceLossCallback([this]() { nReferenceLosses++; });
+    timestamp = 1000;
+    feed({0x41, 1, 2, 3});
+    seq++;
+    feed({0x41, 4, 5, 6});
+
+    EXPECT_EQ(nReferenceLosses, 1);
+    EXPECT_EQ(decoder.m_n_reference_losses, 1);
+}
+
+TEST_F(RtpDecoderTest, WaitsForFrameTypeOfFragmentedSlice)
+{
+    decoder.setReferenceLossCallback([this]() { nReferenceLosses++; });
+    timestamp = 1000;
+    feed({0x09, 0x10});  // AUD doesn't tell
+    seq++;
+    EXPECT_EQ(nReferenceLosses, 0);
+    feed({0x1C, 0x81, 1, 2, 3});  // FU-A start of a slice with nal_ref_idc 0
+    EXPECT_EQ(nReferenceLosses, 0);
+    EXPECT_EQ(decoder.m_n_ignored_losses, 1);
+}
+
+TEST_F(RtpDecoderTest, TreatsLossAcrossFramesAsReferenceLoss)
+{
+    decoder.setReferenceLossCallback([this]() { nReferenceLosses++; });
+    timestamp = 1000;
+    feed({0x01, 1, 2, 3});
+    seq++;
+    timestamp = 4000;
+    feed({0x01, 4, 5, 6});
+
+    EXPECT_EQ(nReferenceLosses, 1);
+}
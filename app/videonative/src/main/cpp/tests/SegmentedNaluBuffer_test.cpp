@@ -0,0 +1,86 @@
+#include "parser/SegmentedNaluBuffer.h"  // the class under test
+#include <gtest/gtest.h>
+#include <cstdint>
+#include <vector>
+
+namespace
+{
+std::vector<uint8_t> pattern(size_t size, uint8_t seed)
+{
+    std::vector<uint8_t> data(size);
+    for (size_t i = 0; i < size; ++i) data[i] = (uint8_t) (seed + i * 7);
+    return data;
+}
+
+// Appends @param data in RTP sized pieces, like the FU-A reassembly does
+void appendInFragments(SegmentedNaluBuffer& buffer, const std::vector<uint8_t>& data, size_t fragment = 1400)
+{
+    for (size_t offset = 0; offset < data.size(); offset += fragment)
+    {
+        ASSERT_TRUE(buffer.append(data.data() + offset, std::min(fragment, data.size() - offset)));
+    }
+}
+}  // namespace
+
+// ---------- Small NALUs stay in the first segment --------------------------
+TEST(SegmentedNaluBufferTest, SmallNaluIsNotCopied)
+{
+    auto                pool = std::make_shared<NaluSegmentPool>();
+    SegmentedNaluBuffer buffer(pool);
+    const auto          data = pattern(30000, 1);
+    appendInFragments(buffer, data);
+
+    EXPECT_EQ(buffer.size(), data.size());
+    EXPECT_EQ(buffer.contiguous(), buffer.front());
+    EXPECT_EQ(std::vector<uint8_t>(buffer.contiguous(), buffer.contiguous() + buffer.size()), data);
+    EXPECT_EQ(pool->nAllocated(), 1u);
+}
+
+// ---------- Beyond the old 1 MiB cap ---------------------------------------
+TEST(SegmentedNaluBufferTest, LargeNaluGrowsAndLinearizes)
+{
+    auto                pool = std::make_shared<NaluSegmentPool>();
+    SegmentedNaluBuffer buffer(pool);
+    const auto          data = pattern(3 * 1024 * 1024 + 123, 5);
+    appendInFragments(buffer, data);
+
+    ASSERT_EQ(buffer.size(), data.size());
+    EXPECT_EQ(std::vector<uint8_t>(buffer.contiguous(), buffer.contiguous() + buffer.size()), data);
+
+    std::vector<uint8_t> gathered;
+    buffer.forEachSegment([&](const uint8_t* p, size_t n) { gathered.insert(gathered.end(), p, p + n); });
+    EXPECT_EQ(gathered, data);
+}
+
+TEST(SegmentedNaluBufferTest, SegmentsAreReused)
+{
+    auto                pool = std::make_shared<NaluSegmentPool>();
+    SegmentedNaluBuffer buffer(pool);
+    appendInFragments(buffer, pattern(1024 * 1024, 0));
+    const size_t allocated = pool->nAllocated();
+    EXPECT_EQ(allocated, 1024 * 1024 / SegmentedNaluBuffer::SEGMENT_SIZE);
+
+    buffer.clear();
+    EXPECT_EQ(buffer.size(), 0u);
+    EXPECT_EQ(pool->nFree(), allocated - 1);
+
+    for (int i = 0; i < 10; ++i)
+    {
+        const auto data = pattern(900 * 1024, (uint8_t) i);
+        appendInFragments(buffer, data);
+        ASSERT_EQ(std::vector<uint8_t>(buffer.contiguous(), buffer.contiguous() + buffer.size()), data);
+        buffer.clear();
+    }
+    EXPECT_EQ(pool->nAllocated(), allocated);
+}
+
+TEST(SegmentedNaluBufferTest, RejectsAppendBeyondMaximum)
+{
+    SegmentedNaluBuffer buffer(std::make_shared<NaluSegmentPool>(), 100000);
+    const auto          data = pattern(60000, 3);
+    EXPECT_TRUE(buffer.append(data.data(), data.size()));
+    EXPECT_FALSE(buffer.append(data.data(), data.size()));
+    EXPECT_EQ(buffer.size(), data.size());
+    EXPECT_TRUE(buffer.append(data.data(), 40000));
+    EXPECT_FALSE(buffer.append(data.data(), 1));
+}
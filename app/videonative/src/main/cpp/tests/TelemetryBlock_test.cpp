@@ -0,0 +1,115 @@
+#include "TelemetryBlock.h"  // the class under test
+#include <gtest/gtest.h>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+
+namespace
+{
+// Every field holds the same value, a torn copy mixes two of them
+struct Sample
+{
+    int64_t  stamp;
+    uint32_t values[30];
+};
+
+bool consistent(const Sample& s)
+{
+    for (uint32_t v : s.values)
+    {
+        if (v != (uint32_t) s.stamp)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+}  // namespace
+
+// ---------- Layout Java relies on ------------------------------------------
+TEST(TelemetryBlockTest, HeaderDescribesLayout)
+{
+    TelemetryBlock<Sample> block(3);
+    const auto*            bytes = static_cast<const uint8_t*>(block.data());
+
+    uint32_t sequence;
+    uint16_t version, size;
+    memcpy(&sequence, bytes, 4);
+    memcpy(&version, bytes + 4, 2);
+    memcpy(&size, bytes + 6, 2);
+    EXPECT_EQ(sequence, 0u);
+    EXPECT_EQ(version, 3);
+    EXPECT_EQ(size, sizeof(Sample));
+    EXPECT_EQ(block.size(), TelemetryBlock<Sample>::kHeaderSize + sizeof(Sample));
+
+    block.publish([](Sample& s) { s.stamp = 42; });
+    int64_t stamp;
+    memcpy(&stamp, bytes + TelemetryBlock<Sample>::kHeaderSize, sizeof(stamp));
+    EXPECT_EQ(stamp, 42);
+    EXPECT_EQ(block.sequence(), 2u);
+}
+
+TEST(TelemetryBlockTest, PublishUpdatesInPlace)
+{
+    TelemetryBlock<Sample> block(1);
+    block.publish([](Sample& s) { s.stamp = 1; });
+    block.publish([](Sample& s) { s.values[0] = 7; });
+
+    const Sample s = block.read();
+    EXPECT_EQ(s.stamp, 1);
+    EXPECT_EQ(s.values[0], 7u);
+    EXPECT_EQ(s.values[1], 0u);
+}
+
+// ---------- Readers never keep a torn snapshot -----------------------------
+TEST(TelemetryBlockTest, ConcurrentReadsAreConsistent)
+{
+    constexpr int kWriters   = 2;
+    constexpr int kPublishes = 50000;
+
+    TelemetryBlock<Sample> block(1);
+    std::atomic<bool>      done{false};
+    std::atomic<int64_t>   nextStamp{1};
+
+    std::thread writers[kWriters];
+    for (auto& writer : writers)
+    {
+        writer = std::thread(
+            [&]
+            {
+                for (int i = 0; i < kPublishes; ++i)
+                {
+                    block.publish(
+                        [&](Sample& s)
+                        {
+                            s.stamp = nextStamp++;
+                            for (auto& v : s.values) v = (uint32_t) s.stamp;
+                        });
+                }
+            });
+    }
+
+    std::thread reader(
+        [&]
+        {
+            int64_t last = 0;
+            while (!done)
+            {
+                const Sample s = block.read();
+                ASSERT_TRUE(consistent(s)) << "torn snapshot at stamp " << s.stamp;
+                // Publishes are serialized, a reader never goes back in time
+                ASSERT_GE(s.stamp, last);
+                last = s.stamp;
+            }
+        });
+
+    for (auto& writer : writers) writer.join();
+    done = true;
+    reader.join();
+
+    const Sample s = block.read();
+    EXPECT_TRUE(consistent(s));
+    EXPECT_EQ(s.stamp, kWriters * kPublishes);
+    EXPECT_EQ(block.sequence(), 2u * kWriters * kPublishes);
+}
@@ -0,0 +1,347 @@
+#include "VideoDecoder.h"  // the class under test
+#include <gtest/gtest.h>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <vector>
+#include "NullDecoderBackend.h"
+
+namespace
+{
+const std::vector<uint8_t> SPS   = {0, 0, 0, 1, 0x67, 1, 2, 3};
+const std::vector<uint8_t> PPS   = {0, 0, 0, 1, 0x68, 4, 5};
+const std::vector<uint8_t> SLICE = {0, 0, 0, 1, 0x41, 20, 21, 22};
+// nal_ref_idc 0, no other frame needs it
+const std::vector<uint8_t> DISPOSABLE_SLICE = {0, 0, 0, 1, 0x01, 23, 24, 25};
+
+std::vector<uint8_t> idr(size_t size)
+{
+    std::vector<uint8_t> data = {0, 0, 0, 1, 0x65};
+    data.resize(size, 0x5A);
+    return data;
+}
+
+const std::vector<uint8_t> AUD = {0, 0, 0, 1, 0x09, 0xF0};
+const std::vector<uint8_t> SEI = {0, 0, 0, 1, 0x06, 5, 1, 0, 0x80};
+
+struct AccessUnit
+{
+    std::vector<uint8_t> data;
+    NALU::AccessUnitInfo info;
+};
+
+// All NALUs of a frame back to back and classified by all of them, as the parser forwards them in access unit mode
+AccessUnit accessUnit(std::initializer_list<std::vector<uint8_t>> nalus)
+{
+    AccessUnit au;
+    for (const auto& nalu : nalus)
+    {
+        au.data.insert(au.data.end(), nalu.begin(), nalu.end());
+        const NALU unit(nalu.data(), nalu.size());
+        au.info.keyframe   = au.info.keyframe || unit.is_keyframe();
+        au.info.disposable = au.info.disposable && unit.is_disposable();
+    }
+    return au;
+}
+
+// Has no input buffer while stalled, like a decoder whose surface is not consumed
+class StalledDecoderBackend : public NullDecoderBackend
+{
+  public:
+    ssize_t dequeueInputBuffer(int64_t timeoutUs) override
+    {
+        if (stalled)
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(timeoutUs));
+            return TRY_AGAIN_LATER;
+        }
+        return NullDecoderBackend::dequeueInputBuffer(timeoutUs);
+    }
+
+    std::atomic<bool> stalled{true};
+};
+
+class VideoDecoderTest : public ::testing::Test
+{
+  protected:
+    // Every backend the decoder created, they live until the decoder deletes them
+    std::vector<NullDecoderBackend*> backends;
+    size_t                           nInputBuffers = NullDecoderBackend::DEFAULT_INPUT_BUFFERS;
+    size_t                           inputSize     = NullDecoderBackend::DEFAULT_INPUT_SIZE;
+    VideoDecoder                     decoder;
+
+    void SetUp() override
+    {
+        decoder.setOutput(0,
+                          [this]()
+                          {
+                              auto backend = std::make_unique<NullDecoderBackend>(nInputBuffers, inputSize);
+                              backends.push_back(backend.get());
+                              return backend;
+                          });
+    }
+
+    void TearDown() override
+    {
+        decoder.setOutput(0, nullptr);
+        decoder.setOutput(1, nullptr);
+    }
+
+    void feed(const std::vector<uint8_t>& data) { decoder.interpretNALU(NALU(data.data(), data.size())); }
+
+    void feedAccessUnit(const AccessUnit& au)
+    {
+        decoder.interpretNALU(
+            NALU(au.data.data(), au.data.size(), false, std::chrono::steady_clock::now(), true, au.info));
+    }
+
+    // Decoder 0 without input buffers until it is told otherwise, so the queue fills up
+    StalledDecoderBackend* stallPrimary(FeedPolicy policy, size_t capacity, std::chrono::milliseconds latencyBudget)
+    {
+        decoder.setFeedPolicy(0, policy, capacity, latencyBudget);
+        decoder.setOutput(0,
+                          [this]()
+                          {
+                              auto b  = std::make_unique<StalledDecoderBackend>();
+                              stalled = b.get();
+                              return b;
+                          });
+        return stalled;
+    }
+
+    StalledDecoderBackend* stalled = nullptr;
+
+    // The output thread renders asynchronously
+    static bool waitFor(const std::function<bool()>& condition)
+    {
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+        while (!condition())
+        {
+            if (std::chrono::steady_clock::now() > deadline) return false;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return true;
+    }
+};
+}  // namespace
+
+// ---------- Configuration from the key frames ------------------------------
+TEST_F(VideoDecoderTest, StartsOnceKeyFramesAreThere)
+{
+    std::atomic<int> width{0};
+    decoder.registerOnDecoderRatioChangedCallback([&](const VideoRatio ratio) { width = ratio.width; });
+    feed(SLICE);
+    feed(SPS);
+    EXPECT_TRUE(backends.empty());
+    feed(PPS);
+    ASSERT_EQ(backends.size(), 1u);
+
+    feed(idr(2000));
+    feed(SLICE);
+    feed(SLICE);
+    auto* backend = backends[0];
+    EXPECT_TRUE(waitFor([&] { return backend->nRenderedFrames == 3; }));
+    EXPECT_TRUE(waitFor([&] { return width == 640; }));
+}
+
+TEST_F(VideoDecoderTest, RestartsWithLargerInputBuffers)
+{
+    nInputBuffers = 2;
+    inputSize     = 4096;
+    feed(SPS);
+    feed(PPS);
+    feed(idr(10000));
+
+    ASSERT_EQ(backends.size(), 2u);
+    EXPECT_GE(backends[1]->nInputSize, 10000u);
+    auto* backend = backends[1];
+    EXPECT_TRUE(waitFor([&] { return backend->nRenderedFrames == 1; }));
+}
+
+// ---------- Input buffers lent to the parser -------------------------------
+TEST_F(VideoDecoderTest, QueuesLentInputWithoutCopy)
+{
+    feed(SPS);
+    feed(PPS);
+    decoder.lock();
+    const auto buffer = decoder.acquire();
+    ASSERT_NE(buffer.data, nullptr);
+    EXPECT_EQ(buffer.capacity, NullDecoderBackend::DEFAULT_INPUT_SIZE);
+    std::copy(SLICE.begin(), SLICE.end(), buffer.data);
+    decoder.interpretNALU(NALU(buffer.data, SLICE.size()));
+    decoder.release(buffer);
+    EXPECT_FALSE(decoder.isValid(buffer));
+    decoder.unlock();
+
+    auto* backend = backends[0];
+    EXPECT_TRUE(waitFor([&] { return backend->nRenderedFrames == 1; }));
+}
+
+// ---------- Closing the output ---------------------------------------------
+TEST_F(VideoDecoderTest, ClosingOutputStopsDecoder)
+{
+    feed(SPS);
+    feed(PPS);
+    ASSERT_EQ(backends.size(), 1u);
+    decoder.setOutput(0, nullptr);
+
+    // Only buffered until an output is set again, then the next key frames start a new decoder
+    feed(SPS);
+    feed(PPS);
+    feed(idr(100));
+    EXPECT_EQ(backends.size(), 1u);
+    SetUp();
+    feed(SLICE);
+    EXPECT_EQ(backends.size(), 2u);
+}
+
+// ---------- Feeder threads --------------------------------------------------
+TEST_F(VideoDecoderTest, StalledSecondaryDoesNotHoldUpPrimary)
+{
+    // Every NALU reaches the primary decoder, however fast they come
+    decoder.setFeedPolicy(0, FeedPolicy::WAIT);
+    decoder.setOutput(1, []() { return std::make_unique<StalledDecoderBackend>(); });
+    feed(SPS);
+    feed(PPS);
+    feed(idr(100));
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 100; ++i)
+    {
+        feed(SLICE);
+    }
+    EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(500));
+    // Full after the queue capacity, then everything up to the next key frame is dropped
+    const auto secondary = decoder.feederStats(1);
+    EXPECT_EQ(secondary.nQueued, VideoDecoder::FEED_QUEUE_CAPACITY);
+    EXPECT_EQ(secondary.nDropped, 101u - VideoDecoder::FEED_QUEUE_CAPACITY);
+
+    auto* backend = backends[0];
+    EXPECT_TRUE(waitFor([&] { return backend->nRenderedFrames == 101; }));
+    const auto primary = decoder.feederStats(0);
+    EXPECT_EQ(primary.nFed, 101u);
+    EXPECT_EQ(primary.nDropped, 0u);
+}
+
+TEST_F(VideoDecoderTest, DroppingFeederResumesAtKeyFrame)
+{
+    stallPrimary(FeedPolicy::SKIP_TO_KEY_FRAME, 1, std::chrono::milliseconds(0));
+    feed(SPS);
+    feed(PPS);
+    ASSERT_NE(stalled, nullptr);
+    // The feeder holds on to the first one until the decoder has an input buffer, the others find the queue full
+    for (int i = 0; i < 10; ++i)
+    {
+        feed(SLICE);
+    }
+    EXPECT_EQ(decoder.feederStats(0).nQueued, 1u);
+    EXPECT_EQ(decoder.feederStats(0).nDropped, 9u);
+
+    stalled->stalled = false;
+    EXPECT_TRUE(waitFor([&] { return decoder.feederStats(0).nFed == 1; }));
+    // Still skipping up to the parameter sets of the next key frame
+    feed(SLICE);
+    EXPECT_EQ(decoder.feederStats(0).nDropped, 10u);
+    feed(SPS);
+    EXPECT_TRUE(waitFor([&] { return decoder.feederStats(0).nFed == 2; }));
+    feed(idr(100));
+    EXPECT_TRUE(waitFor([&] { return decoder.feederStats(0).nFed == 3; }));
+    EXPECT_EQ(decoder.feederStats(0).nDropped, 10u);
+}
+
+TEST_F(VideoDecoderTest, PriorityDropsDisposableFirstAndKeepsKeyFrames)
+{
+    std::atomic<int> keyFramesNeeded{0};
+    decoder.registerOnKeyFrameNeededCallback([&] { keyFramesNeeded++; });
+    stallPrimary(FeedPolicy::PRIORITY, 8, std::chrono::milliseconds(0));
+    feed(SPS);
+    feed(PPS);
+    feed(idr(100));
+    // Half full: 3 more, then the disposable ones are dropped
+    for (int i = 0; i < 10; ++i)
+    {
+        feed(DISPOSABLE_SLICE);
+    }
+    auto stats = decoder.feederStats(0);
+    EXPECT_EQ(stats.nQueued, 4u);
+    EXPECT_EQ(stats.nDroppedDisposable, 7u);
+    EXPECT_EQ(keyFramesNeeded, 0);
+
+    // Up to the room kept for key frames, then skipping to the next one
+    for (int i = 0; i < 5; ++i)
+    {
+        feed(SLICE);
+    }
+    stats = decoder.feederStats(0);
+    EXPECT_EQ(stats.nQueued, 7u);
+    EXPECT_EQ(stats.nDropped, 7u + 2u);
+    EXPECT_EQ(keyFramesNeeded, 1);
+
+    feed(SPS);
+    EXPECT_EQ(decoder.feederStats(0).nQueued, 8u);
+    stalled->stalled = false;
+    EXPECT_TRUE(waitFor([&] { return decoder.feederStats(0).nFed == 8; }));
+}
+
+TEST_F(VideoDecoderTest, PriorityClassifiesAccessUnitsByAllTheirSlices)
+{
+    std::atomic<int> keyFramesNeeded{0};
+    decoder.registerOnKeyFrameNeededCallback([&] { keyFramesNeeded++; });
+    stallPrimary(FeedPolicy::PRIORITY, 8, std::chrono::milliseconds(0));
+    feed(SPS);
+    feed(PPS);
+    feedAccessUnit(accessUnit({AUD, SEI, idr(100)}));
+    for (int i = 0; i < 3; ++i)
+    {
+        feedAccessUnit(accessUnit({AUD, SEI, SLICE}));
+    }
+    // Half full, only the frames without a reference slice go
+    for (int i = 0; i < 2; ++i)
+    {
+        feedAccessUnit(accessUnit({AUD, SEI, SLICE}));
+        feedAccessUnit(accessUnit({AUD, DISPOSABLE_SLICE}));
+    }
+    auto stats = decoder.feederStats(0);
+    EXPECT_EQ(stats.nQueued, 6u);
+    EXPECT_EQ(stats.nDroppedDisposable, 2u);
+
+    // Up to the room kept for key frames, then skipping to the next one
+    for (int i = 0; i < 2; ++i)
+    {
+        feedAccessUnit(accessUnit({AUD, SLICE}));
+    }
+    stats = decoder.feederStats(0);
+    EXPECT_EQ(stats.nQueued, 7u);
+    EXPECT_EQ(keyFramesNeeded, 1);
+
+    // An IDR slice behind an AUD still makes a key frame
+    feedAccessUnit(accessUnit({AUD, SEI, idr(100)}));
+    EXPECT_EQ(decoder.feederStats(0).nQueued, 8u);
+    stalled->stalled = false;
+    EXPECT_TRUE(waitFor([&] { return decoder.feederStats(0).nFed == 8; }));
+}
+
+TEST_F(VideoDecoderTest, BacklogOverBudgetFastForwardsToKeyFrame)
+{
+    std::atomic<int> keyFramesNeeded{0};
+    decoder.registerOnKeyFrameNeededCallback([&] { keyFramesNeeded++; });
+    stallPrimary(FeedPolicy::PRIORITY, 32, std::chrono::milliseconds(50));
+    feed(SPS);
+    feed(PPS);
+    feed(idr(100));
+    for (int i = 0; i < 5; ++i)
+    {
+        feed(SLICE);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    feed(SPS);
+    feed(idr(100));
+    feed(SLICE);
+    stalled->stalled = false;
+
+    // The stale slices go, decoding goes on from the new key frame
+    EXPECT_TRUE(waitFor([&] { return decoder.feederStats(0).nFed == 4; }));
+    const auto stats = decoder.feederStats(0);
+    EXPECT_EQ(stats.nFastForwards, 1u);
+    EXPECT_EQ(stats.nDropped, 5u);
+    EXPECT_EQ(keyFramesNeeded, 1);
+}
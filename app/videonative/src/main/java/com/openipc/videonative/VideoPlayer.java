@@ -11,6 +11,7 @@ import android.view.SurfaceHolder;
 import androidx.annotation.Nullable;
 import androidx.appcompat.app.AppCompatActivity;
 
+import java.nio.ByteBuffer;
 import java.util.Timer;
 import java.util.TimerTask;
 
@@ -23,6 +24,27 @@ import java.util.TimerTask;
 public class VideoPlayer implements IVideoParamsChanged {
     private static final String TAG = "pixelpilot";
 
+    // Pipeline stages of getLatencyStats() / getLatencyHistogram(), LatencyStage in LatencyStats.h
+    // The first four are only measured for video coming in-process from the wfb-ng link
+    public static final int LATENCY_RADIO_QUEUE = 0;
+    public static final int LATENCY_AGGREGATOR = 1;
+    public static final int LATENCY_FEC_RECOVERY = 2;
+    public static final int LATENCY_HANDOFF = 3;
+    public static final int LATENCY_REORDER = 4;
+    public static final int LATENCY_REASSEMBLY = 5;
+    public static final int LATENCY_INPUT_WAIT = 6;
+    public static final int LATENCY_DECODE = 7;
+    public static final int LATENCY_TOTAL = 8;
+    public static final int LATENCY_STAGES = 9;
+    // Values per stage in getLatencyStats(), all times in microseconds
+    public static final int LATENCY_COUNT = 0;
+    public static final int LATENCY_AVG = 1;
+    public static final int LATENCY_P50 = 2;
+    public static final int LATENCY_P90 = 3;
+    public static final int LATENCY_P99 = 4;
+    public static final int LATENCY_MAX = 5;
+    public static final int LATENCY_FIELDS = 6;
+
     //All the native binding(s)
     static {
         System.loadLibrary("VideoNative");
@@ -33,11 +55,16 @@ public class VideoPlayer implements IVideoParamsChanged {
     private IVideoParamsChanged mVideoParamsChanged;
     // This timer is used to then 'call back' the IVideoParamsChanged
     private Timer timer;
+    // Read by the timer thread only
+    private final VideoTelemetry timerTelemetry;
+    private int lastRatioChanges;
+    private int lastInfoChanges;
 
     // Setup as much as possible without creating the decoder
     public VideoPlayer(final AppCompatActivity parent) {
         this.context = parent;
         nativeVideoPlayer = nativeInitialize(context);
+        timerTelemetry = newTelemetry();
     }
 
     public static native long nativeInitialize(Context context);
@@ -52,6 +79,11 @@ public class VideoPlayer implements IVideoParamsChanged {
 
     public static native void nativeSetUdpForwarding(long nativeInstance, String ip, int port, boolean enabled);
 
+    // Producer entry point and context of the in-process video sink, handed to WfbNgLink.setInProcessVideoSink
+    public static native long nativeGetInProcessSinkFn();
+
+    public static native long nativeGetInProcessSinkCtx(long nativeInstance);
+
     public static native void nativeStartDvr(long nativeInstance, int fd, int fmp4_enabled);
 
     public static native void nativeStopDvr(long nativeInstance);
@@ -68,9 +100,24 @@ public class VideoPlayer implements IVideoParamsChanged {
     public static native boolean anyVideoBytesParsedSinceLastCall(long nativeInstance);
 
     public static native boolean receivingVideoButCannotParse(long nativeInstance);
-    // TODO: Use message queue from cpp for performance#
-    // This initiates a 'call back' for the IVideoParams
-    public static native <T extends IVideoParamsChanged> void nativeCallBack(T t, long nativeInstance);
+    // The block the native player publishes its statistics to, see VideoTelemetry
+    public static native ByteBuffer nativeGetTelemetry(long nativeInstance);
+
+    public static native long[] nativeGetLatencyStats(long nativeInstance);
+
+    public static native long[] nativeGetLatencyHistogram(long nativeInstance, int stage);
+
+    public static native void nativeSetDirectDecoderInput(long nativeInstance, boolean enable);
+
+    public static native void nativeSetAccessUnitMode(long nativeInstance, boolean enable);
+
+    public static native void nativeSetKeyframeRequester(long nativeInstance, long fn, long ctx);
+
+    public static native void nativeSetReorderMaxHoldMs(long nativeInstance, int maxHoldMs);
+
+    public static native void nativeWriteTraceEvents(int fd);
+
+    public static native void nativeSetTraceAnomalyListener(TraceAnomalyListener listener);
 
     public static void verifyApplicationThread() {
         if (Looper.myLooper() != Looper.getMainLooper()) {
@@ -91,16 +138,109 @@ public class VideoPlayer implements IVideoParamsChanged {
         verifyApplicationThread();
         nativeStart(nativeVideoPlayer, context);
         //The timer initiates the callback(s), but if no data has changed they are not called (and the timer does almost no work)
-        //TODO: proper queue, but how to do synchronization in java ndk ?!
         timer = new Timer();
         timer.schedule(new TimerTask() {
             @Override
             public void run() {
-                nativeCallBack(VideoPlayer.this, nativeVideoPlayer);
+                publishChanges();
             }
         }, 0, 200);
     }
 
+    /**
+     * A reader of the decoder statistics, polling it reads memory the native player updates and never calls into
+     * native code. Use one reader per thread.
+     */
+    public VideoTelemetry newTelemetry() {
+        return new VideoTelemetry(nativeGetTelemetry(nativeVideoPlayer));
+    }
+
+    /**
+     * Latency of every pipeline stage since the previous call, LATENCY_FIELDS values per stage starting at
+     * stage * LATENCY_FIELDS. Percentiles are bucket upper bounds, at most 25% above the real value.
+     */
+    public synchronized long[] getLatencyStats() {
+        return nativeGetLatencyStats(nativeVideoPlayer);
+    }
+
+    /**
+     * Whole histogram of one stage since the player was created, as pairs of (bucket upper bound in us, count) for
+     * every non-empty bucket.
+     */
+    public long[] getLatencyHistogram(int stage) {
+        return nativeGetLatencyHistogram(nativeVideoPlayer, stage);
+    }
+
+    /**
+     * Reassemble RTP fragments right into the decoder input buffers (default) instead of copying every NALU into
+     * one. Only worth turning off to compare the two.
+     */
+    public void setDirectDecoderInput(boolean enable) {
+        nativeSetDirectDecoderInput(nativeVideoPlayer, enable);
+    }
+
+    /**
+     * Longest time an out-of-order video packet waits for the missing ones before them (default 20 ms). Longer
+     * rides out more reordering between adapters, shorter keeps a lost packet from delaying the frame.
+     */
+    public void setReorderMaxHoldMs(int maxHoldMs) {
+        nativeSetReorderMaxHoldMs(nativeVideoPlayer, maxHoldMs);
+    }
+
+    /**
+     * Submit one decoder input buffer per frame instead of one per NALU. Fewer codec round trips, some decoders
+     * output the frame sooner. Frames are copied, so this replaces the direct decoder input while enabled.
+     */
+    public void setAccessUnitMode(boolean enable) {
+        nativeSetAccessUnitMode(nativeVideoPlayer, enable);
+    }
+
+    /**
+     * Native function and context (see WfbNgLink.getKeyframeRequestFn) called to get a keyframe as soon as a lost
+     * packet broke a reference frame. 0 stops the requests.
+     */
+    public void setKeyframeRequester(long fn, long ctx) {
+        nativeSetKeyframeRequester(nativeVideoPlayer, fn, ctx);
+    }
+
+    /**
+     * Append the recent events of the video threads to fd as Chrome trace JSON array elements, each followed by a
+     * comma. The caller writes the enclosing brackets, so the link events (WfbNgLink.writeTraceEvents) can go into
+     * the same file.
+     */
+    public static void writeTraceEvents(int fd) {
+        nativeWriteTraceEvents(fd);
+    }
+
+    /**
+     * Told about a slow frame or a stalled decoder, at most once every 10 seconds, on a native thread. The recent
+     * events are still in the rings, writeTraceEvents() gets them.
+     */
+    public interface TraceAnomalyListener {
+        void onTraceAnomaly(String reason);
+    }
+
+    /**
+     * Listener for the anomalies worth a trace file, null removes it.
+     */
+    public static void setTraceAnomalyListener(TraceAnomalyListener listener) {
+        nativeSetTraceAnomalyListener(listener);
+    }
+
+    private void publishChanges() {
+        if (!timerTelemetry.update()) {
+            return;
+        }
+        if (timerTelemetry.ratioChanges != lastRatioChanges) {
+            lastRatioChanges = timerTelemetry.ratioChanges;
+            onVideoRatioChanged(timerTelemetry.width, timerTelemetry.height);
+        }
+        if (timerTelemetry.infoChanges != lastInfoChanges) {
+            lastInfoChanges = timerTelemetry.infoChanges;
+            onDecodingInfoChanged(timerTelemetry.toDecodingInfo());
+        }
+    }
+
     public synchronized void stop() {
         if (timer == null) {
             return;
@@ -131,6 +271,14 @@ public class VideoPlayer implements IVideoParamsChanged {
         nativeSetUdpForwarding(nativeVideoPlayer, ip, port, enabled);
     }
 
+    public long getInProcessSinkFn() {
+        return nativeGetInProcessSinkFn();
+    }
+
+    public long getInProcessSinkCtx() {
+        return nativeGetInProcessSinkCtx(nativeVideoPlayer);
+    }
+
     public void startDvr(int fd, boolean enabled_fmp4) {
         nativeStartDvr(nativeVideoPlayer, fd, enabled_fmp4 ? 1 : 0);
     }
@@ -211,7 +359,7 @@ public class VideoPlayer implements IVideoParamsChanged {
         return nativeVideoPlayer;
     }
 
-    // called by native code via NDK
+    // called by the telemetry timer
     @Override
     @SuppressWarnings({"UnusedDeclaration"})
     public void onVideoRatioChanged(int videoW, int videoH) {
@@ -221,7 +369,7 @@ public class VideoPlayer implements IVideoParamsChanged {
         System.out.println("Video W and H" + videoW + "," + videoH);
     }
 
-    // called by native code via NDK
+    // called by the telemetry timer
     @Override
     public void onDecodingInfoChanged(DecodingInfo decodingInfo) {
         if (mVideoParamsChanged != null) {
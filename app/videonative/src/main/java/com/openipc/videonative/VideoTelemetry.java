@@ -0,0 +1,106 @@
+package com.openipc.videonative;
+
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+
+/**
+ * Decoder statistics read from the block the native player publishes (VideoTelemetry in VideoPlayer.h).
+ * Polling reads memory only, no JNI call and no allocation. Not thread safe, one instance per polling thread.
+ */
+public class VideoTelemetry {
+    private static final int VERSION = 1;
+    private static final int SIZE = 64;
+
+    private static final int SEQUENCE = 0;
+    private static final int HEADER_VERSION = 4;
+    private static final int HEADER_SIZE = 6;
+    private static final int LAYOUT = 16;
+    private static final int PUBLISH_MS = LAYOUT;
+    private static final int RATIO_CHANGES = LAYOUT + 8;
+    private static final int INFO_CHANGES = LAYOUT + 12;
+    private static final int WIDTH = LAYOUT + 16;
+    private static final int HEIGHT = LAYOUT + 20;
+    private static final int CURRENT_FPS = LAYOUT + 24;
+    private static final int CURRENT_KBPS = LAYOUT + 28;
+    private static final int AVG_PARSING_MS = LAYOUT + 32;
+    private static final int AVG_WAIT_FOR_INPUT_MS = LAYOUT + 36;
+    private static final int AVG_DECODING_MS = LAYOUT + 40;
+    private static final int N_NALU = LAYOUT + 44;
+    private static final int N_NALUS_FEEDED = LAYOUT + 48;
+    private static final int N_DECODED_FRAMES = LAYOUT + 52;
+    private static final int N_CODEC = LAYOUT + 56;
+
+    // Volatile store + load as a full fence around the plain reads, VarHandle.fullFence() needs API 33
+    private static volatile int fence;
+
+    private final ByteBuffer buffer;
+    private int sequence = -1;
+
+    public long publishMs;
+    // Incremented by the native side whenever width/height or the decoding info change
+    public int ratioChanges;
+    public int infoChanges;
+    public int width;
+    public int height;
+    public float currentFPS;
+    public float currentKiloBitsPerSecond;
+    public float avgParsingTime_ms;
+    public float avgWaitForInputBTime_ms;
+    public float avgDecodingTime_ms;
+    public int nNALU;
+    public int nNALUSFeeded;
+    public int nDecodedFrames;
+    public int nCodec;
+
+    VideoTelemetry(ByteBuffer block) {
+        buffer = block.order(ByteOrder.nativeOrder());
+        if (buffer.getShort(HEADER_VERSION) != VERSION || buffer.getShort(HEADER_SIZE) != SIZE) {
+            throw new IllegalStateException("Unexpected video telemetry layout");
+        }
+    }
+
+    private static void fullFence() {
+        fence = 0;
+        int ignored = fence;
+    }
+
+    /**
+     * @return True if a new snapshot was copied into the fields, false if nothing was published since the last call.
+     */
+    public boolean update() {
+        while (true) {
+            int seq = buffer.getInt(SEQUENCE);
+            if ((seq & 1) != 0) {
+                continue;
+            }
+            if (seq == sequence) {
+                return false;
+            }
+            fullFence();
+            publishMs = buffer.getLong(PUBLISH_MS);
+            ratioChanges = buffer.getInt(RATIO_CHANGES);
+            infoChanges = buffer.getInt(INFO_CHANGES);
+            width = buffer.getInt(WIDTH);
+            height = buffer.getInt(HEIGHT);
+            currentFPS = buffer.getFloat(CURRENT_FPS);
+            currentKiloBitsPerSecond = buffer.getFloat(CURRENT_KBPS);
+            avgParsingTime_ms = buffer.getFloat(AVG_PARSING_MS);
+            avgWaitForInputBTime_ms = buffer.getFloat(AVG_WAIT_FOR_INPUT_MS);
+            avgDecodingTime_ms = buffer.getFloat(AVG_DECODING_MS);
+            nNALU = buffer.getInt(N_NALU);
+            nNALUSFeeded = buffer.getInt(N_NALUS_FEEDED);
+            nDecodedFrames = buffer.getInt(N_DECODED_FRAMES);
+            nCodec = buffer.getInt(N_CODEC);
+            fullFence();
+            if (buffer.getInt(SEQUENCE) == seq) {
+                sequence = seq;
+                return true;
+            }
+        }
+    }
+
+    public DecodingInfo toDecodingInfo() {
+        return new DecodingInfo(currentFPS, currentKiloBitsPerSecond, avgParsingTime_ms, avgWaitForInputBTime_ms,
+                avgDecodingTime_ms, nNALU, nNALUSFeeded, nDecodedFrames, nCodec);
+    }
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+/**
+ * @class BoundedQueue
+ * @brief Fixed-capacity lock-free queue for many producers and one consumer.
+ *
+ * Every cell carries a sequence number (Vyukov's bounded queue), so producers only contend on the enqueue
+ * position and never wait for each other or for the consumer. Elements are constructed once and reused:
+ * producers fill a cell in place, the consumer reads it in place.
+ */
+template <typename T> class BoundedQueue {
+  public:
+    /**
+     * @param capacity Number of cells, rounded up to a power of two.
+     */
+    explicit BoundedQueue(size_t capacity) {
+        size_t size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        mask_ = size - 1;
+        cells_ = std::make_unique<Cell[]>(size);
+        for (size_t i = 0; i < size; ++i) {
+            cells_[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    BoundedQueue(const BoundedQueue &) = delete;
+    BoundedQueue &operator=(const BoundedQueue &) = delete;
+
+    /**
+     * @brief Claims a free cell, lets @p fill write it and publishes it. Safe from any number of threads.
+     * @return False (and counts a drop) if the queue is full or @p fill rejected the element.
+     */
+    template <typename Fill> bool push(Fill &&fill) {
+        size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+        Cell *cell;
+        for (;;) {
+            cell = &cells_[pos & mask_];
+            const size_t seq = cell->seq.load(std::memory_order_acquire);
+            const intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (dif == 0) {
+                if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (dif < 0) {
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            } else {
+                pos = enqueuePos_.load(std::memory_order_relaxed);
+            }
+        }
+        const bool ok = fill(cell->value);
+        // A rejected element still has to release the cell, the consumer skips it
+        cell->valid = ok;
+        cell->seq.store(pos + 1, std::memory_order_release);
+        if (!ok) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+        }
+        return ok;
+    }
+
+    /**
+     * @brief Oldest published element or nullptr. Consumer thread only, valid until pop().
+     */
+    T *front() {
+        for (;;) {
+            const size_t pos = dequeuePos_.load(std::memory_order_relaxed);
+            Cell &cell = cells_[pos & mask_];
+            if (cell.seq.load(std::memory_order_acquire) != pos + 1) {
+                return nullptr;
+            }
+            if (cell.valid) {
+                return &cell.value;
+            }
+            pop();
+        }
+    }
+
+    /**
+     * @brief Returns the element obtained by front() to the producers. Consumer thread only.
+     */
+    void pop() {
+        const size_t pos = dequeuePos_.load(std::memory_order_relaxed);
+        cells_[pos & mask_].seq.store(pos + mask_ + 1, std::memory_order_release);
+        dequeuePos_.store(pos + 1, std::memory_order_release);
+    }
+
+    bool empty() const { return depth() == 0; }
+
+    /// Approximate number of queued elements, safe from any thread.
+    size_t depth() const {
+        const size_t enq = enqueuePos_.load(std::memory_order_acquire);
+        const size_t deq = dequeuePos_.load(std::memory_order_acquire);
+        return enq > deq ? enq - deq : 0;
+    }
+
+    size_t capacity() const { return mask_ + 1; }
+
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+  private:
+    struct Cell {
+        std::atomic<size_t> seq{0};
+        bool valid{false};
+        T value{};
+    };
+
+    size_t mask_{0};
+    std::unique_ptr<Cell[]> cells_;
+    alignas(64) std::atomic<size_t> enqueuePos_{0};
+    alignas(64) std::atomic<size_t> dequeuePos_{0};
+    alignas(64) std::atomic<uint64_t> dropped_{0};
+};
@@ -0,0 +1,97 @@
+#include "DiversityFilter.h"
+
+#include <climits>
+
+namespace {
+
+// Packet types and header layout of wfb-ng (wifibroadcast.hpp): type byte, then the big endian
+// data nonce (block_idx << 8 | fragment_idx) for data packets.
+constexpr uint8_t kPacketData = 0x1;
+constexpr uint8_t kPacketSession = 0x2;
+constexpr size_t kDataHeaderSize = 1 + sizeof(uint64_t);
+
+uint64_t readBe64(const uint8_t *p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; ++i) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+uint64_t fnv1a(const uint8_t *p, size_t size) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < size; ++i) {
+        h = (h ^ p[i]) * 0x100000001b3ull;
+    }
+    return h;
+}
+
+} // namespace
+
+bool DiversityFilter::accept(const uint8_t *payload, size_t size, uint8_t wlan_idx, int8_t best_rssi) {
+    if (size == 0) {
+        return true;
+    }
+    if (payload[0] == kPacketSession) {
+        const uint64_t hash = fnv1a(payload, size);
+        if (hash != last_session_hash_) {
+            last_session_hash_ = hash;
+            reset();
+        }
+        return true;
+    }
+    if (payload[0] != kPacketData || size < kDataHeaderSize || wlan_idx >= MAX_ADAPTERS) {
+        return true;
+    }
+
+    Counters &c = counters_[wlan_idx];
+    c.received.fetch_add(1, std::memory_order_relaxed);
+    c.interval_received.fetch_add(1, std::memory_order_relaxed);
+    c.interval_rssi_sum.fetch_add(best_rssi, std::memory_order_relaxed);
+
+    const uint64_t nonce = readBe64(payload + 1);
+    // Fibonacci hashing spreads the few fragments of consecutive blocks over the whole table
+    Slot &slot = window_[(nonce * 0x9e3779b97f4a7c15ull) >> (64 - 10)];
+    static_assert(WINDOW == 1 << 10);
+    if (slot.used && slot.nonce == nonce) {
+        c.duplicates.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    slot.nonce = nonce;
+    slot.used = true;
+    c.first.fetch_add(1, std::memory_order_relaxed);
+    interval_unique_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void DiversityFilter::reset() {
+    for (Slot &slot : window_) {
+        slot.used = false;
+    }
+}
+
+std::vector<DiversityFilter::AdapterStats> DiversityFilter::stats() {
+    std::vector<AdapterStats> result;
+    const uint64_t unique = interval_unique_.exchange(0, std::memory_order_relaxed);
+    for (size_t i = 0; i < MAX_ADAPTERS; ++i) {
+        Counters &c = counters_[i];
+        const uint64_t received = c.received.load(std::memory_order_relaxed);
+        if (received == 0) {
+            continue;
+        }
+        const uint64_t interval_received = c.interval_received.exchange(0, std::memory_order_relaxed);
+        const int64_t rssi_sum = c.interval_rssi_sum.exchange(0, std::memory_order_relaxed);
+
+        AdapterStats s{};
+        s.wlan_idx = static_cast<uint8_t>(i);
+        s.received = received;
+        s.first = c.first.load(std::memory_order_relaxed);
+        s.duplicates = c.duplicates.load(std::memory_order_relaxed);
+        s.loss_permille =
+            unique > interval_received ? static_cast<int>((unique - interval_received) * 1000 / unique) : 0;
+        s.rssi_avg = interval_received > 0 ? static_cast<int>(rssi_sum / static_cast<int64_t>(interval_received))
+                                           : INT8_MIN;
+        result.push_back(s);
+    }
+    return result;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @class DiversityFilter
+ * @brief Drops the copies of a data packet that another adapter already delivered, before the aggregator decrypts
+ * them, and keeps per-adapter reception statistics.
+ *
+ * With N adapters on the same channel every packet arrives up to N times. The aggregator would also reject the
+ * copies, but only after paying for the AEAD decrypt. The filter remembers the nonces of the last WINDOW data
+ * packets (a hash table where a collision just forgets the older nonce, so a copy can slip through but a new packet
+ * is never dropped). A session packet with new content starts a new nonce space and clears the table.
+ *
+ * accept() is called on the stream worker only, stats() from any thread.
+ */
+class DiversityFilter {
+  public:
+    static constexpr size_t MAX_ADAPTERS = 8;
+    static constexpr size_t WINDOW = 1024;
+
+    struct AdapterStats {
+        uint8_t wlan_idx;
+        uint64_t received;   // data packets from this adapter, copies included
+        uint64_t first;      // data packets this adapter delivered before any other
+        uint64_t duplicates; // copies another adapter already delivered
+        int loss_permille;   // unique packets of the stream this adapter missed since the last stats() call
+        int rssi_avg;        // best chain, since the last stats() call, INT8_MIN if nothing was received
+    };
+
+    /**
+     * @param payload wfb-ng packet (802.11 header stripped).
+     * @param best_rssi Strongest chain of this copy, only used for statistics.
+     * @return False if the packet is a copy the aggregator already got.
+     */
+    bool accept(const uint8_t *payload, size_t size, uint8_t wlan_idx, int8_t best_rssi);
+
+    /// Adapters that delivered anything, resets the interval counters (loss, rssi).
+    std::vector<AdapterStats> stats();
+
+  private:
+    struct Slot {
+        uint64_t nonce;
+        bool used;
+    };
+
+    struct Counters {
+        std::atomic<uint64_t> received{0};
+        std::atomic<uint64_t> first{0};
+        std::atomic<uint64_t> duplicates{0};
+        std::atomic<uint64_t> interval_received{0};
+        std::atomic<int64_t> interval_rssi_sum{0};
+    };
+
+    void reset();
+
+    std::array<Slot, WINDOW> window_{};
+    uint64_t last_session_hash_{0};
+    std::array<Counters, MAX_ADAPTERS> counters_;
+    std::atomic<uint64_t> interval_unique_{0};
+};
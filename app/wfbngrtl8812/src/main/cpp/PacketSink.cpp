@@ -0,0 +1,72 @@
+#include "PacketSink.h"
+
+#include <android/log.h>
+
+#include <arpa/inet.h>
+#include <cstddef>
+#include <cstring>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#undef TAG
+#define TAG "pixelpilot"
+
+UdpPacketSink::UdpPacketSink(const std::string &addr, int port) {
+    sockfd_ = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sockfd_ < 0) {
+        __android_log_print(ANDROID_LOG_ERROR, TAG, "UdpPacketSink: socket failed: %s", strerror(errno));
+        return;
+    }
+    dest_.sin_family = AF_INET;
+    dest_.sin_port = htons(port);
+    if (inet_pton(AF_INET, addr.c_str(), &dest_.sin_addr) <= 0) {
+        __android_log_print(ANDROID_LOG_ERROR, TAG, "UdpPacketSink: invalid address %s", addr.c_str());
+        close(sockfd_);
+        sockfd_ = -1;
+    }
+}
+
+UdpPacketSink::~UdpPacketSink() {
+    if (sockfd_ >= 0) {
+        close(sockfd_);
+    }
+}
+
+void UdpPacketSink::send(const uint8_t *data, size_t size, const PacketTiming &) {
+    if (sockfd_ < 0) {
+        return;
+    }
+    sendto(sockfd_, data, size, MSG_DONTWAIT, reinterpret_cast<const sockaddr *>(&dest_), sizeof(dest_));
+}
+
+UdsPacketSink::UdsPacketSink(const std::string &path) {
+    if (path.empty() || path.size() >= sizeof(dest_.sun_path)) {
+        __android_log_print(ANDROID_LOG_ERROR, TAG, "UdsPacketSink: invalid path '%s'", path.c_str());
+        return;
+    }
+    sockfd_ = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (sockfd_ < 0) {
+        __android_log_print(ANDROID_LOG_ERROR, TAG, "UdsPacketSink: socket failed: %s", strerror(errno));
+        return;
+    }
+    dest_.sun_family = AF_UNIX;
+    memcpy(dest_.sun_path, path.data(), path.size());
+    if (path[0] == '@') {
+        dest_.sun_path[0] = '\0';
+    }
+    dest_len_ = offsetof(sockaddr_un, sun_path) + path.size();
+}
+
+UdsPacketSink::~UdsPacketSink() {
+    if (sockfd_ >= 0) {
+        close(sockfd_);
+    }
+}
+
+void UdsPacketSink::send(const uint8_t *data, size_t size, const PacketTiming &) {
+    if (sockfd_ < 0) {
+        return;
+    }
+    // Nobody bound to the path yet is not an error, the datagram is just lost like with UDP
+    sendto(sockfd_, data, size, MSG_DONTWAIT, reinterpret_cast<const sockaddr *>(&dest_), dest_len_);
+}
@@ -0,0 +1,132 @@
+#ifndef PACKET_SINK_H
+#define PACKET_SINK_H
+
+#include "wfb-ng/src/rx.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include <netinet/in.h>
+#include <sys/un.h>
+
+/**
+ * @brief Where the time of a reassembled packet went before it left the aggregator.
+ *
+ * Timestamps are CLOCK_MONOTONIC (steady_clock) nanoseconds. For a packet that had to wait for FEC they belong to
+ * the frame that completed the block, which is the one the packet was released by; the time it sat in the block
+ * before that is not known here. Passed across libraries by InProcessPushFn, so the layout is part of that contract.
+ */
+struct PacketTiming {
+    static constexpr uint32_t kFecRecovered = 1;
+
+    int64_t arrival_ns; ///< USB transfer completed, RxFrameMeta::timestamp_ns
+    int64_t dequeue_ns; ///< The stream worker took the frame off its queue
+    uint32_t flags;     ///< kFecRecovered if the block needed FEC to release this packet
+};
+
+/**
+ * @brief Destination for the packets an aggregator reassembled.
+ *
+ * send() is called on the thread running the aggregator and must not keep the pointers past its return.
+ */
+class PacketSink {
+  public:
+    virtual ~PacketSink() = default;
+    virtual void send(const uint8_t *data, size_t size, const PacketTiming &timing) = 0;
+};
+
+/**
+ * @brief Sends every packet as one UDP datagram, the classic wfb-ng output.
+ */
+class UdpPacketSink : public PacketSink {
+  public:
+    UdpPacketSink(const std::string &addr, int port);
+    ~UdpPacketSink() override;
+    void send(const uint8_t *data, size_t size, const PacketTiming &timing) override;
+
+  private:
+    int sockfd_{-1};
+    sockaddr_in dest_{};
+};
+
+/**
+ * @brief Sends every packet as one datagram to a unix domain socket.
+ *
+ * A path starting with '@' names a socket in the abstract namespace, which needs no writable directory.
+ */
+class UdsPacketSink : public PacketSink {
+  public:
+    explicit UdsPacketSink(const std::string &path);
+    ~UdsPacketSink() override;
+    void send(const uint8_t *data, size_t size, const PacketTiming &timing) override;
+
+  private:
+    int sockfd_{-1};
+    sockaddr_un dest_{};
+    socklen_t dest_len_{0};
+};
+
+/**
+ * @brief Producer entry point exported by another native library of this process.
+ *
+ * The VideoNative library hands (fn, ctx) over through Java, fn copies the packet into a preallocated ring that
+ * the video player drains on its own thread. Unlike the socket sinks it also gets the packet timing, the player
+ * folds it into its latency breakdown.
+ */
+using InProcessPushFn = void (*)(void *ctx, const uint8_t *data, size_t len, const PacketTiming *timing);
+
+class InProcessPacketSink : public PacketSink {
+  public:
+    InProcessPacketSink(InProcessPushFn fn, void *ctx) : fn_(fn), ctx_(ctx) {}
+    void send(const uint8_t *data, size_t size, const PacketTiming &timing) override {
+        fn_(ctx_, data, size, &timing);
+    }
+
+  private:
+    InProcessPushFn fn_;
+    void *ctx_;
+};
+
+/**
+ * @brief Aggregator whose output goes to a replaceable PacketSink instead of a fixed socket.
+ *
+ * The sink can be swapped while the session is running (no new session key needed), callers must serialize
+ * setSink() with process_packet(). beginFrame() before every process_packet() stamps the packets it releases.
+ */
+class AggregatorSink : public Aggregator {
+  public:
+    AggregatorSink(std::shared_ptr<PacketSink> sink, const std::string &keypair, uint64_t epoch, uint32_t channel_id)
+        : Aggregator(keypair, epoch, channel_id), sink_(std::move(sink)) {}
+
+    void setSink(std::shared_ptr<PacketSink> sink) { sink_ = std::move(sink); }
+
+    void beginFrame(int64_t arrival_ns) {
+        timing_.arrival_ns = arrival_ns;
+        timing_.dequeue_ns =
+            std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+                .count();
+        fec_recovered_at_begin_ = count_p_fec_recovered;
+    }
+
+    /// Fragments FEC recovered since beginFrame(), non-zero if the last frame completed a block that needed it
+    uint32_t recoveredInFrame() const { return count_p_fec_recovered - fec_recovered_at_begin_; }
+
+  protected:
+    void send_to_socket(const uint8_t *payload, uint16_t packet_size) override {
+        if (sink_) {
+            // wfb-ng counts recovered fragments before it flushes the block, everything sent after that in the
+            // same call waited for FEC, including packets that arrived fine but queued up behind a lost one
+            timing_.flags = count_p_fec_recovered != fec_recovered_at_begin_ ? PacketTiming::kFecRecovered : 0;
+            sink_->send(payload, packet_size, timing_);
+        }
+    }
+
+  private:
+    std::shared_ptr<PacketSink> sink_;
+    PacketTiming timing_{};
+    uint32_t fec_recovered_at_begin_{0};
+};
+
+#endif // PACKET_SINK_H
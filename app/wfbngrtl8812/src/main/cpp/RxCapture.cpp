@@ -0,0 +1,247 @@
+#include "RxCapture.h"
+
+#include <android/log.h>
+
+#include "pcap.h"
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstring>
+
+#undef TAG
+#define TAG "pixelpilot"
+
+namespace {
+
+constexpr int kDltIeee80211Radiotap = 127;
+
+// Radiotap presence bits
+constexpr int kFlags = 1;
+constexpr int kChannel = 3;
+constexpr int kAntSignal = 5;
+constexpr int kAntNoise = 6;
+constexpr int kAntenna = 11;
+constexpr int kRadiotapNamespace = 29;
+constexpr int kVendorNamespace = 30;
+constexpr int kExt = 31;
+
+constexpr uint8_t kFlagFcs = 0x10;
+constexpr uint16_t kChan2Ghz = 0x0080;
+constexpr uint16_t kChan5Ghz = 0x0100;
+constexpr uint16_t kChanOfdm = 0x0040;
+
+// {alignment, size} of the standard fields, indexed by presence bit
+constexpr struct {
+    uint8_t align;
+    uint8_t size;
+} kFields[] = {
+    {8, 8}, {1, 1}, {1, 1}, {2, 4}, {1, 2}, {1, 1}, {1, 1}, {2, 2}, {2, 2},  {2, 2}, {1, 1}, {1, 1},
+    {1, 1}, {1, 1}, {2, 2}, {2, 2}, {1, 1}, {1, 1}, {4, 8}, {1, 3}, {4, 8}, {2, 12}, {8, 12},
+};
+
+void putLe16(uint8_t *p, uint16_t v) {
+    p[0] = v & 0xff;
+    p[1] = v >> 8;
+}
+
+void putLe32(uint8_t *p, uint32_t v) {
+    for (int i = 0; i < 4; ++i) {
+        p[i] = (v >> (8 * i)) & 0xff;
+    }
+}
+
+uint32_t getLe32(const uint8_t *p) { return p[0] | (p[1] << 8) | (p[2] << 16) | (uint32_t(p[3]) << 24); }
+
+int64_t steadyNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+} // namespace
+
+size_t writeRadiotap(const RxFrameMeta &meta, uint8_t *out) {
+    size_t n_chains = 0;
+    while (n_chains < std::size(meta.antenna) && meta.antenna[n_chains] != 0xff) {
+        ++n_chains;
+    }
+
+    // Presence words: the combined fields, then one word per chain in the radiotap namespace
+    const size_t n_words = 1 + n_chains;
+    size_t pos = 4 + 4 * n_words;
+    for (size_t w = 0; w < n_words; ++w) {
+        uint32_t present = w == 0 ? (1u << kFlags) | (1u << kChannel) | (1u << kAntSignal)
+                                  : (1u << kAntSignal) | (1u << kAntNoise) | (1u << kAntenna);
+        if (w + 1 < n_words) {
+            present |= (1u << kRadiotapNamespace) | (1u << kExt);
+        }
+        putLe32(out + 4 + 4 * w, present);
+    }
+
+    int8_t best = SCHAR_MIN;
+    for (size_t i = 0; i < n_chains; ++i) {
+        best = std::max(best, meta.rssi[i]);
+    }
+    out[pos++] = kFlagFcs;
+    pos += pos & 1;
+    putLe16(out + pos, meta.freq);
+    putLe16(out + pos + 2, kChanOfdm | (meta.freq < 3000 ? kChan2Ghz : kChan5Ghz));
+    pos += 4;
+    out[pos++] = static_cast<uint8_t>(best);
+    for (size_t i = 0; i < n_chains; ++i) {
+        // SNR is no radiotap field, it travels as noise = signal - snr
+        out[pos++] = static_cast<uint8_t>(meta.rssi[i]);
+        out[pos++] = static_cast<uint8_t>(meta.rssi[i] - meta.snr[i]);
+        out[pos++] = meta.antenna[i];
+    }
+
+    out[0] = 0; // version
+    out[1] = 0;
+    putLe16(out + 2, static_cast<uint16_t>(pos));
+    return pos;
+}
+
+bool parseRadiotap(const uint8_t *data, size_t size, RxFrameMeta &meta, size_t &header_len, bool &has_fcs) {
+    if (size < 8 || data[0] != 0) {
+        return false;
+    }
+    header_len = data[2] | (data[3] << 8);
+    if (header_len < 8 || header_len > size) {
+        return false;
+    }
+    has_fcs = false;
+    std::fill(std::begin(meta.antenna), std::end(meta.antenna), 0xff);
+    std::fill(std::begin(meta.rssi), std::end(meta.rssi), SCHAR_MIN);
+    std::fill(std::begin(meta.snr), std::end(meta.snr), 0);
+    std::fill(std::begin(meta.noise), std::end(meta.noise), SCHAR_MAX);
+    meta.freq = 0;
+
+    // All presence words first, the field data follows the last one
+    size_t n_words = 1;
+    while ((getLe32(data + 4 * n_words) & (1u << kExt)) && 4 + 4 * (n_words + 1) <= header_len) {
+        ++n_words;
+    }
+    size_t pos = 4 + 4 * n_words;
+
+    int8_t combined_signal = SCHAR_MIN;
+    size_t chain = 0;
+    bool in_radiotap_ns = true;
+    for (size_t w = 0; w < n_words && in_radiotap_ns; ++w) {
+        const uint32_t present = getLe32(data + 4 + 4 * w);
+        // Word 0 holds the combined values, every further radiotap namespace word one chain
+        const bool per_chain = w > 0 && chain < std::size(meta.antenna);
+        int8_t signal = SCHAR_MIN;
+        int8_t noise = SCHAR_MAX;
+        int antenna = -1;
+        for (int bit = 0; bit < kRadiotapNamespace; ++bit) {
+            if (!(present & (1u << bit))) {
+                continue;
+            }
+            if (bit >= static_cast<int>(std::size(kFields))) {
+                return true; // unknown alignment, the frame offset is still right
+            }
+            pos = (pos + kFields[bit].align - 1) & ~size_t(kFields[bit].align - 1);
+            if (pos + kFields[bit].size > header_len) {
+                return true;
+            }
+            const uint8_t *field = data + pos;
+            switch (bit) {
+            case kFlags:
+                has_fcs = field[0] & kFlagFcs;
+                break;
+            case kChannel:
+                meta.freq = field[0] | (field[1] << 8);
+                break;
+            case kAntSignal:
+                signal = static_cast<int8_t>(field[0]);
+                break;
+            case kAntNoise:
+                noise = static_cast<int8_t>(field[0]);
+                break;
+            case kAntenna:
+                antenna = field[0];
+                break;
+            }
+            pos += kFields[bit].size;
+        }
+        if (w == 0) {
+            combined_signal = signal;
+        } else if (per_chain) {
+            meta.antenna[chain] = antenna >= 0 ? antenna : chain;
+            meta.rssi[chain] = signal;
+            meta.noise[chain] = noise;
+            meta.snr[chain] = noise != SCHAR_MAX ? signal - noise : 0;
+            ++chain;
+        }
+        // A vendor namespace (or a bare EXT) ends what we can interpret
+        in_radiotap_ns = (present & (1u << kRadiotapNamespace)) && !(present & (1u << kVendorNamespace));
+    }
+    if (chain == 0 && combined_signal != SCHAR_MIN) {
+        meta.antenna[0] = 0;
+        meta.rssi[0] = combined_signal;
+    }
+    return true;
+}
+
+RxCapture::RxCapture()
+    : worker_("wfb-capture", 1024, 10, [this](const RxQueuedFrame &frame) { write(frame); }) {}
+
+RxCapture::~RxCapture() { stop(); }
+
+bool RxCapture::start(const std::string &path) {
+    stop();
+    auto lock = worker_.lock();
+    pcap_ = pcap_open_dead(kDltIeee80211Radiotap, 65535);
+    dumper_ = pcap_ ? pcap_dump_open(pcap_, path.c_str()) : nullptr;
+    if (dumper_ == nullptr) {
+        __android_log_print(ANDROID_LOG_ERROR,
+                            TAG,
+                            "capture: cannot create %s: %s",
+                            path.c_str(),
+                            pcap_ ? pcap_geterr(pcap_) : "pcap_open_dead failed");
+        if (pcap_) {
+            pcap_close(pcap_);
+            pcap_ = nullptr;
+        }
+        return false;
+    }
+    const int64_t realtime_ns =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch())
+            .count();
+    clock_offset_ns_ = realtime_ns - steadyNs();
+    written_ = 0;
+    active_ = true;
+    __android_log_print(ANDROID_LOG_DEBUG, TAG, "capture: writing %s", path.c_str());
+    return true;
+}
+
+void RxCapture::stop() {
+    active_ = false;
+    auto lock = worker_.lock();
+    if (dumper_) {
+        pcap_dump_close(dumper_);
+        dumper_ = nullptr;
+        __android_log_print(ANDROID_LOG_DEBUG, TAG, "capture: stopped after %llu frames", (unsigned long long)written_);
+    }
+    if (pcap_) {
+        pcap_close(pcap_);
+        pcap_ = nullptr;
+    }
+}
+
+void RxCapture::write(const RxQueuedFrame &frame) {
+    if (dumper_ == nullptr) {
+        return; // queued before stop()
+    }
+    uint8_t packet[RADIOTAP_MAX_SIZE + RxQueuedFrame::MAX_SIZE];
+    const size_t header_len = writeRadiotap(frame.meta, packet);
+    std::memcpy(packet + header_len, frame.data, frame.size);
+
+    const int64_t ts = frame.meta.timestamp_ns + clock_offset_ns_;
+    pcap_pkthdr hdr{};
+    hdr.ts.tv_sec = ts / 1000000000;
+    hdr.ts.tv_usec = (ts % 1000000000) / 1000;
+    hdr.caplen = hdr.len = header_len + frame.size;
+    pcap_dump(reinterpret_cast<u_char *>(dumper_), &hdr, packet);
+    written_.fetch_add(1, std::memory_order_relaxed);
+}
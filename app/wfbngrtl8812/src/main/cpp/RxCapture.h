@@ -0,0 +1,72 @@
+#pragma once
+
+#include "RxStreamWorker.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <span>
+#include <string>
+
+struct pcap;
+struct pcap_dumper;
+
+/**
+ * @brief Radiotap header describing @p meta: flags (FCS included), channel, combined and per-chain signal/noise.
+ * @return Bytes written to @p out, at most RADIOTAP_MAX_SIZE.
+ */
+size_t writeRadiotap(const RxFrameMeta &meta, uint8_t *out);
+
+constexpr size_t RADIOTAP_MAX_SIZE = 64;
+
+/**
+ * @brief Fills @p meta (signal, noise, antennas, frequency) from a radiotap header.
+ *
+ * Understands the standard fields up to TIMESTAMP and extended presence words in the radiotap namespace (one per
+ * chain, as written by writeRadiotap() and by Linux drivers). Parsing stops quietly at anything else.
+ * @param header_len Size of the radiotap header, the 802.11 frame starts behind it.
+ * @param has_fcs Set if the frame ends with its FCS.
+ * @return False if @p data does not start with a radiotap header.
+ */
+bool parseRadiotap(const uint8_t *data, size_t size, RxFrameMeta &meta, size_t &header_len, bool &has_fcs);
+
+/**
+ * @class RxCapture
+ * @brief Writes every frame the adapters deliver, with its radio metadata as radiotap, to a pcap file.
+ *
+ * push() only copies the frame into a queue, the file is written on the capture's own thread so a slow storage
+ * never stalls USB reception. Frames that do not fit the queue are counted and lost.
+ */
+class RxCapture {
+  public:
+    RxCapture();
+    ~RxCapture();
+
+    /// Starts a new file (stops the running one). @return False if the file could not be created.
+    bool start(const std::string &path);
+    void stop();
+
+    bool active() const { return active_.load(std::memory_order_relaxed); }
+
+    /// Raw 802.11 frame including its FCS. Safe from all RX threads.
+    void push(std::span<const uint8_t> frame, const RxFrameMeta &meta) {
+        if (active()) {
+            worker_.push(frame.data(), frame.size(), meta);
+        }
+    }
+
+    uint64_t written() const { return written_; }
+    uint64_t dropped() { return worker_.stats().dropped; }
+
+  private:
+    void write(const RxQueuedFrame &frame);
+
+    std::atomic<bool> active_{false};
+    pcap *pcap_{nullptr};
+    pcap_dumper *dumper_{nullptr};
+    // realtime - steady clock, for the pcap timestamps
+    int64_t clock_offset_ns_{0};
+    std::atomic<uint64_t> written_{0};
+    RxStreamWorker worker_;
+};
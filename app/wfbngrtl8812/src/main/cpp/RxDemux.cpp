@@ -0,0 +1,125 @@
+#include "RxDemux.h"
+
+#include "RxFrame.h"
+#include "TraceRecorder.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+
+namespace {
+
+// 802.11 QoS data header in front and the FCS behind every wfb-ng payload
+constexpr size_t kIeee80211HeaderSize = 24;
+constexpr size_t kFcsSize = 4;
+
+int8_t bestRssi(const RxFrameMeta &meta) {
+    int8_t best = SCHAR_MIN;
+    for (size_t i = 0; i < std::size(meta.antenna) && meta.antenna[i] != 0xff; ++i) {
+        best = std::max(best, meta.rssi[i]);
+    }
+    return best;
+}
+
+} // namespace
+
+RxStream::RxStream(uint32_t channel_id,
+                   std::shared_ptr<PacketSink> sink,
+                   const std::string &keypair,
+                   size_t queue_capacity,
+                   int nice,
+                   FrameHook hook)
+    : channel_id_(channel_id), hook_(std::move(hook)), sink_(std::move(sink)),
+      aggregator_(std::make_unique<AggregatorSink>(sink_, keypair, 0, channel_id)) {
+    char name[16];
+    snprintf(name, sizeof(name), "wfb-rx-%u", static_cast<unsigned>(radioPort()));
+    worker_ = std::make_unique<RxStreamWorker>(name, queue_capacity, nice, [this](const RxQueuedFrame &f) {
+        const bool first = diversity_.accept(f.data, f.size, f.meta.wlan_idx, bestRssi(f.meta));
+        if (hook_) {
+            hook_(*this, f, first);
+        }
+        if (!first) {
+            return;
+        }
+        TRACE_SCOPE_ARG("aggregate", f.size);
+        aggregator_->beginFrame(f.meta.timestamp_ns);
+        aggregator_->process_packet(
+            f.data, f.size, f.meta.wlan_idx, f.meta.antenna, f.meta.rssi, f.meta.noise, f.meta.freq, 0, 0, NULL);
+        if (const uint32_t recovered = aggregator_->recoveredInFrame()) {
+            TRACE_INSTANT("fec_block", recovered);
+        }
+    });
+}
+
+void RxStream::setSink(std::shared_ptr<PacketSink> sink) {
+    auto lock = worker_->lock();
+    sink_ = std::move(sink);
+    aggregator_->setSink(sink_);
+}
+
+void RxStream::resetAggregator(const std::string &keypair) {
+    std::shared_ptr<PacketSink> sink;
+    {
+        auto lock = worker_->lock();
+        sink = sink_;
+    }
+    // Loading the keypair stays outside the lock so the worker keeps draining its queue meanwhile
+    auto aggregator = std::make_unique<AggregatorSink>(sink, keypair, 0, channel_id_);
+    auto lock = worker_->lock();
+    // setSink() may have run since the copy above
+    aggregator->setSink(sink_);
+    aggregator_ = std::move(aggregator);
+}
+
+RxDemux::View::Result RxDemux::View::dispatch(std::span<uint8_t> data, const RxFrameMeta &meta) {
+    RxFrame frame(data);
+    uint32_t channel_id;
+    if (!frame.IsValidWfbFrame() || !frame.GetChannelID(channel_id)) {
+        return NOT_WFB;
+    }
+    RxStream *stream = find(channel_id);
+    if (stream == nullptr) {
+        return NO_STREAM;
+    }
+    const bool queued =
+        stream->push(data.data() + kIeee80211HeaderSize, data.size() - kIeee80211HeaderSize - kFcsSize, meta);
+    return queued ? QUEUED : DROPPED;
+}
+
+void RxDemux::add(std::shared_ptr<RxStream> stream) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto table = std::make_shared<Table>(*table_);
+    (*table)[stream->channelId()] = std::move(stream);
+    table_ = std::move(table);
+    generation_.fetch_add(1, std::memory_order_release);
+}
+
+bool RxDemux::remove(uint32_t channel_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (table_->count(channel_id) == 0) {
+        return false;
+    }
+    auto table = std::make_shared<Table>(*table_);
+    table->erase(channel_id);
+    table_ = std::move(table);
+    generation_.fetch_add(1, std::memory_order_release);
+    return true;
+}
+
+std::shared_ptr<RxStream> RxDemux::find(uint32_t channel_id) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto it = table_->find(channel_id);
+    return it != table_->end() ? it->second : nullptr;
+}
+
+std::vector<std::shared_ptr<RxStream>> RxDemux::streams() const {
+    std::vector<std::shared_ptr<RxStream>> result;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto &[id, stream] : *table_) {
+            result.push_back(stream);
+        }
+    }
+    std::sort(result.begin(), result.end(), [](const auto &a, const auto &b) { return a->channelId() < b->channelId(); });
+    return result;
+}
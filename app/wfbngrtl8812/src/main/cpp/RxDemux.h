@@ -0,0 +1,132 @@
+#pragma once
+
+#include "DiversityFilter.h"
+#include "PacketSink.h"
+#include "RxStreamWorker.h"
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @class RxStream
+ * @brief One received wfb-ng stream: its aggregator, output sink and worker thread.
+ */
+class RxStream {
+  public:
+    /**
+     * Extra per-frame work done on the worker before the frame reaches the aggregator. Sees every copy, @p first
+     * is false for a copy another adapter already delivered.
+     */
+    using FrameHook = std::function<void(RxStream &, const RxQueuedFrame &, bool first)>;
+
+    /**
+     * @param channel_id (link_id << 8) | radio_port.
+     * @param queue_capacity Frames the RX threads can queue ahead of the worker.
+     * @param nice Priority of the worker thread.
+     */
+    RxStream(uint32_t channel_id,
+             std::shared_ptr<PacketSink> sink,
+             const std::string &keypair,
+             size_t queue_capacity,
+             int nice,
+             FrameHook hook = nullptr);
+
+    uint32_t channelId() const { return channel_id_; }
+    uint8_t radioPort() const { return channel_id_ & 0xff; }
+
+    bool push(const uint8_t *payload, size_t size, const RxFrameMeta &meta) {
+        return worker_->push(payload, size, meta);
+    }
+
+    /// Replaces the output, the session and its key are kept.
+    void setSink(std::shared_ptr<PacketSink> sink);
+
+    /// Starts over with a fresh aggregator, e.g. after the key changed.
+    void resetAggregator(const std::string &keypair);
+
+    /// Only valid on the worker (inside the hook) or while holding worker().lock().
+    AggregatorSink *aggregator() { return aggregator_.get(); }
+
+    RxStreamWorker &worker() { return *worker_; }
+
+    /// Per-adapter reception of this stream, see DiversityFilter::stats().
+    std::vector<DiversityFilter::AdapterStats> adapterStats() { return diversity_.stats(); }
+
+  private:
+    const uint32_t channel_id_;
+    const FrameHook hook_;
+    std::shared_ptr<PacketSink> sink_;
+    std::unique_ptr<AggregatorSink> aggregator_;
+    DiversityFilter diversity_;
+    // Last member: the thread must stop before the aggregator goes away
+    std::unique_ptr<RxStreamWorker> worker_;
+};
+
+/**
+ * @class RxDemux
+ * @brief Routes frames to their RxStream by channel id.
+ *
+ * The table is copy-on-write: add()/remove() publish a new immutable map and bump a generation counter. Each RX
+ * thread owns a View that only re-reads the table (under the mutex) after the generation changed, so a lookup is
+ * one relaxed atomic load plus a hash lookup, no matter how many streams exist. A removed stream is destroyed once
+ * the last View dropped its snapshot.
+ */
+class RxDemux {
+  public:
+    using Table = std::unordered_map<uint32_t, std::shared_ptr<RxStream>>;
+
+    class View {
+      public:
+        explicit View(const RxDemux &demux) : demux_(demux) {}
+
+        RxStream *find(uint32_t channel_id) {
+            const uint64_t generation = demux_.generation_.load(std::memory_order_acquire);
+            if (generation != generation_ || !table_) {
+                std::lock_guard<std::mutex> lock(demux_.mutex_);
+                table_ = demux_.table_;
+                generation_ = generation;
+            }
+            const auto it = table_->find(channel_id);
+            return it != table_->end() ? it->second.get() : nullptr;
+        }
+
+        /// What dispatch() did with a frame.
+        enum Result { QUEUED, DROPPED, NO_STREAM, NOT_WFB };
+
+        /**
+         * @brief Validates a raw 802.11 frame (FCS included) and queues its payload on the stream it belongs to.
+         * @return DROPPED if the queue of that stream was full.
+         */
+        Result dispatch(std::span<uint8_t> frame, const RxFrameMeta &meta);
+
+      private:
+        const RxDemux &demux_;
+        std::shared_ptr<const Table> table_;
+        uint64_t generation_{0};
+    };
+
+    RxDemux() : table_(std::make_shared<const Table>()) {}
+
+    /// Adds or replaces the stream with the same channel id.
+    void add(std::shared_ptr<RxStream> stream);
+
+    /// @return False if no stream with that id was registered.
+    bool remove(uint32_t channel_id);
+
+    std::shared_ptr<RxStream> find(uint32_t channel_id) const;
+
+    /// Snapshot of all streams, ordered by channel id.
+    std::vector<std::shared_ptr<RxStream>> streams() const;
+
+  private:
+    mutable std::mutex mutex_;
+    std::shared_ptr<const Table> table_;
+    std::atomic<uint64_t> generation_{1};
+};
@@ -6,6 +6,8 @@
 #define LIBUSBDEMO_RXFRAME_H
 
 #include <array>
+#include <cstdint>
+#include <cstring>
 #include <iomanip>
 #include <iostream>
 #include <span>
@@ -81,6 +83,19 @@ class RxFrame {
                _data[21] == channel_id[3];
     }
 
+    /**
+     * @brief Channel id ((link_id << 8) | radio_port) carried in both addresses of a wfb-ng frame.
+     * @return False if the frame is too short or the two copies disagree.
+     */
+    bool GetChannelID(uint32_t &channel_id) const {
+        if (_data.size() < 22 || _data[10] != 0x57 || _data[11] != 0x42 ||
+            std::memcmp(_data.data() + 10, _data.data() + 16, 6) != 0) {
+            return false;
+        }
+        channel_id = (uint32_t(_data[12]) << 24) | (uint32_t(_data[13]) << 16) | (uint32_t(_data[14]) << 8) | _data[15];
+        return true;
+    }
+
   private:
     bool IsDataFrame() const { return _data.size() >= 2 && _data[0] == _dataHeader[0] && _data[1] == _dataHeader[1]; }
 
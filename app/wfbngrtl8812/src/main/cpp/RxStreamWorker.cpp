@@ -0,0 +1,112 @@
+#include "RxStreamWorker.h"
+
+#include "TraceRecorder.h"
+
+#include <android/log.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#undef TAG
+#define TAG "pixelpilot"
+
+RxStreamWorker::RxStreamWorker(std::string name, size_t capacity, int nice, Handler handler)
+    : name_(std::move(name)), handler_(std::move(handler)), queue_(capacity), nice_(nice) {
+    thread_ = std::thread([this] { loop(); });
+    pthread_setname_np(thread_.native_handle(), name_.c_str());
+}
+
+RxStreamWorker::~RxStreamWorker() {
+    running_ = false;
+    {
+        std::lock_guard<std::mutex> lock(wait_mutex_);
+        wait_cv_.notify_one();
+    }
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+bool RxStreamWorker::push(const uint8_t *payload, size_t size, const RxFrameMeta &meta) {
+    const bool ok = queue_.push([&](RxQueuedFrame &frame) {
+        if (size > RxQueuedFrame::MAX_SIZE) {
+            return false;
+        }
+        frame.meta = meta;
+        frame.size = static_cast<uint16_t>(size);
+        std::memcpy(frame.data, payload, size);
+        return true;
+    });
+    if (!ok) {
+        // The worker did not keep up with USB, the trace shows what it was doing instead
+        TRACE_ANOMALY("rx_queue_full");
+        return false;
+    }
+
+    const size_t depth = queue_.depth();
+    size_t high = high_water_.load(std::memory_order_relaxed);
+    while (depth > high && !high_water_.compare_exchange_weak(high, depth, std::memory_order_relaxed)) {
+    }
+
+    // Pairs with the fence in loop(): either the worker sees the frame, or we see it waiting
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (worker_waiting_.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> lock(wait_mutex_);
+        wait_cv_.notify_one();
+    }
+    return true;
+}
+
+RxStreamWorker::Stats RxStreamWorker::stats() {
+    return Stats{queue_.depth(), high_water_.exchange(0), queue_.dropped(), processed_.load()};
+}
+
+void RxStreamWorker::applyPriority() {
+    const int nice = nice_.load(std::memory_order_relaxed);
+    if (priority_applied_ && nice == applied_nice_) {
+        return;
+    }
+    if (setpriority(PRIO_PROCESS, gettid(), nice) != 0) {
+        __android_log_print(
+            ANDROID_LOG_WARN, TAG, "%s: setpriority(%d) failed: %s", name_.c_str(), nice, strerror(errno));
+    }
+    applied_nice_ = nice;
+    priority_applied_ = true;
+}
+
+void RxStreamWorker::loop() {
+    while (running_) {
+        applyPriority();
+        if (RxQueuedFrame *frame = queue_.front()) {
+            {
+                std::lock_guard<std::mutex> lock(handler_mutex_);
+                handler_(*frame);
+            }
+            queue_.pop();
+            processed_.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+
+        // Fragments of one FEC block arrive back to back, poll briefly before paying for a futex wake up.
+        // On a single core spinning only delays the producer.
+        static const bool spin = std::thread::hardware_concurrency() > 1;
+        const auto spin_until = std::chrono::steady_clock::now() + std::chrono::microseconds(50);
+        while (spin && queue_.empty() && std::chrono::steady_clock::now() < spin_until) {
+        }
+        if (!queue_.empty()) {
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(wait_mutex_);
+        worker_waiting_.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (running_ && queue_.empty()) {
+            wait_cv_.wait_for(lock, std::chrono::milliseconds(100));
+        }
+        worker_waiting_.store(false, std::memory_order_relaxed);
+    }
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include "BoundedQueue.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/**
+ * @brief Radio metadata the RX thread captures together with a frame.
+ */
+struct RxFrameMeta {
+    int64_t timestamp_ns; // steady clock, when the driver handed the frame over
+    int8_t rssi[4];
+    int8_t snr[4];
+    int8_t noise[4];
+    uint8_t antenna[4];
+    uint16_t freq;
+    uint8_t wlan_idx;
+};
+
+/**
+ * @brief One queue cell: the wfb payload of a frame (802.11 header and FCS stripped) plus its metadata.
+ */
+struct RxQueuedFrame {
+    // Larger than any frame a wfb-ng transmitter produces, anything bigger is dropped
+    static constexpr size_t MAX_SIZE = 4096;
+
+    RxFrameMeta meta;
+    uint16_t size;
+    uint8_t data[MAX_SIZE];
+};
+
+/**
+ * @class RxStreamWorker
+ * @brief Drains the frames of one radio port into its aggregator on a dedicated thread.
+ *
+ * The USB RX thread only classifies a frame and push()es it, it never blocks on an aggregator. The worker
+ * calls the handler for every frame with its own mutex held, control code takes lock() to swap whatever the
+ * handler works on (aggregator, sink) between two frames.
+ */
+class RxStreamWorker {
+  public:
+    using Handler = std::function<void(const RxQueuedFrame &)>;
+
+    struct Stats {
+        size_t depth;
+        size_t high_water;
+        uint64_t dropped;
+        uint64_t processed;
+    };
+
+    /**
+     * @param name Thread name, max 15 characters.
+     * @param capacity Queue size in frames.
+     * @param nice Scheduling priority of the worker thread (setpriority() nice value).
+     */
+    RxStreamWorker(std::string name, size_t capacity, int nice, Handler handler);
+    ~RxStreamWorker();
+
+    RxStreamWorker(const RxStreamWorker &) = delete;
+    RxStreamWorker &operator=(const RxStreamWorker &) = delete;
+
+    /**
+     * @brief Copies a frame into the queue, never blocks. Safe from several RX threads.
+     * @return False if the frame was dropped (queue full or frame too large).
+     */
+    bool push(const uint8_t *payload, size_t size, const RxFrameMeta &meta);
+
+    std::unique_lock<std::mutex> lock() { return std::unique_lock<std::mutex>(handler_mutex_); }
+
+    /// Applied by the worker before its next frame.
+    void setPriority(int nice) { nice_ = nice; }
+
+    /// Also resets the high water mark.
+    Stats stats();
+
+  private:
+    void loop();
+    void applyPriority();
+
+    const std::string name_;
+    const Handler handler_;
+    BoundedQueue<RxQueuedFrame> queue_;
+    std::mutex handler_mutex_;
+
+    std::atomic<bool> running_{true};
+    std::atomic<bool> worker_waiting_{false};
+    std::mutex wait_mutex_;
+    std::condition_variable wait_cv_;
+
+    std::atomic<int> nice_;
+    int applied_nice_{0};
+    bool priority_applied_{false};
+    std::atomic<size_t> high_water_{0};
+    std::atomic<uint64_t> processed_{0};
+    std::thread thread_;
+};
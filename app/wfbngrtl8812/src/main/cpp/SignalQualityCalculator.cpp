@@ -1,6 +1,8 @@
 #include "SignalQualityCalculator.h"
 #include <android/log.h>
+#include <algorithm>
 #include <chrono>
+#include <climits>
 #include <random>
 
 namespace {
@@ -21,69 +23,138 @@ std::string generate_random_string(size_t length) {
 
 } // namespace
 
-// Remove RSSI samples older than 1 second
-void SignalQualityCalculator::cleanup_old_rssi_data() {
-    auto now = std::chrono::steady_clock::now();
-    auto cutoff = now - kAveragingWindow;
-
-    // Erase-remove idiom for data older than cutoff
-    m_rssis.erase(std::remove_if(
-                      m_rssis.begin(), m_rssis.end(), [&](const RssiEntry &entry) { return entry.timestamp < cutoff; }),
-                  m_rssis.end());
-}
-
-void SignalQualityCalculator::cleanup_old_snr_data() {
-    auto now = std::chrono::steady_clock::now();
-    auto cutoff = now - kAveragingWindow;
-
-    // Erase-remove idiom for data older than cutoff
-    m_snrs.erase(
-        std::remove_if(m_snrs.begin(), m_snrs.end(), [&](const SnrEntry &entry) { return entry.timestamp < cutoff; }),
-        m_snrs.end());
+void SignalQualityCalculator::add_frame(const RxFrameMeta &meta, bool first, int64_t time_ms) {
+    if (meta.wlan_idx >= kMaxAdapters) {
+        return;
+    }
+    ChainBucket *bucket = m_chains.at(time_ms);
+    if (bucket == nullptr) {
+        return;
+    }
+    if (first) {
+        bucket->unique.fetch_add(1, std::memory_order_relaxed);
+    }
+    for (int i = 0; i < kChainsPerAdapter && meta.antenna[i] != 0xff; ++i) {
+        const int chain = meta.wlan_idx * kChainsPerAdapter + i;
+        if (m_antennas[chain].load(std::memory_order_relaxed) != meta.antenna[i]) {
+            m_antennas[chain].store(meta.antenna[i], std::memory_order_relaxed);
+        }
+        bucket->packets[chain].fetch_add(1, std::memory_order_relaxed);
+        auto &bins = bucket->bins[chain];
+        bins[RSSI][meta.rssi[i] + 128].fetch_add(1, std::memory_order_relaxed);
+        bins[SNR][meta.snr[i] + 128].fetch_add(1, std::memory_order_relaxed);
+        // SCHAR_MAX is wfb-ng's "not reported", the RTL8812 path only reports RSSI and SNR
+        if (meta.noise[i] != SCHAR_MAX) {
+            bins[NOISE][meta.noise[i] + 128].fetch_add(1, std::memory_order_relaxed);
+        }
+    }
 }
 
-void SignalQualityCalculator::cleanup_old_fec_data() {
-    auto now = std::chrono::steady_clock::now();
-    auto cutoff = now - kAveragingWindow;
-
-    m_fec_data.erase(std::remove_if(m_fec_data.begin(),
-                                    m_fec_data.end(),
-                                    [&](const FecEntry &entry) { return entry.timestamp < cutoff; }),
-                     m_fec_data.end());
+SignalQualityCalculator::MetricStats SignalQualityCalculator::summarize(const Histogram &bins) {
+    MetricStats stats{};
+    uint32_t total = 0;
+    int64_t sum = 0;
+    for (int b = 0; b < kBins; ++b) {
+        total += bins[b];
+        sum += int64_t(bins[b]) * (b - 128);
+    }
+    if (total == 0) {
+        return stats;
+    }
+    stats.count = total;
+    stats.avg = static_cast<float>(sum) / static_cast<float>(total);
+
+    // Percentile p is the smallest value with at least ceil(p * total) samples at or below it
+    const uint32_t rank10 = std::max(1u, (total * 10 + 99) / 100);
+    const uint32_t rank50 = std::max(1u, (total * 50 + 99) / 100);
+    const uint32_t rank90 = std::max(1u, (total * 90 + 99) / 100);
+    uint32_t seen = 0;
+    bool first = true;
+    for (int b = 0; b < kBins; ++b) {
+        if (bins[b] == 0) {
+            continue;
+        }
+        const int value = b - 128;
+        if (first) {
+            stats.min = value;
+            first = false;
+        }
+        stats.max = value;
+        const uint32_t before = seen;
+        seen += bins[b];
+        if (before < rank10 && seen >= rank10) stats.p10 = value;
+        if (before < rank50 && seen >= rank50) stats.p50 = value;
+        if (before < rank90 && seen >= rank90) stats.p90 = value;
+    }
+    return stats;
 }
 
-// Add a new RSSI entry with current timestamp
-void SignalQualityCalculator::add_rssi(uint8_t ant1, uint8_t ant2) {
-    //__android_log_print(ANDROID_LOG_WARN, TAG, "rssi1 %d, rssi2 %d", (int)ant1, (int)ant2);
-    std::lock_guard<std::recursive_mutex> lock(m_mutex);
-    RssiEntry entry;
-    entry.timestamp = std::chrono::steady_clock::now();
-    entry.ant1 = ant1;
-    entry.ant2 = ant2;
-    m_rssis.push_back(entry);
+std::vector<SignalQualityCalculator::ChainReport> SignalQualityCalculator::chain_stats(int64_t time_ms) const {
+    uint32_t unique = 0;
+    uint32_t packets[kChains] = {};
+    std::array<std::array<Histogram, METRIC_COUNT>, kChains> bins{};
+    m_chains.forEach(time_ms, [&](const ChainBucket &bucket) {
+        unique += bucket.unique.load(std::memory_order_relaxed);
+        for (int c = 0; c < kChains; ++c) {
+            const uint32_t n = bucket.packets[c].load(std::memory_order_relaxed);
+            if (n == 0) {
+                continue;
+            }
+            packets[c] += n;
+            for (int m = 0; m < METRIC_COUNT; ++m) {
+                for (int b = 0; b < kBins; ++b) {
+                    bins[c][m][b] += bucket.bins[c][m][b].load(std::memory_order_relaxed);
+                }
+            }
+        }
+    });
+
+    std::vector<ChainReport> reports;
+    for (int c = 0; c < kChains; ++c) {
+        if (packets[c] == 0) {
+            continue;
+        }
+        ChainReport report{};
+        report.wlan_idx = c / kChainsPerAdapter;
+        report.antenna = m_antennas[c].load(std::memory_order_relaxed);
+        report.packets = packets[c];
+        report.pdr = unique > 0 ? std::min(1.f, static_cast<float>(packets[c]) / static_cast<float>(unique)) : 0.f;
+        for (int m = 0; m < METRIC_COUNT; ++m) {
+            report.metrics[m] = summarize(bins[c][m]);
+        }
+        reports.push_back(report);
+    }
+    return reports;
 }
 
-void SignalQualityCalculator::add_snr(int8_t ant1, int8_t ant2) {
-    //__android_log_print(ANDROID_LOG_WARN, TAG, "rssi1 %d, rssi2 %d", (int)ant1, (int)ant2);
-    std::lock_guard<std::recursive_mutex> lock(m_mutex);
-    SnrEntry entry;
-    entry.timestamp = std::chrono::steady_clock::now();
-    entry.ant1 = ant1;
-    entry.ant2 = ant2;
-    m_snrs.push_back(entry);
+SignalQualityCalculator::Histogram
+SignalQualityCalculator::histogram(uint8_t wlan_idx, uint8_t chain, Metric metric, int64_t time_ms) const {
+    Histogram result{};
+    if (wlan_idx >= kMaxAdapters || chain >= kChainsPerAdapter || metric < 0 || metric >= METRIC_COUNT) {
+        return result;
+    }
+    const int c = wlan_idx * kChainsPerAdapter + chain;
+    m_chains.forEach(time_ms, [&](const ChainBucket &bucket) {
+        for (int b = 0; b < kBins; ++b) {
+            result[b] += bucket.bins[c][metric][b].load(std::memory_order_relaxed);
+        }
+    });
+    return result;
 }
 
 // Calculate signal quality based on last-second RSSI and FEC data
-SignalQualityCalculator::SignalQuality SignalQualityCalculator::calculate_signal_quality() {
+SignalQualityCalculator::SignalQuality SignalQualityCalculator::calculate_signal_quality(int64_t time_ms) {
     SignalQuality ret;
-    std::lock_guard<std::recursive_mutex> lock(m_mutex);
 
-    // Get fresh averages over the last second
-    float avg_rssi = get_avg(m_rssis);
-
-    float avg_snr = get_avg(m_snrs);
-
-    //    __android_log_print(ANDROID_LOG_DEBUG, TAG, "avg_rssi: %f", avg_rssi);
+    // Get fresh averages over the last second, the best chain of any adapter counts
+    ret.chains = chain_stats(time_ms);
+    float avg_rssi = 0.f;
+    float avg_snr = 0.f;
+    for (size_t i = 0; i < ret.chains.size(); ++i) {
+        const ChainReport &chain = ret.chains[i];
+        avg_rssi = i == 0 ? chain.metrics[RSSI].avg : std::max(avg_rssi, chain.metrics[RSSI].avg);
+        avg_snr = i == 0 ? chain.metrics[SNR].avg : std::max(avg_snr, chain.metrics[SNR].avg);
+    }
 
     // Map the RSSI from range 0..80 to -1024..1024
     avg_rssi = map_range(avg_rssi, 0.f, 80.f, -1024.f, 1024.f);
@@ -92,9 +163,7 @@ SignalQualityCalculator::SignalQuality SignalQualityCalculator::calculate_signal
     // Return final clamped quality
     // formula: quality = avg_rssi - p_recovered * 5 - p_lost * 100
     // clamp between -1024 and 1024
-    auto [p_recovered, p_lost] = get_accumulated_fec_data();
-
-    //    __android_log_print(ANDROID_LOG_ERROR, "DEBUG", "FEC RECOVERED %d, FEC_LOST %d", p_recovered, p_lost);
+    auto [p_recovered, p_lost] = get_accumulated_fec_data(time_ms);
 
     float quality = avg_rssi; // - static_cast<float>(p_recovered) * 12.f - static_cast<float>(p_lost) * 40.f;
     quality = std::max(-1024.f, std::min(1024.f, quality));
@@ -104,56 +173,49 @@ SignalQualityCalculator::SignalQuality SignalQualityCalculator::calculate_signal
     ret.recovered_last_second = p_recovered;
 
     ret.snr = avg_snr;
-    ret.idr_code = m_idr_code;
-
-    cleanup_old_rssi_data();
-    cleanup_old_snr_data();
-    cleanup_old_fec_data();
-
-    /* __android_log_print(ANDROID_LOG_DEBUG,
-                         TAG,
-                         "QUALITY: %f, RSSI: %f, P_RECOVERED: %u, P_LOST: %u",
-                         quality,
-                         avg_rssi,
-                         p_recovered,
-                         p_lost);
- */
+    {
+        std::lock_guard<std::mutex> lock(m_idr_mutex);
+        ret.idr_code = m_idr_code;
+    }
+
     return ret;
 }
 
 // Sum up FEC data over the last 1 second
-std::pair<uint32_t, uint32_t> SignalQualityCalculator::get_accumulated_fec_data() {
-    // Make sure we clean up old FEC data first
-    cleanup_old_fec_data();
-
-    if (m_fec_data.empty()) return {300, 300};
-
-    //    __android_log_print(ANDROID_LOG_ERROR, "LOST size", "%zu", m_fec_data.size());
-
+std::pair<uint32_t, uint32_t> SignalQualityCalculator::get_accumulated_fec_data(int64_t time_ms) {
+    uint32_t reports = 0;
     uint32_t p_recovered = 0;
     uint32_t p_all = 0;
     uint32_t p_lost = 0;
-    for (const auto &data : m_fec_data) {
-        p_all += data.all;
-        p_recovered += data.recovered;
-        p_lost += data.lost;
-    }
+    m_fec_data.forEach(time_ms, [&](const FecBucket &bucket) {
+        reports += bucket.reports.load(std::memory_order_relaxed);
+        p_all += bucket.all.load(std::memory_order_relaxed);
+        p_recovered += bucket.recovered.load(std::memory_order_relaxed);
+        p_lost += bucket.lost.load(std::memory_order_relaxed);
+    });
+
+    if (reports == 0) return {300, 300};
+
     return {p_recovered, p_lost};
 }
 
-// Add new FEC data entry with current timestamp
-void SignalQualityCalculator::add_fec_data(uint32_t p_all, uint32_t p_recovered, uint32_t p_lost) {
-    //    __android_log_print(ANDROID_LOG_ERROR, "RECOVERED + LOST", "%u + %u", p_recovered, p_lost);
-    std::lock_guard<std::recursive_mutex> lock(m_mutex);
-    FecEntry entry;
-    entry.timestamp = std::chrono::steady_clock::now();
-    entry.all = p_all;
-    entry.recovered = p_recovered;
-    entry.lost = p_lost;
-
-    if (p_lost > 0) {
-        m_idr_code = generate_random_string(4);
+void SignalQualityCalculator::request_idr() {
+    std::lock_guard<std::mutex> lock(m_idr_mutex);
+    m_idr_code = generate_random_string(4);
+}
+
+// Add new FEC data with its timestamp
+void SignalQualityCalculator::add_fec_data(uint32_t p_all, uint32_t p_recovered, uint32_t p_lost, int64_t time_ms) {
+    if (p_lost > 0 && m_idr_on_fec_loss.load(std::memory_order_relaxed)) {
+        request_idr();
     }
 
-    m_fec_data.push_back(entry);
+    FecBucket *bucket = m_fec_data.at(time_ms);
+    if (bucket == nullptr) {
+        return;
+    }
+    bucket->all.fetch_add(p_all, std::memory_order_relaxed);
+    bucket->recovered.fetch_add(p_recovered, std::memory_order_relaxed);
+    bucket->lost.fetch_add(p_lost, std::memory_order_relaxed);
+    bucket->reports.fetch_add(1, std::memory_order_relaxed);
 }
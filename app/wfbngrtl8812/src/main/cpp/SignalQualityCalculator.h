@@ -1,9 +1,15 @@
 #pragma once
+#include "RxStreamWorker.h"
+#include "TimeBucketRing.h"
+
 #include <algorithm>
 #include <android/log.h>
+#include <array>
+#include <atomic>
 #include <chrono>
 #include <cstdint>
 #include <mutex>
+#include <string>
 #include <utility>
 #include <vector>
 
@@ -12,97 +18,134 @@ static const char *TAG = "SignalQualityCalculator";
 
 class SignalQualityCalculator {
   public:
+    // A chain is one antenna path of one adapter, chains of further adapters are not tracked
+    static constexpr int kMaxAdapters = 4;
+    static constexpr int kChainsPerAdapter = 2;
+    static constexpr int kChains = kMaxAdapters * kChainsPerAdapter;
+    static constexpr int kBins = 256; ///< one per int8 value, bin = value + 128
+
+    enum Metric { RSSI, SNR, NOISE, METRIC_COUNT };
+
+    /// Distribution of one metric of one chain over the last second, all 0 without samples.
+    struct MetricStats {
+        uint32_t count;
+        float avg;
+        int min;
+        int max;
+        int p10;
+        int p50;
+        int p90;
+    };
+
+    struct ChainReport {
+        uint8_t wlan_idx;
+        uint8_t antenna;
+        uint32_t packets; ///< copies this chain received
+        float pdr;        ///< packets / unique packets of the stream, 0..1
+        MetricStats metrics[METRIC_COUNT];
+    };
+
+    using Histogram = std::array<uint32_t, kBins>;
+
     struct SignalQuality {
         int lost_last_second;
         int recovered_last_second;
         int quality;
         float snr;
         std::string idr_code;
+        std::vector<ChainReport> chains; ///< chains that received anything in the last second
     };
 
     SignalQualityCalculator() = default;
     ~SignalQualityCalculator() = default;
 
-    void add_rssi(uint8_t ant1, uint8_t ant2);
-
-    void add_snr(int8_t ant1, int8_t ant2);
-
-    void add_fec_data(uint32_t p_all, uint32_t p_recovered, uint32_t p_lost);
+    /// Milliseconds of the steady clock, the time base of all samples.
+    static int64_t now_ms() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
 
-    template <class T> float get_avg(const T &array) {
-        std::lock_guard<std::recursive_mutex> lock(m_mutex);
+    /**
+     * Every copy of a video packet, lock-free and O(1) per chain. @p first is false for a copy another adapter
+     * already delivered, the first copies count the stream's packets for the delivery ratios.
+     */
+    void add_frame(const RxFrameMeta &meta, bool first, int64_t time_ms = now_ms());
 
-        // Remove old entries
-        cleanup_old_rssi_data();
+    void add_fec_data(uint32_t p_all, uint32_t p_recovered, uint32_t p_lost, int64_t time_ms = now_ms());
 
-        float sum1 = 0.f;
-        float sum2 = 0.f;
-        int count = static_cast<int>(array.size());
+    /// New IDR request code, the camera sends one keyframe for every code it has not seen yet.
+    void request_idr();
 
-        if (count > 0) {
-            for (auto &entry : array) {
-                sum1 += entry.ant1;
-                sum2 += entry.ant2;
-            }
-            sum1 /= count;
-            sum2 /= count;
-        }
+    /**
+     * Whether a FEC block that could not be recovered requests an IDR. Off while the video player parses the stream
+     * in-process, it knows which losses broke a reference frame and calls request_idr() itself.
+     */
+    void set_idr_on_fec_loss(bool enable) { m_idr_on_fec_loss.store(enable, std::memory_order_relaxed); }
 
-        // We'll take the maximum of the two average RSSI values
-        float avg = std::max(sum1, sum2);
-        return avg;
-    }
+    /// Chains that received anything in the last second, by adapter and chain.
+    std::vector<ChainReport> chain_stats(int64_t time_ms = now_ms()) const;
 
-    SignalQuality calculate_signal_quality();
+    /// Last second of one metric of one chain, empty for an unknown chain.
+    Histogram histogram(uint8_t wlan_idx, uint8_t chain, Metric metric, int64_t time_ms = now_ms()) const;
 
-    static SignalQualityCalculator &get_instance() {
-        static SignalQualityCalculator instance;
-        return instance;
-    }
+    SignalQuality calculate_signal_quality(int64_t time_ms = now_ms());
 
   private:
-    std::pair<uint32_t, uint32_t> get_accumulated_fec_data();
-
-    // Helper methods to remove old entries
-    void cleanup_old_rssi_data();
-    void cleanup_old_snr_data();
-    void cleanup_old_fec_data();
-
-    // We store a timestamp for each RSSI entry
-    struct RssiEntry {
-        std::chrono::steady_clock::time_point timestamp;
-        uint8_t ant1;
-        uint8_t ant2;
+    /**
+     * One time bucket of all chains: a histogram per chain and metric, so averages, min, max and percentiles come
+     * out of the window without keeping samples. 16 bit bins hold 100 ms of any realistic packet rate.
+     */
+    struct ChainBucket {
+        std::atomic<uint32_t> unique;
+        std::atomic<uint32_t> packets[kChains];
+        std::atomic<uint16_t> bins[kChains][METRIC_COUNT][kBins];
+
+        void clear() {
+            unique.store(0, std::memory_order_relaxed);
+            for (int c = 0; c < kChains; ++c) {
+                packets[c].store(0, std::memory_order_relaxed);
+                for (auto &metric : bins[c]) {
+                    for (auto &bin : metric) {
+                        bin.store(0, std::memory_order_relaxed);
+                    }
+                }
+            }
+        }
     };
 
-    // We store a timestamp for each RSSI entry
-    struct SnrEntry {
-        std::chrono::steady_clock::time_point timestamp;
-        int8_t ant1;
-        int8_t ant2;
+    struct FecBucket {
+        std::atomic<uint32_t> all;
+        std::atomic<uint32_t> recovered;
+        std::atomic<uint32_t> lost;
+        std::atomic<uint32_t> reports;
+
+        void clear() {
+            all.store(0, std::memory_order_relaxed);
+            recovered.store(0, std::memory_order_relaxed);
+            lost.store(0, std::memory_order_relaxed);
+            reports.store(0, std::memory_order_relaxed);
+        }
     };
 
-    // We store a timestamp for each FEC entry
-    struct FecEntry {
-        std::chrono::steady_clock::time_point timestamp;
-        uint32_t all;
-        uint32_t recovered;
-        uint32_t lost;
-    };
+    using ChainRing = TimeBucketRing<ChainBucket>;
+    using FecRing = TimeBucketRing<FecBucket>;
+
+    static MetricStats summarize(const Histogram &bins);
+
+    std::pair<uint32_t, uint32_t> get_accumulated_fec_data(int64_t time_ms);
 
     double map_range(double value, double inputMin, double inputMax, double outputMin, double outputMax) {
         return outputMin + ((value - inputMin) * (outputMax - outputMin) / (inputMax - inputMin));
     }
 
   private:
-    const std::chrono::seconds kAveragingWindow{std::chrono::seconds(1)};
-    mutable std::recursive_mutex m_mutex;
-
-    std::vector<RssiEntry> m_rssis;
-
-    std::vector<SnrEntry> m_snrs;
-
-    std::vector<FecEntry> m_fec_data;
+    ChainRing m_chains;
+    FecRing m_fec_data;
+    // Antenna index each chain reported last, for the reports
+    std::array<std::atomic<uint8_t>, kChains> m_antennas{};
 
+    std::mutex m_idr_mutex;
     std::string m_idr_code{"aaaa"};
+    std::atomic<bool> m_idr_on_fec_loss{true};
 };
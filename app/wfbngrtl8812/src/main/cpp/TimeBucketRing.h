@@ -0,0 +1,78 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+
+/**
+ * @class TimeBucketRing
+ * @brief Sliding time window made of fixed buckets, for statistics written on a hot path.
+ *
+ * The window is @p Buckets buckets of @p BucketMs each. A bucket belongs to one period (now_ms / BucketMs) and is
+ * cleared by the first writer of a newer period that maps to it, so writing is O(1) without locks or allocations
+ * and expired samples never need to be removed. Bucket needs a clear() and atomic members writers update with
+ * relaxed operations.
+ *
+ * Readers do not block writers. A bucket that is recycled while it is read (the oldest one, at a period change)
+ * can mix old and new samples; for statistics that is accepted.
+ */
+template <typename Bucket, size_t Buckets = 10, int64_t BucketMs = 100> class TimeBucketRing {
+  public:
+    static constexpr int64_t kWindowMs = Buckets * BucketMs;
+
+    /**
+     * @brief The bucket a sample taken at @p now_ms goes to, cleared first if it still held an older period.
+     * @return nullptr if the sample is older than the period the bucket holds by now.
+     */
+    Bucket *at(int64_t now_ms) {
+        const int64_t period = now_ms / BucketMs;
+        Slot &slot = slots_[period % Buckets];
+        int64_t seen = slot.period.load(std::memory_order_acquire);
+        while (seen != period) {
+            if (seen > period) {
+                return nullptr;
+            }
+            if (seen == kClearing) {
+                std::this_thread::yield();
+                seen = slot.period.load(std::memory_order_acquire);
+                continue;
+            }
+            // One writer wins the bucket and clears it, the others wait for the new period
+            if (slot.period.compare_exchange_weak(seen, kClearing, std::memory_order_acquire)) {
+                slot.bucket.clear();
+                slot.period.store(period, std::memory_order_release);
+                return &slot.bucket;
+            }
+        }
+        return &slot.bucket;
+    }
+
+    /**
+     * @brief Calls @p fn with every bucket of the window that ends at @p now_ms, oldest first.
+     */
+    template <typename Fn> void forEach(int64_t now_ms, Fn &&fn) const {
+        const int64_t period = now_ms / BucketMs;
+        for (int64_t p = period - int64_t(Buckets) + 1; p <= period; ++p) {
+            if (p < 0) {
+                continue;
+            }
+            const Slot &slot = slots_[p % Buckets];
+            if (slot.period.load(std::memory_order_acquire) == p) {
+                fn(slot.bucket);
+            }
+        }
+    }
+
+  private:
+    static constexpr int64_t kEmpty = -1;
+    static constexpr int64_t kClearing = -2;
+
+    struct Slot {
+        std::atomic<int64_t> period{kEmpty};
+        Bucket bucket;
+    };
+
+    std::array<Slot, Buckets> slots_;
+};
@@ -8,11 +8,7 @@
 #include "src/zfex.h"
 
 #include <algorithm>
-#include <android/log.h>
 #include <arpa/inet.h>
-#include <asm-generic/poll.h>
-#include <asm-generic/socket.h>
-#include <bits/ioctl.h>
 #include <cerrno>
 #include <cinttypes>
 #include <climits>
@@ -20,24 +16,36 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
-#include <linux/if.h>
 #include <linux/if_packet.h>
-#include <linux/in.h>
 #include <linux/random.h>
 #include <linux/sockios.h>
-#include <linux/time.h>
-#include <linux/uio.h>
 #include <memory>
 #include <poll.h>
 #include <stdexcept>
 #include <string>
-#include <sys/endian.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <utility>
 #include <vector>
 
+// Bionic-only headers, the host build (host/tx_bench) gets the same definitions from glibc, where the kernel
+// UAPI ones clash with the libc ones
+#ifdef __ANDROID__
+#include <android/log.h>
+#include <asm-generic/poll.h>
+#include <asm-generic/socket.h>
+#include <bits/ioctl.h>
+#include <linux/if.h>
+#include <linux/in.h>
+#include <linux/time.h>
+#include <linux/uio.h>
+#include <sys/endian.h>
+#else
+#include <endian.h>
+#include <sys/ioctl.h>
+#endif
+
 constexpr char *TAG = "TXFrame";
 
 //-------------------------------------------------------------
@@ -83,9 +91,15 @@ Transmitter::Transmitter(int k, int n, const std::string &keypair, uint64_t epoc
 
 Transmitter::~Transmitter() {
     // block_, fecPtr_ automatically cleaned up via unique_ptr
+    // Derived classes stop the pipeline, injectFrame() must not outlive them
 }
 
 bool Transmitter::sendPacket(const uint8_t *buf, size_t size, uint8_t flags) {
+    // A block boundary, the only place k/n and the link headers may change
+    if (fragmentIndex_ == 0 && configPending_.load(std::memory_order_acquire)) {
+        applyLinkConfig();
+    }
+
     // If we are asked to finalize FEC block with no data while the block is empty, ignore
     if (fragmentIndex_ == 0 && (flags & WFB_PACKET_FEC_ONLY)) {
         return false;
@@ -111,7 +125,16 @@ bool Transmitter::sendPacket(const uint8_t *buf, size_t size, uint8_t flags) {
     }
 
     // Send this fragment
-    sendBlockFragment(totalHdrSize + size);
+    if (pipelined()) {
+        pushJob({PipelineJob::DATA,
+                 fragmentIndex_,
+                 blockIndex_,
+                 totalHdrSize + size,
+                 block_[fragmentIndex_].get(),
+                 {}});
+    } else {
+        sendBlockFragment(totalHdrSize + size);
+    }
 
     // Track largest data size in block
     maxPacketSize_ = std::max(maxPacketSize_, totalHdrSize + size);
@@ -122,16 +145,27 @@ bool Transmitter::sendPacket(const uint8_t *buf, size_t size, uint8_t flags) {
         return true;
     }
 
-    // If we have k fragments, encode the parity
-    fec_encode_simd(fecPtr_.get(),
-                    const_cast<const uint8_t **>(reinterpret_cast<uint8_t **>(block_.data())),
-                    reinterpret_cast<uint8_t **>(block_.data()) + fecK_,
-                    maxPacketSize_);
+    if (pipelined()) {
+        // The worker encodes and sends the parity, ingest continues in a spare block
+        pushJob({PipelineJob::PARITY, 0, blockIndex_, maxPacketSize_, nullptr, std::move(block_)});
+        std::unique_lock<std::mutex> lock(pipelineMutex_);
+        spaceCv_.wait(lock, [this] { return !spareBlocks_.empty() || pipelineError_; });
+        if (pipelineError_) {
+            std::rethrow_exception(pipelineError_);
+        }
+        block_ = std::move(spareBlocks_.back());
+        spareBlocks_.pop_back();
+    } else {
+        // If we have k fragments, encode the parity
+        encodeParity(block_, maxPacketSize_);
+
+        // Send all FEC fragments
+        while (fragmentIndex_ < static_cast<uint8_t>(fecN_)) {
+            sendBlockFragment(maxPacketSize_);
+            fragmentIndex_++;
+        }
 
-    // Send all FEC fragments
-    while (fragmentIndex_ < static_cast<uint8_t>(fecN_)) {
-        sendBlockFragment(maxPacketSize_);
-        fragmentIndex_++;
+        blockComplete();
     }
 
     // Move to next block
@@ -141,31 +175,52 @@ bool Transmitter::sendPacket(const uint8_t *buf, size_t size, uint8_t flags) {
 
     // Generate a new session key after we have looped over MAX_BLOCK_IDX blocks
     if (blockIndex_ > MAX_BLOCK_IDX) {
-        makeSessionKey();
-        sendSessionKey();
+        if (pipelined()) {
+            pushJob({PipelineJob::REKEY, 0, 0, 0, nullptr, {}});
+        } else {
+            makeSessionKey();
+            sendSessionKey();
+        }
         blockIndex_ = 0;
     }
     return true;
 }
 
-void Transmitter::sendSessionKey() { injectPacket(sessionKeyPacket_, sizeof(sessionKeyPacket_)); }
+void Transmitter::sendSessionKey() {
+    if (pipelined()) {
+        // The worker owns the session key, and the packet has to stay in order with the data
+        pushJob({PipelineJob::SESSION_KEY, 0, 0, 0, nullptr, {}});
+        return;
+    }
+    injectPacket(sessionKeyPacket_, sizeof(sessionKeyPacket_));
+}
 
 void Transmitter::sendBlockFragment(size_t packetSize) {
-    // Prepare local buffer for encryption
-    uint8_t cipherBuf[MAX_FORWARDER_PACKET_SIZE];
-    std::memset(cipherBuf, 0, sizeof(cipherBuf));
+    encryptFragment(block_[fragmentIndex_].get(), packetSize, blockIndex_, fragmentIndex_);
+}
+
+void Transmitter::encodeParity(Block &block, size_t size) {
+    fec_encode_simd(fecPtr_.get(),
+                    const_cast<const uint8_t **>(reinterpret_cast<uint8_t **>(block.data())),
+                    reinterpret_cast<uint8_t **>(block.data()) + fecK_,
+                    size);
+}
+
+void Transmitter::encryptFragment(const uint8_t *fragment, size_t size, uint64_t blockIndex, uint8_t fragmentIndex) {
+    // Encrypt straight into the frame that gets injected, header and ciphertext cover all bytes sent
+    uint8_t *cipherBuf = acquireFrame();
 
     auto *blockHdr = reinterpret_cast<wblock_hdr_t *>(cipherBuf);
     blockHdr->packet_type = WFB_PACKET_DATA;
-    blockHdr->data_nonce = htobe64(((blockIndex_ & BLOCK_IDX_MASK) << 8) + fragmentIndex_);
+    blockHdr->data_nonce = htobe64(((blockIndex & BLOCK_IDX_MASK) << 8) + fragmentIndex);
 
     unsigned long long cipherLen = 0;
 
     // AEAD encrypt
     int rc = crypto_aead_chacha20poly1305_encrypt(cipherBuf + sizeof(wblock_hdr_t),
                                                   &cipherLen,
-                                                  block_[fragmentIndex_].get(),
-                                                  packetSize,
+                                                  fragment,
+                                                  size,
                                                   reinterpret_cast<const uint8_t *>(blockHdr),
                                                   sizeof(wblock_hdr_t),
                                                   nullptr,
@@ -176,13 +231,180 @@ void Transmitter::sendBlockFragment(size_t packetSize) {
     }
 
     size_t finalSize = sizeof(wblock_hdr_t) + cipherLen;
-    injectPacket(cipherBuf, finalSize);
+    injectFrame(cipherBuf, finalSize);
+}
+
+void Transmitter::startPipeline(size_t blocks) {
+    if (pipelined()) {
+        return;
+    }
+    blocks = std::max<size_t>(blocks, 2);
+    for (size_t b = 1; b < blocks; ++b) {
+        Block block(fecN_);
+        for (auto &fragment : block) {
+            fragment.reset(new uint8_t[MAX_FEC_PAYLOAD]());
+        }
+        spareBlocks_.push_back(std::move(block));
+    }
+    // Every block in the pipeline has at most k data jobs and one parity job, plus some session key packets
+    jobs_.resize(blocks * (fecK_ + 1) + 8);
+    pipelineStop_ = false;
+    pipelineThread_ = std::thread(&Transmitter::pipelineLoop, this);
+}
+
+void Transmitter::stopPipeline() {
+    if (!pipelined()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(pipelineMutex_);
+        pipelineStop_ = true;
+    }
+    jobCv_.notify_one();
+    pipelineThread_.join();
+}
+
+void Transmitter::pushJob(PipelineJob &&job) {
+    {
+        std::unique_lock<std::mutex> lock(pipelineMutex_);
+        spaceCv_.wait(lock, [this] { return jobCount_ < jobs_.size() || pipelineError_; });
+        if (pipelineError_) {
+            std::rethrow_exception(pipelineError_);
+        }
+        jobs_[(jobHead_ + jobCount_) % jobs_.size()] = std::move(job);
+        ++jobCount_;
+    }
+    jobCv_.notify_one();
+}
+
+void Transmitter::pipelineLoop() {
+    std::unique_lock<std::mutex> lock(pipelineMutex_);
+    while (true) {
+        jobCv_.wait(lock, [this] { return jobCount_ > 0 || pipelineStop_; });
+        if (jobCount_ == 0) {
+            return; // stopped and drained
+        }
+        PipelineJob job = std::move(jobs_[jobHead_]);
+        lock.unlock();
+
+        try {
+            switch (job.type) {
+            case PipelineJob::DATA:
+                encryptFragment(job.data, job.size, job.blockIndex, job.fragment);
+                break;
+            case PipelineJob::PARITY:
+                encodeParity(job.block, job.size);
+                for (int f = fecK_; f < fecN_; ++f) {
+                    encryptFragment(job.block[f].get(), job.size, job.blockIndex, static_cast<uint8_t>(f));
+                }
+                blockComplete();
+                break;
+            case PipelineJob::REKEY:
+                makeSessionKey();
+                [[fallthrough]];
+            case PipelineJob::SESSION_KEY:
+                injectPacket(sessionKeyPacket_, sizeof(sessionKeyPacket_));
+                break;
+            }
+        } catch (...) {
+            lock.lock();
+            // Ingest rethrows on its next call, queued jobs are dropped
+            pipelineError_ = std::current_exception();
+            jobCount_ = 0;
+            spaceCv_.notify_all();
+            jobCv_.wait(lock, [this] { return pipelineStop_; });
+            return;
+        }
+
+        lock.lock();
+        jobHead_ = (jobHead_ + 1) % jobs_.size();
+        --jobCount_;
+        if (job.type == PipelineJob::PARITY) {
+            spareBlocks_.push_back(std::move(job.block));
+        }
+        spaceCv_.notify_one();
+    }
+}
+
+void Transmitter::setLinkConfig(int k, int n, std::vector<uint8_t> radiotapHeader) {
+    if (k < 1 || n < k || n > 255) {
+        throw std::runtime_error(string_format("Invalid FEC parameters k=%d n=%d", k, n));
+    }
+    std::lock_guard<std::mutex> lock(configMutex_);
+    pendingK_ = k;
+    pendingN_ = n;
+    pendingRadiotap_ = std::move(radiotapHeader);
+    configPending_.store(true, std::memory_order_release);
+}
+
+void Transmitter::applyLinkConfig() {
+    int k, n;
+    std::vector<uint8_t> radiotapHeader;
+    {
+        std::lock_guard<std::mutex> lock(configMutex_);
+        k = pendingK_;
+        n = pendingN_;
+        radiotapHeader = std::move(pendingRadiotap_);
+        configPending_.store(false, std::memory_order_relaxed);
+    }
+
+    // The worker still encodes earlier blocks with the old code and headers
+    if (pipelined()) {
+        std::unique_lock<std::mutex> lock(pipelineMutex_);
+        spaceCv_.wait(lock, [this] { return jobCount_ == 0 || pipelineError_; });
+        if (pipelineError_) {
+            std::rethrow_exception(pipelineError_);
+        }
+    }
+
+    if (!radiotapHeader.empty()) {
+        applyRadiotapHeader(radiotapHeader);
+    }
+    if (k == fecK_ && n == fecN_) {
+        return;
+    }
+
+    fec_t *rawFec;
+    fec_new(k, n, &rawFec);
+    if (!rawFec) {
+        throw std::runtime_error("fec_new() failed");
+    }
+    fecPtr_.reset(rawFec);
+    fecK_ = k;
+    fecN_ = n;
+    resizeBlock(block_);
+    applyFecParams(k, n);
+    if (pipelined()) {
+        // Drained, so every other block is a spare and the job ring is empty
+        std::lock_guard<std::mutex> lock(pipelineMutex_);
+        for (auto &block : spareBlocks_) {
+            resizeBlock(block);
+        }
+        jobs_.clear();
+        jobs_.resize((spareBlocks_.size() + 1) * (fecK_ + 1) + 8);
+        jobHead_ = 0;
+    }
+
+    // Same key, new k/n for the receivers
+    makeSessionPacket();
+    sendSessionKey();
+}
+
+void Transmitter::resizeBlock(Block &block) const {
+    const size_t old = block.size();
+    block.resize(fecN_);
+    for (size_t i = old; i < block.size(); ++i) {
+        block[i].reset(new uint8_t[MAX_FEC_PAYLOAD]());
+    }
 }
 
 void Transmitter::makeSessionKey() {
     // Random session key
     randombytes_buf(sessionKey_, sizeof(sessionKey_));
+    makeSessionPacket();
+}
 
+void Transmitter::makeSessionPacket() {
     auto *hdr = reinterpret_cast<wsession_hdr_t *>(sessionKeyPacket_);
     hdr->packet_type = WFB_PACKET_SESSION;
     randombytes_buf(hdr->session_nonce, sizeof(hdr->session_nonce));
@@ -262,6 +484,7 @@ RawSocketTransmitter::RawSocketTransmitter(int k,
 }
 
 RawSocketTransmitter::~RawSocketTransmitter() {
+    stopPipeline();
     for (int fd : sockFds_) {
         ::close(fd);
     }
@@ -377,7 +600,10 @@ UdpTransmitter::UdpTransmitter(int k,
     saddr_.sin_port = htons(static_cast<unsigned short>(basePort_));
 }
 
-UdpTransmitter::~UdpTransmitter() { ::close(sockFd_); }
+UdpTransmitter::~UdpTransmitter() {
+    stopPipeline();
+    ::close(sockFd_);
+}
 
 void UdpTransmitter::selectOutput(int idx) { saddr_.sin_port = htons(static_cast<unsigned short>(basePort_ + idx)); }
 
@@ -413,6 +639,27 @@ void UdpTransmitter::injectPacket(const uint8_t *buf, size_t size) {
 // UsbTransmitter
 //-------------------------------------------------------------
 
+namespace {
+
+/// Radiotap header followed by the 802.11 header of a wfb-ng channel, the sequence number is patched per frame.
+std::vector<uint8_t> makeLinkHeaders(const uint8_t *radiotapHeader,
+                                     size_t radiotapHeaderLen,
+                                     uint8_t frameType,
+                                     uint32_t channelId) {
+    std::vector<uint8_t> headers(radiotapHeaderLen + sizeof(ieee80211_header));
+    std::memcpy(headers.data(), radiotapHeader, radiotapHeaderLen);
+
+    uint8_t *ieeeHdr = headers.data() + radiotapHeaderLen;
+    std::memcpy(ieeeHdr, ieee80211_header, sizeof(ieee80211_header));
+    ieeeHdr[0] = frameType;
+    uint32_t channelIdBE = htonl(channelId);
+    std::memcpy(ieeeHdr + SRC_MAC_THIRD_BYTE, &channelIdBE, sizeof(uint32_t));
+    std::memcpy(ieeeHdr + DST_MAC_THIRD_BYTE, &channelIdBE, sizeof(uint32_t));
+    return headers;
+}
+
+} // namespace
+
 UsbTransmitter::UsbTransmitter(int k,
                                int n,
                                const std::string &keypair,
@@ -422,15 +669,55 @@ UsbTransmitter::UsbTransmitter(int k,
                                uint8_t *radiotapHeader,
                                size_t radiotapHeaderLen,
                                uint8_t frameType,
-                               IRtlDevice *device)
-        : Transmitter(k, n, keypair, epoch, channelId), channelId_(channelId), currentOutput_(0), ieee80211Sequence_(0),
-          radiotapHeader_(radiotapHeader), radiotapHeaderLen_(radiotapHeaderLen), frameType_(frameType),
-          rtlDevice_(device) {
+                               IRtlDevice *device,
+                               size_t inflight,
+                               bool burst)
+        : UsbTransmitter(k,
+                         n,
+                         keypair,
+                         epoch,
+                         channelId,
+                         radiotapHeader,
+                         radiotapHeaderLen,
+                         frameType,
+                         [device](const uint8_t *frame, size_t size) {
+                             return static_cast<bool>(device->send_packet(frame, size));
+                         },
+                         inflight,
+                         burst) {
     (void)wlans; // Not used directly here
+    if (!device) {
+#ifdef __ANDROID__
+        __android_log_print(ANDROID_LOG_DEBUG, TAG, "No USB device, cannot send packets");
+#endif
+        throw std::runtime_error("USB Transmitter: no device, should stop");
+    }
 }
 
+UsbTransmitter::UsbTransmitter(int k,
+                               int n,
+                               const std::string &keypair,
+                               uint64_t epoch,
+                               uint32_t channelId,
+                               uint8_t *radiotapHeader,
+                               size_t radiotapHeaderLen,
+                               uint8_t frameType,
+                               UsbTxQueue::SendFn send,
+                               size_t inflight,
+                               bool burst)
+        : Transmitter(k, n, keypair, epoch, channelId), channelId_(channelId), inflight_(inflight), frameType_(frameType),
+          currentOutput_(0), ieee80211Sequence_(0),
+          txQueue_(std::move(send),
+                   inflight,
+                   queueFrames(n, inflight),
+                   makeLinkHeaders(radiotapHeader, radiotapHeaderLen, frameType, channelId).data(),
+                   radiotapHeaderLen + sizeof(ieee80211_header),
+                   burst) {}
+
 void UsbTransmitter::dumpStats(
     FILE *fp, uint64_t ts, uint32_t &injectedPackets, uint32_t &droppedPackets, uint32_t &injectedBytes) {
+    // Counted by the sender threads as transfers complete
+    txQueue_.takeOutputStats(antennaStat_);
     for (auto &kv : antennaStat_) {
         const auto &stats = kv.second;
         uint64_t countAll = stats.countPacketsInjected + stats.countPacketsDropped;
@@ -466,49 +753,42 @@ void UsbTransmitter::dumpStats(
     antennaStat_.clear();
 }
 
-void UsbTransmitter::injectPacket(const uint8_t *buf, size_t size) {
-    if (!rtlDevice_) {
-#ifdef __ANDROID__
-        __android_log_print(ANDROID_LOG_DEBUG, TAG, "No USB device, cannot send packets");
-#endif
-        throw std::runtime_error("USB Transmitter: no device, should stop");
+void UsbTransmitter::applyRadiotapHeader(const std::vector<uint8_t> &header) {
+    const std::vector<uint8_t> linkHeaders = makeLinkHeaders(header.data(), header.size(), frameType_, channelId_);
+    txQueue_.setHeader(linkHeaders.data(), linkHeaders.size());
+}
+
+void UsbTransmitter::applyFecParams(int /*k*/, int n) {
+    // In burst mode a whole block is held until blockComplete(), a pool sized for a smaller n would never free up
+    txQueue_.resize(queueFrames(n, inflight_));
+}
+
+uint8_t *UsbTransmitter::acquireFrame() {
+    uint8_t *frame = txQueue_.acquire();
+    if (!frame) {
+        throw std::runtime_error("UsbTransmitter: TX queue stopped");
     }
+    return frame;
+}
 
+void UsbTransmitter::injectPacket(const uint8_t *buf, size_t size) {
+    // Packets not built by sendBlockFragment (session key) are copied into a frame
     if (size > MAX_FORWARDER_PACKET_SIZE) {
         throw std::runtime_error("UsbTransmitter::injectPacket - packet too large");
     }
+    uint8_t *frame = acquireFrame();
+    std::memcpy(frame, buf, size);
+    injectFrame(frame, size);
+}
 
-    uint8_t ieeeHdr[sizeof(ieee80211_header)];
-    std::memcpy(ieeeHdr, ieee80211_header, sizeof(ieee80211_header));
-
-    // Patch frame type
-    ieeeHdr[0] = frameType_;
-    uint32_t channelIdBE = htonl(channelId_);
-    std::memcpy(ieeeHdr + SRC_MAC_THIRD_BYTE, &channelIdBE, sizeof(uint32_t));
-    std::memcpy(ieeeHdr + DST_MAC_THIRD_BYTE, &channelIdBE, sizeof(uint32_t));
-
+void UsbTransmitter::injectFrame(uint8_t *buf, size_t size) {
+    // Everything but the sequence number is already in place in front of the packet
+    uint8_t *ieeeHdr = buf - sizeof(ieee80211_header);
     ieeeHdr[FRAME_SEQ_LB] = static_cast<uint8_t>(ieee80211Sequence_ & 0xff);
     ieeeHdr[FRAME_SEQ_HB] = static_cast<uint8_t>((ieee80211Sequence_ >> 8) & 0xff);
     ieee80211Sequence_ += 16;
 
-    uint64_t startUs = get_time_us();
-
-    // Merge into one contiguous buffer
-    size_t totalSize = radiotapHeaderLen_ + sizeof(ieeeHdr) + size;
-    std::unique_ptr<uint8_t[]> buffer(new uint8_t[totalSize]);
-
-    std::memcpy(buffer.get(), radiotapHeader_, radiotapHeaderLen_);
-    std::memcpy(buffer.get() + radiotapHeaderLen_, ieeeHdr, sizeof(ieeeHdr));
-    std::memcpy(buffer.get() + radiotapHeaderLen_ + sizeof(ieeeHdr), buf, size);
-
-    bool result = static_cast<bool>(rtlDevice_->send_packet(buffer.get(), totalSize));
-
-#ifdef __ANDROID__
-//    __android_log_print(ANDROID_LOG_DEBUG, TAG, "send_packet res:%d", result);
-#endif
-
-    uint64_t key = (static_cast<uint64_t>(currentOutput_) << 8) | 0xff;
-    antennaStat_[key].logLatency(get_time_us() - startUs, result, static_cast<uint32_t>(size));
+    txQueue_.submit(buf, size, currentOutput_);
 }
 
 //-------------------------------------------------------------
@@ -795,22 +1075,14 @@ void TxFrame::dataSource(
     }
 }
 
-void TxFrame::run(IRtlDevice *rtlDevice, TxArgs *arg) {
-    // Decide if using VHT
-    if (arg->bandwidth >= 80) {
-        arg->vht_mode = true;
-    }
-
-    // Radiotap header preparation
-    std::unique_ptr<uint8_t[]> rtHeader;
-    size_t rtHeaderLen = 0;
-    uint8_t frameType = FRAME_TYPE_RTS;
+std::vector<uint8_t> TxFrame::makeRadiotapHeader(const TxArgs &arg) {
+    std::vector<uint8_t> rtHeader;
 
     // Construct the appropriate radiotap header (HT vs. VHT)
-    if (!arg->vht_mode) {
+    if (!arg.vht_mode && arg.bandwidth < 80) {
         // HT mode
         uint8_t flags = 0;
-        switch (arg->bandwidth) {
+        switch (arg.bandwidth) {
         case 10:
         case 20:
             flags |= IEEE80211_RADIOTAP_MCS_BW_20;
@@ -819,14 +1091,14 @@ void TxFrame::run(IRtlDevice *rtlDevice, TxArgs *arg) {
             flags |= IEEE80211_RADIOTAP_MCS_BW_40;
             break;
         default:
-            throw std::runtime_error(string_format("Unsupported bandwidth: %d", arg->bandwidth));
+            throw std::runtime_error(string_format("Unsupported bandwidth: %d", arg.bandwidth));
         }
 
-        if (arg->short_gi) {
+        if (arg.short_gi) {
             flags |= IEEE80211_RADIOTAP_MCS_SGI;
         }
 
-        switch (arg->stbc) {
+        switch (arg.stbc) {
         case 0:
             break;
         case 1:
@@ -839,34 +1111,30 @@ void TxFrame::run(IRtlDevice *rtlDevice, TxArgs *arg) {
             flags |= (IEEE80211_RADIOTAP_MCS_STBC_3 << IEEE80211_RADIOTAP_MCS_STBC_SHIFT);
             break;
         default:
-            throw std::runtime_error(string_format("Unsupported STBC type: %d", arg->stbc));
+            throw std::runtime_error(string_format("Unsupported STBC type: %d", arg.stbc));
         }
 
-        if (arg->ldpc) {
+        if (arg.ldpc) {
             flags |= IEEE80211_RADIOTAP_MCS_FEC_LDPC;
         }
 
-        rtHeaderLen = sizeof(radiotap_header_ht);
-        rtHeader.reset(new uint8_t[rtHeaderLen]);
-        std::memcpy(rtHeader.get(), radiotap_header_ht, rtHeaderLen);
+        rtHeader.assign(radiotap_header_ht, radiotap_header_ht + sizeof(radiotap_header_ht));
 
         rtHeader[MCS_FLAGS_OFF] = flags;
-        rtHeader[MCS_IDX_OFF] = static_cast<uint8_t>(arg->mcs_index);
+        rtHeader[MCS_IDX_OFF] = static_cast<uint8_t>(arg.mcs_index);
     } else {
         // VHT mode
         uint8_t flags = 0;
-        rtHeaderLen = sizeof(radiotap_header_vht);
-        rtHeader.reset(new uint8_t[rtHeaderLen]);
-        std::memcpy(rtHeader.get(), radiotap_header_vht, rtHeaderLen);
+        rtHeader.assign(radiotap_header_vht, radiotap_header_vht + sizeof(radiotap_header_vht));
 
-        if (arg->short_gi) {
+        if (arg.short_gi) {
             flags |= IEEE80211_RADIOTAP_VHT_FLAG_SGI;
         }
-        if (arg->stbc) {
+        if (arg.stbc) {
             flags |= IEEE80211_RADIOTAP_VHT_FLAG_STBC;
         }
 
-        switch (arg->bandwidth) {
+        switch (arg.bandwidth) {
         case 80:
             rtHeader[VHT_BW_OFF] = IEEE80211_RADIOTAP_VHT_BW_80M;
             break;
@@ -874,19 +1142,31 @@ void TxFrame::run(IRtlDevice *rtlDevice, TxArgs *arg) {
             rtHeader[VHT_BW_OFF] = IEEE80211_RADIOTAP_VHT_BW_160M;
             break;
         default:
-            throw std::runtime_error(string_format("Unsupported VHT bandwidth: %d", arg->bandwidth));
+            throw std::runtime_error(string_format("Unsupported VHT bandwidth: %d", arg.bandwidth));
         }
 
-        if (arg->ldpc) {
+        if (arg.ldpc) {
             rtHeader[VHT_CODING_OFF] = IEEE80211_RADIOTAP_VHT_CODING_LDPC_USER0;
         }
 
         rtHeader[VHT_FLAGS_OFF] = flags;
-        rtHeader[VHT_MCSNSS0_OFF] |= static_cast<uint8_t>((arg->mcs_index << IEEE80211_RADIOTAP_VHT_MCS_SHIFT) &
+        rtHeader[VHT_MCSNSS0_OFF] |= static_cast<uint8_t>((arg.mcs_index << IEEE80211_RADIOTAP_VHT_MCS_SHIFT) &
                                                           IEEE80211_RADIOTAP_VHT_MCS_MASK);
         rtHeader[VHT_MCSNSS0_OFF] |=
-            static_cast<uint8_t>((arg->vht_nss << IEEE80211_RADIOTAP_VHT_NSS_SHIFT) & IEEE80211_RADIOTAP_VHT_NSS_MASK);
+            static_cast<uint8_t>((arg.vht_nss << IEEE80211_RADIOTAP_VHT_NSS_SHIFT) & IEEE80211_RADIOTAP_VHT_NSS_MASK);
     }
+    return rtHeader;
+}
+
+void TxFrame::run(IRtlDevice *rtlDevice, TxArgs *arg) {
+    // Decide if using VHT
+    if (arg->bandwidth >= 80) {
+        arg->vht_mode = true;
+    }
+
+    // Radiotap header preparation
+    const std::vector<uint8_t> rtHeader = makeRadiotapHeader(*arg);
+    uint8_t frameType = FRAME_TYPE_RTS;
 
     // Check system entropy
     {
@@ -943,16 +1223,27 @@ void TxFrame::run(IRtlDevice *rtlDevice, TxArgs *arg) {
                 arg->k, arg->n, arg->keypair, "127.0.0.1", arg->debug_port, arg->epoch, channelId);
         } else {
             // Use the USB-based transmitter
-            transmitter = std::make_shared<UsbTransmitter>(arg->k,
-                                                           arg->n,
-                                                           arg->keypair,
-                                                           arg->epoch,
-                                                           channelId,
-                                                           std::vector<std::string>{}, // wlans not used in USB
-                                                           rtHeader.get(),
-                                                           rtHeaderLen,
-                                                           frameType,
-                                                           rtlDevice);
+            auto usbTransmitter = std::make_shared<UsbTransmitter>(arg->k,
+                                                                   arg->n,
+                                                                   arg->keypair,
+                                                                   arg->epoch,
+                                                                   channelId,
+                                                                   std::vector<std::string>{}, // wlans not used in USB
+                                                                   const_cast<uint8_t *>(rtHeader.data()),
+                                                                   rtHeader.size(),
+                                                                   frameType,
+                                                                   rtlDevice,
+                                                                   static_cast<size_t>(arg->usb_inflight),
+                                                                   arg->usb_burst);
+            transmitter = usbTransmitter;
+        }
+
+        if (arg->fec_pipeline) {
+            transmitter->startPipeline();
+        }
+        {
+            std::lock_guard<std::mutex> lock(transmitterMutex_);
+            transmitter_ = transmitter;
         }
 
         // Start polling loop
@@ -964,4 +1255,31 @@ void TxFrame::run(IRtlDevice *rtlDevice, TxArgs *arg) {
         std::fprintf(stderr, "Error in TxFrame::run: %s\n", ex.what());
 #endif
     }
-}
\ No newline at end of file
+    std::lock_guard<std::mutex> lock(transmitterMutex_);
+    transmitter_.reset();
+}
+
+bool TxFrame::usbQueueStats(UsbTxQueue::Stats &stats, bool reset) {
+    std::lock_guard<std::mutex> lock(transmitterMutex_);
+    auto usbTransmitter = std::dynamic_pointer_cast<UsbTransmitter>(transmitter_);
+    if (!usbTransmitter) {
+        return false;
+    }
+    stats = usbTransmitter->queueStats(reset);
+    return true;
+}
+
+bool TxFrame::setLinkConfig(const TxArgs &arg) {
+    // Validate before anything runs, so callers can store the config either way
+    if (arg.k < 1 || arg.n < arg.k) {
+        throw std::runtime_error(string_format("Invalid FEC parameters k=%d n=%d", arg.k, arg.n));
+    }
+    const std::vector<uint8_t> rtHeader = makeRadiotapHeader(arg);
+    std::lock_guard<std::mutex> lock(transmitterMutex_);
+    if (!transmitter_) {
+        return false;
+    }
+    // The UDP debug transmitter has no radiotap header and ignores it
+    transmitter_->setLinkConfig(arg.k, arg.n, rtHeader);
+    return true;
+}
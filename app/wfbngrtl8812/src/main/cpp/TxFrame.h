@@ -9,19 +9,25 @@ extern "C" {
 #include "devourer/src/IRtlDevice.h"    // IRtlDevice interface (all chip generations)
 #include "wfb-ng/src/wifibroadcast.hpp" // Wifibroadcast definitions
 
+#include "UsbTxQueue.h"
+
 // -- System / C++ Includes --
 #include <algorithm>
 #include <arpa/inet.h>
+#include <atomic>
 #include <cerrno>
+#include <condition_variable>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <exception>
 #include <fcntl.h>
 #include <linux/if_ether.h>
 #include <linux/if_packet.h>
 #include <linux/random.h>
 #include <memory>
+#include <mutex>
 #include <net/if.h>
 #include <netinet/in.h>
 #include <poll.h>
@@ -30,6 +36,7 @@ extern "C" {
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <thread>
 #include <unistd.h>
 #include <unordered_map>
 
@@ -100,6 +107,30 @@ class Transmitter {
      */
     void sendSessionKey();
 
+    /**
+     * @brief Moves parity encoding and all encryption and injection onto a worker thread.
+     *
+     * sendPacket() then only copies the payload into the open block and queues it; a closed block is handed to the
+     * worker whole while ingest continues into a spare one. The worker processes everything in submission order, so
+     * output order and nonces are the same as without the pipeline. Call before the first sendPacket(); derived
+     * classes stop it in their destructor.
+     * @param blocks FEC blocks that can be in the pipeline at once, including the one being filled.
+     */
+    void startPipeline(size_t blocks = 3);
+
+    /**
+     * @brief Processes what is queued and joins the worker. No-op without a pipeline.
+     */
+    void stopPipeline();
+
+    /**
+     * @brief Switches FEC parameters and link headers at the next block boundary, from any thread.
+     *
+     * The session key stays, a new session packet announces the new k/n right away.
+     * @param radiotapHeader New radiotap header, empty to keep the current one.
+     */
+    void setLinkConfig(int k, int n, std::vector<uint8_t> radiotapHeader);
+
     /**
      * @brief Choose which output interface (antenna / socket / etc.) to use.
      * @param idx The interface index, or -1 for "mirror" mode.
@@ -125,22 +156,93 @@ class Transmitter {
      */
     virtual void injectPacket(const uint8_t *buf, size_t size) = 0;
 
+    /**
+     * @brief Buffer the next data packet is encrypted into, MAX_FORWARDER_PACKET_SIZE bytes.
+     *
+     * Transmitters that prepend link headers hand out a frame with headroom in front, so the packet is built in
+     * its final position. The default is a buffer owned by the Transmitter.
+     */
+    virtual uint8_t *acquireFrame() { return frameBuf_; }
+
+    /**
+     * @brief Injects a packet built in a buffer from acquireFrame(). Defaults to injectPacket().
+     * @param buf The buffer returned by acquireFrame().
+     * @param size Byte length of the packet.
+     */
+    virtual void injectFrame(uint8_t *buf, size_t size) { injectPacket(buf, size); }
+
+    /**
+     * @brief Called after the last fragment of a FEC block was injected.
+     */
+    virtual void blockComplete() {}
+
+    /**
+     * @brief Takes a new radiotap header from setLinkConfig(). Runs at a block boundary with the pipeline drained.
+     */
+    virtual void applyRadiotapHeader(const std::vector<uint8_t> & /*header*/) {}
+
+    /**
+     * @brief Takes new FEC parameters from setLinkConfig(). Runs at a block boundary with the pipeline drained,
+     * before the session packet announcing them is injected.
+     */
+    virtual void applyFecParams(int /*k*/, int /*n*/) {}
+
   private:
+    using Block = std::vector<std::unique_ptr<uint8_t[]>>;
+
+    /// One step for the pipeline worker.
+    struct PipelineJob {
+        enum Type : uint8_t { DATA, PARITY, SESSION_KEY, REKEY } type;
+        uint8_t fragment;
+        uint64_t blockIndex;
+        size_t size;
+        const uint8_t *data; // DATA: the fragment in its block
+        Block block;         // PARITY: the closed block, goes back to the spares afterwards
+    };
+
     void sendBlockFragment(size_t packetSize);
+    void encryptFragment(const uint8_t *fragment, size_t size, uint64_t blockIndex, uint8_t fragmentIndex);
+    void encodeParity(Block &block, size_t size);
     void makeSessionKey();
+    void makeSessionPacket();
+    void applyLinkConfig();
+    void resizeBlock(Block &block) const;
+
+    bool pipelined() const { return pipelineThread_.joinable(); }
+    void pushJob(PipelineJob &&job);
+    void pipelineLoop();
 
   private:
     // FEC encoding
     std::unique_ptr<fec_t, FecDeleter> fecPtr_;
-    const unsigned short int fecK_;
-    const unsigned short int fecN_;
+    unsigned short int fecK_;
+    unsigned short int fecN_;
 
     // Per-block counters
     uint64_t blockIndex_;
     uint8_t fragmentIndex_;
-    std::vector<std::unique_ptr<uint8_t[]>> block_;
+    Block block_;
     size_t maxPacketSize_;
 
+    // Pipeline: ring of jobs for the worker and blocks ingest can switch to
+    std::thread pipelineThread_;
+    std::mutex pipelineMutex_;
+    std::condition_variable jobCv_;   // worker waits for jobs
+    std::condition_variable spaceCv_; // ingest waits for ring space or a spare block
+    std::vector<PipelineJob> jobs_;
+    size_t jobHead_ = 0;
+    size_t jobCount_ = 0;
+    std::vector<Block> spareBlocks_;
+    bool pipelineStop_ = false;
+    std::exception_ptr pipelineError_;
+
+    // setLinkConfig() from another thread, picked up by sendPacket() between blocks
+    std::mutex configMutex_;
+    std::atomic<bool> configPending_{false};
+    int pendingK_ = 0;
+    int pendingN_ = 0;
+    std::vector<uint8_t> pendingRadiotap_;
+
     // Session properties
     const uint64_t epoch_;
     const uint32_t channelId_;
@@ -152,54 +254,11 @@ class Transmitter {
 
     // Session key packet buffer: header + data + Mac
     uint8_t sessionKeyPacket_[sizeof(wsession_hdr_t) + sizeof(wsession_data_t) + crypto_box_MACBYTES];
-};
-
-//-------------------------------------------------------------
-/**
- * @class TxAntennaItem
- * @brief Tracks statistics for a single output interface/antenna.
- */
-class TxAntennaItem {
-  public:
-    TxAntennaItem()
-            : countPacketsInjected(0), countBytesInjected(0), countPacketsDropped(0), latencySum(0), latencyMin(0),
-              latencyMax(0) {}
-
-    /**
-     * @brief Logs packet latency and updates injection/dropping stats.
-     * @param latency Microseconds elapsed.
-     * @param succeeded True if packet was sent successfully, false if dropped.
-     * @param packetSize Number of bytes in the packet.
-     */
-    void logLatency(uint64_t latency, bool succeeded, uint32_t packetSize) {
-        if ((countPacketsInjected + countPacketsDropped) == 0) {
-            latencyMin = latency;
-            latencyMax = latency;
-        } else {
-            latencyMin = std::min(latency, latencyMin);
-            latencyMax = std::max(latency, latencyMax);
-        }
-        latencySum += latency;
 
-        if (succeeded) {
-            ++countPacketsInjected;
-            countBytesInjected += packetSize;
-        } else {
-            ++countPacketsDropped;
-        }
-    }
-
-    // Stats
-    uint32_t countPacketsInjected;
-    uint32_t countBytesInjected;
-    uint32_t countPacketsDropped;
-    uint64_t latencySum;
-    uint64_t latencyMin;
-    uint64_t latencyMax;
+    // Data packet buffer for transmitters without their own frames
+    uint8_t frameBuf_[MAX_FORWARDER_PACKET_SIZE];
 };
 
-/// Map: key = (antennaIndex << 8) | 0xff, value = TxAntennaItem
-using TxAntennaStat = std::unordered_map<uint64_t, TxAntennaItem>;
 
 //-------------------------------------------------------------
 /**
@@ -294,27 +353,56 @@ class UsbTransmitter : public Transmitter {
                    uint8_t *radiotapHeader,
                    size_t radiotapHeaderLen,
                    uint8_t frameType,
-                   IRtlDevice *device);
+                   IRtlDevice *device,
+                   size_t inflight = 1,
+                   bool burst = false);
 
-    ~UsbTransmitter() override = default;
+    /**
+     * @brief Same, with frames going to @p send instead of a device (host benchmarks).
+     */
+    UsbTransmitter(int k,
+                   int n,
+                   const std::string &keypair,
+                   uint64_t epoch,
+                   uint32_t channelId,
+                   uint8_t *radiotapHeader,
+                   size_t radiotapHeaderLen,
+                   uint8_t frameType,
+                   UsbTxQueue::SendFn send,
+                   size_t inflight,
+                   bool burst);
+
+    ~UsbTransmitter() override { stopPipeline(); }
 
     void selectOutput(int idx) override { currentOutput_ = idx; }
 
     void dumpStats(
         FILE *fp, uint64_t ts, uint32_t &injectedPackets, uint32_t &droppedPackets, uint32_t &injectedBytes) override;
 
+    /// Queue depth, transfers in flight and completion latency of the TX queue.
+    UsbTxQueue::Stats queueStats(bool reset) { return txQueue_.stats(reset); }
+
   private:
     void injectPacket(const uint8_t *buf, size_t size) override;
+    uint8_t *acquireFrame() override;
+    void injectFrame(uint8_t *buf, size_t size) override;
+    void blockComplete() override { txQueue_.flush(); }
+    void applyRadiotapHeader(const std::vector<uint8_t> &header) override;
+    void applyFecParams(int k, int n) override;
+
+    /// A held block, every transfer in flight and as many queued behind them.
+    static size_t queueFrames(int n, size_t inflight) {
+        return static_cast<size_t>(n) + 2 * std::max<size_t>(inflight, 1) + 1;
+    }
 
   private:
     const uint32_t channelId_;
+    const size_t inflight_;
+    const uint8_t frameType_;
     int currentOutput_;
     uint16_t ieee80211Sequence_;
     TxAntennaStat antennaStat_;
-    uint8_t *radiotapHeader_;
-    size_t radiotapHeaderLen_;
-    uint8_t frameType_;
-    IRtlDevice *rtlDevice_;
+    UsbTxQueue txQueue_;
 };
 
 //-------------------------------------------------------------
@@ -340,6 +428,9 @@ struct TxArgs {
     int debug_port = 0;
     int fec_timeout = 20;
     int rcv_buf = 0;
+    int usb_inflight = 1;   // concurrent USB bulk-OUT transfers, > 1 can reorder frames on air
+    bool usb_burst = false; // submit the fragments of a FEC block back-to-back
+    bool fec_pipeline = false; // parity and encryption on a worker, see Transmitter::startPipeline()
     bool mirror = false;
     bool vht_mode = false;
     std::string keypair = "tx.key";
@@ -389,9 +480,32 @@ class TxFrame {
      */
     void stop();
 
+    /**
+     * @brief Stats of the USB TX queue of the running transmitter.
+     * @return False if no USB transmitter is running.
+     */
+    bool usbQueueStats(UsbTxQueue::Stats &stats, bool reset);
+
+    /**
+     * @brief Changes FEC k/n, MCS, bandwidth, GI, STBC and LDPC of the running transmitter.
+     *
+     * Takes effect at the next FEC block boundary. Throws std::runtime_error on values the radiotap header or the
+     * FEC cannot express.
+     * @return False if no transmitter is running.
+     */
+    bool setLinkConfig(const TxArgs &arg);
+
+    /**
+     * @brief Builds the HT or VHT (bandwidth >= 80) radiotap header for @p arg.
+     */
+    static std::vector<uint8_t> makeRadiotapHeader(const TxArgs &arg);
+
   private:
     bool shouldStop_ = false;
 
+    std::mutex transmitterMutex_;
+    std::shared_ptr<Transmitter> transmitter_;
+
     /**
      * @brief Create a UDP socket for receiving data
      * @param port UDP port to bind to
@@ -0,0 +1,54 @@
+#include "TxFramePool.h"
+
+#include <cstring>
+#include <stdexcept>
+
+TxFramePool::TxFramePool(size_t frames, const uint8_t *header, size_t headerLen)
+        : frames_(0),
+          // Cache line aligned frames, the USB stack copies them out whole
+          stride_((MAX_HEADROOM + MAX_FORWARDER_PACKET_SIZE + 63) & ~size_t(63)), headroom_(0) {
+    allocate(frames);
+    setHeader(header, headerLen);
+}
+
+void TxFramePool::allocate(size_t frames) {
+    storage_.reset(new uint8_t[frames * stride_ + 63]);
+    auto *base = reinterpret_cast<uint8_t *>((reinterpret_cast<uintptr_t>(storage_.get()) + 63) & ~uintptr_t(63));
+    free_.clear();
+    free_.reserve(frames);
+    for (size_t i = frames; i-- > 0;) {
+        free_.push_back(base + i * stride_ + MAX_HEADROOM);
+    }
+    frames_ = frames;
+}
+
+void TxFramePool::resize(size_t frames) {
+    // Every frame carries the same headers, keep a copy of one
+    std::vector<uint8_t> header(headroom_);
+    if (!free_.empty()) {
+        std::memcpy(header.data(), free_.back() - headroom_, headroom_);
+    }
+    allocate(frames);
+    setHeader(header.data(), header.size());
+}
+
+void TxFramePool::setHeader(const uint8_t *header, size_t headerLen) {
+    if (headerLen > MAX_HEADROOM) {
+        throw std::runtime_error("TxFramePool: link headers exceed MAX_HEADROOM");
+    }
+    for (uint8_t *packet : free_) {
+        std::memcpy(packet - headerLen, header, headerLen);
+    }
+    headroom_ = headerLen;
+}
+
+uint8_t *TxFramePool::acquire() {
+    if (free_.empty()) {
+        return nullptr;
+    }
+    uint8_t *packet = free_.back();
+    free_.pop_back();
+    return packet;
+}
+
+void TxFramePool::release(uint8_t *packet) { free_.push_back(packet); }
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "wfb-ng/src/wifibroadcast.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/**
+ * @class TxFramePool
+ * @brief Preallocated transmit frames for one session/port.
+ *
+ * Every frame starts with the link headers (radiotap + 802.11), which are copied in once when the pool is
+ * created or the link configuration changes, followed by room for MAX_FORWARDER_PACKET_SIZE bytes of wfb-ng
+ * packet. The packet sits at a fixed offset, the headers end right in front of it. acquire() hands out the
+ * packet position, so nothing has to be copied in front of it before injection. Not thread safe, UsbTxQueue
+ * guards it with its own lock.
+ */
+class TxFramePool {
+  public:
+    /// Room reserved for link headers, radiotap HT/VHT + 802.11 fit with space to spare.
+    static constexpr size_t MAX_HEADROOM = 64;
+
+    /**
+     * @param frames Number of frames, the most that can be in flight at once.
+     * @param header Link headers written in front of every packet, at most MAX_HEADROOM bytes.
+     * @param headerLen Byte length of @p header.
+     */
+    TxFramePool(size_t frames, const uint8_t *header, size_t headerLen);
+
+    /**
+     * @brief Rewrites the link headers of all frames. Only while every frame is in the pool.
+     */
+    void setHeader(const uint8_t *header, size_t headerLen);
+
+    /**
+     * @brief Reallocates the pool with @p frames frames, the link headers are kept. Only while every frame is in
+     * the pool.
+     */
+    void resize(size_t frames);
+
+    /**
+     * @brief Takes a free frame.
+     * @return Where the wfb-ng packet goes, headroom() bytes after the frame start, or nullptr if all frames
+     *         are in use.
+     */
+    uint8_t *acquire();
+
+    /**
+     * @brief Returns a frame from acquire() to the pool.
+     */
+    void release(uint8_t *packet);
+
+    /// Bytes of link headers in front of every packet.
+    size_t headroom() const { return headroom_; }
+
+    /// Frames not in use.
+    size_t available() const { return free_.size(); }
+
+    /// All frames.
+    size_t size() const { return frames_; }
+
+  private:
+    void allocate(size_t frames);
+
+    size_t frames_;
+    const size_t stride_;
+    size_t headroom_;
+    std::unique_ptr<uint8_t[]> storage_;
+    std::vector<uint8_t *> free_;
+};
@@ -0,0 +1,169 @@
+#include "UsbTxQueue.h"
+
+#include "TraceRecorder.h"
+
+#include <algorithm>
+#include <pthread.h>
+#include <string>
+
+UsbTxQueue::UsbTxQueue(
+    SendFn send, size_t inflight, size_t frames, const uint8_t *header, size_t headerLen, bool burst)
+        : send_(std::move(send)), burst_(burst), pool_(frames, header, headerLen), ring_(frames) {
+    inflight = std::max<size_t>(inflight, 1);
+    for (size_t i = 0; i < inflight; ++i) {
+        senders_.emplace_back(&UsbTxQueue::senderLoop, this, i);
+    }
+}
+
+UsbTxQueue::~UsbTxQueue() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    readyCv_.notify_all();
+    freeCv_.notify_all();
+    for (auto &t : senders_) {
+        t.join();
+    }
+}
+
+uint8_t *UsbTxQueue::acquire() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    uint8_t *packet = nullptr;
+    freeCv_.wait(lock, [&] { return stop_ || (packet = pool_.acquire()) != nullptr; });
+    return stop_ ? nullptr : packet;
+}
+
+void UsbTxQueue::submit(uint8_t *packet, size_t size, int output) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        // Every frame in the ring came from the pool, so the ring never overflows
+        ring_[(head_ + count_) % ring_.size()] =
+            Entry{packet, static_cast<uint16_t>(size), static_cast<int16_t>(output), get_time_us()};
+        ++count_;
+        highWater_ = std::max(highWater_, count_);
+        if (burst_) {
+            return;
+        }
+        visible_ = count_;
+    }
+    readyCv_.notify_one();
+}
+
+void UsbTxQueue::discard(uint8_t *packet) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pool_.release(packet);
+    }
+    freeCv_.notify_one();
+}
+
+void UsbTxQueue::flush() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (visible_ == count_) {
+            return;
+        }
+        visible_ = count_;
+    }
+    readyCv_.notify_all();
+}
+
+void UsbTxQueue::setHeader(const uint8_t *header, size_t headerLen) {
+    flush();
+    std::unique_lock<std::mutex> lock(mutex_);
+    freeCv_.wait(lock, [this] { return stop_ || pool_.available() == pool_.size(); });
+    pool_.setHeader(header, headerLen);
+}
+
+void UsbTxQueue::resize(size_t frames) {
+    flush();
+    std::unique_lock<std::mutex> lock(mutex_);
+    freeCv_.wait(lock, [this] { return stop_ || pool_.available() == pool_.size(); });
+    if (stop_ || frames == pool_.size()) {
+        return;
+    }
+    pool_.resize(frames);
+    // Empty, every queued frame came back
+    ring_.assign(frames, Entry{});
+    head_ = 0;
+}
+
+void UsbTxQueue::senderLoop(size_t index) {
+    const std::string name = "usb-tx-" + std::to_string(index);
+    pthread_setname_np(pthread_self(), name.c_str());
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        readyCv_.wait(lock, [this] { return stop_ || visible_ > 0; });
+        if (stop_) {
+            // Whatever is still queued goes back unsent
+            dropped_ += count_;
+            for (; count_ > 0; --count_, head_ = (head_ + 1) % ring_.size()) {
+                pool_.release(ring_[head_].packet);
+            }
+            visible_ = 0;
+            return;
+        }
+        const Entry entry = ring_[head_];
+        head_ = (head_ + 1) % ring_.size();
+        --count_;
+        --visible_;
+        ++inFlight_;
+        ++submitted_;
+        // The headers only change while nothing is queued
+        const size_t headroom = pool_.headroom();
+        lock.unlock();
+
+        bool ok;
+        {
+            TRACE_SCOPE_ARG("tx_inject", entry.size);
+            ok = send_(entry.packet - headroom, headroom + entry.size);
+        }
+        if (!ok) {
+            TRACE_ANOMALY("usb_tx_failed");
+        }
+        const uint64_t latencyUs = get_time_us() - entry.submitUs;
+
+        lock.lock();
+        --inFlight_;
+        pool_.release(entry.packet);
+        if (ok) {
+            ++completed_;
+        } else {
+            ++failed_;
+        }
+        latencySumUs_ += latencyUs;
+        ++latencyCount_;
+        latencyMaxUs_ = std::max(latencyMaxUs_, latencyUs);
+
+        outputStats_[(static_cast<uint64_t>(entry.output) << 8) | 0xff].logLatency(latencyUs, ok, entry.size);
+        freeCv_.notify_all();
+    }
+}
+
+UsbTxQueue::Stats UsbTxQueue::stats(bool reset) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Stats s{count_,
+            highWater_,
+            inFlight_,
+            submitted_,
+            completed_,
+            failed_,
+            dropped_,
+            latencyCount_ ? latencySumUs_ / latencyCount_ : 0,
+            latencyMaxUs_};
+    if (reset) {
+        highWater_ = count_;
+        latencySumUs_ = 0;
+        latencyCount_ = 0;
+        latencyMaxUs_ = 0;
+    }
+    return s;
+}
+
+void UsbTxQueue::takeOutputStats(TxAntennaStat &out) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    out.clear();
+    out.swap(outputStats_);
+}
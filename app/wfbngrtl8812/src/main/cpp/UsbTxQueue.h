@@ -0,0 +1,177 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "TxFramePool.h"
+
+/**
+ * @class TxAntennaItem
+ * @brief Tracks statistics for a single output interface/antenna.
+ */
+class TxAntennaItem {
+  public:
+    TxAntennaItem()
+            : countPacketsInjected(0), countBytesInjected(0), countPacketsDropped(0), latencySum(0), latencyMin(0),
+              latencyMax(0) {}
+
+    /**
+     * @brief Logs packet latency and updates injection/dropping stats.
+     * @param latency Microseconds elapsed.
+     * @param succeeded True if packet was sent successfully, false if dropped.
+     * @param packetSize Number of bytes in the packet.
+     */
+    void logLatency(uint64_t latency, bool succeeded, uint32_t packetSize) {
+        if ((countPacketsInjected + countPacketsDropped) == 0) {
+            latencyMin = latency;
+            latencyMax = latency;
+        } else {
+            latencyMin = std::min(latency, latencyMin);
+            latencyMax = std::max(latency, latencyMax);
+        }
+        latencySum += latency;
+
+        if (succeeded) {
+            ++countPacketsInjected;
+            countBytesInjected += packetSize;
+        } else {
+            ++countPacketsDropped;
+        }
+    }
+
+    // Stats
+    uint32_t countPacketsInjected;
+    uint32_t countBytesInjected;
+    uint32_t countPacketsDropped;
+    uint64_t latencySum;
+    uint64_t latencyMin;
+    uint64_t latencyMax;
+};
+
+/// Map: key = (antennaIndex << 8) | 0xff, value = TxAntennaItem
+using TxAntennaStat = std::unordered_map<uint64_t, TxAntennaItem>;
+
+/**
+ * @class UsbTxQueue
+ * @brief Queue between the FEC/crypto path and the USB bulk-OUT endpoint.
+ *
+ * The device only offers a blocking send, so a configurable number of sender threads each keep one transfer in
+ * flight; frames go back to the pool when their transfer completes. In burst mode the fragments of a FEC block are
+ * held until flush() and then submitted back-to-back.
+ */
+class UsbTxQueue {
+  public:
+    /// Sends one complete frame (link headers + packet), true on success.
+    using SendFn = std::function<bool(const uint8_t *frame, size_t size)>;
+
+    struct Stats {
+        size_t depth;          ///< Frames queued, held ones included
+        size_t highWater;      ///< Highest depth since the last stats(true)
+        size_t inFlight;       ///< Transfers running right now
+        uint64_t submitted;    ///< Frames handed to the senders
+        uint64_t completed;    ///< Transfers that succeeded
+        uint64_t failed;       ///< Transfers the device rejected
+        uint64_t dropped;      ///< Frames discarded without a transfer (shutdown)
+        uint64_t latencyAvgUs; ///< submit() to completion
+        uint64_t latencyMaxUs;
+    };
+
+    /**
+     * @param send Blocking send, called from up to @p inflight threads at once.
+     * @param inflight Number of transfers in flight, at least 1. With more than one, @p send must be safe to call
+     * concurrently, and frames can go on air out of order since the transfers race each other.
+     * @param frames Number of preallocated frames.
+     * @param header Link headers written in front of every packet once.
+     * @param headerLen Byte length of @p header.
+     * @param burst Hold fragments until flush().
+     */
+    UsbTxQueue(SendFn send, size_t inflight, size_t frames, const uint8_t *header, size_t headerLen, bool burst);
+    ~UsbTxQueue();
+
+    UsbTxQueue(const UsbTxQueue &) = delete;
+    UsbTxQueue &operator=(const UsbTxQueue &) = delete;
+
+    /**
+     * @brief A free frame's packet position, MAX_FORWARDER_PACKET_SIZE bytes with headroom() bytes of link headers in
+     * front. Blocks while every frame is queued or in flight.
+     */
+    uint8_t *acquire();
+
+    /**
+     * @brief Queues a packet built in a frame from acquire().
+     * @param output Output index the stats are accounted to.
+     */
+    void submit(uint8_t *packet, size_t size, int output);
+
+    /**
+     * @brief Returns a frame from acquire() without sending it.
+     */
+    void discard(uint8_t *packet);
+
+    /**
+     * @brief Submits the fragments held in burst mode.
+     */
+    void flush();
+
+    /**
+     * @brief Waits until every queued frame was sent, then rewrites the link headers of all frames.
+     */
+    void setHeader(const uint8_t *header, size_t headerLen);
+
+    /**
+     * @brief Waits until every queued frame was sent, then reallocates the pool with @p frames frames.
+     */
+    void resize(size_t frames);
+
+    Stats stats(bool reset);
+
+    /**
+     * @brief Moves the per-output counters collected since the last call into @p out.
+     */
+    void takeOutputStats(TxAntennaStat &out);
+
+  private:
+    struct Entry {
+        uint8_t *packet;
+        uint16_t size;
+        int16_t output;
+        uint64_t submitUs;
+    };
+
+    void senderLoop(size_t index);
+
+    const SendFn send_;
+    const bool burst_;
+
+    std::mutex mutex_;
+    std::condition_variable readyCv_; // senders: visible entries
+    std::condition_variable freeCv_;  // acquire(): free frames
+    TxFramePool pool_;
+
+    // Ring of queued entries, the first visible_ of count_ can be sent
+    std::vector<Entry> ring_;
+    size_t head_ = 0;
+    size_t count_ = 0;
+    size_t visible_ = 0;
+    bool stop_ = false;
+
+    size_t highWater_ = 0;
+    size_t inFlight_ = 0;
+    uint64_t submitted_ = 0;
+    uint64_t completed_ = 0;
+    uint64_t failed_ = 0;
+    uint64_t dropped_ = 0;
+    uint64_t latencySumUs_ = 0;
+    uint64_t latencyCount_ = 0;
+    uint64_t latencyMaxUs_ = 0;
+    TxAntennaStat outputStats_;
+
+    std::vector<std::thread> senders_;
+};
@@ -7,13 +7,19 @@
 
 #include "RxFrame.h"
 #include "SignalQualityCalculator.h"
+#include "TraceRecorder.h"
 #include "TxFrame.h"
 #include "devourer/src/RxPacket.h"
 #include "libusb.h"
 #include "wfb-ng/src/wifibroadcast.hpp"
 
+#include <algorithm>
 #include <arpa/inet.h>
 #include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
 #include <cstdint>
 #include <cstring>
 #include <initializer_list>
@@ -30,6 +36,7 @@
 #include <sys/socket.h>
 #include <thread>
 #include <unistd.h>
+#include <unordered_set>
 
 #undef TAG
 #define TAG "pixelpilot"
@@ -54,45 +61,285 @@ std::string generate_random_string(size_t length) {
     return result;
 }
 
+namespace {
+
+// Links a video player may still hold as keyframe request context, see keyframeRequestTrampoline()
+std::mutex live_links_mutex;
+std::unordered_set<WfbngLink *> live_links;
+
+} // namespace
+
 WfbngLink::WfbngLink(JNIEnv *env, jobject context)
         : current_fd(-1), adaptive_link_enabled(true), adaptive_tx_power(30) {
-    initAgg();
+    addRxStream(video_radio_port, std::make_shared<UdpPacketSink>("127.0.0.1", 5600));
+    addRxStream(0x10, std::make_shared<UdpPacketSink>("127.0.0.1", 14550)); // mavlink
+    addRxStream(wfb_rx_port, std::make_shared<UdpPacketSink>("127.0.0.1", 8000));
     log = std::make_shared<Logger>(); // routes to logcat under the "devourer" tag
     wifi_driver = std::make_unique<WiFiDriver>(log);
+
+    uplink_config.k = 1;
+    uplink_config.n = 5;
+    uplink_config.mcs_index = 0;
+    uplink_config.bandwidth = 20;
+    uplink_config.short_gi = false;
+    uplink_config.stbc = true;
+    uplink_config.ldpc = true;
+
+    telemetry_thread = std::thread([this] {
+        while (!telemetry_should_stop) {
+            publishTelemetry();
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+    });
+
+    std::lock_guard<std::mutex> lock(live_links_mutex);
+    live_links.insert(this);
+}
+
+WfbngLink::~WfbngLink() {
+    {
+        // Waits for a keyframe request in flight, later ones from a stale player context are dropped
+        std::lock_guard<std::mutex> lock(live_links_mutex);
+        live_links.erase(this);
+    }
+    telemetry_should_stop = true;
+    if (telemetry_thread.joinable()) {
+        telemetry_thread.join();
+    }
+}
+
+static_assert(sizeof(LinkTelemetry) == 88, "WfbNgTelemetry.java expects 88 bytes");
+static_assert(offsetof(LinkTelemetry, p_all) == 8 && offsetof(LinkTelemetry, link_quality) == 64 &&
+                  offsetof(LinkTelemetry, rssi) == 76 && offsetof(LinkTelemetry, chains) == 84,
+              "WfbNgTelemetry.java offsets");
+
+void WfbngLink::publishTelemetry() {
+    uint32_t p_all = 0, p_dec_err = 0, p_fec_recovered = 0, p_lost = 0, p_bad = 0, p_override = 0, p_outgoing = 0;
+    if (auto video = videoStream()) {
+        // Between two frames of the worker, so no packet is counted twice or lost by clear_stats()
+        auto lock = video->worker().lock();
+        auto aggregator = video->aggregator();
+        if (aggregator) {
+            p_all = aggregator->count_p_all;
+            p_dec_err = aggregator->count_p_dec_err;
+            p_fec_recovered = aggregator->count_p_fec_recovered;
+            p_lost = aggregator->count_p_lost;
+            p_bad = aggregator->count_p_bad;
+            p_override = aggregator->count_p_override;
+            p_outgoing = aggregator->count_p_outgoing;
+            aggregator->clear_stats();
+        }
+    }
+    signal_quality.add_fec_data(p_all, p_fec_recovered, p_lost);
+    const auto quality = signal_quality.calculate_signal_quality();
+
+    float rssi = 0.f;
+    for (size_t i = 0; i < quality.chains.size(); ++i) {
+        const float avg = quality.chains[i].metrics[SignalQualityCalculator::RSSI].avg;
+        rssi = i == 0 ? avg : std::max(rssi, avg);
+    }
+
+    telemetry.publish([&](LinkTelemetry &t) {
+        t.publish_ms = SignalQualityCalculator::now_ms();
+        t.p_all += p_all;
+        t.p_dec_err += p_dec_err;
+        t.p_fec_recovered += p_fec_recovered;
+        t.p_lost += p_lost;
+        t.p_bad += p_bad;
+        t.p_override += p_override;
+        t.p_outgoing += p_outgoing;
+        // -1024..1024 to 0..100
+        t.link_quality = (int32_t)std::lround((quality.quality + 1024.f) * 100.f / 2048.f);
+        t.lost_last_second = quality.lost_last_second;
+        t.recovered_last_second = quality.recovered_last_second;
+        t.rssi = rssi;
+        t.snr = quality.snr;
+        t.chains = (int32_t)quality.chains.size();
+    });
+}
+
+bool WfbngLink::updateUplinkConfig(const std::function<void(TxArgs &)> &change) {
+    std::lock_guard<std::mutex> lock(uplink_mutex);
+    TxArgs config = uplink_config;
+    change(config);
+    // Throws on an unsupported bandwidth, STBC or MCS before anything is stored
+    TxFrame::makeRadiotapHeader(config);
+    const std::shared_ptr<TxFrame> tx = std::atomic_load(&txFrame);
+    const bool applied = tx && tx->setLinkConfig(config);
+    uplink_config = config;
+    return applied;
+}
+
+bool WfbngLink::setUplinkConfig(int k, int n, int mcs, int bandwidth, bool short_gi) {
+    if (k < 1 || n < k || n > 255) {
+        throw std::runtime_error("Invalid FEC parameters k=" + std::to_string(k) + " n=" + std::to_string(n));
+    }
+    if (mcs < 0 || mcs > 31) {
+        throw std::runtime_error("Invalid MCS " + std::to_string(mcs));
+    }
+    return updateUplinkConfig([&](TxArgs &config) {
+        config.k = k;
+        config.n = n;
+        config.mcs_index = mcs;
+        config.bandwidth = bandwidth;
+        config.short_gi = short_gi;
+    });
+}
+
+bool WfbngLink::setUplinkLdpc(bool enable) {
+    return updateUplinkConfig([&](TxArgs &config) { config.ldpc = enable; });
+}
+
+bool WfbngLink::setUplinkStbc(bool enable) {
+    return updateUplinkConfig([&](TxArgs &config) { config.stbc = enable; });
 }
 
 void WfbngLink::initAgg() {
-    std::string client_addr = "127.0.0.1";
-    uint64_t epoch = 0;
+    for (const auto &stream : rx_demux.streams()) {
+        stream->resetAggregator(keyPath);
+    }
+}
+
+void WfbngLink::addRxStream(uint8_t radio_port, std::shared_ptr<PacketSink> sink) {
+    const uint32_t channel_id = channelId(radio_port);
+    if (auto existing = rx_demux.find(channel_id)) {
+        existing->setSink(std::move(sink));
+        return;
+    }
+
+    RxStream::FrameHook hook;
+    if (radio_port == video_radio_port) {
+        hook = [this](RxStream &, const RxQueuedFrame &f, bool first) {
+            signal_quality.add_frame(f.meta, first);
+        };
+    }
+    // Video gets the deep queue and a high priority, a USB burst of a whole FEC block must never be dropped
+    const bool video = radio_port == video_radio_port;
+    rx_demux.add(std::make_shared<RxStream>(
+        channel_id, std::move(sink), keyPath, video ? 512 : 64, video ? video_nice : other_nice, std::move(hook)));
+    __android_log_print(ANDROID_LOG_DEBUG, TAG, "RX stream added, radio port %d", radio_port);
+}
+
+bool WfbngLink::removeRxStream(uint8_t radio_port) {
+    const bool removed = rx_demux.remove(channelId(radio_port));
+    __android_log_print(
+        ANDROID_LOG_DEBUG, TAG, "RX stream radio port %d %s", radio_port, removed ? "removed" : "not registered");
+    return removed;
+}
+
+void WfbngLink::setRxWorkerPriority(int video, int other) {
+    video_nice = video;
+    other_nice = other;
+    for (const auto &stream : rx_demux.streams()) {
+        stream->worker().setPriority(stream->radioPort() == video_radio_port ? video : other);
+    }
+}
+
+void WfbngLink::setVideoSink(InProcessPushFn fn, void *ctx) {
+    std::shared_ptr<PacketSink> sink;
+    if (fn != nullptr && ctx != nullptr) {
+        sink = std::make_shared<InProcessPacketSink>(fn, ctx);
+    } else {
+        sink = std::make_shared<UdpPacketSink>("127.0.0.1", 5600);
+    }
+    addRxStream(video_radio_port, sink);
+    // The in-process player requests keyframes itself, only when a loss hit a reference frame
+    signal_quality.set_idr_on_fec_loss(fn == nullptr);
+    __android_log_print(ANDROID_LOG_DEBUG, TAG, "video sink: %s", fn != nullptr ? "in-process" : "udp:5600");
+}
 
-    uint8_t video_radio_port = 0;
-    uint32_t video_channel_id_f = (link_id << 8) + video_radio_port;
-    video_channel_id_be = htobe32(video_channel_id_f);
-    auto udsName = std::string("my_socket");
+void WfbngLink::requestKeyframe() {
+    TRACE_INSTANT("idr_request", 0);
+    signal_quality.request_idr();
+    {
+        std::lock_guard<std::mutex> lock(idr_wake_mutex);
+        idr_wake_pending = true;
+    }
+    idr_wake.notify_one();
+}
 
-    video_aggregator = std::make_unique<AggregatorUDPv4>(client_addr, 5600, keyPath, epoch, video_channel_id_f, 0);
+void WfbngLink::keyframeRequestTrampoline(void *ctx) {
+    std::lock_guard<std::mutex> lock(live_links_mutex);
+    auto *link = static_cast<WfbngLink *>(ctx);
+    if (live_links.count(link) != 0) {
+        link->requestKeyframe();
+    }
+}
 
-    int mavlink_client_port = 14550;
-    uint8_t mavlink_radio_port = 0x10;
-    uint32_t mavlink_channel_id_f = (link_id << 8) + mavlink_radio_port;
-    mavlink_channel_id_be = htobe32(mavlink_channel_id_f);
+uint8_t WfbngLink::acquireAdapterIndex(int fd) {
+    std::lock_guard<std::mutex> lock(adapter_mutex);
+    uint8_t idx = 0;
+    while (std::any_of(
+        adapter_indices.begin(), adapter_indices.end(), [idx](const auto &entry) { return entry.second == idx; })) {
+        ++idx;
+    }
+    adapter_indices[fd] = idx;
+    return idx;
+}
 
-    mavlink_aggregator =
-        std::make_unique<AggregatorUDPv4>(client_addr, mavlink_client_port, keyPath, epoch, mavlink_channel_id_f, 0);
+void WfbngLink::releaseAdapterIndex(int fd) {
+    std::lock_guard<std::mutex> lock(adapter_mutex);
+    adapter_indices.erase(fd);
+}
 
-    int udp_client_port = 8000;
-    uint8_t udp_radio_port = wfb_rx_port;
-    uint32_t udp_channel_id_f = (link_id << 8) + udp_radio_port;
-    udp_channel_id_be = htobe32(udp_channel_id_f);
+std::vector<int> WfbngLink::getAdapterStats() {
+    std::vector<int> result;
+    auto video = videoStream();
+    if (!video) {
+        return result;
+    }
+    for (const auto &s : video->adapterStats()) {
+        result.insert(result.end(),
+                      {s.wlan_idx, (int)s.received, (int)s.first, (int)s.duplicates, s.loss_permille, s.rssi_avg});
+    }
+    return result;
+}
+
+std::vector<int> WfbngLink::getChainStats() {
+    std::vector<int> result;
+    for (const auto &chain : signal_quality.chain_stats()) {
+        result.insert(result.end(),
+                      {chain.wlan_idx, chain.antenna, (int)chain.packets, (int)std::lround(chain.pdr * 1000)});
+        for (const auto &m : chain.metrics) {
+            result.insert(result.end(),
+                          {(int)m.count, (int)std::lround(m.avg * 10), m.min, m.p10, m.p50, m.p90, m.max});
+        }
+    }
+    return result;
+}
+
+std::vector<int> WfbngLink::getRxQueueStats() {
+    std::vector<int> result;
+    for (const auto &stream : rx_demux.streams()) {
+        const auto stats = stream->worker().stats();
+        result.insert(
+            result.end(),
+            {stream->radioPort(), (int)stats.depth, (int)stats.high_water, (int)stats.dropped, (int)stats.processed});
+    }
+    return result;
+}
 
-    udp_aggregator =
-        std::make_unique<AggregatorUDPv4>(client_addr, udp_client_port, keyPath, epoch, udp_channel_id_f, 0);
+std::vector<int> WfbngLink::getUsbTxStats() {
+    // Replaced when TX moves to another adapter
+    const std::shared_ptr<TxFrame> tx = std::atomic_load(&txFrame);
+    UsbTxQueue::Stats stats;
+    if (!tx || !tx->usbQueueStats(stats, true)) {
+        return {};
+    }
+    return {(int)stats.depth,
+            (int)stats.highWater,
+            (int)stats.inFlight,
+            (int)stats.submitted,
+            (int)stats.completed,
+            (int)stats.failed,
+            (int)stats.dropped,
+            (int)stats.latencyAvgUs,
+            (int)stats.latencyMaxUs};
 }
 
 int WfbngLink::run(JNIEnv *env, jobject context, jint wifiChannel, jint bw, jint fd) {
     int r;
     libusb_context *ctx = NULL;
-    txFrame = std::make_shared<TxFrame>();
 
     r = libusb_set_option(NULL, LIBUSB_OPTION_NO_DEVICE_DISCOVERY);
     r = libusb_init(&ctx);
@@ -138,68 +385,36 @@ int WfbngLink::run(JNIEnv *env, jobject context, jint wifiChannel, jint bw, jint
         return -1;
     }
 
-    uint8_t *video_channel_id_be8 = reinterpret_cast<uint8_t *>(&video_channel_id_be);
-    uint8_t *udp_channel_id_be8 = reinterpret_cast<uint8_t *>(&udp_channel_id_be);
-    uint8_t *mavlink_channel_id_be8 = reinterpret_cast<uint8_t *>(&mavlink_channel_id_be);
+    // Per RX thread view of the demux table, lives as long as the blocking RX loop below
+    RxDemux::View demux(rx_demux);
+    // Every adapter feeds the same aggregators, wfb-ng keys its antenna stats by (wlan_idx, antenna)
+    const uint8_t wlan_idx = acquireAdapterIndex(fd);
+    const uint16_t freq = wifiChannel == 14 ? 2484 : (wifiChannel < 14 ? 2407 : 5000) + 5 * wifiChannel;
+    __android_log_print(ANDROID_LOG_DEBUG, TAG, "fd=%d receives as adapter %d", fd, wlan_idx);
 
     try {
-        auto packetProcessor =
-            [this, video_channel_id_be8, mavlink_channel_id_be8, udp_channel_id_be8](const Packet &packet) {
-                RxFrame frame(packet.Data);
-                if (!frame.IsValidWfbFrame()) {
-                    return;
-                }
-                int8_t rssi[4] = {(int8_t)packet.RxAtrib.rssi[0], (int8_t)packet.RxAtrib.rssi[1], 1, 1};
-                uint32_t freq = 0;
-                int8_t noise[4] = {1, 1, 1, 1};
-                uint8_t antenna[4] = {1, 1, 1, 1};
-
-                std::lock_guard<std::mutex> lock(agg_mutex);
-                if (frame.MatchesChannelID(video_channel_id_be8)) {
-                    SignalQualityCalculator::get_instance().add_rssi(packet.RxAtrib.rssi[0], packet.RxAtrib.rssi[1]);
-                    SignalQualityCalculator::get_instance().add_snr(packet.RxAtrib.snr[0], packet.RxAtrib.snr[1]);
-
-                    video_aggregator->process_packet(packet.Data.data() + sizeof(ieee80211_header),
-                                                     packet.Data.size() - sizeof(ieee80211_header) - 4,
-                                                     0,
-                                                     antenna,
-                                                     rssi,
-                                                     noise,
-                                                     freq,
-                                                     0,
-                                                     0,
-                                                     NULL);
-                    if (should_clear_stats) {
-                        video_aggregator->clear_stats();
-                        should_clear_stats = false;
-                    }
-                } else if (frame.MatchesChannelID(mavlink_channel_id_be8)) {
-                    mavlink_aggregator->process_packet(packet.Data.data() + sizeof(ieee80211_header),
-                                                       packet.Data.size() - sizeof(ieee80211_header) - 4,
-                                                       0,
-                                                       antenna,
-                                                       rssi,
-                                                       noise,
-                                                       freq,
-                                                       0,
-                                                       0,
-                                                       NULL);
-                } else if (frame.MatchesChannelID(udp_channel_id_be8)) {
-                    udp_aggregator->process_packet(packet.Data.data() + sizeof(ieee80211_header),
-                                                   packet.Data.size() - sizeof(ieee80211_header) - 4,
-                                                   0,
-                                                   antenna,
-                                                   rssi,
-                                                   noise,
-                                                   freq,
-                                                   0,
-                                                   0,
-                                                   NULL);
-                }
-            };
-
-        // Store the current fd for later TX power updates.
-        current_fd = fd;
+        auto packetProcessor = [this, &demux, wlan_idx, freq](const Packet &packet) {
+            TRACE_INSTANT("usb_rx", packet.Data.size());
+            // The two chains of the RTL8812, unused slots are marked like wfb-ng does
+            RxFrameMeta meta;
+            meta.timestamp_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                    std::chrono::steady_clock::now().time_since_epoch())
+                                    .count();
+            std::fill(std::begin(meta.antenna), std::end(meta.antenna), 0xff);
+            std::fill(std::begin(meta.rssi), std::end(meta.rssi), SCHAR_MIN);
+            std::fill(std::begin(meta.snr), std::end(meta.snr), 0);
+            std::fill(std::begin(meta.noise), std::end(meta.noise), SCHAR_MAX);
+            for (uint8_t chain = 0; chain < 2; ++chain) {
+                meta.antenna[chain] = chain;
+                meta.rssi[chain] = (int8_t)packet.RxAtrib.rssi[chain];
+                meta.snr[chain] = (int8_t)packet.RxAtrib.snr[chain];
+            }
+            meta.freq = freq;
+            meta.wlan_idx = wlan_idx;
+            capture.push(packet.Data, meta);
+            // Only classify here, the aggregators run on their stream's worker
+            demux.dispatch(packet.Data, meta);
+        };
 
         IRtlDevice *current_device = rtl_devices.at(fd).get();
 
@@ -213,34 +428,12 @@ int WfbngLink::run(JNIEnv *env, jobject context, jint wifiChannel, jint bw, jint
             .ChannelWidth = bandWidth,
         });
 
-        if (!usb_tx_thread) {
-            std::shared_ptr<TxArgs> args = std::make_shared<TxArgs>();
-            args->udp_port = 8001;
-            args->link_id = link_id;
-            args->keypair = keyPath;
-            args->stbc = stbc_enabled;
-            args->ldpc = ldpc_enabled;
-            args->mcs_index = 0;
-            args->vht_mode = false;
-            args->short_gi = false;
-            args->bandwidth = 20;
-            args->k = 1;
-            args->n = 5;
-            args->radio_port = wfb_tx_port;
-
-            __android_log_print(
-                ANDROID_LOG_ERROR, TAG, "radio link ID %d, radio PORT %d", args->link_id, args->radio_port);
-
-            init_thread(usb_tx_thread, [&]() {
-                return std::make_unique<std::thread>([this, current_device, args] {
-                    txFrame->run(current_device, args.get());
-                    __android_log_print(ANDROID_LOG_DEBUG, TAG, "usb_transfer thread should terminate");
-                });
-            });
-
-            if (adaptive_link_enabled) {
-                stop_adaptive_link();
-                start_link_quality_thread(fd);
+        {
+            // The first adapter up transmits, the others only receive until it goes away
+            std::lock_guard<std::recursive_mutex> lock(thread_mutex);
+            tx_devices[fd] = current_device;
+            if (!usb_tx_thread) {
+                startTx(fd, current_device);
             }
         }
 
@@ -249,10 +442,8 @@ int WfbngLink::run(JNIEnv *env, jobject context, jint wifiChannel, jint bw, jint
         current_device->StartRxLoop(packetProcessor);
     } catch (const std::runtime_error &error) {
         __android_log_print(ANDROID_LOG_ERROR, TAG, "runtime_error: %s", error.what());
-        txFrame->stop();
-
-        destroy_thread(usb_tx_thread);
-        stop_adaptive_link();
+        releaseAdapterIndex(fd);
+        releaseTx(fd);
         auto dev = rtl_devices.at(fd).get();
         if (dev) {
             dev->Stop();
@@ -263,10 +454,8 @@ int WfbngLink::run(JNIEnv *env, jobject context, jint wifiChannel, jint bw, jint
     }
 
     __android_log_print(ANDROID_LOG_DEBUG, TAG, "RX loop exited, releasing...");
-    txFrame->stop();
-
-    destroy_thread(usb_tx_thread);
-    stop_adaptive_link();
+    releaseAdapterIndex(fd);
+    releaseTx(fd);
 
     // Clean shutdown: halt TRX DMA and power the chip down before releasing
     // the USB interface.
@@ -281,6 +470,65 @@ int WfbngLink::run(JNIEnv *env, jobject context, jint wifiChannel, jint bw, jint
     return 0;
 }
 
+void WfbngLink::startTx(int fd, IRtlDevice *device) {
+    std::shared_ptr<TxArgs> args;
+    {
+        std::lock_guard<std::mutex> lock(uplink_mutex);
+        args = std::make_shared<TxArgs>(uplink_config);
+    }
+    args->udp_port = 8001;
+    args->link_id = link_id;
+    args->keypair = keyPath;
+    args->radio_port = wfb_tx_port;
+    args->usb_inflight = usb_tx_inflight;
+    args->usb_burst = usb_tx_burst;
+    args->fec_pipeline = tx_fec_pipeline;
+
+    __android_log_print(ANDROID_LOG_ERROR,
+                        TAG,
+                        "radio link ID %d, radio PORT %d, TX on fd=%d",
+                        args->link_id,
+                        args->radio_port,
+                        fd);
+
+    // The thread keeps its own reference, txFrame may be replaced under it
+    auto tx = std::make_shared<TxFrame>();
+    std::atomic_store(&txFrame, tx);
+    current_fd = fd;
+    init_thread(usb_tx_thread, [&]() {
+        return std::make_unique<std::thread>([tx, device, args] {
+            tx->run(device, args.get());
+            __android_log_print(ANDROID_LOG_DEBUG, TAG, "usb_transfer thread should terminate");
+        });
+    });
+
+    if (adaptive_link_enabled) {
+        stop_adaptive_link();
+        start_link_quality_thread(fd);
+    }
+}
+
+void WfbngLink::releaseTx(int fd) {
+    std::lock_guard<std::recursive_mutex> lock(thread_mutex);
+    tx_devices.erase(fd);
+    if (fd != current_fd) {
+        return;
+    }
+    if (auto tx = std::atomic_load(&txFrame)) {
+        tx->stop();
+    }
+    destroy_thread(usb_tx_thread);
+    stop_adaptive_link();
+    std::atomic_store(&txFrame, std::shared_ptr<TxFrame>());
+    current_fd = -1;
+
+    if (!tx_devices.empty()) {
+        const auto [next_fd, device] = *tx_devices.begin();
+        __android_log_print(ANDROID_LOG_DEBUG, TAG, "TX moves from fd=%d to fd=%d", fd, next_fd);
+        startTx(next_fd, device);
+    }
+}
+
 void WfbngLink::stop(JNIEnv *env, jobject context, jint fd) {
     if (rtl_devices.find(fd) == rtl_devices.end()) {
         __android_log_print(ANDROID_LOG_ERROR, TAG, "rtl_devices.find(%d) == rtl_devices.end()", fd);
@@ -293,7 +541,11 @@ void WfbngLink::stop(JNIEnv *env, jobject context, jint fd) {
     } else {
         __android_log_print(ANDROID_LOG_ERROR, TAG, "rtl_devices.at(%d) is nullptr", fd);
     }
-    stop_adaptive_link();
+    // Another adapter's adaptive link keeps running, the RX thread of this one hands TX over when it exits
+    std::lock_guard<std::recursive_mutex> lock(thread_mutex);
+    if (fd == current_fd) {
+        stop_adaptive_link();
+    }
 }
 
 //--------------------------------------JAVA bindings--------------------------------------
@@ -343,15 +595,10 @@ extern "C" JNIEXPORT void JNICALL Java_com_openipc_wfbngrtl8812_WfbNgLink_native
 extern "C" JNIEXPORT void JNICALL Java_com_openipc_wfbngrtl8812_WfbNgLink_nativeStartAdaptivelink(JNIEnv *env,
                                                                                                   jclass clazz,
                                                                                                   jlong wfbngLinkN) {
-    if (native(wfbngLinkN)->video_aggregator == nullptr) {
+    auto video = native(wfbngLinkN)->videoStream();
+    if (video == nullptr) {
         return;
     }
-    auto aggregator = native(wfbngLinkN)->video_aggregator.get();
-}
-
-extern "C" JNIEXPORT jint JNICALL Java_com_openipc_pixelpilot_UsbSerialService_nativeGetSignalQuality(JNIEnv *env,
-                                                                                                      jclass clazz) {
-    return SignalQualityCalculator::get_instance().calculate_signal_quality().quality;
 }
 
 extern "C" JNIEXPORT void JNICALL Java_com_openipc_wfbngrtl8812_WfbNgLink_nativeStop(
@@ -359,60 +606,148 @@ extern "C" JNIEXPORT void JNICALL Java_com_openipc_wfbngrtl8812_WfbNgLink_native
     native(wfbngLinkN)->stop(env, androidContext, fd);
 }
 
-float map_range(float value, float inputMin, float inputMax, float outputMin, float outputMax) {
-    return outputMin + ((value - inputMin) * (outputMax - outputMin) / (inputMax - inputMin));
+extern "C" JNIEXPORT jobject JNICALL Java_com_openipc_wfbngrtl8812_WfbNgLink_nativeGetTelemetry(JNIEnv *env,
+                                                                                               jclass clazz,
+                                                                                               jlong wfbngLinkN) {
+    auto &telemetry = native(wfbngLinkN)->telemetry;
+    return env->NewDirectByteBuffer(telemetry.data(), telemetry.size());
 }
 
-extern "C" JNIEXPORT void JNICALL Java_com_openipc_wfbngrtl8812_WfbNgLink_nativeCallBack(JNIEnv *env,
-                                                                                         jclass clazz,
-                                                                                         jobject wfbStatChangedI,
-                                                                                         jlong wfbngLinkN) {
-    if (native(wfbngLinkN)->video_aggregator == nullptr) {
-        return;
+extern "C" JNIEXPORT void JNICALL Java_com_openipc_wfbngrtl8812_WfbNgLink_nativeRefreshKey(JNIEnv *env,
+                                                                                           jclass clazz,
+                                                                                           jlong wfbngLinkN) {
+    native(wfbngLinkN)->initAgg();
+}
+
+extern "C" JNIEXPORT void JNICALL Java_com_openipc_wfbngrtl8812_WfbNgLink_nativeSetVideoSink(
+    JNIEnv *env, jclass clazz, jlong wfbngLinkN, jlong fn, jlong ctx) {
+    native(wfbngLinkN)->setVideoSink(reinterpret_cast<InProcessPushFn>(fn), reinterpret_cast<void *>(ctx));
+}
+
+extern "C" JNIEXPORT jlong JNICALL Java_com_openipc_wfbngrtl8812_WfbNgLink_nativeGetKeyframeRequestFn(JNIEnv *env,
+                                                                                                    jclass clazz) {
+    return reinterpret_cast<jlong>(&WfbngLink::keyframeRequestTrampoline);
+}
+
+extern "C" JNIEXPORT void JNICALL Java_com_openipc_wfbngrtl8812_WfbNgLink_nativeSetRxWorkerPriority(
+    JNIEnv *env, jclass clazz, jlong wfbngLinkN, jint videoNice, jint otherNice) {
+    native(wfbngLinkN)->setRxWorkerPriority(videoNice, otherNice);
+}
+
+// The channel id only has 8 bits for the port, a larger one would alias another stream
+static bool checkRadioPort(JNIEnv *env, jint radio_port) {
+    if (radio_port >= 0 && radio_port <= UINT8_MAX) {
+        return true;
     }
-    auto aggregator = native(wfbngLinkN)->video_aggregator.get();
-    jclass jClassExtendsIWfbStatChangedI = env->GetObjectClass(wfbStatChangedI);
-    jclass jcStats = env->FindClass("com/openipc/wfbngrtl8812/WfbNGStats");
-    if (jcStats == nullptr) {
+    char message[48];
+    snprintf(message, sizeof(message), "radio port %d not in 0..255", radio_port);
+    env->ThrowNew(env->FindClass("java/lang/IllegalArgumentException"), message);
+    return false;
+}
+
+extern "C" JNIEXPORT void JNICALL Java_com_openipc_wfbngrtl8812_WfbNgLink_nativeAddUdpRxStream(
+    JNIEnv *env, jclass clazz, jlong wfbngLinkN, jint radioPort, jstring host, jint port) {
+    if (!checkRadioPort(env, radioPort)) {
         return;
     }
-    jmethodID jcStatsConstructor = env->GetMethodID(jcStats, "<init>", "(IIIIIIIII)V");
-    if (jcStatsConstructor == nullptr) {
+    const char *host_chars = env->GetStringUTFChars(host, nullptr);
+    auto sink = std::make_shared<UdpPacketSink>(host_chars, port);
+    env->ReleaseStringUTFChars(host, host_chars);
+    native(wfbngLinkN)->addRxStream(radioPort, sink);
+}
+
+extern "C" JNIEXPORT void JNICALL Java_com_openipc_wfbngrtl8812_WfbNgLink_nativeAddUdsRxStream(
+    JNIEnv *env, jclass clazz, jlong wfbngLinkN, jint radioPort, jstring path) {
+    if (!checkRadioPort(env, radioPort)) {
         return;
     }
-    SignalQualityCalculator::get_instance().add_fec_data(
-        aggregator->count_p_all, aggregator->count_p_fec_recovered, aggregator->count_p_lost);
-
-    auto quality = SignalQualityCalculator::get_instance().calculate_signal_quality();
-    uint32_t avg_rssi_int = round(map_range(quality.quality, -1024.f, 1024.f, 0.f, 100.f));
-
-    auto stats = env->NewObject(jcStats,
-                                jcStatsConstructor,
-                                (jint)aggregator->count_p_all,
-                                (jint)aggregator->count_p_dec_err,
-                                (jint)(aggregator->count_p_all - aggregator->count_p_dec_err),
-                                (jint)aggregator->count_p_fec_recovered,
-                                (jint)aggregator->count_p_lost,
-                                (jint)aggregator->count_p_bad,
-                                (jint)aggregator->count_p_override,
-                                (jint)aggregator->count_p_outgoing,
-                                (jint)avg_rssi_int);
-    if (stats == nullptr) {
+    const char *path_chars = env->GetStringUTFChars(path, nullptr);
+    auto sink = std::make_shared<UdsPacketSink>(path_chars);
+    env->ReleaseStringUTFChars(path, path_chars);
+    native(wfbngLinkN)->addRxStream(radioPort, sink);
+}
+
+extern "C" JNIEXPORT void JNICALL Java_com_openipc_wfbngrtl8812_WfbNgLink_nativeAddInProcessRxStream(
+    JNIEnv *env, jclass clazz, jlong wfbngLinkN, jint radioPort, jlong fn, jlong ctx) {
+    if (!checkRadioPort(env, radioPort) || fn == 0 || ctx == 0) {
         return;
     }
-    jmethodID onStatsChanged = env->GetMethodID(
-        jClassExtendsIWfbStatChangedI, "onWfbNgStatsChanged", "(Lcom/openipc/wfbngrtl8812/WfbNGStats;)V");
-    if (onStatsChanged == nullptr) {
-        return;
+    native(wfbngLinkN)->addRxStream(
+        radioPort,
+        std::make_shared<InProcessPacketSink>(reinterpret_cast<InProcessPushFn>(fn), reinterpret_cast<void *>(ctx)));
+}
+
+extern "C" JNIEXPORT jboolean JNICALL Java_com_openipc_wfbngrtl8812_WfbNgLink_nativeRemoveRxStream(JNIEnv *env,
+                                                                                                   jclass clazz,
+                                                                                                   jlong wfbngLinkN,
+                                                                                                   jint radioPort) {
+    if (!checkRadioPort(env, radioPort)) {
+        return false;
     }
-    env->CallVoidMethod(wfbStatChangedI, onStatsChanged, stats);
-    native(wfbngLinkN)->should_clear_stats = true;
+    return native(wfbngLinkN)->removeRxStream(radioPort);
 }
 
-extern "C" JNIEXPORT void JNICALL Java_com_openipc_wfbngrtl8812_WfbNgLink_nativeRefreshKey(JNIEnv *env,
-                                                                                           jclass clazz,
-                                                                                           jlong wfbngLinkN) {
-    native(wfbngLinkN)->initAgg();
+extern "C" JNIEXPORT jboolean JNICALL Java_com_openipc_wfbngrtl8812_WfbNgLink_nativeStartCapture(JNIEnv *env,
+                                                                                                 jclass clazz,
+                                                                                                 jlong wfbngLinkN,
+                                                                                                 jstring path) {
+    const char *path_chars = env->GetStringUTFChars(path, nullptr);
+    const bool ok = native(wfbngLinkN)->capture.start(path_chars);
+    env->ReleaseStringUTFChars(path, path_chars);
+    return ok;
+}
+
+extern "C" JNIEXPORT void JNICALL Java_com_openipc_wfbngrtl8812_WfbNgLink_nativeStopCapture(JNIEnv *env,
+                                                                                            jclass clazz,
+                                                                                            jlong wfbngLinkN) {
+    native(wfbngLinkN)->capture.stop();
+}
+
+extern "C" JNIEXPORT jintArray JNICALL Java_com_openipc_wfbngrtl8812_WfbNgLink_nativeGetAdapterStats(JNIEnv *env,
+                                                                                                    jclass clazz,
+                                                                                                    jlong wfbngLinkN) {
+    const std::vector<int> stats = native(wfbngLinkN)->getAdapterStats();
+    jintArray result = env->NewIntArray(stats.size());
+    if (result != nullptr) {
+        env->SetIntArrayRegion(result, 0, stats.size(), stats.data());
+    }
+    return result;
+}
+
+extern "C" JNIEXPORT jintArray JNICALL Java_com_openipc_wfbngrtl8812_WfbNgLink_nativeGetChainStats(JNIEnv *env,
+                                                                                                 jclass clazz,
+                                                                                                 jlong wfbngLinkN) {
+    const std::vector<int> stats = native(wfbngLinkN)->getChainStats();
+    jintArray result = env->NewIntArray(stats.size());
+    if (result != nullptr) {
+        env->SetIntArrayRegion(result, 0, stats.size(), stats.data());
+    }
+    return result;
+}
+
+extern "C" JNIEXPORT jintArray JNICALL Java_com_openipc_wfbngrtl8812_WfbNgLink_nativeGetChainHistogram(
+    JNIEnv *env, jclass clazz, jlong wfbngLinkN, jint adapter, jint chain, jint metric) {
+    if (adapter < 0 || chain < 0 || metric < 0 || metric >= SignalQualityCalculator::METRIC_COUNT) {
+        return env->NewIntArray(0);
+    }
+    const auto bins = native(wfbngLinkN)->signal_quality.histogram(
+        adapter, chain, static_cast<SignalQualityCalculator::Metric>(metric));
+    jintArray result = env->NewIntArray(bins.size());
+    if (result != nullptr) {
+        env->SetIntArrayRegion(result, 0, bins.size(), reinterpret_cast<const jint *>(bins.data()));
+    }
+    return result;
+}
+
+extern "C" JNIEXPORT jintArray JNICALL Java_com_openipc_wfbngrtl8812_WfbNgLink_nativeGetRxQueueStats(JNIEnv *env,
+                                                                                                    jclass clazz,
+                                                                                                    jlong wfbngLinkN) {
+    const std::vector<int> stats = native(wfbngLinkN)->getRxQueueStats();
+    jintArray result = env->NewIntArray(stats.size());
+    if (result != nullptr) {
+        env->SetIntArrayRegion(result, 0, stats.size(), stats.data());
+    }
+    return result;
 }
 
 // Modified start_link_quality_thread: use adaptive_link_enabled and adaptive_tx_power
@@ -440,7 +775,7 @@ void WfbngLink::start_link_quality_thread(int fd) {
         }
 
         while (!this->adaptive_link_should_stop) {
-            auto quality = SignalQualityCalculator::get_instance().calculate_signal_quality();
+            auto quality = signal_quality.calculate_signal_quality();
 #if defined(ANDROID_DEBUG_RSSI) || true
             __android_log_print(ANDROID_LOG_WARN, TAG, "quality %d", quality.quality);
 #endif
@@ -452,6 +787,7 @@ void WfbngLink::start_link_quality_thread(int fd) {
             // map to 1000..2000
             quality.quality = map_range(quality.quality, -1024, 1024, 1000, 2000);
             {
+                TRACE_SCOPE_ARG("adaptive_link", quality.quality);
                 uint32_t len;
                 char message[100];
 
@@ -514,7 +850,11 @@ void WfbngLink::start_link_quality_thread(int fd) {
                     break;
                 }
             }
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            std::unique_lock<std::mutex> wake_lock(idr_wake_mutex);
+            idr_wake.wait_for(wake_lock, std::chrono::milliseconds(100), [this] {
+                return idr_wake_pending || adaptive_link_should_stop;
+            });
+            idr_wake_pending = false;
         }
         close(sockfd);
         this->adaptive_link_should_stop = false;
@@ -577,7 +917,7 @@ extern "C" JNIEXPORT void JNICALL Java_com_openipc_wfbngrtl8812_WfbNgLink_native
                                                                                            jlong wfbngLinkN,
                                                                                            jint use) {
     WfbngLink *link = native(wfbngLinkN);
-    link->ldpc_enabled = (use != 0);
+    link->setUplinkLdpc(use != 0);
 }
 
 extern "C" JNIEXPORT void JNICALL Java_com_openipc_wfbngrtl8812_WfbNgLink_nativeSetUseStbc(JNIEnv *env,
@@ -585,7 +925,54 @@ extern "C" JNIEXPORT void JNICALL Java_com_openipc_wfbngrtl8812_WfbNgLink_native
                                                                                            jlong wfbngLinkN,
                                                                                            jint use) {
     WfbngLink *link = native(wfbngLinkN);
-    link->stbc_enabled = (use != 0);
+    link->setUplinkStbc(use != 0);
+}
+
+extern "C" JNIEXPORT jboolean JNICALL Java_com_openipc_wfbngrtl8812_WfbNgLink_nativeSetUplinkConfig(JNIEnv *env,
+                                                                                                   jclass clazz,
+                                                                                                   jlong wfbngLinkN,
+                                                                                                   jint k,
+                                                                                                   jint n,
+                                                                                                   jint mcs,
+                                                                                                   jint bandwidth,
+                                                                                                   jboolean shortGi) {
+    try {
+        native(wfbngLinkN)->setUplinkConfig(k, n, mcs, bandwidth, shortGi);
+        return true;
+    } catch (const std::runtime_error &error) {
+        __android_log_print(ANDROID_LOG_ERROR, TAG, "setUplinkConfig: %s", error.what());
+        return false;
+    }
+}
+
+extern "C" JNIEXPORT void JNICALL Java_com_openipc_wfbngrtl8812_WfbNgLink_nativeSetUsbTxQueue(
+    JNIEnv *env, jclass clazz, jlong wfbngLinkN, jint inflight, jboolean burst) {
+    WfbngLink *link = native(wfbngLinkN);
+    // Nothing shows devourer's send_packet is safe from several threads, and parallel transfers can reach the air
+    // out of order. One transfer at a time until both are settled.
+    if (inflight > 1) {
+        __android_log_print(ANDROID_LOG_WARN, TAG, "USB TX: %d transfers in flight requested, using 1", (int)inflight);
+    }
+    link->usb_tx_inflight = 1;
+    link->usb_tx_burst = burst;
+}
+
+extern "C" JNIEXPORT void JNICALL Java_com_openipc_wfbngrtl8812_WfbNgLink_nativeSetTxFecPipeline(JNIEnv *env,
+                                                                                                 jclass clazz,
+                                                                                                 jlong wfbngLinkN,
+                                                                                                 jboolean enable) {
+    native(wfbngLinkN)->tx_fec_pipeline = enable;
+}
+
+extern "C" JNIEXPORT jintArray JNICALL Java_com_openipc_wfbngrtl8812_WfbNgLink_nativeGetUsbTxStats(JNIEnv *env,
+                                                                                                  jclass clazz,
+                                                                                                  jlong wfbngLinkN) {
+    const std::vector<int> stats = native(wfbngLinkN)->getUsbTxStats();
+    jintArray result = env->NewIntArray(stats.size());
+    if (result != nullptr) {
+        env->SetIntArrayRegion(result, 0, stats.size(), stats.data());
+    }
+    return result;
 }
 
 extern "C" JNIEXPORT void JNICALL Java_com_openipc_wfbngrtl8812_WfbNgLink_nativeSetFecThresholds(
@@ -597,4 +984,15 @@ extern "C" JNIEXPORT void JNICALL Java_com_openipc_wfbngrtl8812_WfbNgLink_native
     link->fec_recovered_to_3 = recTo3;
     link->fec_recovered_to_2 = recTo2;
     link->fec_recovered_to_1 = recTo1;
-}
\ No newline at end of file
+}
+
+extern "C" JNIEXPORT void JNICALL Java_com_openipc_wfbngrtl8812_WfbNgLink_nativeWriteTraceEvents(JNIEnv *env,
+                                                                                                jclass clazz,
+                                                                                                jint fd) {
+    trace::writeEvents(fd);
+}
+
+extern "C" JNIEXPORT void JNICALL Java_com_openipc_wfbngrtl8812_WfbNgLink_nativeSetTraceAnomalyListener(
+    JNIEnv *env, jclass clazz, jobject listener) {
+    trace::setAnomalyListener(env, listener);
+}
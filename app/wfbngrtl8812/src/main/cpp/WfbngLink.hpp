@@ -2,7 +2,11 @@
 #define FPV_VR_WFBNG_LINK_H
 
 #include "FecChangeController.h"
+#include "PacketSink.h"
+#include "RxCapture.h"
+#include "RxDemux.h"
 #include "SignalQualityCalculator.h"
+#include "TelemetryBlock.h"
 #include "TxFrame.h"
 
 extern "C" {
@@ -12,6 +16,8 @@ extern "C" {
 #include "devourer/src/IRtlDevice.h"
 #include "devourer/src/WiFiDriver.h"
 #include "wfb-ng/src/rx.hpp"
+#include <atomic>
+#include <condition_variable>
 #include <cstdint>
 #include <functional>
 #include <jni.h>
@@ -24,6 +30,29 @@ extern "C" {
 const uint8_t wfb_tx_port = 160;
 const uint8_t wfb_rx_port = 32;
 
+/**
+ * Link statistics shared with Java (WfbNgTelemetry.java mirrors the offsets). Counters are totals of the video
+ * aggregator since the link was created, readers take the difference between two snapshots.
+ */
+struct LinkTelemetry {
+    static constexpr uint16_t kVersion = 1;
+
+    int64_t publish_ms; ///< steady clock
+    uint64_t p_all;
+    uint64_t p_dec_err;
+    uint64_t p_fec_recovered;
+    uint64_t p_lost;
+    uint64_t p_bad;
+    uint64_t p_override;
+    uint64_t p_outgoing;
+    int32_t link_quality; ///< 0..100
+    int32_t lost_last_second;
+    int32_t recovered_last_second;
+    float rssi; ///< best chain average over the last second
+    float snr;  ///< best chain average over the last second
+    int32_t chains; ///< chains that received in the last second
+};
+
 class WfbngLink {
   public:
     // FEC switching thresholds (for menu)
@@ -33,34 +62,105 @@ class WfbngLink {
     int fec_recovered_to_2 = 14;
     int fec_recovered_to_1 = 8;
     WfbngLink(JNIEnv *env, jobject context);
+    ~WfbngLink();
 
     int run(JNIEnv *env, jobject androidContext, jint wifiChannel, jint bw, jint fd);
 
     void initAgg();
 
+    /**
+     * Queue depth, high water mark since the last call, drops and processed frames of every RX stream,
+     * 5 ints per stream: radio port, depth, high water, dropped, processed.
+     */
+    std::vector<int> getRxQueueStats();
+
+    /**
+     * Reception of the video stream per USB adapter since the last call, 6 ints per adapter:
+     * adapter index, packets received, received first, duplicates, loss in permille, average RSSI of the best chain.
+     */
+    std::vector<int> getAdapterStats();
+
+    /**
+     * Video reception per chain (antenna path of an adapter) over the last second, 25 ints per chain: adapter index,
+     * antenna, packets, delivery ratio in permille, then for RSSI, SNR and noise each: samples, average in tenths,
+     * min, p10, p50, p90, max.
+     */
+    std::vector<int> getChainStats();
+
+    /**
+     * Uplink USB TX queue, 9 ints, empty while no TX runs: queue depth, high water mark since the last call,
+     * transfers in flight, submitted, completed, failed, dropped, average and max completion latency in us since
+     * the last call.
+     */
+    std::vector<int> getUsbTxStats();
+
+    /**
+     * Receive the stream of @p radio_port (this link's id) into @p sink. An already registered port only gets
+     * the new sink and keeps its session.
+     */
+    void addRxStream(uint8_t radio_port, std::shared_ptr<PacketSink> sink);
+
+    /// @return False if @p radio_port was not registered.
+    bool removeRxStream(uint8_t radio_port);
+
+    /// Nice values of the video worker and of all other stream workers, also used for streams added later.
+    void setRxWorkerPriority(int video_nice, int other_nice);
+
+    /**
+     * Route video either to the in-process consumer (fn, ctx) or, with fn == nullptr, back to UDP 127.0.0.1:5600.
+     * Takes effect on the next packet, the running session is kept.
+     */
+    void setVideoSink(InProcessPushFn fn, void *ctx);
+
+    /**
+     * Ask the camera for a keyframe now: a new IDR request code goes out with the next adaptive link message, and
+     * the link quality thread sends that right away instead of at its next 100 ms tick. Without adaptive link the
+     * code only goes out once it is enabled. Any thread.
+     */
+    void requestKeyframe();
+
+    /// requestKeyframe() of the WfbngLink @p ctx, handed to the video player like InProcessPushFn. Does nothing once
+    /// that link is destroyed.
+    static void keyframeRequestTrampoline(void *ctx);
+
     void stop(JNIEnv *env, jobject androidContext, jint fd);
 
-    std::mutex agg_mutex;
-    std::unique_ptr<AggregatorUDPv4> video_aggregator;
-    std::unique_ptr<AggregatorUDPv4> mavlink_aggregator;
-    std::unique_ptr<AggregatorUDPv4> udp_aggregator;
+    /// Video stream or nullptr if it was removed.
+    std::shared_ptr<RxStream> videoStream() const { return rx_demux.find(channelId(video_radio_port)); }
+
+    RxDemux rx_demux;
+    /// Raw frames of all adapters to pcap, for replay on a host (see host/rx_replay.cpp).
+    RxCapture capture;
 
     void start_link_quality_thread(int fd);
 
     // adaptive link
     // TODO: move this to private section
+    /// Adapter that runs TX and the adaptive link, -1 while none does.
     int current_fd;
     bool adaptive_link_enabled;
     bool adaptive_link_should_stop{false};
     int adaptive_tx_power;
 
-    // Runtime configurable PHY parameters
-    bool ldpc_enabled{true};
-    bool stbc_enabled{true};
+    /**
+     * Uplink FEC k/n, MCS, bandwidth (20/40, VHT from 80) and short GI. A running TX switches at its next FEC
+     * block without restarting, otherwise the config is used when the TX thread starts. Throws
+     * std::runtime_error on values the uplink cannot use, nothing is changed then.
+     * @return True if a running TX took the config.
+     */
+    bool setUplinkConfig(int k, int n, int mcs, int bandwidth, bool short_gi);
+    bool setUplinkLdpc(bool enable);
+    bool setUplinkStbc(bool enable);
+
+    // USB TX queue, applied when the TX thread starts. One transfer in flight, see nativeSetUsbTxQueue
+    int usb_tx_inflight{1};
+    bool usb_tx_burst{false};
+    bool tx_fec_pipeline{false};
 
     std::map<int, std::shared_ptr<IRtlDevice>> rtl_devices;
     std::unique_ptr<std::thread> link_quality_thread{nullptr};
-    bool should_clear_stats{false};
+    SignalQualityCalculator signal_quality;
+    TelemetryBlock<LinkTelemetry> telemetry{LinkTelemetry::kVersion};
     FecChangeController fec;
 
     void init_thread(std::unique_ptr<std::thread> &thread,
@@ -82,7 +182,11 @@ class WfbngLink {
         std::unique_lock<std::recursive_mutex> lock(thread_mutex);
 
         if (!link_quality_thread) return;
-        this->adaptive_link_should_stop = true;
+        {
+            std::lock_guard<std::mutex> wake_lock(idr_wake_mutex);
+            this->adaptive_link_should_stop = true;
+        }
+        idr_wake.notify_all();
         destroy_thread(link_quality_thread);
     }
 
@@ -97,16 +201,46 @@ class WfbngLink {
 
     const char *keyPath = "/data/user/0/com.openipc.pixelpilot/files/gs.key";
     std::recursive_mutex thread_mutex;
+    /// Wakes the link quality thread early for a keyframe request.
+    std::mutex idr_wake_mutex;
+    std::condition_variable idr_wake;
+    bool idr_wake_pending{false};
     std::unique_ptr<WiFiDriver> wifi_driver;
+    /// Of the TX thread, replaced when TX moves to another adapter.
     std::shared_ptr<TxFrame> txFrame;
-    uint32_t video_channel_id_be;
-    uint32_t mavlink_channel_id_be;
-    uint32_t udp_channel_id_be;
+    /// Adapters up for TX (past InitWrite) by fd. Guarded by thread_mutex.
+    std::map<int, IRtlDevice *> tx_devices;
+    /// Starts the TX thread and the adaptive link on adapter @p fd. Caller holds thread_mutex.
+    void startTx(int fd, IRtlDevice *device);
+    /// Ends TX if adapter @p fd runs it, another adapter that is still up takes over.
+    void releaseTx(int fd);
+    /// Lowest index no other running adapter uses, for the wlan_idx of its frames.
+    uint8_t acquireAdapterIndex(int fd);
+    void releaseAdapterIndex(int fd);
+
+    uint32_t channelId(uint8_t radio_port) const { return (link_id << 8) + radio_port; }
+
+    const uint8_t video_radio_port{0};
+    std::atomic<int> video_nice{-16};
+    std::atomic<int> other_nice{0};
+    std::mutex adapter_mutex;
+    std::map<int, uint8_t> adapter_indices;
+
+    /// Copies the uplink config, changes it, validates it and hands it to the running TX.
+    bool updateUplinkConfig(const std::function<void(TxArgs &)> &change);
+
+    std::mutex uplink_mutex;
+    TxArgs uplink_config;
+
+    /// Moves the aggregator counters into the totals and publishes them with the signal quality.
+    void publishTelemetry();
+
+    std::atomic<bool> telemetry_should_stop{false};
+    std::thread telemetry_thread;
 
     Logger_t log;
     std::unique_ptr<std::thread> usb_tx_thread{nullptr};
     uint32_t link_id{7669206};
-    SignalQualityCalculator rssi_calculator;
 };
 
 #endif // FPV_VR_WFBNG_LINK_H
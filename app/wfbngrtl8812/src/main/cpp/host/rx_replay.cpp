@@ -0,0 +1,296 @@
+// Replays pcap captures (WfbNgLink.startCapture() or any radiotap capture) through the same RX path the app
+// runs: RxFrame validation, channel demux, the stream worker with duplicate suppression and the wfb-ng
+// aggregator. Every file stands for one adapter, so two captures of the same flight replay diversity reception.
+//
+//   rx_replay [-k gs.key] [-l link_id] [-p radio_port] [-s speed | -m] [-o host:port] capture.pcap...
+//
+//   -s speed   replay at speed x the recorded pace (default 1)
+//   -m         as fast as possible, frames are never dropped
+//   -o         forward the reassembled packets, e.g. to a desktop video player
+
+#include "PacketSink.h"
+#include "RxCapture.h"
+#include "RxDemux.h"
+#include "SignalQualityCalculator.h"
+
+#include <pcap.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+constexpr size_t kFcsSize = 4;
+
+int64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+/**
+ * Measures what comes out of the aggregator. The stream hook marks when the worker picked up a frame, send()
+ * runs synchronously inside process_packet() on the same thread.
+ */
+class MeasuringSink : public PacketSink {
+  public:
+    explicit MeasuringSink(std::shared_ptr<PacketSink> forward) : forward_(std::move(forward)) {}
+
+    void onFrame(const RxQueuedFrame &frame) {
+        frame_queued_ns_ = frame.meta.timestamp_ns;
+        frame_start_ns_ = nowNs();
+    }
+
+    void send(const uint8_t *data, size_t size, const PacketTiming &timing) override {
+        const int64_t now = nowNs();
+        latency_ns_.push_back(now - frame_queued_ns_);
+        decode_ns_.push_back(now - frame_start_ns_);
+        bytes_ += size;
+        if (forward_) {
+            forward_->send(data, size, timing);
+        }
+    }
+
+    size_t packets() const { return latency_ns_.size(); }
+    uint64_t bytes() const { return bytes_; }
+    std::vector<int64_t> &latencies() { return latency_ns_; }
+    std::vector<int64_t> &decodeTimes() { return decode_ns_; }
+
+  private:
+    std::shared_ptr<PacketSink> forward_;
+    int64_t frame_queued_ns_{0};
+    int64_t frame_start_ns_{0};
+    uint64_t bytes_{0};
+    std::vector<int64_t> latency_ns_;
+    std::vector<int64_t> decode_ns_;
+};
+
+struct AdapterResult {
+    size_t frames = 0;
+    size_t dispatched = 0;
+    size_t dropped = 0;
+};
+
+/// One capture file, replayed like an adapter with index @p wlan_idx.
+void replayAdapter(
+    const char *path, uint8_t wlan_idx, RxDemux &demux, double speed, int64_t start_ns, AdapterResult &result) {
+    char errbuf[PCAP_ERRBUF_SIZE];
+    pcap_t *pcap = pcap_open_offline(path, errbuf);
+    if (pcap == nullptr) {
+        fprintf(stderr, "%s: %s\n", path, errbuf);
+        return;
+    }
+    if (pcap_datalink(pcap) != DLT_IEEE802_11_RADIO) {
+        fprintf(stderr, "%s: link type %d is not 802.11 + radiotap\n", path, pcap_datalink(pcap));
+        pcap_close(pcap);
+        return;
+    }
+
+    RxDemux::View view(demux);
+    std::vector<uint8_t> frame;
+    pcap_pkthdr *hdr;
+    const u_char *data;
+    int64_t first_ts = -1;
+    while (pcap_next_ex(pcap, &hdr, &data) == 1) {
+        RxFrameMeta meta;
+        size_t header_len;
+        bool has_fcs;
+        if (!parseRadiotap(data, hdr->caplen, meta, header_len, has_fcs)) {
+            continue;
+        }
+        result.frames++;
+
+        const int64_t ts = int64_t(hdr->ts.tv_sec) * 1000000000 + int64_t(hdr->ts.tv_usec) * 1000;
+        if (first_ts < 0) {
+            first_ts = ts;
+        }
+        if (speed > 0) {
+            const int64_t due = start_ns + int64_t((ts - first_ts) / speed);
+            const int64_t wait = due - nowNs();
+            if (wait > 0) {
+                std::this_thread::sleep_for(std::chrono::nanoseconds(wait));
+            }
+        }
+
+        // The RX path expects the FCS behind the payload, like the adapter delivers it
+        frame.assign(data + header_len, data + hdr->caplen);
+        if (!has_fcs) {
+            frame.resize(frame.size() + kFcsSize);
+        }
+        meta.wlan_idx = wlan_idx;
+        meta.timestamp_ns = nowNs();
+        // The same validation and lookup as the adapter threads of the app
+        RxDemux::View::Result dispatched = view.dispatch(frame, meta);
+        while (speed <= 0 && dispatched == RxDemux::View::DROPPED) {
+            std::this_thread::yield();
+            dispatched = view.dispatch(frame, meta);
+        }
+        if (dispatched == RxDemux::View::DROPPED) {
+            result.dropped++;
+        } else if (dispatched == RxDemux::View::QUEUED) {
+            result.dispatched++;
+        }
+    }
+    pcap_close(pcap);
+}
+
+double percentileUs(std::vector<int64_t> &v, double p) {
+    if (v.empty()) {
+        return 0;
+    }
+    std::sort(v.begin(), v.end());
+    return v[size_t(p * (v.size() - 1))] / 1000.0;
+}
+
+void usage() {
+    fprintf(stderr,
+            "usage: rx_replay [-k gs.key] [-l link_id] [-p radio_port] [-s speed | -m] [-o host:port] "
+            "capture.pcap...\n");
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    std::string key = "gs.key";
+    uint32_t link_id = 7669206;
+    int radio_port = 0;
+    double speed = 1.0;
+    std::shared_ptr<PacketSink> forward;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "k:l:p:s:mo:")) != -1) {
+        switch (opt) {
+        case 'k':
+            key = optarg;
+            break;
+        case 'l':
+            link_id = strtoul(optarg, nullptr, 0);
+            break;
+        case 'p':
+            radio_port = atoi(optarg);
+            break;
+        case 's':
+            speed = atof(optarg);
+            break;
+        case 'm':
+            speed = 0;
+            break;
+        case 'o': {
+            const char *colon = strrchr(optarg, ':');
+            if (colon == nullptr) {
+                usage();
+                return 1;
+            }
+            forward = std::make_shared<UdpPacketSink>(std::string(static_cast<const char *>(optarg), colon), atoi(colon + 1));
+            break;
+        }
+        default:
+            usage();
+            return 1;
+        }
+    }
+    if (optind >= argc || radio_port < 0 || radio_port > 255) {
+        usage();
+        return 1;
+    }
+    const size_t n_adapters = std::min<size_t>(argc - optind, DiversityFilter::MAX_ADAPTERS);
+
+    auto sink = std::make_shared<MeasuringSink>(forward);
+    auto signal = std::make_shared<SignalQualityCalculator>();
+    RxDemux demux;
+    auto stream = std::make_shared<RxStream>(
+        (link_id << 8) + radio_port,
+        sink,
+        key,
+        4096,
+        0,
+        [sink, signal](RxStream &, const RxQueuedFrame &frame, bool first) {
+            sink->onFrame(frame);
+            signal->add_frame(frame.meta, first);
+        });
+    demux.add(stream);
+
+    std::vector<AdapterResult> results(n_adapters);
+    std::vector<std::thread> threads;
+    const int64_t start_ns = nowNs();
+    for (size_t i = 0; i < n_adapters; ++i) {
+        threads.emplace_back(replayAdapter, argv[optind + i], uint8_t(i), std::ref(demux), speed, start_ns,
+                             std::ref(results[i]));
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+    // Let the worker drain
+    while (stream->worker().stats().depth > 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    const double seconds = (nowNs() - start_ns) / 1e9;
+
+    auto lock = stream->worker().lock();
+    const AggregatorSink *agg = stream->aggregator();
+    size_t frames = 0;
+    for (size_t i = 0; i < n_adapters; ++i) {
+        printf("adapter %zu (%s): %zu frames, %zu dispatched, %zu dropped\n",
+               i,
+               argv[optind + i],
+               results[i].frames,
+               results[i].dispatched,
+               results[i].dropped);
+        frames += results[i].frames;
+    }
+    for (const auto &a : stream->adapterStats()) {
+        printf("adapter %d: first %llu, duplicates %llu, missed %.1f%%\n",
+               a.wlan_idx,
+               (unsigned long long)a.first,
+               (unsigned long long)a.duplicates,
+               a.loss_permille / 10.0);
+    }
+    static const char *metrics[] = {"rssi", "snr", "noise"};
+    for (const auto &chain : signal->chain_stats()) {
+        printf("adapter %d antenna %d, last second: %u packets, delivery %.1f%%\n",
+               chain.wlan_idx,
+               chain.antenna,
+               chain.packets,
+               chain.pdr * 100);
+        for (int m = 0; m < SignalQualityCalculator::METRIC_COUNT; ++m) {
+            const auto &s = chain.metrics[m];
+            if (s.count > 0) {
+                printf("  %-5s avg %.1f min %d p10 %d p50 %d p90 %d max %d\n",
+                       metrics[m],
+                       s.avg,
+                       s.min,
+                       s.p10,
+                       s.p50,
+                       s.p90,
+                       s.max);
+            }
+        }
+    }
+    printf("%.2f s, %.0f frames/s, %zu packets out (%.2f MBit/s)\n",
+           seconds,
+           frames / seconds,
+           sink->packets(),
+           sink->bytes() * 8 / seconds / 1e6);
+    printf("aggregator: all %u, fec recovered %u, lost %u, dec err %u, bad %u\n",
+           (unsigned)agg->count_p_all,
+           (unsigned)agg->count_p_fec_recovered,
+           (unsigned)agg->count_p_lost,
+           (unsigned)agg->count_p_dec_err,
+           (unsigned)agg->count_p_bad);
+    printf("decode us p50 %.1f p99 %.1f max %.1f\n",
+           percentileUs(sink->decodeTimes(), 0.5),
+           percentileUs(sink->decodeTimes(), 0.99),
+           percentileUs(sink->decodeTimes(), 1.0));
+    printf("rx->out latency us p50 %.1f p99 %.1f max %.1f\n",
+           percentileUs(sink->latencies(), 0.5),
+           percentileUs(sink->latencies(), 0.99),
+           percentileUs(sink->latencies(), 1.0));
+    return 0;
+}
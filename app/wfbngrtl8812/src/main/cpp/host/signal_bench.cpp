@@ -0,0 +1,235 @@
+// SignalQualityCalculator at the rate the video stream feeds it: every packet adds RSSI, SNR and noise of both
+// chains, the stats callback and the adaptive link thread query it a few times per second. Compares the time-bucket rings
+// with the previous mutex + vector implementation (kept here as VectorCalculator).
+//
+//   signal_bench [-r samples/s] [-t seconds] [-q queries/s]
+//
+// The simulated run feeds -t seconds of samples with synthetic timestamps as fast as possible, the paced run feeds
+// them in real time on one thread while another queries, like on the phone.
+
+#include "SignalQualityCalculator.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+int64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+/// The previous implementation: one timestamped entry per sample, expired entries erased on every query.
+class VectorCalculator {
+  public:
+    void add_frame(const RxFrameMeta &meta, bool, int64_t time_ms) {
+        {
+            std::lock_guard<std::recursive_mutex> lock(mutex_);
+            rssis_.push_back({time_ms, meta.rssi[0], meta.rssi[1]});
+        }
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+        snrs_.push_back({time_ms, meta.snr[0], meta.snr[1]});
+    }
+
+    float calculate(int64_t time_ms) {
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+        return std::max(avg(rssis_, time_ms), avg(snrs_, time_ms));
+    }
+
+  private:
+    struct Entry {
+        int64_t time_ms;
+        int ant1;
+        int ant2;
+    };
+
+    static float avg(std::vector<Entry> &entries, int64_t time_ms) {
+        entries.erase(std::remove_if(entries.begin(),
+                                     entries.end(),
+                                     [&](const Entry &e) { return e.time_ms < time_ms - 1000; }),
+                      entries.end());
+        if (entries.empty()) {
+            return 0;
+        }
+        float sum1 = 0, sum2 = 0;
+        for (const auto &e : entries) {
+            sum1 += e.ant1;
+            sum2 += e.ant2;
+        }
+        return std::max(sum1, sum2) / entries.size();
+    }
+
+    std::recursive_mutex mutex_;
+    std::vector<Entry> rssis_;
+    std::vector<Entry> snrs_;
+};
+
+/// Two adapters with two chains each, every packet arrives on both
+std::vector<RxFrameMeta> makeSamples(size_t count) {
+    std::vector<RxFrameMeta> samples(count);
+    uint32_t state = 1;
+    for (size_t i = 0; i < count; ++i) {
+        RxFrameMeta &m = samples[i];
+        state = state * 1664525 + 1013904223;
+        std::fill(std::begin(m.antenna), std::end(m.antenna), 0xff);
+        m.wlan_idx = i % 2;
+        m.antenna[0] = 0;
+        m.antenna[1] = 1;
+        m.rssi[0] = int8_t(40 + (state >> 24) % 30 - 10 * m.wlan_idx);
+        m.rssi[1] = int8_t(30 + (state >> 16) % 30);
+        m.snr[0] = int8_t(10 + (state >> 8) % 20);
+        m.snr[1] = int8_t(-5 + (state >> 4) % 20);
+        m.noise[0] = int8_t(-90 + (state >> 12) % 8);
+        m.noise[1] = int8_t(-92 + (state >> 20) % 8);
+    }
+    return samples;
+}
+
+double percentile(std::vector<int64_t> &v, double p) {
+    if (v.empty()) {
+        return 0;
+    }
+    std::sort(v.begin(), v.end());
+    return double(v[size_t(p * (v.size() - 1))]);
+}
+
+/// Feeds @p seconds of samples at @p rate with synthetic timestamps, querying @p qps times per second.
+template <typename Calc, typename Query>
+void simulated(const char *name, Calc &calc, Query query, const std::vector<RxFrameMeta> &samples, int rate, int qps) {
+    const int64_t step_us = 1000000 / rate;
+    const int64_t query_every = std::max(1, rate / qps);
+    int64_t query_ns = 0, queries = 0;
+    volatile float sink = 0;
+    // Only the queries are timed one by one, the clock would cost as much as an add
+    const int64_t start = nowNs();
+    for (size_t i = 0; i < samples.size(); ++i) {
+        const int64_t t_ms = int64_t(i) * step_us / 1000;
+        calc.add_frame(samples[i], i % 2 == 0, t_ms);
+        if (int64_t(i) % query_every == 0) {
+            const int64_t q = nowNs();
+            sink = sink + query(calc, t_ms);
+            query_ns += nowNs() - q;
+            ++queries;
+        }
+    }
+    const int64_t add_ns = nowNs() - start - query_ns;
+    printf("%-8s simulated: add %6.1f ns/sample, query %8.1f us\n",
+           name,
+           double(add_ns) / samples.size(),
+           queries ? query_ns / 1000.0 / queries : 0.0);
+}
+
+/// Real time: one thread adds at @p rate, another queries @p qps times per second.
+template <typename Calc, typename Query>
+void paced(const char *name, Calc &calc, Query query, const std::vector<RxFrameMeta> &samples, int rate, int qps) {
+    std::atomic<bool> done{false};
+    std::vector<int64_t> query_ns;
+    std::thread reader([&] {
+        volatile float sink = 0;
+        while (!done.load()) {
+            const int64_t start = nowNs();
+            sink = sink + query(calc, SignalQualityCalculator::now_ms());
+            query_ns.push_back(nowNs() - start);
+            std::this_thread::sleep_for(std::chrono::microseconds(1000000 / qps));
+        }
+    });
+
+    std::vector<int64_t> add_ns;
+    add_ns.reserve(samples.size());
+    const int64_t begin = nowNs();
+    for (size_t i = 0; i < samples.size(); ++i) {
+        const int64_t due = begin + int64_t(i) * 1000000000 / rate;
+        while (nowNs() < due) {
+            std::this_thread::yield();
+        }
+        const int64_t t_ms = SignalQualityCalculator::now_ms();
+        const int64_t start = nowNs();
+        calc.add_frame(samples[i], i % 2 == 0, t_ms);
+        add_ns.push_back(nowNs() - start);
+    }
+    done = true;
+    reader.join();
+    printf("%-8s paced:     add ns p50 %.0f p99 %.0f max %.0f, query us p50 %.1f max %.1f\n",
+           name,
+           percentile(add_ns, 0.5),
+           percentile(add_ns, 0.99),
+           percentile(add_ns, 1.0),
+           percentile(query_ns, 0.5) / 1000,
+           percentile(query_ns, 1.0) / 1000);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    int rate = 20000;
+    double seconds = 3;
+    int qps = 4;
+    int opt;
+    while ((opt = getopt(argc, argv, "r:t:q:")) != -1) {
+        switch (opt) {
+        case 'r':
+            rate = atoi(optarg);
+            break;
+        case 't':
+            seconds = atof(optarg);
+            break;
+        case 'q':
+            qps = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-r samples/s] [-t seconds] [-q queries/s]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (rate <= 0 || qps <= 0 || seconds <= 0) {
+        fprintf(stderr, "rate, queries and seconds must be positive\n");
+        return 1;
+    }
+    const std::vector<RxFrameMeta> samples = makeSamples(size_t(rate * seconds));
+    printf("%d samples/s for %.1f s, %d queries/s\n", rate, seconds, qps);
+
+    const auto bucketQuery = [](SignalQualityCalculator &calc, int64_t t_ms) {
+        return calc.calculate_signal_quality(t_ms).snr;
+    };
+    const auto vectorQuery = [](VectorCalculator &calc, int64_t t_ms) { return calc.calculate(t_ms); };
+
+    {
+        SignalQualityCalculator calc;
+        simulated("buckets", calc, bucketQuery, samples, rate, qps);
+        static const char *names[] = {"rssi", "snr", "noise"};
+        for (const auto &chain : calc.chain_stats(int64_t(seconds * 1000))) {
+            printf("  adapter %d chain %d: %u packets, pdr %.2f\n", chain.wlan_idx, chain.antenna, chain.packets, chain.pdr);
+            for (int m = 0; m < SignalQualityCalculator::METRIC_COUNT; ++m) {
+                const auto &s = chain.metrics[m];
+                printf("    %-5s avg %6.1f min %4d p10 %4d p50 %4d p90 %4d max %4d\n",
+                       names[m],
+                       s.avg,
+                       s.min,
+                       s.p10,
+                       s.p50,
+                       s.p90,
+                       s.max);
+            }
+        }
+    }
+    {
+        VectorCalculator calc;
+        simulated("vector", calc, vectorQuery, samples, rate, qps);
+    }
+    {
+        SignalQualityCalculator calc;
+        paced("buckets", calc, bucketQuery, samples, rate, qps);
+    }
+    {
+        VectorCalculator calc;
+        paced("vector", calc, vectorQuery, samples, rate, qps);
+    }
+    return 0;
+}
@@ -0,0 +1,485 @@
+// Cost of the uplink TX path: Transmitter::sendPacket through a null injectPacket, and the stages it is made of
+// measured on their own with the same primitives:
+//   packetize   memcpy of the payload + zero fill up to MAX_FEC_PAYLOAD (per data packet)
+//   fec_encode  fec_encode_simd of one block, k data -> n-k parity fragments (per block)
+//   aead        cipherBuf zero fill + crypto_aead_chacha20poly1305_encrypt (per fragment, data and parity)
+//   sendPacket  everything above plus header bookkeeping (per data packet)
+//
+// The ZFEX_* SIMD options are compile time, every variant is its own executable (tx_bench_<variant>).
+//
+//   tx_bench_<variant> [-t seconds per case] [-g min sendPacket MB/s at k=8 n=12 1400 B] [-u transfer us]
+//
+// With -g the exit code is 1 if the throughput is below the threshold, for use as a regression gate.
+// Every run first raises n of a bursting UsbTransmitter at runtime and exits with 1 if the TX path hangs.
+// With -u the UsbTransmitter queue runs against a fake device whose transfers take that long, for every
+// in-flight depth with and without FEC block bursts.
+//
+// The "close" rows compare the per-call sendPacket latency with and without Transmitter::startPipeline(); the
+// block closing call is the spike. They also check that both emit the same nonce sequence.
+
+#include "TxFrame.h"
+
+#include "sodium.h"
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#ifndef TX_BENCH_VARIANT
+#define TX_BENCH_VARIANT "default"
+#endif
+
+namespace {
+
+/**
+ * CPU cycles of this thread from the PMU, TSC ticks where perf events are not available (containers, VMs),
+ * nothing at all otherwise.
+ */
+class CycleCounter {
+  public:
+    CycleCounter() {
+        perf_event_attr attr{};
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CPU_CYCLES;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd_ = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+    ~CycleCounter() {
+        if (fd_ >= 0) {
+            close(fd_);
+        }
+    }
+
+    const char *unit() const {
+#if defined(__x86_64__) || defined(__i386__)
+        return fd_ >= 0 ? "cycles" : "tsc";
+#else
+        return fd_ >= 0 ? "cycles" : nullptr;
+#endif
+    }
+
+    uint64_t now() const {
+        uint64_t value = 0;
+        if (fd_ >= 0) {
+            if (read(fd_, &value, sizeof(value)) != sizeof(value)) {
+                return 0;
+            }
+            return value;
+        }
+#if defined(__x86_64__) || defined(__i386__)
+        value = __rdtsc();
+#endif
+        return value;
+    }
+
+  private:
+    int fd_{-1};
+};
+
+double nowSec() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/// Keeps the work of a case from being optimized away.
+volatile uint64_t g_sink;
+
+/// Counts instead of sending.
+class NullTransmitter : public Transmitter {
+  public:
+    using Transmitter::Transmitter;
+    ~NullTransmitter() override { stopPipeline(); }
+    void selectOutput(int) override {}
+    void dumpStats(FILE *, uint64_t, uint32_t &, uint32_t &, uint32_t &) override {}
+
+    uint64_t bytes = 0;
+    uint64_t nonce_hash = 14695981039346656037ull; ///< FNV-1a over the data nonces in injection order
+
+  private:
+    void injectPacket(const uint8_t *buf, size_t size) override {
+        bytes += size;
+        g_sink = buf[size - 1];
+        if (buf[0] == WFB_PACKET_DATA) {
+            for (size_t i = 1; i < sizeof(wblock_hdr_t); ++i) {
+                nonce_hash = (nonce_hash ^ buf[i]) * 1099511628211ull;
+            }
+        }
+    }
+};
+
+struct Result {
+    double ops_per_sec;
+    double bytes_per_sec;
+    double cycles_per_byte; // < 0 if no counter
+};
+
+/**
+ * Runs @p op (one operation of @p bytes_per_op bytes) in batches until @p seconds passed.
+ */
+template <typename Op> Result measure(const CycleCounter &counter, double seconds, size_t bytes_per_op, Op op) {
+    for (int i = 0; i < 16; ++i) { // warm up caches and the branch predictor
+        op();
+    }
+    uint64_t ops = 0;
+    const double start = nowSec();
+    const uint64_t start_cycles = counter.now();
+    double elapsed;
+    do {
+        for (int i = 0; i < 64; ++i) {
+            op();
+        }
+        ops += 64;
+        elapsed = nowSec() - start;
+    } while (elapsed < seconds);
+    const uint64_t cycles = counter.now() - start_cycles;
+    const double bytes = double(ops) * bytes_per_op;
+    return {ops / elapsed, bytes / elapsed, counter.unit() ? cycles / bytes : -1};
+}
+
+void print(const char *stage, int k, int n, size_t payload, const Result &r, const char *unit) {
+    printf("%-8s k=%-2d n=%-2d %4zu B  %-10s %10.0f op/s %9.1f MB/s",
+           TX_BENCH_VARIANT,
+           k,
+           n,
+           payload,
+           stage,
+           r.ops_per_sec,
+           r.bytes_per_sec / 1e6);
+    if (r.cycles_per_byte >= 0) {
+        printf("  %6.2f %s/B", r.cycles_per_byte, unit);
+    }
+    printf("\n");
+}
+
+/**
+ * sendPacket latency per call, synchronous and pipelined, over the same number of packets.
+ */
+void benchBlockClose(const std::string &keypair, double seconds) {
+    const std::vector<uint8_t> payload(1400, 0x5a);
+    const std::pair<int, int> fec_params[] = {{8, 12}, {16, 24}, {32, 48}};
+    for (const auto &[k, n] : fec_params) {
+        // Whole blocks, sized by a synchronous trial run
+        uint64_t packets = 0;
+        {
+            NullTransmitter tx(k, n, keypair, 0, 7669206 << 8);
+            const double start = nowSec();
+            while (nowSec() - start < seconds) {
+                tx.sendPacket(payload.data(), payload.size(), 0);
+                ++packets;
+            }
+            packets = std::max<uint64_t>(packets / k, 1) * k;
+        }
+        uint64_t reference_hash = 0;
+        for (const bool pipeline : {false, true}) {
+            std::vector<double> us;
+            us.reserve(packets);
+            uint64_t hash;
+            double elapsed;
+            {
+                NullTransmitter tx(k, n, keypair, 0, 7669206 << 8);
+                if (pipeline) {
+                    tx.startPipeline();
+                }
+                const double start = nowSec();
+                for (uint64_t i = 0; i < packets; ++i) {
+                    const double t = nowSec();
+                    tx.sendPacket(payload.data(), payload.size(), 0);
+                    us.push_back((nowSec() - t) * 1e6);
+                }
+                tx.stopPipeline();
+                elapsed = nowSec() - start;
+                hash = tx.nonce_hash;
+            }
+            if (!pipeline) {
+                reference_hash = hash;
+            }
+            std::sort(us.begin(), us.end());
+            printf("%-8s k=%-2d n=%-2d 1400 B  close %-9s %9.0f op/s  us/call p50 %6.1f p99 %7.1f max %7.1f%s\n",
+                   TX_BENCH_VARIANT,
+                   k,
+                   n,
+                   pipeline ? "pipelined" : "sync",
+                   packets / elapsed,
+                   us[us.size() / 2],
+                   us[us.size() * 99 / 100],
+                   us.back(),
+                   pipeline && hash != reference_hash ? "  NONCE ORDER DIFFERS" : "");
+        }
+    }
+}
+
+/**
+ * UsbTransmitter through its TX queue into a device that needs @p transfer_us per bulk transfer, k=8 n=12 1400 B.
+ */
+void benchUsbQueue(const std::string &keypair, double seconds, int transfer_us) {
+    const std::vector<uint8_t> payload(1400, 0x5a);
+    uint8_t radiotap[13] = {0, 0, 13, 0};
+
+    for (const size_t inflight : {1, 2, 4, 8}) {
+        for (const bool burst : {false, true}) {
+            std::atomic<uint64_t> frames{0};
+            uint64_t latency_avg = 0, latency_max = 0;
+            double elapsed;
+            {
+                UsbTransmitter tx(
+                    8,
+                    12,
+                    keypair,
+                    0,
+                    7669206 << 8,
+                    radiotap,
+                    sizeof(radiotap),
+                    0xb4,
+                    [&](const uint8_t *, size_t) {
+                        std::this_thread::sleep_for(std::chrono::microseconds(transfer_us));
+                        frames.fetch_add(1, std::memory_order_relaxed);
+                        return true;
+                    },
+                    inflight,
+                    burst);
+                uint64_t packets = 0;
+                const double start = nowSec();
+                do {
+                    for (int i = 0; i < 8; ++i) {
+                        tx.sendPacket(payload.data(), payload.size(), 0);
+                    }
+                    packets += 8;
+                } while (nowSec() - start < seconds);
+                // Wait for the queue to drain, then count what made it out
+                while (tx.queueStats(false).completed < packets * 12 / 8) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+                elapsed = nowSec() - start;
+                const auto stats = tx.queueStats(true);
+                latency_avg = stats.latencyAvgUs;
+                latency_max = stats.latencyMaxUs;
+            }
+            printf("usb %4d us/transfer  inflight %zu %-8s %8.0f frames/s  completion us avg %5llu max %6llu\n",
+                   transfer_us,
+                   inflight,
+                   burst ? "burst" : "",
+                   frames / elapsed,
+                   (unsigned long long)latency_avg,
+                   (unsigned long long)latency_max);
+        }
+    }
+}
+
+/**
+ * Burst mode UsbTransmitter started at k=1 n=5, then switched to k=8 n=12 between blocks. A frame pool still sized
+ * for n=5 can't hold the new blocks and sendPacket() waits forever.
+ * Exits with 1 if the blocks after the switch did not get out within 5 s.
+ */
+void checkBurstFecIncrease(const std::string &keypair) {
+    const std::vector<uint8_t> payload(1400, 0x5a);
+    uint8_t radiotap[13] = {0, 0, 13, 0};
+    std::atomic<uint64_t> frames{0};
+    UsbTransmitter tx(1,
+                      5,
+                      keypair,
+                      0,
+                      7669206 << 8,
+                      radiotap,
+                      sizeof(radiotap),
+                      0xb4,
+                      [&](const uint8_t *, size_t) {
+                          frames.fetch_add(1, std::memory_order_relaxed);
+                          return true;
+                      },
+                      1,
+                      true);
+    std::atomic<bool> done{false};
+    std::thread sender([&] {
+        for (int i = 0; i < 4; ++i) {
+            tx.sendPacket(payload.data(), payload.size(), 0);
+        }
+        tx.setLinkConfig(8, 12, {});
+        for (int i = 0; i < 8 * 4; ++i) {
+            tx.sendPacket(payload.data(), payload.size(), 0);
+        }
+        done = true;
+    });
+    const double start = nowSec();
+    while (!done && nowSec() - start < 5) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if (!done) {
+        // The sender is stuck in acquire(), neither it nor tx can be torn down
+        printf("usb burst k=1 n=5 -> k=8 n=12: HANG after %llu frames\n", (unsigned long long)frames.load());
+        fflush(stdout);
+        unlink(keypair.c_str());
+        _exit(1);
+    }
+    sender.join();
+    printf("usb burst k=1 n=5 -> k=8 n=12: ok\n");
+}
+
+std::string writeKeypair() {
+    // Transmitter reads tx secret key + rx public key
+    uint8_t tx_public[crypto_box_PUBLICKEYBYTES], tx_secret[crypto_box_SECRETKEYBYTES];
+    uint8_t rx_public[crypto_box_PUBLICKEYBYTES], rx_secret[crypto_box_SECRETKEYBYTES];
+    crypto_box_keypair(tx_public, tx_secret);
+    crypto_box_keypair(rx_public, rx_secret);
+    char path[] = "/tmp/tx_bench_keyXXXXXX";
+    const int fd = mkstemp(path);
+    if (fd < 0 || write(fd, tx_secret, sizeof(tx_secret)) != sizeof(tx_secret) ||
+        write(fd, rx_public, sizeof(rx_public)) != sizeof(rx_public)) {
+        perror("keypair");
+        exit(1);
+    }
+    close(fd);
+    return path;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    double seconds = 0.3;
+    double gate_mbps = 0;
+    int transfer_us = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:g:u:")) != -1) {
+        switch (opt) {
+        case 't':
+            seconds = atof(optarg);
+            break;
+        case 'g':
+            gate_mbps = atof(optarg);
+            break;
+        case 'u':
+            transfer_us = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-t seconds per case] [-g min MB/s] [-u transfer us]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (sodium_init() < 0) {
+        fprintf(stderr, "sodium_init failed\n");
+        return 1;
+    }
+    const std::string keypair = writeKeypair();
+    checkBurstFecIncrease(keypair);
+    if (transfer_us > 0) {
+        benchUsbQueue(keypair, seconds, transfer_us);
+        unlink(keypair.c_str());
+        return 0;
+    }
+    const CycleCounter counter;
+    const char *unit = counter.unit();
+
+    const std::pair<int, int> fec_params[] = {{1, 2}, {2, 3}, {4, 6}, {8, 12}, {12, 18}};
+    const size_t payloads[] = {200, 800, 1400, MAX_PAYLOAD_SIZE};
+    double gate_result = -1;
+
+    std::vector<uint8_t> payload(MAX_PAYLOAD_SIZE);
+    randombytes_buf(payload.data(), payload.size());
+    uint8_t key[crypto_aead_chacha20poly1305_KEYBYTES];
+    randombytes_buf(key, sizeof(key));
+
+    for (const auto &[k, n] : fec_params) {
+        fec_t *fec;
+        fec_new(k, n, &fec);
+        std::vector<std::vector<uint8_t>> block(n, std::vector<uint8_t>(MAX_FEC_PAYLOAD));
+        std::vector<const uint8_t *> data_ptrs;
+        std::vector<uint8_t *> parity_ptrs;
+        for (int i = 0; i < n; ++i) {
+            if (i < k) {
+                data_ptrs.push_back(block[i].data());
+            } else {
+                parity_ptrs.push_back(block[i].data());
+            }
+        }
+
+        for (const size_t size : payloads) {
+            const size_t fragment = sizeof(wpacket_hdr_t) + size;
+
+            print("packetize",
+                  k,
+                  n,
+                  size,
+                  measure(counter,
+                          seconds,
+                          size,
+                          [&] {
+                              uint8_t *dst = block[0].data();
+                              std::memcpy(dst + sizeof(wpacket_hdr_t), payload.data(), size);
+                              std::memset(dst + fragment, 0, MAX_FEC_PAYLOAD - fragment);
+                              g_sink = dst[fragment - 1];
+                          }),
+                  unit);
+
+            print("fec_encode",
+                  k,
+                  n,
+                  size,
+                  measure(counter,
+                          seconds,
+                          size_t(k) * fragment,
+                          [&] {
+                              fec_encode_simd(fec, data_ptrs.data(), parity_ptrs.data(), fragment);
+                              g_sink = parity_ptrs[0][0];
+                          }),
+                  unit);
+
+            uint64_t nonce = 0;
+            print("aead",
+                  k,
+                  n,
+                  size,
+                  measure(counter,
+                          seconds,
+                          fragment,
+                          [&] {
+                              uint8_t cipher[MAX_FORWARDER_PACKET_SIZE];
+                              std::memset(cipher, 0, sizeof(cipher));
+                              auto *hdr = reinterpret_cast<wblock_hdr_t *>(cipher);
+                              hdr->packet_type = WFB_PACKET_DATA;
+                              hdr->data_nonce = htobe64(++nonce);
+                              unsigned long long len;
+                              crypto_aead_chacha20poly1305_encrypt(cipher + sizeof(wblock_hdr_t),
+                                                                   &len,
+                                                                   block[0].data(),
+                                                                   fragment,
+                                                                   cipher,
+                                                                   sizeof(wblock_hdr_t),
+                                                                   nullptr,
+                                                                   reinterpret_cast<uint8_t *>(&hdr->data_nonce),
+                                                                   key);
+                              g_sink = cipher[len];
+                          }),
+                  unit);
+
+            NullTransmitter tx(k, n, keypair, 0, 7669206 << 8);
+            const Result r = measure(counter, seconds, size, [&] { tx.sendPacket(payload.data(), size, 0); });
+            print("sendPacket", k, n, size, r, unit);
+            if (k == 8 && n == 12 && size == 1400) {
+                gate_result = r.bytes_per_sec / 1e6;
+            }
+        }
+        fec_free(fec);
+    }
+    benchBlockClose(keypair, seconds);
+    unlink(keypair.c_str());
+
+    if (gate_mbps > 0 && gate_result < gate_mbps) {
+        fprintf(stderr, "sendPacket k=8 n=12 1400 B: %.1f MB/s, below the gate of %.1f MB/s\n", gate_result, gate_mbps);
+        return 1;
+    }
+    return 0;
+}
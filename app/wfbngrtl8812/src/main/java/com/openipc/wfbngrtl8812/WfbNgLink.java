@@ -9,6 +9,7 @@ import android.util.Log;
 import androidx.annotation.Keep;
 import androidx.appcompat.app.AppCompatActivity;
 
+import java.nio.ByteBuffer;
 import java.util.HashMap;
 import java.util.Map;
 import java.util.Timer;
@@ -36,32 +37,86 @@ public class WfbNgLink implements WfbNGStatsChanged {
     Map<UsbDevice, Thread> linkThreads = new HashMap<>();
     Map<UsbDevice, UsbDeviceConnection> linkConns = new HashMap<>();
     private WfbNGStatsChanged statsChanged;
+    // Read by the timer thread only
+    private final WfbNgTelemetry timerTelemetry;
+    private long lastAll, lastDecErr, lastFecRecovered, lastLost, lastBad, lastOverride, lastOutgoing;
 
     // Native method declarations.
     public static native long nativeInitialize(Context context);
     public static native void nativeRun(long nativeInstance, Context context, int wifiChannel, int bandWidth, int fd);
     public static native void nativeStop(long nativeInstance, Context context, int fd);
     public static native void nativeRefreshKey(long nativeInstance);
-    public static native <T extends WfbNGStatsChanged> void nativeCallBack(T t, long nativeInstance);
+    public static native ByteBuffer nativeGetTelemetry(long nativeInstance);
     public static native void nativeStartAdaptivelink(long nativeInstance);
     public static native void nativeSetAdaptiveLinkEnabled(long nativeInstance, boolean enabled);
     public static native void nativeSetTxPower(long nativeInstance, int power);
     public static native void nativeSetUseFec(long nativeInstance, int use);
     public static native void nativeSetUseLdpc(long nativeInstance, int use);
     public static native void nativeSetUseStbc(long nativeInstance, int use);
+    public static native void nativeSetVideoSink(long nativeInstance, long fn, long ctx);
+    public static native long nativeGetKeyframeRequestFn();
+    public static native void nativeSetRxWorkerPriority(long nativeInstance, int videoNice, int otherNice);
+    public static native int[] nativeGetRxQueueStats(long nativeInstance);
+    public static native int[] nativeGetAdapterStats(long nativeInstance);
+    public static native int[] nativeGetChainStats(long nativeInstance);
+    public static native int[] nativeGetChainHistogram(long nativeInstance, int adapter, int chain, int metric);
+    public static native boolean nativeSetUplinkConfig(long nativeInstance, int k, int n, int mcs, int bandwidth,
+                                                       boolean shortGi);
+    public static native void nativeSetUsbTxQueue(long nativeInstance, int inflight, boolean burst);
+    public static native int[] nativeGetUsbTxStats(long nativeInstance);
+    public static native void nativeSetTxFecPipeline(long nativeInstance, boolean enable);
+    public static native boolean nativeStartCapture(long nativeInstance, String path);
+    public static native void nativeStopCapture(long nativeInstance);
+    public static native void nativeAddUdpRxStream(long nativeInstance, int radioPort, String host, int port);
+    public static native void nativeAddUdsRxStream(long nativeInstance, int radioPort, String path);
+    public static native void nativeAddInProcessRxStream(long nativeInstance, int radioPort, long fn, long ctx);
+    public static native boolean nativeRemoveRxStream(long nativeInstance, int radioPort);
+    public static native void nativeWriteTraceEvents(int fd);
+    public static native void nativeSetTraceAnomalyListener(TraceAnomalyListener listener);
 
     public WfbNgLink(final AppCompatActivity parent) {
         this.context = parent;
         nativeWfbngLink = nativeInitialize(context);
+        timerTelemetry = newTelemetry();
         timer = new Timer();
         timer.schedule(new TimerTask() {
             @Override
             public void run() {
-                nativeCallBack(WfbNgLink.this, nativeWfbngLink);
+                publishStats();
             }
         }, 0, 300);
     }
 
+    /**
+     * A reader of the link statistics the native side updates about every 100 ms. Reading does not call into
+     * native code and does not allocate; use one reader per thread.
+     */
+    public WfbNgTelemetry newTelemetry() {
+        return new WfbNgTelemetry(nativeGetTelemetry(nativeWfbngLink));
+    }
+
+    // The counters since the previous timer run, like the aggregator used to report them
+    private void publishStats() {
+        if (!timerTelemetry.update()) {
+            return;
+        }
+        WfbNgTelemetry t = timerTelemetry;
+        int all = (int) (t.packetsAll - lastAll);
+        int decErr = (int) (t.packetsDecErr - lastDecErr);
+        WfbNGStats stats = new WfbNGStats(all, decErr, all - decErr,
+                (int) (t.packetsFecRecovered - lastFecRecovered), (int) (t.packetsLost - lastLost),
+                (int) (t.packetsBad - lastBad), (int) (t.packetsOverride - lastOverride),
+                (int) (t.packetsOutgoing - lastOutgoing), t.linkQuality);
+        lastAll = t.packetsAll;
+        lastDecErr = t.packetsDecErr;
+        lastFecRecovered = t.packetsFecRecovered;
+        lastLost = t.packetsLost;
+        lastBad = t.packetsBad;
+        lastOverride = t.packetsOverride;
+        lastOutgoing = t.packetsOutgoing;
+        onWfbNgStatsChanged(stats);
+    }
+
     public boolean isRunning() {
         return !linkThreads.isEmpty();
     }
@@ -92,6 +147,171 @@ public class WfbNgLink implements WfbNGStatsChanged {
         nativeSetUseStbc(nativeWfbngLink, use);
     }
 
+    /**
+     * Hand video packets straight to another native library of this process (see VideoPlayer.getInProcessSinkFn)
+     * instead of sending them to udp://127.0.0.1:5600.
+     */
+    public void setInProcessVideoSink(long fn, long ctx) {
+        nativeSetVideoSink(nativeWfbngLink, fn, ctx);
+    }
+
+    // Fall back to the loopback UDP output.
+    public void clearInProcessVideoSink() {
+        nativeSetVideoSink(nativeWfbngLink, 0, 0);
+    }
+
+    /**
+     * Native function and context the video player calls to request a keyframe, see
+     * VideoPlayer.setKeyframeRequester. Sent with the adaptive link messages, so it needs adaptive link enabled.
+     */
+    public long getKeyframeRequestFn() {
+        return nativeGetKeyframeRequestFn();
+    }
+
+    public long getKeyframeRequestCtx() {
+        return nativeWfbngLink;
+    }
+
+    /**
+     * Nice values of the threads running the video aggregator and the mavlink/udp aggregators.
+     */
+    public void setRxWorkerPriority(int videoNice, int otherNice) {
+        nativeSetRxWorkerPriority(nativeWfbngLink, videoNice, otherNice);
+    }
+
+    /**
+     * RX queue counters, 5 ints per stream: radio port, depth, high water mark since the last call, dropped, processed.
+     */
+    public int[] getRxQueueStats() {
+        return nativeGetRxQueueStats(nativeWfbngLink);
+    }
+
+    /**
+     * Video reception per USB adapter, 6 ints per adapter: adapter index, received, received first, duplicates,
+     * loss in permille and average best-chain RSSI since the last call.
+     */
+    public int[] getAdapterStats() {
+        return nativeGetAdapterStats(nativeWfbngLink);
+    }
+
+    public static final int METRIC_RSSI = 0;
+    public static final int METRIC_SNR = 1;
+    public static final int METRIC_NOISE = 2;
+
+    /**
+     * Video reception per antenna chain of every adapter over the last second, 25 ints per chain: adapter index,
+     * antenna, packets, delivery ratio in permille, then for RSSI, SNR and noise each: samples, average in tenths,
+     * min, p10, p50, p90, max.
+     */
+    public int[] getChainStats() {
+        return nativeGetChainStats(nativeWfbngLink);
+    }
+
+    /**
+     * Last second of one METRIC_* of one chain, 256 counts where index i holds the value i - 128.
+     */
+    public int[] getChainHistogram(int adapter, int chain, int metric) {
+        return nativeGetChainHistogram(nativeWfbngLink, adapter, chain, metric);
+    }
+
+    /**
+     * Uplink FEC k/n, MCS, bandwidth (20, 40, 80, 160) and short guard interval. A running uplink switches at its
+     * next FEC block without restarting.
+     * @return False if the values were rejected.
+     */
+    public boolean setUplinkConfig(int k, int n, int mcs, int bandwidth, boolean shortGi) {
+        return nativeSetUplinkConfig(nativeWfbngLink, k, n, mcs, bandwidth, shortGi);
+    }
+
+    /**
+     * Uplink USB transfers kept in flight at once, and whether the fragments of a FEC block are submitted
+     * back-to-back. Takes effect when the next adapter starts.
+     * <p>
+     * inflight is limited to 1 for now: parallel transfers can put frames on air out of order, and the driver's send
+     * is not known to be safe from several threads.
+     */
+    public void setUsbTxQueue(int inflight, boolean burst) {
+        nativeSetUsbTxQueue(nativeWfbngLink, inflight, burst);
+    }
+
+    /**
+     * Compute uplink FEC parity and encryption on a worker thread, so closing a large block does not stall ingest.
+     * Takes effect when the next adapter starts.
+     */
+    public void setTxFecPipeline(boolean enable) {
+        nativeSetTxFecPipeline(nativeWfbngLink, enable);
+    }
+
+    /**
+     * Uplink USB TX queue, 9 ints, empty while no TX runs: depth, high water mark since the last call, transfers in
+     * flight, submitted, completed, failed, dropped, average and max completion latency in us since the last call.
+     */
+    public int[] getUsbTxStats() {
+        return nativeGetUsbTxStats(nativeWfbngLink);
+    }
+
+    /**
+     * Receive radio port 0..255 of this link and forward it to host:port. Replaces the output of a registered port.
+     *
+     * @throws IllegalArgumentException if radioPort is outside 0..255, here and in the other *RxStream methods.
+     */
+    public void addUdpRxStream(int radioPort, String host, int port) {
+        nativeAddUdpRxStream(nativeWfbngLink, radioPort, host, port);
+    }
+
+    /**
+     * Like addUdpRxStream, the output goes to a unix datagram socket ('@' prefix: abstract namespace).
+     */
+    public void addUdsRxStream(int radioPort, String path) {
+        nativeAddUdsRxStream(nativeWfbngLink, radioPort, path);
+    }
+
+    /**
+     * Like addUdpRxStream, the output goes to an in-process consumer (see setInProcessVideoSink).
+     */
+    public void addInProcessRxStream(int radioPort, long fn, long ctx) {
+        nativeAddInProcessRxStream(nativeWfbngLink, radioPort, fn, ctx);
+    }
+
+    public boolean removeRxStream(int radioPort) {
+        return nativeRemoveRxStream(nativeWfbngLink, radioPort);
+    }
+
+    /**
+     * Append the recent events of the link threads to fd as Chrome trace JSON array elements, each followed by a
+     * comma. The caller writes the brackets, see VideoPlayer.writeTraceEvents for the video side.
+     */
+    public static void writeTraceEvents(int fd) {
+        nativeWriteTraceEvents(fd);
+    }
+
+    /**
+     * Told when the link misbehaves (RX queue overflow, USB TX failure), at most once every 10 seconds, on a native
+     * thread. The recent events are still in the rings, writeTraceEvents() gets them.
+     */
+    public interface TraceAnomalyListener {
+        void onTraceAnomaly(String reason);
+    }
+
+    /**
+     * Listener for the anomalies worth a trace file, null removes it.
+     */
+    public static void setTraceAnomalyListener(TraceAnomalyListener listener) {
+        nativeSetTraceAnomalyListener(listener);
+    }
+
+    /**
+     * Record every received frame with its radio metadata to a pcap file (radiotap link type), e.g. to replay a
+     * field problem on a desktop. Returns false if the file could not be created.
+     */
+    public boolean startCapture(String path) {
+        return nativeStartCapture(nativeWfbngLink, path);
+    }
+
+    public void stopCapture() {
+        nativeStopCapture(nativeWfbngLink);
+    }
+
     public synchronized void start(int wifiChannel, int bandWidth, UsbDevice usbDevice) {
         Log.d(TAG, "wfb-ng monitoring on " + usbDevice.getDeviceName() + " using wifi channel " + wifiChannel);
         UsbManager usbManager = (UsbManager) context.getSystemService(Context.USB_SERVICE);
@@ -137,7 +357,7 @@ public class WfbNgLink implements WfbNGStatsChanged {
         statsChanged = callback;
     }
 
-    // Called by native code via NDK.
+    // Called by the stats timer.
     @Override
     public void onWfbNgStatsChanged(WfbNGStats stats) {
         if (statsChanged != null) {
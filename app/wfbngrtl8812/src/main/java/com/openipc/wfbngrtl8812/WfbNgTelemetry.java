@@ -0,0 +1,107 @@
+package com.openipc.wfbngrtl8812;
+
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+
+/**
+ * Reads the link statistics the native side publishes into shared memory (LinkTelemetry in WfbngLink.hpp), without
+ * JNI calls or allocations. The block is a seqlock: the sequence is odd while the native side writes, a snapshot is
+ * only kept if the sequence was even and unchanged around the copy.
+ * <p>
+ * Not thread safe, every polling thread needs its own instance.
+ */
+public class WfbNgTelemetry {
+    private static final int VERSION = 1;
+    private static final int SIZE = 88;
+
+    private static final int SEQUENCE = 0;
+    private static final int HEADER_VERSION = 4;
+    private static final int HEADER_SIZE = 6;
+    private static final int LAYOUT = 16;
+    private static final int PUBLISH_MS = LAYOUT;
+    private static final int P_ALL = LAYOUT + 8;
+    private static final int P_DEC_ERR = LAYOUT + 16;
+    private static final int P_FEC_RECOVERED = LAYOUT + 24;
+    private static final int P_LOST = LAYOUT + 32;
+    private static final int P_BAD = LAYOUT + 40;
+    private static final int P_OVERRIDE = LAYOUT + 48;
+    private static final int P_OUTGOING = LAYOUT + 56;
+    private static final int LINK_QUALITY = LAYOUT + 64;
+    private static final int LOST_LAST_SECOND = LAYOUT + 68;
+    private static final int RECOVERED_LAST_SECOND = LAYOUT + 72;
+    private static final int RSSI = LAYOUT + 76;
+    private static final int SNR = LAYOUT + 80;
+    private static final int CHAINS = LAYOUT + 84;
+
+    // minSdk 26 has no VarHandle fences: a volatile store followed by a volatile load keeps the plain buffer
+    // reads on either side from moving across it (release + acquire, a full fence on ART).
+    private static volatile int fence;
+
+    private final ByteBuffer buffer;
+    private int sequence = -1;
+
+    // Last snapshot, counters are totals since the link was created
+    public long publishMs;
+    public long packetsAll;
+    public long packetsDecErr;
+    public long packetsFecRecovered;
+    public long packetsLost;
+    public long packetsBad;
+    public long packetsOverride;
+    public long packetsOutgoing;
+    public int linkQuality;
+    public int lostLastSecond;
+    public int recoveredLastSecond;
+    public float rssi;
+    public float snr;
+    public int chains;
+
+    WfbNgTelemetry(ByteBuffer block) {
+        buffer = block.order(ByteOrder.nativeOrder());
+        if (buffer.getShort(HEADER_VERSION) != VERSION || buffer.getShort(HEADER_SIZE) != SIZE) {
+            throw new IllegalStateException("Unexpected link telemetry layout");
+        }
+    }
+
+    private static void loadFence() {
+        fence = 0;
+        int ignored = fence;
+    }
+
+    /**
+     * Copies the latest snapshot into the fields.
+     *
+     * @return False if nothing was published since the last call.
+     */
+    public boolean update() {
+        while (true) {
+            int seq = buffer.getInt(SEQUENCE);
+            if ((seq & 1) != 0) {
+                continue;
+            }
+            if (seq == sequence) {
+                return false;
+            }
+            loadFence();
+            publishMs = buffer.getLong(PUBLISH_MS);
+            packetsAll = buffer.getLong(P_ALL);
+            packetsDecErr = buffer.getLong(P_DEC_ERR);
+            packetsFecRecovered = buffer.getLong(P_FEC_RECOVERED);
+            packetsLost = buffer.getLong(P_LOST);
+            packetsBad = buffer.getLong(P_BAD);
+            packetsOverride = buffer.getLong(P_OVERRIDE);
+            packetsOutgoing = buffer.getLong(P_OUTGOING);
+            linkQuality = buffer.getInt(LINK_QUALITY);
+            lostLastSecond = buffer.getInt(LOST_LAST_SECOND);
+            recoveredLastSecond = buffer.getInt(RECOVERED_LAST_SECOND);
+            rssi = buffer.getFloat(RSSI);
+            snr = buffer.getFloat(SNR);
+            chains = buffer.getInt(CHAINS);
+            loadFence();
+            if (buffer.getInt(SEQUENCE) == seq) {
+                sequence = seq;
+                return true;
+            }
+        }
+    }
+}